@@ -0,0 +1,61 @@
+//
+//  WSBIP158.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+@class WSHash256;
+
+//
+// Compact block filters
+//
+// https://github.com/bitcoin/bips/blob/master/bip-0158.mediawiki
+//
+
+#pragma mark -
+
+extern const uint8_t            WSBIP158FilterTypeBasic;
+extern const uint8_t            WSBIP158BasicFilterP;
+extern const uint64_t           WSBIP158BasicFilterM;
+
+#pragma mark -
+
+//
+// Golomb-coded set of scripts keyed by block id, immutable
+//
+@interface WSBIP158Filter : NSObject
+
++ (instancetype)filterWithBlockId:(WSHash256 *)blockId elements:(NSArray *)elements; // NSData
+- (instancetype)initWithBlockId:(WSHash256 *)blockId data:(NSData *)data error:(NSError **)error;
+- (WSHash256 *)blockId;
+- (NSData *)data;
+- (NSUInteger)numberOfElements;
+
+- (BOOL)matchesData:(NSData *)data;
+- (BOOL)matchesAnyData:(NSArray *)datas; // NSData, single pass over the set
+
+- (WSHash256 *)filterHash;
+- (WSHash256 *)filterHeaderWithPreviousHeader:(WSHash256 *)previousHeader;
+
+@end
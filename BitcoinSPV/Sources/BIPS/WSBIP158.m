@@ -0,0 +1,379 @@
+//
+//  WSBIP158.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSBIP158.h"
+#import "WSBuffer.h"
+#import "WSHash256.h"
+#import "WSBitcoinConstants.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+const uint8_t           WSBIP158FilterTypeBasic                 = 0x00;
+const uint8_t           WSBIP158BasicFilterP                    = 19;
+const uint64_t          WSBIP158BasicFilterM                    = 784931;
+
+typedef struct {
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger bitOffset;
+} WSBIP158BitReader;
+
+static void WSBIP158KeyFromBlockId(WSHash256 *blockId, uint64_t *k0, uint64_t *k1);
+static uint64_t WSBIP158HashedValue(uint64_t k0, uint64_t k1, uint64_t range, NSData *data);
+static uint64_t WSBIP158SipHash(uint64_t k0, uint64_t k1, const uint8_t *bytes, NSUInteger length);
+static uint64_t WSBIP158MultiplyHigh(uint64_t a, uint64_t b);
+static BOOL WSBIP158ReadDelta(WSBIP158BitReader *reader, uint8_t p, uint64_t *delta);
+static int WSBIP158CompareValues(const void *a, const void *b);
+
+#pragma mark -
+
+@interface WSBIP158Filter ()
+
+@property (nonatomic, strong) WSHash256 *blockId;
+@property (nonatomic, strong) NSData *data;
+@property (nonatomic, assign) NSUInteger numberOfElements;
+@property (nonatomic, assign) NSUInteger setOffset;
+@property (nonatomic, assign) uint64_t k0;
+@property (nonatomic, assign) uint64_t k1;
+
+@end
+
+@implementation WSBIP158Filter
+
++ (instancetype)filterWithBlockId:(WSHash256 *)blockId elements:(NSArray *)elements
+{
+    WSExceptionCheckIllegal(blockId);
+    WSExceptionCheckIllegal(elements);
+
+    uint64_t k0, k1;
+    WSBIP158KeyFromBlockId(blockId, &k0, &k1);
+
+    NSOrderedSet *uniqueElements = [[NSOrderedSet alloc] initWithArray:elements];
+    const NSUInteger count = uniqueElements.count;
+    const uint64_t range = (uint64_t)count * WSBIP158BasicFilterM;
+
+    uint64_t *values = (uint64_t *)malloc(MAX(count, 1) * sizeof(uint64_t));
+    NSUInteger i = 0;
+    for (NSData *element in uniqueElements) {
+        values[i++] = WSBIP158HashedValue(k0, k1, range, element);
+    }
+    qsort(values, count, sizeof(uint64_t), WSBIP158CompareValues);
+
+    // Golomb-Rice coding of deltas, MSB first
+    NSMutableData *bits = [[NSMutableData alloc] initWithCapacity:(count * (WSBIP158BasicFilterP + 2) / 8 + 1)];
+    uint8_t accumulator = 0;
+    NSUInteger accumulatorBits = 0;
+    uint64_t lastValue = 0;
+
+#define WSBIP158_APPEND_BIT(bit) \
+    accumulator = (uint8_t)((accumulator << 1) | (bit)); \
+    if (++accumulatorBits == 8) { \
+        [bits appendBytes:&accumulator length:1]; \
+        accumulator = 0; \
+        accumulatorBits = 0; \
+    }
+
+    for (i = 0; i < count; ++i) {
+        const uint64_t delta = values[i] - lastValue;
+        lastValue = values[i];
+
+        for (uint64_t q = (delta >> WSBIP158BasicFilterP); q > 0; --q) {
+            WSBIP158_APPEND_BIT(1);
+        }
+        WSBIP158_APPEND_BIT(0);
+        for (int b = WSBIP158BasicFilterP - 1; b >= 0; --b) {
+            WSBIP158_APPEND_BIT((delta >> b) & 1);
+        }
+    }
+
+#undef WSBIP158_APPEND_BIT
+
+    if (accumulatorBits > 0) {
+        accumulator <<= (8 - accumulatorBits);
+        [bits appendBytes:&accumulator length:1];
+    }
+    free(values);
+
+    WSMutableBuffer *buffer = [[WSMutableBuffer alloc] initWithCapacity:(9 + bits.length)];
+    [buffer appendVarInt:count];
+    [buffer appendData:bits];
+    return [[self alloc] initWithBlockId:blockId data:buffer.data error:NULL];
+}
+
+- (instancetype)initWithBlockId:(WSHash256 *)blockId data:(NSData *)data error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(blockId);
+    WSExceptionCheckIllegal(data);
+
+    if (data.length == 0) {
+        WSErrorSetNotEnoughBytes(error, [self class], 0, 1);
+        return nil;
+    }
+
+    WSBuffer *buffer = [[WSBuffer alloc] initWithData:data];
+    const uint8_t firstByte = [buffer uint8AtOffset:0];
+    NSUInteger expectedLength = 1;
+    if (firstByte == WSBufferVarInt16Byte) {
+        expectedLength += sizeof(uint16_t);
+    }
+    else if (firstByte == WSBufferVarInt32Byte) {
+        expectedLength += sizeof(uint32_t);
+    }
+    else if (firstByte == WSBufferVarInt64Byte) {
+        expectedLength += sizeof(uint64_t);
+    }
+    if (data.length < expectedLength) {
+        WSErrorSetNotEnoughBytes(error, [self class], data.length, expectedLength);
+        return nil;
+    }
+
+    NSUInteger varIntLength;
+    const uint64_t count = [buffer varIntAtOffset:0 length:&varIntLength];
+    if (count > UINT32_MAX) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Too many filter elements (%llu)", count);
+        return nil;
+    }
+
+    if ((self = [super init])) {
+        uint64_t k0, k1;
+        WSBIP158KeyFromBlockId(blockId, &k0, &k1);
+
+        self.blockId = blockId;
+        self.data = data;
+        self.numberOfElements = (NSUInteger)count;
+        self.setOffset = varIntLength;
+        self.k0 = k0;
+        self.k1 = k1;
+    }
+    return self;
+}
+
+- (BOOL)matchesData:(NSData *)data
+{
+    WSExceptionCheckIllegal(data);
+
+    return [self matchesAnyData:@[data]];
+}
+
+- (BOOL)matchesAnyData:(NSArray *)datas
+{
+    WSExceptionCheckIllegal(datas);
+
+    if ((self.numberOfElements == 0) || (datas.count == 0)) {
+        return NO;
+    }
+
+    const NSUInteger count = datas.count;
+    const uint64_t range = (uint64_t)self.numberOfElements * WSBIP158BasicFilterM;
+    uint64_t *targets = (uint64_t *)malloc(count * sizeof(uint64_t));
+    NSUInteger i = 0;
+    for (NSData *data in datas) {
+        targets[i++] = WSBIP158HashedValue(self.k0, self.k1, range, data);
+    }
+    qsort(targets, count, sizeof(uint64_t), WSBIP158CompareValues);
+
+    // merge sorted targets against the decoded (sorted) set
+    WSBIP158BitReader reader;
+    reader.bytes = (const uint8_t *)self.data.bytes + self.setOffset;
+    reader.length = self.data.length - self.setOffset;
+    reader.bitOffset = 0;
+
+    BOOL matches = NO;
+    uint64_t value = 0;
+    NSUInteger targetIndex = 0;
+    for (NSUInteger decoded = 0; (decoded < self.numberOfElements) && !matches; ++decoded) {
+        uint64_t delta;
+        if (!WSBIP158ReadDelta(&reader, WSBIP158BasicFilterP, &delta)) {
+            break;
+        }
+        value += delta;
+
+        while ((targetIndex < count) && (targets[targetIndex] < value)) {
+            ++targetIndex;
+        }
+        if (targetIndex == count) {
+            break;
+        }
+        matches = (targets[targetIndex] == value);
+    }
+    free(targets);
+    return matches;
+}
+
+- (WSHash256 *)filterHash
+{
+    return WSHash256Compute(self.data);
+}
+
+- (WSHash256 *)filterHeaderWithPreviousHeader:(WSHash256 *)previousHeader
+{
+    WSExceptionCheckIllegal(previousHeader);
+
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:(2 * WSHash256Length)];
+    [data appendData:self.filterHash.data];
+    [data appendData:previousHeader.data];
+    return WSHash256Compute(data);
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"{blockId=%@, elements=%lu, length=%lu}",
+            self.blockId, (unsigned long)self.numberOfElements, (unsigned long)self.data.length];
+}
+
+@end
+
+#pragma mark -
+
+static void WSBIP158KeyFromBlockId(WSHash256 *blockId, uint64_t *k0, uint64_t *k1)
+{
+    NSCParameterAssert(blockId);
+
+    // first 16 bytes of block id (internal byte order), little-endian
+    const uint8_t *bytes = blockId.bytes;
+    *k0 = 0;
+    *k1 = 0;
+    for (int i = 7; i >= 0; --i) {
+        *k0 = (*k0 << 8) | bytes[i];
+        *k1 = (*k1 << 8) | bytes[8 + i];
+    }
+}
+
+static uint64_t WSBIP158HashedValue(uint64_t k0, uint64_t k1, uint64_t range, NSData *data)
+{
+    NSCParameterAssert(data);
+
+    // uniform mapping to [0, N * M) without division
+    return WSBIP158MultiplyHigh(WSBIP158SipHash(k0, k1, data.bytes, data.length), range);
+}
+
+#define WSBIP158_ROTL(x, b)     (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define WSBIP158_SIPROUND \
+    v0 += v1; v1 = WSBIP158_ROTL(v1, 13); v1 ^= v0; v0 = WSBIP158_ROTL(v0, 32); \
+    v2 += v3; v3 = WSBIP158_ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = WSBIP158_ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = WSBIP158_ROTL(v1, 17); v1 ^= v2; v2 = WSBIP158_ROTL(v2, 32);
+
+//
+// SipHash-2-4: https://131002.net/siphash/
+//
+static uint64_t WSBIP158SipHash(uint64_t k0, uint64_t k1, const uint8_t *bytes, NSUInteger length)
+{
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+    const NSUInteger blocks = length & ~(NSUInteger)7;
+    for (NSUInteger i = 0; i < blocks; i += 8) {
+        uint64_t m = 0;
+        for (int j = 7; j >= 0; --j) {
+            m = (m << 8) | bytes[i + j];
+        }
+        v3 ^= m;
+        WSBIP158_SIPROUND
+        WSBIP158_SIPROUND
+        v0 ^= m;
+    }
+
+    uint64_t last = (uint64_t)length << 56;
+    for (NSUInteger j = 0; j < (length & 7); ++j) {
+        last |= (uint64_t)bytes[blocks + j] << (8 * j);
+    }
+    v3 ^= last;
+    WSBIP158_SIPROUND
+    WSBIP158_SIPROUND
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    WSBIP158_SIPROUND
+    WSBIP158_SIPROUND
+    WSBIP158_SIPROUND
+    WSBIP158_SIPROUND
+
+    return (v0 ^ v1 ^ v2 ^ v3);
+}
+
+#undef WSBIP158_SIPROUND
+#undef WSBIP158_ROTL
+
+static uint64_t WSBIP158MultiplyHigh(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)a * b) >> 64);
+#else
+    const uint64_t aLo = (uint32_t)a;
+    const uint64_t aHi = a >> 32;
+    const uint64_t bLo = (uint32_t)b;
+    const uint64_t bHi = b >> 32;
+
+    const uint64_t loLo = aLo * bLo;
+    const uint64_t hiLo = aHi * bLo;
+    const uint64_t loHi = aLo * bHi;
+    const uint64_t hiHi = aHi * bHi;
+
+    const uint64_t cross = (loLo >> 32) + (uint32_t)hiLo + loHi;
+    return hiHi + (hiLo >> 32) + (cross >> 32);
+#endif
+}
+
+static BOOL WSBIP158ReadDelta(WSBIP158BitReader *reader, uint8_t p, uint64_t *delta)
+{
+    const NSUInteger totalBits = reader->length * 8;
+
+    // unary quotient
+    uint64_t quotient = 0;
+    while (YES) {
+        if (reader->bitOffset >= totalBits) {
+            return NO;
+        }
+        const NSUInteger offset = reader->bitOffset++;
+        if (((reader->bytes[offset >> 3] >> (7 - (offset & 7))) & 1) == 0) {
+            break;
+        }
+        ++quotient;
+    }
+
+    // p-bit remainder
+    if (reader->bitOffset + p > totalBits) {
+        return NO;
+    }
+    uint64_t remainder = 0;
+    for (uint8_t i = 0; i < p; ++i) {
+        const NSUInteger offset = reader->bitOffset++;
+        remainder = (remainder << 1) | ((reader->bytes[offset >> 3] >> (7 - (offset & 7))) & 1);
+    }
+
+    *delta = (quotient << p) | remainder;
+    return YES;
+}
+
+static int WSBIP158CompareValues(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return ((x < y) ? -1 : ((x > y) ? 1 : 0));
+}
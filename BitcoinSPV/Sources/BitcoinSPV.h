@@ -43,13 +43,20 @@
 
 #import "WSBlockStore.h"
 #import "WSMemoryBlockStore.h"
+#import "WSMappedBlockStore.h"
+#import "WSPackedBlockStore.h"
+#import "WSSQLiteBlockStore.h"
+#import "WSHeaderTable.h"
+#import "WSOrphanPool.h"
 #import "WSCoreDataManager.h"
 #import "WSBlockHeader.h"
 #import "WSStorableBlock.h"
 
 #import "WSConnectionPool.h"
 #import "WSPeerGroup.h"
+#import "WSTrafficStats.h"
 #import "WSBlockChainDownloader.h"
+#import "WSCompactFilterDownloader.h"
 #import "WSSeed.h"
 #import "WSSeedGenerator.h"
 
@@ -68,6 +75,7 @@
 #import "WSBIP37.h"
 #import "WSBIP38.h"
 #import "WSBIP39.h"
+#import "WSBIP158.h"
 
 #import "NSString+Binary.h"
 #import "NSString+Base58.h"
@@ -34,6 +34,7 @@
 @class WSFilteredBlock;
 @class WSBlockLocator;
 @class WSCoreDataManager;
+@class WSOrphanPool;
 
 #pragma mark -
 
@@ -59,9 +60,11 @@ typedef void (^WSBlockChainReorganizeBlock)(WSStorableBlock *, NSArray *, NSArra
 - (instancetype)initWithStore:(id<WSBlockStore>)store maxSize:(NSUInteger)maxSize;
 - (NSUInteger)maxSize;
 - (void)truncate;
+- (void)synchronize; // commits pending store writes
 
 - (WSStorableBlock *)head;
 - (WSStorableBlock *)blockForId:(WSHash256 *)blockId;
+- (WSStorableBlock *)blockAtHeight:(uint32_t)height; // main chain only
 - (NSArray *)allBlockIds;
 - (uint32_t)currentHeight;
 - (uint32_t)currentTimestamp;
@@ -75,12 +78,31 @@ typedef void (^WSBlockChainReorganizeBlock)(WSStorableBlock *, NSArray *, NSArra
                         reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
                                   error:(NSError **)error;
 
+// contiguous headers extending the head are validated and stored as a unit
+- (NSArray *)addBlockHeaders:(NSArray *)headers error:(NSError **)error; // WSBlockHeader -> WSStorableBlock
+- (NSArray *)addBlockHeaders:(NSArray *)headers
+            connectedOrphans:(NSArray **)connectedOrphans
+             reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
+                       error:(NSError **)error;
+- (NSArray *)addBlockHeaders:(NSArray *)headers
+                    location:(WSBlockChainLocation *)location // of last added block
+            connectedOrphans:(NSArray **)connectedOrphans
+             reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
+                       error:(NSError **)error;
+
 - (BOOL)isOrphanBlock:(WSStorableBlock *)block;
 - (BOOL)isKnownOrphanBlockWithId:(WSHash256 *)blockId;
+- (WSOrphanPool *)orphanPool;
 - (WSStorableBlock *)findForkBaseFromHead:(WSStorableBlock *)forkHead;
 
 - (void)loadFromCoreDataManager:(WSCoreDataManager *)manager;
-- (void)saveToCoreDataManager:(WSCoreDataManager *)manager;
+- (void)saveToCoreDataManager:(WSCoreDataManager *)manager; // asynchronous, only writes changes since last save
+- (void)saveToCoreDataManager:(WSCoreDataManager *)manager completionBlock:(void (^)(BOOL success))completionBlock; // called on manager context queue
+- (void)waitForPendingSavesToCoreDataManager:(WSCoreDataManager *)manager; // blocks until queued saves are written
+
+// main chain headers snapshot, PoW and linkage are verified on import, must carry more work than current chain
+- (BOOL)exportHeadersToPath:(NSString *)path error:(NSError **)error;
+- (BOOL)importHeadersFromPath:(NSString *)path error:(NSError **)error;
 
 - (NSString *)descriptionWithMaxBlocks:(NSUInteger)maxBlocks;
 - (NSString *)descriptionWithIndent:(NSUInteger)indent maxBlocks:(NSUInteger)maxBlocks;
@@ -95,4 +117,7 @@ typedef void (^WSBlockChainReorganizeBlock)(WSStorableBlock *, NSArray *, NSArra
 - (void)blockChain:(WSBlockChain *)blockChain didReplaceHead:(WSStorableBlock *)head;
 - (void)blockChain:(WSBlockChain *)blockChain didReorganizeAtBase:(WSStorableBlock *)base oldBlocks:(NSArray *)oldBlocks newBlocks:(NSArray *)newBlocks;
 
+@optional
+- (void)blockChain:(WSBlockChain *)blockChain didExtendHeadWithBlocks:(NSArray *)blocks;
+
 @end
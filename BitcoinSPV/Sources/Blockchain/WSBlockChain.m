@@ -23,17 +23,25 @@
 //  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#import <CommonCrypto/CommonDigest.h>
+
 #import "WSBlockChain.h"
 #import "WSHash256.h"
 #import "WSBlockStore.h"
 #import "WSStorableBlock.h"
 #import "WSStorableBlock+BlockChain.h"
 #import "WSBlockHeader.h"
+#import "WSFilteredBlock.h"
 #import "WSBlockLocator.h"
+#import "WSOrphanPool.h"
+#import "WSBitcoinConstants.h"
 #import "WSLogging.h"
 #import "WSConfig.h"
 #import "WSMacrosCore.h"
 #import "WSErrors.h"
+#import "WSUInt256.h"
+#import "WSBuffer.h"
+#import "NSData+Hash.h"
 #import "WSCoreDataManager.h"
 #import "WSBlockHeaderEntity.h"
 #import "WSStorableBlockEntity.h"
@@ -44,15 +52,130 @@
 
 // adapted from: https://github.com/bitcoinj/bitcoinj/blob/master/core/src/main/java/com/google/bitcoin/core/AbstractBlockChain.java
 
+//
+// headers snapshot layout (little endian):
+//
+// [header][count * 80-byte serialized headers][trailer]
+//
+// headers run along main chain from baseHeight to headHeight, the
+// checksum is the hash256 of everything preceding it
+//
+// base is either genesis or a checkpoint, which is what import trusts
+// for base work: the trailer works are only cross-checked
+//
+
+static const uint32_t WSHeadersSnapshotMagic        = 0x53485357; // 'WSHS'
+static const uint32_t WSHeadersSnapshotVersion      = 1;
+
+#define WSHeadersSnapshotHeaderLength               80
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t networkMagic;
+    uint32_t count;
+} WSHeadersSnapshotHeader;
+
+typedef struct {
+    uint32_t baseHeight;
+    uint32_t headHeight;
+    uint8_t baseWork[32];   // big endian
+    uint8_t headWork[32];   // big endian
+    uint8_t checksum[32];
+} WSHeadersSnapshotTrailer;
+
+_Static_assert(sizeof(WSHeadersSnapshotHeader) == 16, "Unexpected WSHeadersSnapshotHeader size");
+_Static_assert(sizeof(WSHeadersSnapshotTrailer) == 104, "Unexpected WSHeadersSnapshotTrailer size");
+
+static BOOL WSHeadersSnapshotVerifyHeader(const uint8_t *header, const WSUInt256 *maxTarget, uint8_t *blockId, WSUInt256 *work);
+
+// blocks written to Core Data by a single background save, coalesces
+// the deltas of saves requested before the writer gets to run
+@interface WSBlockChainSaveBatch : NSObject
+
+@property (nonatomic, strong) WSCoreDataManager *manager;
+@property (nonatomic, strong) NSMutableDictionary *blocksById;  // WSHash256 -> WSStorableBlock
+@property (nonatomic, assign) uint32_t minHeight;               // entities below are stale
+@property (nonatomic, assign) BOOL isFull;                      // replace all entities
+@property (nonatomic, assign) BOOL isStarted;
+@property (nonatomic, strong) NSMutableArray *completionBlocks;
+
+- (void)mergeBlocks:(NSArray *)blocks minHeight:(uint32_t)minHeight isFull:(BOOL)isFull;
+- (void)addCompletionBlock:(void (^)(BOOL))completionBlock;
+- (void)completeWithSuccess:(BOOL)success;
+
+@end
+
+@implementation WSBlockChainSaveBatch
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self.blocksById = [[NSMutableDictionary alloc] init];
+        self.completionBlocks = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)mergeBlocks:(NSArray *)blocks minHeight:(uint32_t)minHeight isFull:(BOOL)isFull
+{
+    if (isFull) {
+        [self.blocksById removeAllObjects];
+        self.isFull = YES;
+    }
+    for (WSStorableBlock *block in blocks) {
+        self.blocksById[block.blockId] = block;
+    }
+    self.minHeight = MAX(self.minHeight, minHeight);
+}
+
+- (void)addCompletionBlock:(void (^)(BOOL))completionBlock
+{
+    if (completionBlock) {
+        [self.completionBlocks addObject:[completionBlock copy]];
+    }
+}
+
+- (void)completeWithSuccess:(BOOL)success
+{
+    for (void (^completionBlock)(BOOL) in self.completionBlocks) {
+        completionBlock(success);
+    }
+    [self.completionBlocks removeAllObjects];
+}
+
+@end
+
+#pragma mark -
+
 @interface WSBlockChain ()
 
 @property (nonatomic, strong) id<WSBlockStore> store;
 @property (nonatomic, assign) NSUInteger maxSize;
-@property (nonatomic, strong) NSMutableDictionary *orphans; // WSHash256 -> WSStorableBlock
+@property (nonatomic, strong) WSOrphanPool *orphanPool;
+@property (nonatomic, strong) NSMutableData *activeBlockIds; // WSHash256Length bytes per block (ascending height, head last)
+@property (nonatomic, assign) uint32_t activeBaseHeight;
 @property (nonatomic, assign) BOOL doValidate;
-
-- (NSArray *)connectCurrentOrphansWithReorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock;
+@property (nonatomic, weak) WSCoreDataManager *savedManager;
+@property (nonatomic, strong) NSMutableDictionary *unsavedBlocksById; // WSHash256 -> WSStorableBlock
+@property (nonatomic, strong) WSBlockChainSaveBatch *pendingSaveBatch; // @synchronized (self)
+@property (nonatomic, assign) BOOL needsFullSave; // @synchronized (self)
+
+- (void)putBlockInStore:(WSStorableBlock *)block;
+- (void)rebuildActiveChain;
+- (void)rebuildActiveChainFromHead:(WSStorableBlock *)head blocksById:(NSDictionary *)blocksById;
+- (void)trimActiveChain;
+- (NSUInteger)activeCount;
+- (const uint8_t *)activeBlockIdBytesAtHeight:(uint32_t)height;
+- (void)appendActiveBlock:(WSStorableBlock *)block;
+- (void)reorganizeActiveChainAtBase:(WSStorableBlock *)base newBlocks:(NSArray *)newBlocks;
+- (BOOL)isActiveBlock:(WSStorableBlock *)block;
+- (BOOL)extendHeadWithHeaders:(NSArray *)headers fromIndex:(NSUInteger)index addedBlocks:(NSMutableArray *)addedBlocks error:(NSError **)error;
+- (NSArray *)connectOrphansToParents:(NSArray *)parents reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock;
 - (NSArray *)subchainFromHead:(WSStorableBlock *)head toBase:(WSStorableBlock *)base;
+- (BOOL)writeSaveBatch:(WSBlockChainSaveBatch *)batch;
+- (WSStorableBlock *)snapshotAnchorAtHeight:(uint32_t)height;
+- (WSStorableBlock *)snapshotBlockFromBuffer:(WSBuffer *)buffer index:(NSUInteger)index height:(uint32_t)height error:(NSError **)error;
 
 @end
 
@@ -72,7 +195,9 @@
     if ((self = [super init])) {
         self.store = store;
         self.maxSize = maxSize;
-        self.orphans = [[NSMutableDictionary alloc] init];
+        self.orphanPool = [[WSOrphanPool alloc] initWithMaxSize:WSBlockChainDefaultMaxOrphans maxAge:WSBlockChainDefaultMaxOrphanAge];
+        self.unsavedBlocksById = [[NSMutableDictionary alloc] init];
+        [self rebuildActiveChain];
 
         //
         // test networks (testnet3/regtest) validates blocks in
@@ -93,7 +218,15 @@
 - (void)truncate
 {
     [self.store truncate];
-    [self.orphans removeAllObjects];
+    [self.orphanPool removeAllOrphans];
+    [self.unsavedBlocksById removeAllObjects];
+    self.savedManager = nil;
+    [self rebuildActiveChain];
+}
+
+- (void)synchronize
+{
+    [self.store synchronize];
 }
 
 #pragma mark Access
@@ -110,13 +243,23 @@
     return [self.store blockForId:blockId];
 }
 
+- (WSStorableBlock *)blockAtHeight:(uint32_t)height
+{
+    const uint8_t *blockIdBytes = [self activeBlockIdBytesAtHeight:height];
+    if (!blockIdBytes) {
+        return nil;
+    }
+    return [self.store blockForId:WSHash256FromData([NSData dataWithBytes:blockIdBytes length:WSHash256Length])];
+}
+
 - (NSArray *)allBlockIds
 {
-    NSMutableArray *ids = [[NSMutableArray alloc] initWithCapacity:self.currentHeight];
-    WSStorableBlock *block = self.head;
-    while (block) {
-        [ids addObject:block.blockId];
-        block = [block previousBlockInChain:self];
+    const NSUInteger count = [self activeCount];
+    const uint8_t *bytes = self.activeBlockIds.bytes;
+
+    NSMutableArray *ids = [[NSMutableArray alloc] initWithCapacity:count];
+    for (NSUInteger i = count; i > 0; --i) {
+        [ids addObject:WSHash256FromData([NSData dataWithBytes:(bytes + (i - 1) * WSHash256Length) length:WSHash256Length])];
     }
     return ids;
 }
@@ -138,13 +281,13 @@
     WSHash256 *genesisBlockId = [self.store.parameters genesisBlockId];
 
     NSInteger i = 0;
-    NSInteger step = 1;
+    uint32_t step = 1;
     while (block && ![block.blockId isEqual:genesisBlockId]) {
         [hashes addObject:block.blockId];
         if (i >= 10) {
             step <<= 1;
         }
-        block = [block previousBlockInChain:self maxStep:step lastPreviousBlock:NULL];
+        block = ((block.height >= step) ? [self blockAtHeight:(block.height - step)] : nil);
         ++i;
     }
     [hashes addObject:genesisBlockId];
@@ -175,8 +318,9 @@
     }
 
     WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:checkpoint.header transactions:nil height:checkpoint.height work:checkpoint.workData];
-    [self.store putBlock:block];
+    [self putBlockInStore:block];
     [self.store setHead:block];
+    [self rebuildActiveChain];
     return block;
 }
 
@@ -201,12 +345,13 @@
             DDLogDebug(@"Trying to replace head with more detailed block: %@", header.blockId);
             WSStorableBlock *headParent = [self.head previousBlockInChain:self];
             WSStorableBlock *newHead = [headParent buildNextBlockFromHeader:header transactions:transactions];
+            [newHead buildSkipInChain:self];
             if ([self.head hasMoreWorkThanBlock:newHead]) {
                 DDLogDebug(@"Ignoring block with less work than head (%@ < %@)", [newHead workString], [self.head workString]);
                 return nil;
             }
 
-            [self.store putBlock:newHead];
+            [self putBlockInStore:newHead];
             [self.store setHead:newHead];
             if (location) {
                 *location = WSBlockChainLocationMain;
@@ -224,7 +369,7 @@
             return nil;
         }
     }
-    if (connectedOrphans && self.orphans[header.blockId]) {
+    if (connectedOrphans && [self.orphanPool containsOrphanWithId:header.blockId]) {
         DDLogDebug(@"Ignoring known orphan: %@", header.blockId);
         if (location) {
             *location = WSBlockChainLocationOrphan;
@@ -238,6 +383,7 @@
     if ([header.previousBlockId isEqual:self.head.blockId]) {
         DDLogVerbose(@"Block %@ is on main chain (head: %@)", header.blockId, self.head.blockId);
         WSStorableBlock *newHead = [self.head buildNextBlockFromHeader:header transactions:transactions];
+        [newHead buildSkipInChain:self];
         
         if (self.doValidate) {
             if (![newHead validateTargetInChain:self error:error]) {
@@ -251,15 +397,19 @@
                      header.blockId,
                      (unsigned long)transactions.count);
 
-        [self.store putBlock:newHead];
+        [self putBlockInStore:newHead];
         [self.store setHead:newHead];
+        [self appendActiveBlock:newHead];
         addedBlock = newHead;
         if (location) {
             *location = WSBlockChainLocationMain;
         }
 
-        while (self.store.size > self.maxSize) {
-            [self.store removeTail];
+        if (self.store.size > self.maxSize) {
+            while (self.store.size > self.maxSize) {
+                [self.store removeTail];
+            }
+            [self trimActiveChain];
         }
         
         [self.delegate blockChain:self didAddNewBlock:addedBlock location:WSBlockChainLocationMain];
@@ -275,7 +425,7 @@
             DDLogDebug(@"Added orphan block %@ (unknown height)", header.blockId);
             
             WSStorableBlock *orphan = [[WSStorableBlock alloc] initWithHeader:header transactions:transactions];
-            self.orphans[header.blockId] = orphan;
+            [self.orphanPool addOrphan:orphan];
             addedBlock = orphan;
             if (location) {
                 *location = WSBlockChainLocationOrphan;
@@ -288,6 +438,7 @@
 
         DDLogDebug(@"Block %@ may be on a fork (head: %@)", header.blockId, forkHead.blockId);
         WSStorableBlock *newForkHead = [forkHead buildNextBlockFromHeader:header transactions:transactions];
+        [newForkHead buildSkipInChain:self];
         
         // fork is not best chain, extend with new head
         if (![newForkHead hasMoreWorkThanBlock:self.head]) {
@@ -305,7 +456,7 @@
                            header.blockId,
                            (unsigned long)transactions.count);
 
-                [self.store putBlock:newForkHead];
+                [self putBlockInStore:newForkHead];
                 addedBlock = newForkHead;
                 if (location) {
                     *location = WSBlockChainLocationFork;
@@ -325,8 +476,9 @@
             NSArray *oldBlocks = [self subchainFromHead:self.head toBase:forkBase];
             NSArray *newBlocks = [self subchainFromHead:newForkHead toBase:forkBase];
             
-            [self.store putBlock:newForkHead];
+            [self putBlockInStore:newForkHead];
             [self.store setHead:newForkHead];
+            [self reorganizeActiveChainAtBase:forkBase newBlocks:newBlocks];
             addedBlock = newForkHead;
             if (location) {
                 *location = WSBlockChainLocationMain; // after reorg
@@ -344,28 +496,164 @@
     
     // blockchain updated, orphans might not be anymore
     if (connectedOrphans) {
-        *connectedOrphans = [self connectCurrentOrphansWithReorganizeBlock:reorganizeBlock];
+        *connectedOrphans = (addedBlock ? [self connectOrphansToParents:@[addedBlock] reorganizeBlock:reorganizeBlock] : @[]);
     }
 
     return addedBlock;
 }
 
-- (NSArray *)connectCurrentOrphansWithReorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
+- (NSArray *)addBlockHeaders:(NSArray *)headers error:(NSError *__autoreleasing *)error
 {
-    NSMutableArray *allConnectedOrphans = [[NSMutableArray alloc] init];
-    BOOL anyConnected;
+    return [self addBlockHeaders:headers connectedOrphans:NULL reorganizeBlock:NULL error:error];
+}
 
-    do {
-        anyConnected = NO;
+- (NSArray *)addBlockHeaders:(NSArray *)headers
+            connectedOrphans:(NSArray *__autoreleasing *)connectedOrphans
+             reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
+                       error:(NSError *__autoreleasing *)error
+{
+    return [self addBlockHeaders:headers location:NULL connectedOrphans:connectedOrphans reorganizeBlock:reorganizeBlock error:error];
+}
+
+- (NSArray *)addBlockHeaders:(NSArray *)headers
+                    location:(WSBlockChainLocation *)location
+            connectedOrphans:(NSArray *__autoreleasing *)connectedOrphans
+             reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
+                       error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(headers);
+    
+    //
+    // headers are consumed in order until the first rejected one, so
+    // that (addedBlocks.count < headers.count) means headers[addedBlocks.count]
+    // was rejected; error is only set on invalid headers
+    //
+    NSMutableArray *addedBlocks = [[NSMutableArray alloc] initWithCapacity:headers.count];
+    WSBlockChainLocation lastLocation = WSBlockChainLocationNone;
+
+    while (addedBlocks.count < headers.count) {
+        const NSUInteger previousCount = addedBlocks.count;
+        const BOOL isValid = [self extendHeadWithHeaders:headers fromIndex:addedBlocks.count addedBlocks:addedBlocks error:error];
+        if (addedBlocks.count > previousCount) {
+            lastLocation = WSBlockChainLocationMain;
+        }
+        if (!isValid || (addedBlocks.count == headers.count)) {
+            break;
+        }
+
+        // not extending head, fall back to single header (fork, reorganize or orphan)
+        WSBlockHeader *header = headers[addedBlocks.count];
+        if ([self.orphanPool containsOrphanWithId:header.blockId]) {
+            DDLogDebug(@"Ignoring known orphan: %@", header.blockId);
+            break;
+        }
+        WSBlockChainLocation addedLocation;
+        WSStorableBlock *addedBlock = [self addBlockWithHeader:header
+                                                  transactions:nil
+                                                      location:&addedLocation
+                                              connectedOrphans:NULL
+                                               reorganizeBlock:reorganizeBlock
+                                                         error:error];
+        if (!addedBlock) {
+            break;
+        }
+        [addedBlocks addObject:addedBlock];
+        lastLocation = addedLocation;
+    }
+
+    if (location) {
+        *location = lastLocation;
+    }
+
+    // blockchain updated, orphans might not be anymore
+    if (connectedOrphans) {
+        *connectedOrphans = [self connectOrphansToParents:addedBlocks reorganizeBlock:reorganizeBlock];
+    }
+    
+    return addedBlocks;
+}
+
+- (BOOL)extendHeadWithHeaders:(NSArray *)headers fromIndex:(NSUInteger)index addedBlocks:(NSMutableArray *)addedBlocks error:(NSError *__autoreleasing *)error
+{
+    NSParameterAssert(headers);
+    NSParameterAssert(addedBlocks);
+
+    const NSUInteger firstAddedIndex = addedBlocks.count;
+    WSStorableBlock *head = self.head;
+    BOOL isValid = YES;
+
+    // store and index blocks one by one, validation needs previous blocks in chain
+    for (NSUInteger i = index; i < headers.count; ++i) {
+        WSBlockHeader *header = headers[i];
+        if (![header.previousBlockId isEqual:head.blockId]) {
+            break;
+        }
         
-        // WARNING: copy, don't modifiy iterated collection
-        for (WSStorableBlock *orphan in [[self.orphans allValues] copy]) {
-            WSStorableBlock *parentBlock = [self.store blockForId:orphan.previousBlockId];
+        WSStorableBlock *newHead = [head buildNextBlockFromHeader:header transactions:nil];
+        [newHead buildSkipInChain:self];
 
-            // still orphan
-            if (!parentBlock) {
-                continue;
+        if (self.doValidate) {
+            if (![newHead validateTargetInChain:self error:error]) {
+                DDLogDebug(@"Block %@ is invalid", header.blockId);
+                isValid = NO;
+                break;
+            }
+        }
+
+        [self putBlockInStore:newHead];
+        [self appendActiveBlock:newHead];
+        [addedBlocks addObject:newHead];
+        head = newHead;
+    }
+
+    // extend head and trim tail once for the whole batch
+    if (addedBlocks.count > firstAddedIndex) {
+        DDLogVerbose(@"Extending main chain to %u with %lu blocks", head.height, (unsigned long)(addedBlocks.count - firstAddedIndex));
+
+        [self.store setHead:head];
+        if (self.store.size > self.maxSize) {
+            while (self.store.size > self.maxSize) {
+                [self.store removeTail];
+            }
+            [self trimActiveChain];
+        }
+
+        NSArray *newBlocks = [addedBlocks subarrayWithRange:NSMakeRange(firstAddedIndex, addedBlocks.count - firstAddedIndex)];
+        if ([self.delegate respondsToSelector:@selector(blockChain:didExtendHeadWithBlocks:)]) {
+            [self.delegate blockChain:self didExtendHeadWithBlocks:newBlocks];
+        }
+        else {
+            for (WSStorableBlock *block in newBlocks) {
+                [self.delegate blockChain:self didAddNewBlock:block location:WSBlockChainLocationMain];
             }
+        }
+    }
+
+    return isValid;
+}
+
+- (NSArray *)connectOrphansToParents:(NSArray *)parents reorganizeBlock:(WSBlockChainReorganizeBlock)reorganizeBlock
+{
+    NSParameterAssert(parents);
+
+    NSMutableArray *allConnectedOrphans = [[NSMutableArray alloc] init];
+    if (self.orphanPool.count == 0) {
+        return allConnectedOrphans;
+    }
+
+    // only visit children of blocks just added to store
+    NSMutableArray *pendingParents = [[NSMutableArray alloc] init];
+    for (WSStorableBlock *parent in parents) {
+        if (![self.orphanPool containsOrphanWithId:parent.blockId]) {
+            [pendingParents addObject:parent];
+        }
+    }
+
+    while (pendingParents.count > 0) {
+        WSStorableBlock *parent = [pendingParents lastObject];
+        [pendingParents removeLastObject];
+
+        for (WSStorableBlock *orphan in [self.orphanPool removeOrphansWithParentId:parent.blockId]) {
 
             // orphan has a parent, try readding to main chain or some fork (non-recursive)
             DDLogDebug(@"Trying to connect orphan block %@", orphan.blockId);
@@ -377,17 +665,15 @@
                                                                   error:NULL];
             if (connectedOrphan) {
                 [allConnectedOrphans addObject:connectedOrphan];
-                anyConnected = YES;
+                [pendingParents addObject:connectedOrphan];
             }
-
-            // remove from original
-            [self.orphans removeObjectForKey:orphan.blockId];
         }
-        
-        if (allConnectedOrphans.count > 0) {
-            DDLogDebug(@"Connected %lu orphan blocks: %@", (unsigned long)allConnectedOrphans.count, allConnectedOrphans);
-        }
-    } while (anyConnected);
+    }
+
+    if (allConnectedOrphans.count > 0) {
+        DDLogDebug(@"Connected %lu orphan blocks: %@", (unsigned long)allConnectedOrphans.count, allConnectedOrphans);
+        DDLogDebug(@"Orphan pool: %@", self.orphanPool);
+    }
 
     return allConnectedOrphans;
 }
@@ -403,13 +689,36 @@
 {
     WSExceptionCheckIllegal(blockId);
 
-    return (self.orphans[blockId] != nil);
+    return [self.orphanPool containsOrphanWithId:blockId];
 }
 
 - (WSStorableBlock *)findForkBaseFromHead:(WSStorableBlock *)forkHead
 {
     NSParameterAssert(forkHead);
 
+    //
+    // main chain ancestors of forkHead are a prefix by height, so binary
+    // search the highest one with skip-based ancestor lookups
+    //
+    if ((forkHead.height != WSBlockUnknownHeight) && (forkHead.height >= self.activeBaseHeight)) {
+        uint32_t low = self.activeBaseHeight;
+        uint32_t high = MIN(forkHead.height, self.head.height);
+
+        if ([self isActiveBlock:[forkHead ancestorAtHeight:low inChain:self]]) {
+            while (low < high) {
+                const uint32_t middle = low + (high - low + 1) / 2;
+                if ([self isActiveBlock:[forkHead ancestorAtHeight:middle inChain:self]]) {
+                    low = middle;
+                }
+                else {
+                    high = middle - 1;
+                }
+            }
+            return [self blockAtHeight:low];
+        }
+    }
+
+    // fork base out of main chain index, walk back
     WSStorableBlock *mainBlock = self.head;
     WSStorableBlock *forkBlock = forkHead;
 
@@ -437,6 +746,14 @@
 
     NSMutableArray *chain = [[NSMutableArray alloc] initWithCapacity:(head.height - base.height)];
 
+    // slice main chain when possible
+    if ([self isActiveBlock:head] && [self isActiveBlock:base]) {
+        for (uint32_t height = head.height; height > base.height; --height) {
+            [chain addObject:[self blockAtHeight:height]];
+        }
+        return chain;
+    }
+
     WSStorableBlock *block = head;
     do {
         [chain addObject:block];
@@ -446,6 +763,128 @@
     return chain;
 }
 
+#pragma mark Main chain
+
+- (void)rebuildActiveChain
+{
+    [self rebuildActiveChainFromHead:self.store.head blocksById:nil];
+}
+
+// walks back from head keeping ids only, blocksById spares store lookups when given
+- (void)rebuildActiveChainFromHead:(WSStorableBlock *)head blocksById:(NSDictionary *)blocksById
+{
+    NSParameterAssert(head);
+
+    NSMutableData *reversedIds = [[NSMutableData alloc] init];
+    uint32_t baseHeight = head.height;
+    WSStorableBlock *block = head;
+    while (block) {
+        @autoreleasepool {
+            [reversedIds appendBytes:block.blockId.bytes length:WSHash256Length];
+            baseHeight = block.height;
+            block = (blocksById ? blocksById[block.previousBlockId] : [block previousBlockInChain:self]);
+        }
+    }
+
+    const NSUInteger count = reversedIds.length / WSHash256Length;
+    const uint8_t *reversedBytes = reversedIds.bytes;
+    self.activeBlockIds = [[NSMutableData alloc] initWithLength:reversedIds.length];
+    uint8_t *bytes = self.activeBlockIds.mutableBytes;
+    for (NSUInteger i = 0; i < count; ++i) {
+        memcpy(bytes + i * WSHash256Length, reversedBytes + (count - 1 - i) * WSHash256Length, WSHash256Length);
+    }
+    self.activeBaseHeight = baseHeight;
+
+    DDLogDebug(@"Indexed main chain from height %u to %u", baseHeight, head.height);
+}
+
+// drop blocks removed from store tail
+- (void)trimActiveChain
+{
+    NSUInteger removedCount = 0;
+    const NSUInteger count = [self activeCount];
+    const uint8_t *bytes = self.activeBlockIds.bytes;
+
+    while ((removedCount + 1 < count) && ![self.store containsBlockIdBytes:(bytes + removedCount * WSHash256Length)]) {
+        ++removedCount;
+    }
+    if (removedCount > 0) {
+        [self.activeBlockIds replaceBytesInRange:NSMakeRange(0, removedCount * WSHash256Length) withBytes:NULL length:0];
+        self.activeBaseHeight += (uint32_t)removedCount;
+    }
+
+    // don't hold trimmed blocks until next save
+    if (self.unsavedBlocksById.count > 2 * self.maxSize) {
+        const uint32_t baseHeight = self.activeBaseHeight;
+        NSSet *trimmedIds = [self.unsavedBlocksById keysOfEntriesPassingTest:^BOOL(WSHash256 *blockId, WSStorableBlock *block, BOOL *stop) {
+            return (block.height < baseHeight);
+        }];
+        [self.unsavedBlocksById removeObjectsForKeys:[trimmedIds allObjects]];
+    }
+}
+
+- (void)reorganizeActiveChainAtBase:(WSStorableBlock *)base newBlocks:(NSArray *)newBlocks
+{
+    NSParameterAssert(base);
+    NSParameterAssert(newBlocks.count > 0);
+
+    if (![self isActiveBlock:base]) {
+        DDLogWarn(@"Fork base %@ (#%u) is not indexed, rebuilding main chain", base.blockId, base.height);
+        [self rebuildActiveChain];
+        return;
+    }
+
+    const NSUInteger baseIndex = base.height - self.activeBaseHeight;
+    self.activeBlockIds.length = (baseIndex + 1) * WSHash256Length;
+
+    // newBlocks are head first
+    for (WSStorableBlock *block in [newBlocks reverseObjectEnumerator]) {
+        [self appendActiveBlock:block];
+    }
+    NSAssert([self isActiveBlock:self.store.head], @"Main chain index out of sync with head");
+}
+
+- (BOOL)isActiveBlock:(WSStorableBlock *)block
+{
+    if (!block) {
+        return NO;
+    }
+    const uint8_t *blockIdBytes = [self activeBlockIdBytesAtHeight:block.height];
+    return (blockIdBytes && (memcmp(blockIdBytes, block.blockId.bytes, WSHash256Length) == 0));
+}
+
+- (NSUInteger)activeCount
+{
+    return self.activeBlockIds.length / WSHash256Length;
+}
+
+- (const uint8_t *)activeBlockIdBytesAtHeight:(uint32_t)height
+{
+    if ((height == WSBlockUnknownHeight) || (height < self.activeBaseHeight)) {
+        return NULL;
+    }
+    const NSUInteger index = height - self.activeBaseHeight;
+    if (index >= [self activeCount]) {
+        return NULL;
+    }
+    return (const uint8_t *)self.activeBlockIds.bytes + index * WSHash256Length;
+}
+
+- (void)appendActiveBlock:(WSStorableBlock *)block
+{
+    NSParameterAssert(block);
+    NSAssert(block.height == self.activeBaseHeight + [self activeCount], @"Non-contiguous main chain index (%u != %lu)",
+             block.height, (unsigned long)(self.activeBaseHeight + [self activeCount]));
+
+    [self.activeBlockIds appendBytes:block.blockId.bytes length:WSHash256Length];
+}
+
+- (void)putBlockInStore:(WSStorableBlock *)block
+{
+    [self.store putBlock:block];
+    self.unsavedBlocksById[block.blockId] = block;
+}
+
 #pragma mark Core Data
 
 - (void)loadFromCoreDataManager:(WSCoreDataManager *)manager
@@ -457,7 +896,9 @@
     __block NSArray *blockEntities = nil;
     [manager.context performBlockAndWait:^{
         NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:[WSStorableBlockEntity entityName]];
-        request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"height" ascending:NO]];
+        request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"height" ascending:YES]];
+        request.relationshipKeyPathsForPrefetching = @[@"header"];
+        request.fetchBatchSize = WSBlockChainCoreDataFetchBatchSize;
         
         NSError *error;
         blockEntities = [manager.context executeFetchRequest:request error:&error];
@@ -468,39 +909,457 @@
             DDLogError(@"Error fetching all blocks (%@)", error);
         }
         
+        NSMutableArray *blocks = [[NSMutableArray alloc] initWithCapacity:blockEntities.count];
+        NSMutableDictionary *blocksById = [[NSMutableDictionary alloc] initWithCapacity:blockEntities.count];
         for (WSStorableBlockEntity *blockEntity in blockEntities) {
-            WSStorableBlock *block = [blockEntity toStorableBlockWithParameters:self.store.parameters];
-            [self.store putBlock:block];
+            WSStorableBlock *block = [blockEntity toLazyStorableBlockWithParameters:self.store.parameters];
+            [blocks addObject:block];
+            blocksById[block.blockId] = block;
+        }
+        WSStorableBlock *head = [blocks lastObject];
 
-            if (blockEntity == [blockEntities firstObject]) {
-                [self.store setHead:block];
+        //
+        // index main chain first from loaded blocks, then rebuild skip
+        // pointers (not saved) by ascending height so that each block
+        // finds its main chain ancestors by height and its fork
+        // ancestors already in store
+        //
+        if (head) {
+            [self rebuildActiveChainFromHead:head blocksById:blocksById];
+            for (WSStorableBlock *block in blocks) {
+                [block buildSkipInChain:self];
+                [self.store putBlock:block];
             }
+            [self.store setHead:head];
+            [self.store findAndRestoreTail];
         }
-        [self.store findAndRestoreTail];
+        else {
+            [self.store findAndRestoreTail];
+            [self rebuildActiveChain];
+        }
+
+        [self.unsavedBlocksById removeAllObjects];
+        self.savedManager = manager;
 
         DDLogInfo(@"Loaded blockchain (%u) from Core Data: %@", self.head.height, manager.storeURL);
     }];
 }
 
 - (void)saveToCoreDataManager:(WSCoreDataManager *)manager
+{
+    [self saveToCoreDataManager:manager completionBlock:NULL];
+}
+
+- (void)saveToCoreDataManager:(WSCoreDataManager *)manager completionBlock:(void (^)(BOOL))completionBlock
 {
     WSExceptionCheckIllegal(manager);
-    
-    [manager truncate];
-    [manager.context performBlockAndWait:^{
-        for (WSStorableBlock *block in [self.store allBlocks]) {
-            WSStorableBlockEntity *blockEntity = [[WSStorableBlockEntity alloc] initWithContext:manager.context];
-            [blockEntity copyFromStorableBlock:block];
+
+    BOOL isFull = (manager != self.savedManager);
+    @synchronized (self) {
+        isFull |= self.needsFullSave;
+        self.needsFullSave = NO;
+    }
+
+    // only blocks added since last save unless switching manager
+    NSArray *blocks = (isFull ? [self.store allBlocks] : [self.unsavedBlocksById allValues]);
+    const uint32_t minHeight = self.activeBaseHeight;
+    [self.unsavedBlocksById removeAllObjects];
+    self.savedManager = manager;
+
+    WSBlockChainSaveBatch *batch = nil;
+    @synchronized (self) {
+        WSBlockChainSaveBatch *pendingBatch = self.pendingSaveBatch;
+        if (pendingBatch && !pendingBatch.isStarted && (pendingBatch.manager == manager)) {
+            [pendingBatch mergeBlocks:blocks minHeight:minHeight isFull:isFull];
+            [pendingBatch addCompletionBlock:completionBlock];
+
+            DDLogDebug(@"Coalesced %lu blocks into pending Core Data save", (unsigned long)blocks.count);
+            return;
+        }
+
+        batch = [[WSBlockChainSaveBatch alloc] init];
+        batch.manager = manager;
+        [batch mergeBlocks:blocks minHeight:minHeight isFull:isFull];
+        [batch addCompletionBlock:completionBlock];
+        self.pendingSaveBatch = batch;
+    }
+
+    [manager.context performBlock:^{
+        @synchronized (self) {
+            batch.isStarted = YES;
+            if (self.pendingSaveBatch == batch) {
+                self.pendingSaveBatch = nil;
+            }
         }
+        [batch completeWithSuccess:[self writeSaveBatch:batch]];
     }];
+}
+
+- (void)waitForPendingSavesToCoreDataManager:(WSCoreDataManager *)manager
+{
+    WSExceptionCheckIllegal(manager);
+
+    // context queue is serial, any save enqueued so far runs first
+    [manager.context performBlockAndWait:^{
+    }];
+}
+
+//
+// manager context queue
+//
+// entities are updated in place rather than deleted and inserted again,
+// lazy blocks loaded from this manager keep fetching transactions from
+// their original entities
+//
+- (BOOL)writeSaveBatch:(WSBlockChainSaveBatch *)batch
+{
+    WSCoreDataManager *manager = batch.manager;
+    NSManagedObjectContext *context = manager.context;
+
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:[WSStorableBlockEntity entityName]];
+    request.relationshipKeyPathsForPrefetching = @[@"header"];
+    if (!batch.isFull) {
+        NSMutableArray *blockIdsData = [[NSMutableArray alloc] initWithCapacity:batch.blocksById.count];
+        for (WSHash256 *blockId in [batch.blocksById keyEnumerator]) {
+            [blockIdsData addObject:blockId.data];
+        }
+
+        // stale or rewritten blocks, full saves go through all entities
+        request.predicate = [NSPredicate predicateWithFormat:@"(height < %@) OR (header.blockIdData IN %@)", @(batch.minHeight), blockIdsData];
+    }
 
     NSError *error;
-    if ([manager saveWithError:&error]) {
-        DDLogInfo(@"Saved blockchain (%u) to Core Data: %@", self.head.height, manager.storeURL);
+    NSArray *blockEntities = [context executeFetchRequest:request error:&error];
+    if (!blockEntities) {
+        DDLogError(@"Error fetching saved blocks (%@)", error);
+        @synchronized (self) {
+            self.needsFullSave = YES;
+        }
+        return NO;
     }
-    else {
+
+    NSMutableDictionary *insertedBlocksById = [batch.blocksById mutableCopy];
+    NSUInteger updatedCount = 0;
+    NSUInteger removedCount = 0;
+    for (WSStorableBlockEntity *blockEntity in blockEntities) {
+        WSHash256 *blockId = WSHash256FromData(blockEntity.header.blockIdData);
+        WSStorableBlock *block = insertedBlocksById[blockId];
+        if (!block || (block.height < batch.minHeight)) {
+            [context deleteObject:blockEntity];
+            ++removedCount;
+            continue;
+        }
+        [blockEntity updateFromStorableBlock:block];
+        [insertedBlocksById removeObjectForKey:blockId];
+        ++updatedCount;
+    }
+
+    NSUInteger insertedCount = 0;
+    for (WSStorableBlock *block in [insertedBlocksById objectEnumerator]) {
+        if (block.height < batch.minHeight) {
+            continue;
+        }
+        WSStorableBlockEntity *blockEntity = [[WSStorableBlockEntity alloc] initWithContext:context];
+        [blockEntity copyFromStorableBlock:block];
+        ++insertedCount;
+    }
+
+    if (![manager saveWithError:&error]) {
         DDLogError(@"Unable to save blockchain to Core Data: %@", error);
+        [context rollback];
+        @synchronized (self) {
+            self.needsFullSave = YES;
+        }
+        return NO;
+    }
+    DDLogInfo(@"Saved blockchain to Core Data (%lu added, %lu updated, %lu removed%@): %@",
+              (unsigned long)insertedCount,
+              (unsigned long)updatedCount,
+              (unsigned long)removedCount,
+              (batch.isFull ? @", full" : @""),
+              manager.storeURL);
+    return YES;
+}
+
+#pragma mark Snapshot
+
+- (BOOL)exportHeadersToPath:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(path);
+
+    const uint32_t headHeight = self.head.height;
+    NSAssert(headHeight == self.activeBaseHeight + [self activeCount] - 1, @"Main chain index out of sync with head");
+
+    // start from genesis or first indexed checkpoint
+    uint32_t baseHeight = self.activeBaseHeight;
+    while ((baseHeight <= headHeight) && ![[self snapshotAnchorAtHeight:baseHeight] isEqual:[self blockAtHeight:baseHeight]]) {
+        ++baseHeight;
+    }
+    if (baseHeight > headHeight) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"No checkpoint on main chain to anchor headers snapshot (%u-%u)", self.activeBaseHeight, headHeight);
+        return NO;
+    }
+    const NSUInteger count = headHeight - baseHeight + 1;
+
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:(sizeof(WSHeadersSnapshotHeader) +
+                                                                   count * WSHeadersSnapshotHeaderLength +
+                                                                   sizeof(WSHeadersSnapshotTrailer))];
+
+    WSHeadersSnapshotHeader snapshotHeader;
+    snapshotHeader.magic = CFSwapInt32HostToLittle(WSHeadersSnapshotMagic);
+    snapshotHeader.version = CFSwapInt32HostToLittle(WSHeadersSnapshotVersion);
+    snapshotHeader.networkMagic = CFSwapInt32HostToLittle([self.store.parameters magicNumber]);
+    snapshotHeader.count = CFSwapInt32HostToLittle((uint32_t)count);
+    [data appendBytes:&snapshotHeader length:sizeof(snapshotHeader)];
+
+    WSStorableBlock *baseBlock = nil;
+    for (uint32_t height = baseHeight; height <= headHeight; ++height) {
+        WSStorableBlock *block = [self blockAtHeight:height];
+        if (!block) {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Missing main chain block at height %u", height);
+            return NO;
+        }
+        if (!baseBlock) {
+            baseBlock = block;
+        }
+        [data appendBytes:[[block.header toBuffer] bytes] length:WSHeadersSnapshotHeaderLength];
+    }
+
+    WSHeadersSnapshotTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.baseHeight = CFSwapInt32HostToLittle(baseHeight);
+    trailer.headHeight = CFSwapInt32HostToLittle(headHeight);
+
+    NSData *baseWork = baseBlock.workData;
+    NSData *headWork = self.head.workData;
+    NSAssert((baseWork.length <= sizeof(trailer.baseWork)) && (headWork.length <= sizeof(trailer.headWork)), @"Work exceeds 256 bits");
+    memcpy(trailer.baseWork + sizeof(trailer.baseWork) - baseWork.length, baseWork.bytes, baseWork.length);
+    memcpy(trailer.headWork + sizeof(trailer.headWork) - headWork.length, headWork.bytes, headWork.length);
+    [data appendBytes:&trailer length:(sizeof(trailer) - sizeof(trailer.checksum))];
+
+    NSData *checksum = [data hash256];
+    [data appendData:checksum];
+
+    if (![data writeToFile:path options:NSDataWritingAtomic error:error]) {
+        return NO;
+    }
+    DDLogInfo(@"Exported %lu headers (%u-%u) to %@", (unsigned long)count, baseHeight, headHeight, path);
+    return YES;
+}
+
+- (BOOL)importHeadersFromPath:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(path);
+
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:error];
+    if (!data) {
+        return NO;
+    }
+    const uint8_t *bytes = data.bytes;
+    const NSUInteger minLength = sizeof(WSHeadersSnapshotHeader) + sizeof(WSHeadersSnapshotTrailer);
+    if (data.length < minLength) {
+        WSErrorSetNotEnoughBytes(error, [self class], data.length, minLength);
+        return NO;
+    }
+
+    WSHeadersSnapshotHeader snapshotHeader;
+    memcpy(&snapshotHeader, bytes, sizeof(snapshotHeader));
+    if ((CFSwapInt32LittleToHost(snapshotHeader.magic) != WSHeadersSnapshotMagic) ||
+        (CFSwapInt32LittleToHost(snapshotHeader.version) != WSHeadersSnapshotVersion)) {
+
+        WSErrorSet(error, WSErrorCodeMalformed, @"Not a headers snapshot or unsupported version");
+        return NO;
+    }
+    if (CFSwapInt32LittleToHost(snapshotHeader.networkMagic) != [self.store.parameters magicNumber]) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Headers snapshot from another network (%x)", CFSwapInt32LittleToHost(snapshotHeader.networkMagic));
+        return NO;
+    }
+    const NSUInteger count = CFSwapInt32LittleToHost(snapshotHeader.count);
+    const NSUInteger expectedLength = minLength + count * WSHeadersSnapshotHeaderLength;
+    if ((count == 0) || (data.length != expectedLength)) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unexpected headers snapshot length (%lu != %lu)",
+                   (unsigned long)data.length, (unsigned long)expectedLength);
+        return NO;
+    }
+
+    WSHeadersSnapshotTrailer trailer;
+    memcpy(&trailer, bytes + expectedLength - sizeof(trailer), sizeof(trailer));
+    NSData *checkedData = [NSData dataWithBytesNoCopy:(void *)bytes length:(expectedLength - sizeof(trailer.checksum)) freeWhenDone:NO];
+    if (memcmp([[checkedData hash256] bytes], trailer.checksum, sizeof(trailer.checksum)) != 0) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Headers snapshot checksum mismatch");
+        return NO;
+    }
+
+    const uint32_t baseHeight = CFSwapInt32LittleToHost(trailer.baseHeight);
+    const uint32_t headHeight = CFSwapInt32LittleToHost(trailer.headHeight);
+    if (headHeight != baseHeight + count - 1) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unexpected headers snapshot heights (%u-%u, %lu headers)",
+                   baseHeight, headHeight, (unsigned long)count);
+        return NO;
+    }
+
+    //
+    // stream-verify PoW, linkage, checkpoints, targets and work from raw
+    // bytes, only the headers that fit maxSize are materialized afterwards
+    //
+    WSParameters *parameters = self.store.parameters;
+    WSStorableBlock *anchor = [self snapshotAnchorAtHeight:baseHeight];
+    if (!anchor) {
+        WSErrorSet(error, WSErrorCodeInvalidBlock, @"Headers snapshot base %u is neither genesis nor a checkpoint", baseHeight);
+        return NO;
+    }
+
+    WSUInt256 maxTarget;
+    WSUInt256SetCompact(&maxTarget, [parameters maxProofOfWork], NULL, NULL);
+
+    WSUInt256 work;
+    WSUInt256 trailerWork;
+    WSUInt256 storedBaseWork;
+    WSUInt256 headerWork;
+    WSUInt256SetData(&work, anchor.workData);
+    WSUInt256SetData(&trailerWork, [NSData dataWithBytesNoCopy:trailer.baseWork length:sizeof(trailer.baseWork) freeWhenDone:NO]);
+    if (WSUInt256Compare(&work, &trailerWork) != 0) {
+        WSErrorSet(error, WSErrorCodeInvalidBlock, @"Headers snapshot base work mismatch");
+        return NO;
+    }
+    WSUInt256SetZero(&storedBaseWork);
+
+    const NSUInteger storedCount = MIN(count, self.maxSize);
+    const NSUInteger firstStoredIndex = count - storedCount;
+    const uint32_t retargetInterval = [parameters retargetInterval];
+    const uint8_t *headers = bytes + sizeof(WSHeadersSnapshotHeader);
+    WSBuffer *buffer = [[WSBuffer alloc] initWithData:data];
+    uint8_t previousBlockId[CC_SHA256_DIGEST_LENGTH];
+    uint8_t blockId[CC_SHA256_DIGEST_LENGTH];
+
+    for (NSUInteger i = 0; i < count; ++i) {
+        const uint8_t *header = headers + i * WSHeadersSnapshotHeaderLength;
+        const uint32_t height = baseHeight + (uint32_t)i;
+
+        if (!WSHeadersSnapshotVerifyHeader(header, &maxTarget, blockId, &headerWork)) {
+            WSErrorSet(error, WSErrorCodeInvalidBlock, @"Invalid proof-of-work in headers snapshot at height %u", height);
+            return NO;
+        }
+        if (i == 0) {
+            if (memcmp(blockId, [anchor.blockId bytes], sizeof(blockId)) != 0) {
+                WSErrorSet(error, WSErrorCodeInvalidBlock, @"Headers snapshot does not start from %@ at height %u", anchor.blockId, baseHeight);
+                return NO;
+            }
+        }
+        else {
+            if (memcmp(header + sizeof(uint32_t), previousBlockId, sizeof(previousBlockId)) != 0) {
+                WSErrorSet(error, WSErrorCodeInvalidBlock, @"Non-contiguous headers in snapshot at height %u", height);
+                return NO;
+            }
+            WSUInt256Add(&work, &work, &headerWork);
+
+            // same rules as addBlockWithHeader:, bits lie at offset 72
+            if (self.doValidate) {
+                if (height % retargetInterval != 0) {
+                    if (memcmp(header + 72, header - WSHeadersSnapshotHeaderLength + 72, sizeof(uint32_t)) != 0) {
+                        WSErrorSet(error, WSErrorCodeInvalidBlock, @"Unexpected target in headers snapshot at height %u", height);
+                        return NO;
+                    }
+                }
+                else if (i >= retargetInterval) {
+                    WSStorableBlock *block = [self snapshotBlockFromBuffer:buffer index:i height:height error:error];
+                    WSStorableBlock *previousBlock = [self snapshotBlockFromBuffer:buffer index:(i - 1) height:(height - 1) error:error];
+                    WSStorableBlock *retargetBlock = [self snapshotBlockFromBuffer:buffer index:(i - retargetInterval) height:(height - retargetInterval) error:error];
+                    if (!block || !previousBlock || !retargetBlock) {
+                        return NO;
+                    }
+                    if (![block validateTargetFromPreviousBlock:previousBlock retargetBlock:retargetBlock error:error]) {
+                        return NO;
+                    }
+                }
+            }
+        }
+
+        WSStorableBlock *checkpoint = [parameters checkpointAtHeight:height];
+        if (checkpoint && (memcmp(blockId, [checkpoint.blockId bytes], sizeof(blockId)) != 0)) {
+            WSErrorSet(error, WSErrorCodeInvalidBlock, @"Headers snapshot does not match checkpoint at height %u", height);
+            return NO;
+        }
+
+        if (i == firstStoredIndex) {
+            storedBaseWork = work;
+        }
+        memcpy(previousBlockId, blockId, sizeof(blockId));
+    }
+
+    WSUInt256SetData(&trailerWork, [NSData dataWithBytesNoCopy:trailer.headWork length:sizeof(trailer.headWork) freeWhenDone:NO]);
+    if (WSUInt256Compare(&work, &trailerWork) != 0) {
+        WSErrorSet(error, WSErrorCodeInvalidBlock, @"Headers snapshot work mismatch");
+        return NO;
+    }
+
+    // never replace a chain with at least as much work
+    WSUInt256 currentWork;
+    WSUInt256SetData(&currentWork, self.head.workData);
+    if (WSUInt256Compare(&work, &currentWork) <= 0) {
+        WSErrorSet(error, WSErrorCodeInvalidBlock, @"Headers snapshot has no more work than current chain (head %u, snapshot head %u)",
+                   self.head.height, headHeight);
+        return NO;
+    }
+
+    // parse everything before touching current chain
+    NSMutableArray *storedHeaders = [[NSMutableArray alloc] initWithCapacity:storedCount];
+    for (NSUInteger i = firstStoredIndex; i < count; ++i) {
+        WSStorableBlock *block = [self snapshotBlockFromBuffer:buffer index:i height:(baseHeight + (uint32_t)i) error:error];
+        if (!block) {
+            return NO;
+        }
+        [storedHeaders addObject:block.header];
+    }
+
+    // verified, replace current chain with snapshot tail
+    [self truncate];
+
+    WSStorableBlock *block = nil;
+    for (WSBlockHeader *header in storedHeaders) {
+        if (!block) {
+            block = [[WSStorableBlock alloc] initWithHeader:header
+                                               transactions:nil
+                                                     height:(baseHeight + (uint32_t)firstStoredIndex)
+                                                       work:WSUInt256Data(&storedBaseWork)];
+        }
+        else {
+            block = [block buildNextBlockFromHeader:header transactions:nil];
+        }
+        [block buildSkipInChain:self];
+        [self putBlockInStore:block];
+    }
+    [self.store setHead:block];
+    while (self.store.size > self.maxSize) {
+        [self.store removeTail];
+    }
+    [self rebuildActiveChain];
+
+    DDLogInfo(@"Imported %lu headers (%u-%u) from %@, kept %lu", (unsigned long)count, baseHeight, headHeight, path, (unsigned long)storedCount);
+    return YES;
+}
+
+- (WSStorableBlock *)snapshotAnchorAtHeight:(uint32_t)height
+{
+    WSParameters *parameters = self.store.parameters;
+    if (height == 0) {
+        return [[WSStorableBlock alloc] initWithHeader:[parameters genesisBlock].header transactions:nil height:0];
     }
+    return [parameters checkpointAtHeight:height];
+}
+
+- (WSStorableBlock *)snapshotBlockFromBuffer:(WSBuffer *)buffer index:(NSUInteger)index height:(uint32_t)height error:(NSError *__autoreleasing *)error
+{
+    const NSUInteger offset = sizeof(WSHeadersSnapshotHeader) + index * WSHeadersSnapshotHeaderLength;
+    WSBlockHeader *header = [[WSBlockHeader alloc] initWithParameters:self.store.parameters
+                                                               buffer:buffer
+                                                                 from:offset
+                                                            available:(buffer.data.length - offset)
+                                                                error:error];
+    if (!header) {
+        return nil;
+    }
+    return [[WSStorableBlock alloc] initWithHeader:header transactions:nil height:height];
 }
 
 #pragma mark WSIndentableDescription
@@ -527,3 +1386,34 @@
 }
 
 @end
+
+#pragma mark -
+
+static BOOL WSHeadersSnapshotVerifyHeader(const uint8_t *header, const WSUInt256 *maxTarget, uint8_t *blockId, WSUInt256 *work)
+{
+    uint8_t hash[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(header, WSHeadersSnapshotHeaderLength, hash);
+    CC_SHA256(hash, sizeof(hash), blockId);
+
+    // bits lie at offset 72 of the serialized header
+    uint32_t bits;
+    memcpy(&bits, header + 72, sizeof(uint32_t));
+    bits = CFSwapInt32LittleToHost(bits);
+
+    WSUInt256 target;
+    BOOL negative;
+    BOOL overflow;
+    WSUInt256SetCompact(&target, bits, &negative, &overflow);
+    if (negative || overflow || WSUInt256IsZero(&target) || (WSUInt256Compare(&target, maxTarget) > 0)) {
+        return NO;
+    }
+
+    WSUInt256 hashValue;
+    WSUInt256SetHashBytes(&hashValue, blockId);
+    if (WSUInt256Compare(&hashValue, &target) > 0) {
+        return NO;
+    }
+
+    WSUInt256SetWorkFromCompact(work, bits);
+    return YES;
+}
@@ -0,0 +1,92 @@
+//
+//  WSBlockRecord.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+#import <Foundation/Foundation.h>
+
+@class WSParameters;
+@class WSBlockHeader;
+@class WSStorableBlock;
+
+//
+// helpers shared by the stores keeping raw block records, i.e. block id,
+// 80-byte serialized header, height, work and skip id, not public API
+//
+
+// block ids are already uniform, mixing only guards against crafted ones
+static inline uint32_t WSBlockRecordIdHash(const uint8_t *blockIdBytes)
+{
+    uint64_t h, l;
+    memcpy(&h, blockIdBytes, sizeof(h));
+    memcpy(&l, blockIdBytes + sizeof(h), sizeof(l));
+
+    h ^= l + 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+// previous block id lies at offset 4 of the serialized header
+static inline const uint8_t *WSBlockRecordPreviousIdBytes(const uint8_t *headerBytes)
+{
+    return headerBytes + sizeof(uint32_t);
+}
+
+// headerBytes is the 80-byte serialized header, the block id is not recomputed
+WSBlockHeader *WSBlockRecordDecodeHeader(WSParameters *parameters, const uint8_t *blockIdBytes, const uint8_t *headerBytes);
+
+//
+// skipIdBytes may be NULL or all zeros if none
+//
+// transactions are taken from transactionsBlock if any, without triggering
+// its pending load (see -[WSStorableBlock takeTransactionsFromBlock:]),
+// otherwise from transactions
+//
+WSStorableBlock *WSBlockRecordDecode(WSParameters *parameters,
+                                     const uint8_t *blockIdBytes,
+                                     const uint8_t *headerBytes,
+                                     uint32_t height,
+                                     NSData *work,
+                                     const uint8_t *skipIdBytes,
+                                     NSOrderedSet *transactions,
+                                     WSStorableBlock *transactionsBlock);
+
+// walks back from head while previous records are found
+uint32_t WSBlockRecordFindTail(uint32_t headIndex, uint32_t noIndex, uint32_t (^previousIndex)(uint32_t index));
+
+//
+// ancestor of headIndex at height, jumps through skip pointers (skipIndex
+// returns noIndex if none) unless they overshoot, noIndex if not found
+//
+// the next tail is the ancestor of head right above the current tail, which
+// unlike the first child found is never on a side branch
+//
+uint32_t WSBlockRecordAncestorIndex(uint32_t headIndex,
+                                    uint32_t height,
+                                    uint32_t noIndex,
+                                    uint32_t (^heightAtIndex)(uint32_t index),
+                                    uint32_t (^previousIndex)(uint32_t index),
+                                    uint32_t (^skipIndex)(uint32_t index));
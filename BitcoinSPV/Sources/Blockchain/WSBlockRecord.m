@@ -0,0 +1,135 @@
+//
+//  WSBlockRecord.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+#import "WSBlockRecord.h"
+#import "WSHash256.h"
+#import "WSStorableBlock.h"
+#import "WSStorableBlock+BlockChain.h"
+#import "WSBlockHeader.h"
+#import "WSBitcoinConstants.h"
+#import "WSMacrosCore.h"
+
+@interface WSBlockHeader (WSBlockRecord)
+
+// avoids recomputing the block id we already store
+- (instancetype)initWithParameters:(WSParameters *)parameters
+                           version:(uint32_t)version
+                   previousBlockId:(WSHash256 *)previousBlockId
+                        merkleRoot:(WSHash256 *)merkleRoot
+                         timestamp:(uint32_t)timestamp
+                              bits:(uint32_t)bits
+                             nonce:(uint32_t)nonce
+                           blockId:(WSHash256 *)blockId;
+
+@end
+
+WSBlockHeader *WSBlockRecordDecodeHeader(WSParameters *parameters, const uint8_t *blockIdBytes, const uint8_t *headerBytes)
+{
+    NSCParameterAssert(parameters);
+    NSCParameterAssert(blockIdBytes);
+    NSCParameterAssert(headerBytes);
+
+    uint32_t version, timestamp, bits, nonce;
+
+    memcpy(&version, headerBytes, sizeof(uint32_t));
+    memcpy(&timestamp, headerBytes + 68, sizeof(uint32_t));
+    memcpy(&bits, headerBytes + 72, sizeof(uint32_t));
+    memcpy(&nonce, headerBytes + 76, sizeof(uint32_t));
+
+    return [[WSBlockHeader alloc] initWithParameters:parameters
+                                             version:CFSwapInt32LittleToHost(version)
+                                     previousBlockId:WSHash256FromData([NSData dataWithBytes:WSBlockRecordPreviousIdBytes(headerBytes) length:WSHash256Length])
+                                          merkleRoot:WSHash256FromData([NSData dataWithBytes:(headerBytes + 36) length:WSHash256Length])
+                                           timestamp:CFSwapInt32LittleToHost(timestamp)
+                                                bits:CFSwapInt32LittleToHost(bits)
+                                               nonce:CFSwapInt32LittleToHost(nonce)
+                                             blockId:WSHash256FromData([NSData dataWithBytes:blockIdBytes length:WSHash256Length])];
+}
+
+WSStorableBlock *WSBlockRecordDecode(WSParameters *parameters,
+                                     const uint8_t *blockIdBytes,
+                                     const uint8_t *headerBytes,
+                                     uint32_t height,
+                                     NSData *work,
+                                     const uint8_t *skipIdBytes,
+                                     NSOrderedSet *transactions,
+                                     WSStorableBlock *transactionsBlock)
+{
+    WSBlockHeader *header = WSBlockRecordDecodeHeader(parameters, blockIdBytes, headerBytes);
+
+    WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:header
+                                                        transactions:(transactionsBlock ? nil : transactions)
+                                                              height:height
+                                                                work:work];
+
+    if (transactionsBlock) {
+        [block takeTransactionsFromBlock:transactionsBlock];
+    }
+
+    static const uint8_t zeroId[32];
+    if (skipIdBytes && (memcmp(skipIdBytes, zeroId, sizeof(zeroId)) != 0)) {
+        [block restoreSkipBlockId:WSHash256FromData([NSData dataWithBytes:skipIdBytes length:WSHash256Length])];
+    }
+    return block;
+}
+
+uint32_t WSBlockRecordFindTail(uint32_t headIndex, uint32_t noIndex, uint32_t (^previousIndex)(uint32_t index))
+{
+    NSCParameterAssert(previousIndex);
+
+    uint32_t index = headIndex;
+    uint32_t tailIndex = noIndex;
+    while (index != noIndex) {
+        tailIndex = index;
+        index = previousIndex(index);
+    }
+    return tailIndex;
+}
+
+uint32_t WSBlockRecordAncestorIndex(uint32_t headIndex,
+                                    uint32_t height,
+                                    uint32_t noIndex,
+                                    uint32_t (^heightAtIndex)(uint32_t index),
+                                    uint32_t (^previousIndex)(uint32_t index),
+                                    uint32_t (^skipIndex)(uint32_t index))
+{
+    NSCParameterAssert(heightAtIndex);
+    NSCParameterAssert(previousIndex);
+    NSCParameterAssert(skipIndex);
+
+    uint32_t index = headIndex;
+    while ((index != noIndex) && (heightAtIndex(index) > height)) {
+        const uint32_t skip = skipIndex(index);
+        if ((skip != noIndex) && (heightAtIndex(skip) >= height)) {
+            index = skip;
+        }
+        else {
+            index = previousIndex(index);
+        }
+    }
+    if ((index != noIndex) && (heightAtIndex(index) != height)) {
+        return noIndex;
+    }
+    return index;
+}
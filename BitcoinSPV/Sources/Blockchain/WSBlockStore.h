@@ -39,6 +39,7 @@
 
 - (WSParameters *)parameters;
 - (WSStorableBlock *)blockForId:(WSHash256 *)blockId;
+- (BOOL)containsBlockIdBytes:(const uint8_t *)blockIdBytes; // doesn't materialize the block
 - (void)putBlock:(WSStorableBlock *)block;
 - (WSStorableBlock *)head;
 - (void)setHead:(WSStorableBlock *)head;
@@ -47,5 +48,6 @@
 - (NSArray *)allBlocks;
 - (NSUInteger)size;
 - (void)truncate;
+- (void)synchronize; // flushes pending writes, no-op if not persistent
 
 @end
@@ -0,0 +1,69 @@
+//
+//  WSHeaderTable.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "WSUInt256.h"
+
+@class WSParameters;
+@class WSHash256;
+@class WSStorableBlock;
+
+extern const uint32_t WSHeaderTableNoIndex;
+
+//
+// thread-safety: not required
+//
+// headers, ids, heights, work and skip ids are kept in contiguous arrays and
+// addressed by integer index, blocks are only materialized on request
+//
+// removed entries leave holes until compaction, which moves entries
+// and thus invalidates any index held by the caller
+//
+@interface WSHeaderTable : NSObject
+
+- (instancetype)initWithParameters:(WSParameters *)parameters capacity:(NSUInteger)capacity;
+- (WSParameters *)parameters;
+- (NSUInteger)count; // live entries
+- (uint32_t)endIndex; // removed entries included
+
+- (uint32_t)indexOfBlockId:(WSHash256 *)blockId;
+- (uint32_t)indexOfBlockIdBytes:(const uint8_t *)blockIdBytes;
+- (uint32_t)putBlock:(WSStorableBlock *)block;
+- (void)removeEntryAtIndex:(uint32_t)index;
+- (BOOL)isRemovedEntryAtIndex:(uint32_t)index;
+- (void)removeAllEntries;
+
+- (BOOL)needsCompaction;
+- (void)compactRemappingIndexes:(uint32_t *)indexes count:(NSUInteger)count;
+
+- (const uint8_t *)blockIdBytesAtIndex:(uint32_t)index;
+- (const uint8_t *)previousBlockIdBytesAtIndex:(uint32_t)index;
+- (uint32_t)heightAtIndex:(uint32_t)index;
+- (const WSUInt256 *)workAtIndex:(uint32_t)index;
+- (const uint8_t *)skipBlockIdBytesAtIndex:(uint32_t)index; // NULL if none
+- (WSStorableBlock *)blockAtIndex:(uint32_t)index transactionsBlock:(WSStorableBlock *)transactionsBlock; // see WSBlockRecordDecode()
+
+@end
@@ -0,0 +1,369 @@
+//
+//  WSHeaderTable.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSHeaderTable.h"
+#import "WSBlockRecord.h"
+#import "WSHash256.h"
+#import "WSStorableBlock.h"
+#import "WSBlockHeader.h"
+#import "WSBitcoinConstants.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+// serialized header without trailing tx count
+#define WSHeaderTableHeaderLength       80
+
+const uint32_t WSHeaderTableNoIndex                 = UINT32_MAX;
+
+static const NSUInteger WSHeaderTableMinCapacity    = 1024;
+static const NSUInteger WSHeaderTableMinCompaction  = 1024;
+static const uint32_t WSHeaderTableSlotEmpty        = 0;
+static const uint32_t WSHeaderTableSlotRemoved      = UINT32_MAX;
+
+@interface WSHeaderTable ()
+
+@property (nonatomic, strong) WSParameters *parameters;
+@property (nonatomic, assign) NSUInteger count;
+@property (nonatomic, assign) uint32_t endIndex;
+@property (nonatomic, assign) NSUInteger capacity;
+@property (nonatomic, assign) uint8_t *headers;             // WSHeaderTableHeaderLength * capacity
+@property (nonatomic, assign) uint8_t *blockIds;            // WSHash256Length * capacity
+@property (nonatomic, assign) uint32_t *heights;            // capacity
+@property (nonatomic, assign) WSUInt256 *works;             // capacity
+@property (nonatomic, assign) uint8_t *skipIds;             // WSHash256Length * capacity, zero if none
+@property (nonatomic, assign) uint8_t *removedFlags;        // capacity
+@property (nonatomic, assign) uint32_t *slots;              // slotCapacity (index + 1)
+@property (nonatomic, assign) NSUInteger slotCapacity;
+@property (nonatomic, assign) NSUInteger usedSlots;
+
+- (void)growToCapacity:(NSUInteger)capacity;
+- (void)rebuildSlots;
+- (uint32_t)slotForBlockIdBytes:(const uint8_t *)blockIdBytes;
+- (void)insertSlotForIndex:(uint32_t)index;
+
+@end
+
+@implementation WSHeaderTable
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithParameters:capacity:");
+    return nil;
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters capacity:(NSUInteger)capacity
+{
+    WSExceptionCheckIllegal(parameters);
+
+    if ((self = [super init])) {
+        self.parameters = parameters;
+        [self growToCapacity:MAX(capacity, WSHeaderTableMinCapacity)];
+        [self rebuildSlots];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(self.headers);
+    free(self.blockIds);
+    free(self.heights);
+    free(self.works);
+    free(self.skipIds);
+    free(self.removedFlags);
+    free(self.slots);
+}
+
+#pragma mark Access
+
+- (uint32_t)indexOfBlockId:(WSHash256 *)blockId
+{
+    WSExceptionCheckIllegal(blockId);
+
+    return [self indexOfBlockIdBytes:blockId.bytes];
+}
+
+- (uint32_t)indexOfBlockIdBytes:(const uint8_t *)blockIdBytes
+{
+    NSParameterAssert(blockIdBytes);
+
+    const uint32_t slot = [self slotForBlockIdBytes:blockIdBytes];
+    if (slot == WSHeaderTableNoIndex) {
+        return WSHeaderTableNoIndex;
+    }
+    return self.slots[slot] - 1;
+}
+
+- (BOOL)isRemovedEntryAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    return (self.removedFlags[index] != 0);
+}
+
+- (const uint8_t *)blockIdBytesAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    return self.blockIds + (size_t)index * WSHash256Length;
+}
+
+// previous block id lies at offset 4 of the serialized header
+- (const uint8_t *)previousBlockIdBytesAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    return WSBlockRecordPreviousIdBytes(self.headers + (size_t)index * WSHeaderTableHeaderLength);
+}
+
+- (uint32_t)heightAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    return self.heights[index];
+}
+
+- (const WSUInt256 *)workAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    return &self.works[index];
+}
+
+- (const uint8_t *)skipBlockIdBytesAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    static const uint8_t zeroId[32];
+    const uint8_t *skipIdBytes = self.skipIds + (size_t)index * WSHash256Length;
+    return ((memcmp(skipIdBytes, zeroId, sizeof(zeroId)) != 0) ? skipIdBytes : NULL);
+}
+
+- (WSStorableBlock *)blockAtIndex:(uint32_t)index transactionsBlock:(WSStorableBlock *)transactionsBlock
+{
+    NSParameterAssert(index < self.endIndex);
+    NSParameterAssert(!self.removedFlags[index]);
+
+    return WSBlockRecordDecode(self.parameters,
+                               [self blockIdBytesAtIndex:index],
+                               self.headers + (size_t)index * WSHeaderTableHeaderLength,
+                               self.heights[index],
+                               WSUInt256Data(&self.works[index]),
+                               self.skipIds + (size_t)index * WSHash256Length,
+                               nil,
+                               transactionsBlock);
+}
+
+#pragma mark Modification
+
+- (uint32_t)putBlock:(WSStorableBlock *)block
+{
+    WSExceptionCheckIllegal(block);
+
+    WSHash256 *blockId = block.blockId;
+    uint32_t index = [self indexOfBlockIdBytes:blockId.bytes];
+    const BOOL isNew = (index == WSHeaderTableNoIndex);
+
+    if (isNew) {
+        WSExceptionCheck(self.endIndex < WSHeaderTableNoIndex - 1, NSInternalInconsistencyException, @"Header table is full");
+
+        if (self.endIndex == self.capacity) {
+            [self growToCapacity:(2 * self.capacity)];
+        }
+        index = self.endIndex;
+    }
+
+    WSBuffer *headerBuffer = [block.header toBuffer];
+    NSAssert(headerBuffer.length == WSBlockHeaderSize, @"Unexpected header length (%lu != %lu)",
+             (unsigned long)headerBuffer.length, (unsigned long)WSBlockHeaderSize);
+
+    memcpy(self.headers + (size_t)index * WSHeaderTableHeaderLength, headerBuffer.bytes, WSHeaderTableHeaderLength);
+    memcpy(self.blockIds + (size_t)index * WSHash256Length, blockId.bytes, WSHash256Length);
+    self.heights[index] = block.height;
+    WSUInt256SetData(&self.works[index], block.workData);
+    if (block.skipBlockId) {
+        memcpy(self.skipIds + (size_t)index * WSHash256Length, block.skipBlockId.bytes, WSHash256Length);
+    }
+    else {
+        memset(self.skipIds + (size_t)index * WSHash256Length, 0, WSHash256Length);
+    }
+    self.removedFlags[index] = 0;
+
+    if (isNew) {
+        ++self.endIndex;
+        ++self.count;
+        [self insertSlotForIndex:index];
+    }
+    return index;
+}
+
+- (void)removeEntryAtIndex:(uint32_t)index
+{
+    NSParameterAssert(index < self.endIndex);
+
+    if (self.removedFlags[index]) {
+        return;
+    }
+    const uint32_t slot = [self slotForBlockIdBytes:[self blockIdBytesAtIndex:index]];
+    NSAssert(slot != WSHeaderTableNoIndex, @"Entry %u not indexed", index);
+
+    self.slots[slot] = WSHeaderTableSlotRemoved;
+    self.removedFlags[index] = 1;
+    --self.count;
+}
+
+- (void)removeAllEntries
+{
+    self.count = 0;
+    self.endIndex = 0;
+    [self rebuildSlots];
+}
+
+- (BOOL)needsCompaction
+{
+    const NSUInteger removedCount = self.endIndex - self.count;
+
+    return ((removedCount >= WSHeaderTableMinCompaction) && (removedCount > self.count));
+}
+
+- (void)compactRemappingIndexes:(uint32_t *)indexes count:(NSUInteger)count
+{
+    DDLogDebug(@"Compacting header table (%lu live out of %u)", (unsigned long)self.count, self.endIndex);
+
+    uint32_t *remap = malloc(self.endIndex * sizeof(uint32_t));
+    uint32_t liveIndex = 0;
+    for (uint32_t i = 0; i < self.endIndex; ++i) {
+        if (self.removedFlags[i]) {
+            remap[i] = WSHeaderTableNoIndex;
+            continue;
+        }
+        if (liveIndex != i) {
+            memcpy(self.headers + (size_t)liveIndex * WSHeaderTableHeaderLength, self.headers + (size_t)i * WSHeaderTableHeaderLength, WSHeaderTableHeaderLength);
+            memcpy(self.blockIds + (size_t)liveIndex * WSHash256Length, self.blockIds + (size_t)i * WSHash256Length, WSHash256Length);
+            self.heights[liveIndex] = self.heights[i];
+            self.works[liveIndex] = self.works[i];
+            memcpy(self.skipIds + (size_t)liveIndex * WSHash256Length, self.skipIds + (size_t)i * WSHash256Length, WSHash256Length);
+            self.removedFlags[liveIndex] = 0;
+        }
+        remap[i] = liveIndex;
+        ++liveIndex;
+    }
+    NSAssert(liveIndex == self.count, @"Live entries mismatch (%u != %lu)", liveIndex, (unsigned long)self.count);
+
+    for (NSUInteger i = 0; i < count; ++i) {
+        if (indexes[i] != WSHeaderTableNoIndex) {
+            indexes[i] = remap[indexes[i]];
+        }
+    }
+    free(remap);
+
+    self.endIndex = liveIndex;
+    [self rebuildSlots];
+}
+
+#pragma mark Storage
+
+- (void)growToCapacity:(NSUInteger)capacity
+{
+    NSParameterAssert(capacity > self.capacity);
+
+    self.headers = reallocf(self.headers, capacity * WSHeaderTableHeaderLength);
+    self.blockIds = reallocf(self.blockIds, capacity * WSHash256Length);
+    self.heights = reallocf(self.heights, capacity * sizeof(uint32_t));
+    self.works = reallocf(self.works, capacity * sizeof(WSUInt256));
+    self.skipIds = reallocf(self.skipIds, capacity * WSHash256Length);
+    self.removedFlags = reallocf(self.removedFlags, capacity * sizeof(uint8_t));
+    WSExceptionCheck(self.headers && self.blockIds && self.heights && self.works && self.skipIds && self.removedFlags,
+                     NSMallocException, @"Unable to grow header table to %lu entries", (unsigned long)capacity);
+
+    self.capacity = capacity;
+}
+
+// keep load under 75%, removed slots dropped
+- (void)rebuildSlots
+{
+    NSUInteger slotCapacity = WSHeaderTableMinCapacity;
+    while (3 * slotCapacity < 4 * (self.count + 1)) {
+        slotCapacity <<= 1;
+    }
+    slotCapacity <<= 1;
+
+    free(self.slots);
+    self.slots = calloc(slotCapacity, sizeof(uint32_t));
+    WSExceptionCheck(self.slots, NSMallocException, @"Unable to allocate %lu header table slots", (unsigned long)slotCapacity);
+    self.slotCapacity = slotCapacity;
+    self.usedSlots = 0;
+
+    for (uint32_t i = 0; i < self.endIndex; ++i) {
+        if (!self.removedFlags[i]) {
+            [self insertSlotForIndex:i];
+        }
+    }
+}
+
+- (uint32_t)slotForBlockIdBytes:(const uint8_t *)blockIdBytes
+{
+    const uint32_t *slots = self.slots;
+    const NSUInteger mask = self.slotCapacity - 1;
+
+    // linear probing, table is never full
+    for (NSUInteger i = WSBlockRecordIdHash(blockIdBytes) & mask; ; i = (i + 1) & mask) {
+        const uint32_t value = slots[i];
+        if (value == WSHeaderTableSlotEmpty) {
+            return WSHeaderTableNoIndex;
+        }
+        if (value == WSHeaderTableSlotRemoved) {
+            continue;
+        }
+        if (memcmp(self.blockIds + (size_t)(value - 1) * WSHash256Length, blockIdBytes, WSHash256Length) == 0) {
+            return (uint32_t)i;
+        }
+    }
+}
+
+- (void)insertSlotForIndex:(uint32_t)index
+{
+    if (4 * (self.usedSlots + 1) > 3 * self.slotCapacity) {
+        [self rebuildSlots];
+
+        // entry was already indexed by the rebuild
+        return;
+    }
+
+    uint32_t *slots = self.slots;
+    const NSUInteger mask = self.slotCapacity - 1;
+
+    NSUInteger i = WSBlockRecordIdHash([self blockIdBytesAtIndex:index]) & mask;
+    while (slots[i] != WSHeaderTableSlotEmpty) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = index + 1;
+    ++self.usedSlots;
+}
+
+@end
+
+#pragma mark -
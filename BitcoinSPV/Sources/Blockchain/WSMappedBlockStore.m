@@ -0,0 +1,1121 @@
+//
+//  WSMappedBlockStore.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+
+#import "WSMappedBlockStore.h"
+#import "WSBlockRecord.h"
+#import "WSHash256.h"
+#import "WSStorableBlock.h"
+#import "WSBlockHeader.h"
+#import "WSFilteredBlock.h"
+#import "WSTransaction.h"
+#import "WSBuffer.h"
+#import "WSParameters.h"
+#import "WSBitcoinConstants.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+//
+// file layout: [header][record 0][record 1]...[record capacity - 1]
+//
+// records are appended and never moved except on compaction, which
+// only happens when removed records outnumber live records
+//
+// the index file is an open-addressing hash table of record indexes,
+// rebuilt from the records whenever it's found out of sync: both headers
+// carry a generation bumped on every sync, and the store is flagged dirty
+// while open so that a crash forces a rebuild on next open
+//
+// transactions are appended to a separate log of [entry][tx length][tx]...,
+// where an empty entry drops the previous ones of the same block, and the
+// log is rewritten once dead entries outweigh live ones. blocks whose
+// transactions are still lazily loaded are not written until put again
+// with loaded transactions
+//
+
+static const uint32_t WSMappedBlockStoreMagic               = 0x424d5357; // 'WSMB'
+static const uint32_t WSMappedBlockStoreIndexMagic          = 0x494d5357; // 'WSMI'
+static const uint32_t WSMappedBlockStoreTransactionsMagic   = 0x544d5357; // 'WSMT'
+static const uint32_t WSMappedBlockStoreVersion             = 1;
+static const uint32_t WSMappedBlockStoreMinCapacity         = 4096;
+static const uint32_t WSMappedBlockStoreMinIndexCapacity    = 8192;
+static const uint32_t WSMappedBlockStoreMinCompaction       = 1024;
+static const off_t WSMappedBlockStoreMinTransactionsCompaction  = 256 * 1024;
+static const uint32_t WSMappedBlockStoreNoRecord            = UINT32_MAX;
+
+static const uint32_t WSMappedBlockStoreFlagCompacting      = 0x1;
+static const uint32_t WSMappedBlockStoreFlagDirty           = 0x2;
+static const uint32_t WSMappedRecordFlagRemoved             = 0x1;
+
+static const uint32_t WSMappedIndexSlotEmpty                = 0;
+static const uint32_t WSMappedIndexSlotRemoved              = UINT32_MAX;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t flags;
+    uint32_t capacity;
+    uint32_t count;         // appended records, including removed
+    uint32_t liveCount;
+    uint32_t headIndex;
+    uint32_t tailIndex;
+    uint32_t generation;    // last synced, matches index
+    uint32_t reserved[2];
+    uint8_t genesisId[32];
+    uint8_t padding[48];
+} WSMappedFileHeader;
+
+typedef struct {
+    uint8_t blockId[32];
+    uint8_t header[80];
+    uint32_t height;
+    uint32_t flags;
+    uint8_t work[32];       // big endian
+    uint8_t skipId[32];     // zero if none
+    uint8_t reserved[8];
+} WSMappedRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;      // power of 2
+    uint32_t used;          // occupied and removed slots
+    uint32_t recordCount;   // file count when last in sync
+    uint32_t generation;    // file generation when last in sync
+    uint32_t reserved[2];
+} WSMappedIndexHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} WSMappedTransactionsHeader;
+
+typedef struct {
+    uint8_t blockId[32];
+    uint32_t length;        // following tx bytes, 0 if transactions were removed
+} WSMappedTransactionsEntry;
+
+_Static_assert(sizeof(WSMappedFileHeader) == 128, "Unexpected WSMappedFileHeader size");
+_Static_assert(sizeof(WSMappedRecord) == 192, "Unexpected WSMappedRecord size");
+_Static_assert(sizeof(WSMappedIndexHeader) == 32, "Unexpected WSMappedIndexHeader size");
+_Static_assert(sizeof(WSMappedTransactionsEntry) == 36, "Unexpected WSMappedTransactionsEntry size");
+
+static BOOL WSMappedRegionResize(int fd, uint8_t **bytes, size_t *length, size_t newLength, NSError **error);
+static void WSMappedRegionUnmap(uint8_t **bytes, size_t *length);
+static void WSMappedErrorSetPOSIX(NSError **error);
+
+@interface WSMappedBlockStore ()
+
+@property (nonatomic, strong) WSFilteredBlock *genesisBlock;
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, copy) NSString *indexPath;
+@property (nonatomic, copy) NSString *transactionsPath;
+@property (nonatomic, assign) BOOL isOpen;
+@property (nonatomic, assign) int fileDescriptor;
+@property (nonatomic, assign) int indexFileDescriptor;
+@property (nonatomic, assign) int transactionsFileDescriptor;
+@property (nonatomic, assign) off_t transactionsLength;
+@property (nonatomic, assign) off_t transactionsGarbageLength;
+@property (nonatomic, assign) uint8_t *fileBytes;
+@property (nonatomic, assign) size_t fileLength;
+@property (nonatomic, assign) uint8_t *indexBytes;
+@property (nonatomic, assign) size_t indexLength;
+@property (nonatomic, strong) WSStorableBlock *cachedHead;
+@property (nonatomic, strong) NSMutableDictionary *transactionOffsetsById; // WSHash256 -> NSNumber (entry offset in transactions log)
+@property (nonatomic, strong) NSMutableDictionary *lazyBlocksById;          // WSHash256 -> WSStorableBlock (transactions source)
+
+- (BOOL)openWithError:(NSError **)error;
+- (BOOL)resetWithError:(NSError **)error;
+- (BOOL)isValidFileHeader:(const WSMappedFileHeader *)fileHeader error:(NSError **)error;
+- (BOOL)isValidIndex;
+- (BOOL)growFileWithError:(NSError **)error;
+- (BOOL)rebuildIndexWithCapacity:(uint32_t)capacity error:(NSError **)error;
+- (void)compact;
+
+- (WSMappedFileHeader *)fileHeader;
+- (WSMappedRecord *)recordAtIndex:(uint32_t)recordIndex;
+- (WSMappedIndexHeader *)indexHeader;
+- (uint32_t *)indexSlots;
+- (uint32_t)recordIndexForIdBytes:(const uint8_t *)blockIdBytes slot:(uint32_t *)slot;
+- (void)insertRecordIndex:(uint32_t)recordIndex;
+- (void)writeBlock:(WSStorableBlock *)block toRecord:(WSMappedRecord *)record;
+- (WSStorableBlock *)blockFromRecordAtIndex:(uint32_t)recordIndex;
+- (uint32_t)nextRecordIndexForTailIndex:(uint32_t)tailIndex;
+
+- (BOOL)loadTransactionsWithError:(NSError **)error;
+- (BOOL)resetTransactionsWithError:(NSError **)error;
+- (NSOrderedSet *)transactionsForBlockId:(WSHash256 *)blockId;
+- (void)writeTransactions:(NSOrderedSet *)transactions forBlockId:(WSHash256 *)blockId;
+- (off_t)transactionsEntryLengthAtOffset:(off_t)offset;
+- (void)compactTransactions;
+
+@end
+
+@implementation WSMappedBlockStore
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithParameters:path:error:");
+    return nil;
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters path:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(parameters);
+    WSExceptionCheckIllegal(path);
+
+    if ((self = [super init])) {
+        self.genesisBlock = [parameters genesisBlock];
+        self.path = path;
+        self.indexPath = [path stringByAppendingString:@"-index"];
+        self.transactionsPath = [path stringByAppendingString:@"-transactions"];
+        self.fileDescriptor = -1;
+        self.indexFileDescriptor = -1;
+        self.transactionsFileDescriptor = -1;
+        self.transactionOffsetsById = [[NSMutableDictionary alloc] init];
+        self.lazyBlocksById = [[NSMutableDictionary alloc] init];
+
+        if (![self openWithError:error]) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self synchronize];
+
+    // closed cleanly, index can be trusted on next open
+    if (self.isOpen) {
+        self.fileHeader->flags &= ~WSMappedBlockStoreFlagDirty;
+        msync(self.fileBytes, sizeof(WSMappedFileHeader), MS_SYNC);
+    }
+
+    uint8_t *bytes = self.fileBytes;
+    size_t length = self.fileLength;
+    WSMappedRegionUnmap(&bytes, &length);
+    bytes = self.indexBytes;
+    length = self.indexLength;
+    WSMappedRegionUnmap(&bytes, &length);
+
+    if (self.fileDescriptor >= 0) {
+        close(self.fileDescriptor);
+    }
+    if (self.indexFileDescriptor >= 0) {
+        close(self.indexFileDescriptor);
+    }
+    if (self.transactionsFileDescriptor >= 0) {
+        close(self.transactionsFileDescriptor);
+    }
+}
+
+- (void)synchronize
+{
+    if (!self.isOpen) {
+        return;
+    }
+
+    // index first, a crash before the file is synced leaves generations mismatched
+    const uint32_t generation = self.fileHeader->generation + 1;
+    self.indexHeader->generation = generation;
+    msync(self.indexBytes, self.indexLength, MS_SYNC);
+    self.fileHeader->generation = generation;
+    msync(self.fileBytes, self.fileLength, MS_SYNC);
+
+    if (self.transactionsFileDescriptor >= 0) {
+        fsync(self.transactionsFileDescriptor);
+    }
+}
+
+#pragma mark WSBlockStore
+
+- (WSParameters *)parameters
+{
+    return self.genesisBlock.parameters;
+}
+
+- (WSStorableBlock *)blockForId:(WSHash256 *)blockId
+{
+    WSExceptionCheckIllegal(blockId);
+
+    if ([blockId isEqual:self.cachedHead.blockId]) {
+        return self.cachedHead;
+    }
+    const uint32_t recordIndex = [self recordIndexForIdBytes:blockId.bytes slot:NULL];
+    if (recordIndex == WSMappedBlockStoreNoRecord) {
+        return nil;
+    }
+    return [self blockFromRecordAtIndex:recordIndex];
+}
+
+- (BOOL)containsBlockIdBytes:(const uint8_t *)blockIdBytes
+{
+    NSParameterAssert(blockIdBytes);
+
+    return ([self recordIndexForIdBytes:blockIdBytes slot:NULL] != WSMappedBlockStoreNoRecord);
+}
+
+- (void)putBlock:(WSStorableBlock *)block
+{
+    WSExceptionCheckIllegal(block);
+
+    WSHash256 *blockId = block.blockId;
+    uint32_t recordIndex = [self recordIndexForIdBytes:blockId.bytes slot:NULL];
+
+    if (recordIndex == WSMappedBlockStoreNoRecord) {
+        if (self.fileHeader->count == self.fileHeader->capacity) {
+            NSError *error;
+            WSExceptionCheck([self growFileWithError:&error], NSInternalInconsistencyException, @"Unable to grow block store (%@)", error);
+        }
+
+        WSMappedFileHeader *fileHeader = self.fileHeader;
+        recordIndex = fileHeader->count;
+        [self writeBlock:block toRecord:[self recordAtIndex:recordIndex]];
+        [self insertRecordIndex:recordIndex];
+
+        // commit record only after index is updated
+        ++fileHeader->count;
+        ++fileHeader->liveCount;
+        self.indexHeader->recordCount = fileHeader->count;
+    }
+    else {
+        [self writeBlock:block toRecord:[self recordAtIndex:recordIndex]];
+    }
+
+    // pending lazy loads are kept pending, see takeTransactionsFromBlock:
+    if ([block hasLoadedTransactions]) {
+        [self writeTransactions:block.transactions forBlockId:blockId];
+        [self.lazyBlocksById removeObjectForKey:blockId];
+    }
+    else {
+        [self writeTransactions:nil forBlockId:blockId];
+        self.lazyBlocksById[blockId] = block;
+    }
+    if ([blockId isEqual:self.cachedHead.blockId]) {
+        self.cachedHead = block;
+    }
+}
+
+- (WSStorableBlock *)head
+{
+    return self.cachedHead;
+}
+
+- (void)setHead:(WSStorableBlock *)head
+{
+    WSExceptionCheckIllegal(head);
+
+    uint32_t recordIndex = [self recordIndexForIdBytes:head.blockId.bytes slot:NULL];
+    if (recordIndex == WSMappedBlockStoreNoRecord) {
+        [self putBlock:head];
+        recordIndex = [self recordIndexForIdBytes:head.blockId.bytes slot:NULL];
+    }
+    self.fileHeader->headIndex = recordIndex;
+    self.cachedHead = head;
+}
+
+- (void)removeTail
+{
+    WSMappedFileHeader *fileHeader = self.fileHeader;
+    NSAssert(fileHeader->liveCount > 0, @"Empty blocks");
+
+    const uint32_t tailIndex = fileHeader->tailIndex;
+    NSAssert(tailIndex != WSMappedBlockStoreNoRecord, @"Tail is nil, store truncated without resetting?");
+
+    const uint32_t newTailIndex = [self nextRecordIndexForTailIndex:tailIndex];
+
+    WSMappedRecord *record = [self recordAtIndex:tailIndex];
+    uint32_t slot;
+    [self recordIndexForIdBytes:record->blockId slot:&slot];
+    self.indexSlots[slot] = WSMappedIndexSlotRemoved;
+    record->flags |= WSMappedRecordFlagRemoved;
+    --fileHeader->liveCount;
+
+    WSHash256 *tailId = WSHash256FromData([NSData dataWithBytes:record->blockId length:WSHash256Length]);
+    [self writeTransactions:nil forBlockId:tailId];
+    [self.lazyBlocksById removeObjectForKey:tailId];
+    fileHeader->tailIndex = newTailIndex;
+
+    const uint32_t removedCount = fileHeader->count - fileHeader->liveCount;
+    if ((removedCount >= WSMappedBlockStoreMinCompaction) && (removedCount > fileHeader->liveCount)) {
+        [self compact];
+    }
+}
+
+- (void)findAndRestoreTail
+{
+    WSMappedFileHeader *fileHeader = self.fileHeader;
+
+    fileHeader->tailIndex = WSBlockRecordFindTail(fileHeader->headIndex, WSMappedBlockStoreNoRecord, ^uint32_t(uint32_t recordIndex) {
+        return [self recordIndexForIdBytes:WSBlockRecordPreviousIdBytes([self recordAtIndex:recordIndex]->header) slot:NULL];
+    });
+}
+
+- (NSArray *)allBlocks
+{
+    const WSMappedFileHeader *fileHeader = self.fileHeader;
+
+    NSMutableArray *blocks = [[NSMutableArray alloc] initWithCapacity:fileHeader->liveCount];
+    for (uint32_t i = 0; i < fileHeader->count; ++i) {
+        if ([self recordAtIndex:i]->flags & WSMappedRecordFlagRemoved) {
+            continue;
+        }
+        [blocks addObject:[self blockFromRecordAtIndex:i]];
+    }
+    return blocks;
+}
+
+- (NSUInteger)size
+{
+    return self.fileHeader->liveCount;
+}
+
+- (void)truncate
+{
+    NSError *error;
+    WSExceptionCheck([self resetWithError:&error], NSInternalInconsistencyException, @"Unable to truncate block store (%@)", error);
+}
+
+#pragma mark Mapping
+
+- (BOOL)openWithError:(NSError *__autoreleasing *)error
+{
+    self.fileDescriptor = open(self.path.fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if (self.fileDescriptor < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    self.indexFileDescriptor = open(self.indexPath.fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if (self.indexFileDescriptor < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    self.transactionsFileDescriptor = open(self.transactionsPath.fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if (self.transactionsFileDescriptor < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+
+    struct stat fileStat;
+    if (fstat(self.fileDescriptor, &fileStat) < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    if (fileStat.st_size == 0) {
+        DDLogDebug(@"Creating block store at %@", self.path);
+        if (![self resetWithError:error]) {
+            return NO;
+        }
+        self.isOpen = YES;
+        return YES;
+    }
+    if ((size_t)fileStat.st_size < sizeof(WSMappedFileHeader)) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store file too short (%lld bytes)", (long long)fileStat.st_size);
+        return NO;
+    }
+
+    WSMappedFileHeader fileHeader;
+    if (pread(self.fileDescriptor, &fileHeader, sizeof(fileHeader), 0) != sizeof(fileHeader)) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    if (![self isValidFileHeader:&fileHeader error:error]) {
+        return NO;
+    }
+    const size_t fileLength = sizeof(WSMappedFileHeader) + (size_t)fileHeader.capacity * sizeof(WSMappedRecord);
+    if ((size_t)fileStat.st_size < fileLength) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store file truncated (%lld < %lu bytes)", (long long)fileStat.st_size, (unsigned long)fileLength);
+        return NO;
+    }
+
+    uint8_t *bytes = NULL;
+    size_t length = 0;
+    if (!WSMappedRegionResize(self.fileDescriptor, &bytes, &length, fileLength, error)) {
+        return NO;
+    }
+    self.fileBytes = bytes;
+    self.fileLength = length;
+
+    if (fstat(self.indexFileDescriptor, &fileStat) < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    if ((size_t)fileStat.st_size >= sizeof(WSMappedIndexHeader)) {
+        bytes = NULL;
+        length = 0;
+        if (!WSMappedRegionResize(self.indexFileDescriptor, &bytes, &length, (size_t)fileStat.st_size, error)) {
+            return NO;
+        }
+        self.indexBytes = bytes;
+        self.indexLength = length;
+    }
+    if (self.fileHeader->flags & WSMappedBlockStoreFlagDirty) {
+        DDLogDebug(@"Block store was not closed cleanly, rebuilding index");
+
+        if (![self rebuildIndexWithCapacity:0 error:error]) {
+            return NO;
+        }
+    }
+    else if (![self isValidIndex]) {
+        DDLogDebug(@"Block store index out of sync, rebuilding");
+
+        if (![self rebuildIndexWithCapacity:0 error:error]) {
+            return NO;
+        }
+    }
+
+    const uint32_t headIndex = self.fileHeader->headIndex;
+    if (headIndex >= self.fileHeader->count) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store head out of bounds (%u >= %u)", headIndex, self.fileHeader->count);
+        return NO;
+    }
+    if (![self loadTransactionsWithError:error]) {
+        return NO;
+    }
+    self.cachedHead = [self blockFromRecordAtIndex:headIndex];
+
+    // cleared on clean close
+    self.fileHeader->flags |= WSMappedBlockStoreFlagDirty;
+    msync(self.fileBytes, sizeof(WSMappedFileHeader), MS_SYNC);
+    self.isOpen = YES;
+
+    DDLogDebug(@"Loaded block store with %u blocks (head: %u)", self.fileHeader->liveCount, self.cachedHead.height);
+    return YES;
+}
+
+- (BOOL)resetWithError:(NSError *__autoreleasing *)error
+{
+    uint8_t *bytes = self.fileBytes;
+    size_t length = self.fileLength;
+    WSMappedRegionUnmap(&bytes, &length);
+    self.fileBytes = NULL;
+    self.fileLength = 0;
+
+    // drop stale records before remapping
+    if (ftruncate(self.fileDescriptor, 0) < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    const size_t fileLength = sizeof(WSMappedFileHeader) + (size_t)WSMappedBlockStoreMinCapacity * sizeof(WSMappedRecord);
+    if (!WSMappedRegionResize(self.fileDescriptor, &bytes, &length, fileLength, error)) {
+        return NO;
+    }
+    self.fileBytes = bytes;
+    self.fileLength = length;
+
+    WSMappedFileHeader *fileHeader = self.fileHeader;
+    fileHeader->magic = WSMappedBlockStoreMagic;
+    fileHeader->version = WSMappedBlockStoreVersion;
+    fileHeader->recordSize = sizeof(WSMappedRecord);
+    fileHeader->flags = WSMappedBlockStoreFlagDirty;
+    fileHeader->capacity = WSMappedBlockStoreMinCapacity;
+    fileHeader->count = 0;
+    fileHeader->liveCount = 0;
+    fileHeader->headIndex = WSMappedBlockStoreNoRecord;
+    fileHeader->tailIndex = WSMappedBlockStoreNoRecord;
+    fileHeader->generation = 0;
+    memcpy(fileHeader->genesisId, self.genesisBlock.header.blockId.bytes, WSHash256Length);
+
+    if (![self rebuildIndexWithCapacity:0 error:error]) {
+        return NO;
+    }
+
+    if (![self resetTransactionsWithError:error]) {
+        return NO;
+    }
+    self.cachedHead = nil;
+    [self.lazyBlocksById removeAllObjects];
+
+    WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:self.genesisBlock.header transactions:nil height:0];
+    [self putBlock:block];
+    self.head = block;
+    fileHeader->tailIndex = fileHeader->headIndex;
+
+    return YES;
+}
+
+- (BOOL)isValidFileHeader:(const WSMappedFileHeader *)fileHeader error:(NSError *__autoreleasing *)error
+{
+    if ((fileHeader->magic != WSMappedBlockStoreMagic) || (fileHeader->recordSize != sizeof(WSMappedRecord))) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Not a block store file");
+        return NO;
+    }
+    if (fileHeader->version != WSMappedBlockStoreVersion) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unsupported block store version (%u != %u)", fileHeader->version, WSMappedBlockStoreVersion);
+        return NO;
+    }
+    if (fileHeader->flags & WSMappedBlockStoreFlagCompacting) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store interrupted while compacting");
+        return NO;
+    }
+    if ((fileHeader->count > fileHeader->capacity) || (fileHeader->liveCount > fileHeader->count) || (fileHeader->liveCount == 0)) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Inconsistent block store counters (%u/%u/%u)",
+                   fileHeader->liveCount, fileHeader->count, fileHeader->capacity);
+        return NO;
+    }
+    if (memcmp(fileHeader->genesisId, self.genesisBlock.header.blockId.bytes, WSHash256Length) != 0) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store belongs to a different network");
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)isValidIndex
+{
+    if (self.indexLength < sizeof(WSMappedIndexHeader)) {
+        return NO;
+    }
+    const WSMappedIndexHeader *indexHeader = self.indexHeader;
+    const uint32_t capacity = indexHeader->capacity;
+    return ((indexHeader->magic == WSMappedBlockStoreIndexMagic) &&
+            (indexHeader->version == WSMappedBlockStoreVersion) &&
+            (capacity > 0) && ((capacity & (capacity - 1)) == 0) &&
+            (self.indexLength >= sizeof(WSMappedIndexHeader) + (size_t)capacity * sizeof(uint32_t)) &&
+            (indexHeader->recordCount == self.fileHeader->count) &&
+            (indexHeader->generation == self.fileHeader->generation));
+}
+
+- (BOOL)growFileWithError:(NSError *__autoreleasing *)error
+{
+    const uint32_t capacity = self.fileHeader->capacity * 2;
+    NSAssert(capacity > self.fileHeader->capacity, @"Block store capacity overflow");
+
+    uint8_t *bytes = self.fileBytes;
+    size_t length = self.fileLength;
+    const BOOL success = WSMappedRegionResize(self.fileDescriptor, &bytes, &length, sizeof(WSMappedFileHeader) + (size_t)capacity * sizeof(WSMappedRecord), error);
+    self.fileBytes = bytes;
+    self.fileLength = length;
+    if (!success) {
+        return NO;
+    }
+    self.fileHeader->capacity = capacity;
+    return YES;
+}
+
+//
+// capacity == 0 picks the smallest power of 2 keeping load under 50%
+//
+- (BOOL)rebuildIndexWithCapacity:(uint32_t)capacity error:(NSError *__autoreleasing *)error
+{
+    const WSMappedFileHeader *fileHeader = self.fileHeader;
+
+    if (capacity == 0) {
+        capacity = WSMappedBlockStoreMinIndexCapacity;
+        while (capacity < 2 * fileHeader->liveCount) {
+            capacity *= 2;
+        }
+    }
+
+    uint8_t *bytes = self.indexBytes;
+    size_t length = self.indexLength;
+    WSMappedRegionUnmap(&bytes, &length);
+    self.indexBytes = NULL;
+    self.indexLength = 0;
+
+    if (ftruncate(self.indexFileDescriptor, 0) < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    if (!WSMappedRegionResize(self.indexFileDescriptor, &bytes, &length, sizeof(WSMappedIndexHeader) + (size_t)capacity * sizeof(uint32_t), error)) {
+        return NO;
+    }
+    self.indexBytes = bytes;
+    self.indexLength = length;
+
+    WSMappedIndexHeader *indexHeader = self.indexHeader;
+    indexHeader->magic = WSMappedBlockStoreIndexMagic;
+    indexHeader->version = WSMappedBlockStoreVersion;
+    indexHeader->capacity = capacity;
+    indexHeader->used = 0;
+
+    for (uint32_t i = 0; i < fileHeader->count; ++i) {
+        if ([self recordAtIndex:i]->flags & WSMappedRecordFlagRemoved) {
+            continue;
+        }
+        [self insertRecordIndex:i];
+    }
+    indexHeader->recordCount = fileHeader->count;
+    indexHeader->generation = fileHeader->generation;
+
+    return YES;
+}
+
+//
+// moves live records to the front preserving their order, a crash
+// in between leaves the compacting flag set and the store unusable
+//
+- (void)compact
+{
+    WSMappedFileHeader *fileHeader = self.fileHeader;
+    DDLogDebug(@"Compacting block store (%u live out of %u)", fileHeader->liveCount, fileHeader->count);
+
+    fileHeader->flags |= WSMappedBlockStoreFlagCompacting;
+    msync(self.fileBytes, sizeof(WSMappedFileHeader), MS_SYNC);
+
+    uint32_t headIndex = WSMappedBlockStoreNoRecord;
+    uint32_t tailIndex = WSMappedBlockStoreNoRecord;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < fileHeader->count; ++i) {
+        const WSMappedRecord *record = [self recordAtIndex:i];
+        if (record->flags & WSMappedRecordFlagRemoved) {
+            continue;
+        }
+        if (i == fileHeader->headIndex) {
+            headIndex = count;
+        }
+        if (i == fileHeader->tailIndex) {
+            tailIndex = count;
+        }
+        if (count != i) {
+            memcpy([self recordAtIndex:count], record, sizeof(WSMappedRecord));
+        }
+        ++count;
+    }
+    NSAssert(count == fileHeader->liveCount, @"Live records mismatch (%u != %u)", count, fileHeader->liveCount);
+
+    fileHeader->count = count;
+    fileHeader->headIndex = headIndex;
+    fileHeader->tailIndex = tailIndex;
+
+    NSError *error;
+    WSExceptionCheck([self rebuildIndexWithCapacity:0 error:&error], NSInternalInconsistencyException, @"Unable to rebuild block store index (%@)", error);
+
+    msync(self.fileBytes, self.fileLength, MS_SYNC);
+    fileHeader->flags &= ~WSMappedBlockStoreFlagCompacting;
+}
+
+#pragma mark Records
+
+- (WSMappedFileHeader *)fileHeader
+{
+    return (WSMappedFileHeader *)self.fileBytes;
+}
+
+- (WSMappedRecord *)recordAtIndex:(uint32_t)recordIndex
+{
+    return (WSMappedRecord *)(self.fileBytes + sizeof(WSMappedFileHeader)) + recordIndex;
+}
+
+- (WSMappedIndexHeader *)indexHeader
+{
+    return (WSMappedIndexHeader *)self.indexBytes;
+}
+
+- (uint32_t *)indexSlots
+{
+    return (uint32_t *)(self.indexBytes + sizeof(WSMappedIndexHeader));
+}
+
+- (uint32_t)recordIndexForIdBytes:(const uint8_t *)blockIdBytes slot:(uint32_t *)slot
+{
+    NSParameterAssert(blockIdBytes);
+
+    const uint32_t *slots = self.indexSlots;
+    const uint32_t mask = self.indexHeader->capacity - 1;
+
+    // linear probing, table is never full
+    for (uint32_t i = WSBlockRecordIdHash(blockIdBytes) & mask; ; i = (i + 1) & mask) {
+        const uint32_t value = slots[i];
+        if (value == WSMappedIndexSlotEmpty) {
+            return WSMappedBlockStoreNoRecord;
+        }
+        if (value == WSMappedIndexSlotRemoved) {
+            continue;
+        }
+        const uint32_t recordIndex = value - 1;
+        if (memcmp([self recordAtIndex:recordIndex]->blockId, blockIdBytes, WSHash256Length) == 0) {
+            if (slot) {
+                *slot = i;
+            }
+            return recordIndex;
+        }
+    }
+}
+
+- (void)insertRecordIndex:(uint32_t)recordIndex
+{
+    WSMappedIndexHeader *indexHeader = self.indexHeader;
+
+    // keep load under 75%, removed slots included
+    if (4 * (indexHeader->used + 1) > 3 * indexHeader->capacity) {
+        NSError *error;
+        WSExceptionCheck([self rebuildIndexWithCapacity:0 error:&error], NSInternalInconsistencyException, @"Unable to rebuild block store index (%@)", error);
+        indexHeader = self.indexHeader;
+
+        // record was already indexed by the rebuild
+        if (recordIndex < self.fileHeader->count) {
+            return;
+        }
+    }
+
+    uint32_t *slots = self.indexSlots;
+    const uint32_t mask = indexHeader->capacity - 1;
+
+    uint32_t i = WSBlockRecordIdHash([self recordAtIndex:recordIndex]->blockId) & mask;
+    while (slots[i] != WSMappedIndexSlotEmpty) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = recordIndex + 1;
+    ++indexHeader->used;
+}
+
+- (void)writeBlock:(WSStorableBlock *)block toRecord:(WSMappedRecord *)record
+{
+    NSParameterAssert(block);
+    NSParameterAssert(record);
+
+    WSBuffer *headerBuffer = [block.header toBuffer];
+    NSAssert(headerBuffer.length == WSBlockHeaderSize, @"Unexpected header length (%lu != %lu)",
+             (unsigned long)headerBuffer.length, (unsigned long)WSBlockHeaderSize);
+
+    memcpy(record->blockId, block.blockId.bytes, WSHash256Length);
+    memcpy(record->header, headerBuffer.bytes, sizeof(record->header));
+    record->height = CFSwapInt32HostToLittle(block.height);
+    record->flags = 0;
+
+    NSData *workData = block.workData;
+    NSAssert(workData.length <= sizeof(record->work), @"Work exceeds 256 bits");
+    memset(record->work, 0, sizeof(record->work));
+    memcpy(record->work + sizeof(record->work) - workData.length, workData.bytes, workData.length);
+
+    WSHash256 *skipBlockId = block.skipBlockId;
+    if (skipBlockId) {
+        memcpy(record->skipId, skipBlockId.bytes, WSHash256Length);
+    }
+    else {
+        memset(record->skipId, 0, sizeof(record->skipId));
+    }
+}
+
+- (WSStorableBlock *)blockFromRecordAtIndex:(uint32_t)recordIndex
+{
+    const WSMappedRecord *record = [self recordAtIndex:recordIndex];
+    NSOrderedSet *transactions = nil;
+    WSStorableBlock *transactionsBlock = nil;
+    if ((self.transactionOffsetsById.count > 0) || (self.lazyBlocksById.count > 0)) {
+        WSHash256 *blockId = WSHash256FromData([NSData dataWithBytes:record->blockId length:WSHash256Length]);
+        transactionsBlock = self.lazyBlocksById[blockId];
+        if (!transactionsBlock) {
+            transactions = [self transactionsForBlockId:blockId];
+        }
+    }
+
+    return WSBlockRecordDecode(self.parameters,
+                               record->blockId,
+                               record->header,
+                               CFSwapInt32LittleToHost(record->height),
+                               [NSData dataWithBytes:record->work length:sizeof(record->work)],
+                               record->skipId,
+                               transactions,
+                               transactionsBlock);
+}
+
+// first child may be on a side branch, see WSBlockRecordAncestorIndex()
+- (uint32_t)nextRecordIndexForTailIndex:(uint32_t)tailIndex
+{
+    const uint32_t height = CFSwapInt32LittleToHost([self recordAtIndex:tailIndex]->height) + 1;
+
+    return WSBlockRecordAncestorIndex(self.fileHeader->headIndex, height, WSMappedBlockStoreNoRecord, ^uint32_t(uint32_t recordIndex) {
+        return CFSwapInt32LittleToHost([self recordAtIndex:recordIndex]->height);
+    }, ^uint32_t(uint32_t recordIndex) {
+        return [self recordIndexForIdBytes:WSBlockRecordPreviousIdBytes([self recordAtIndex:recordIndex]->header) slot:NULL];
+    }, ^uint32_t(uint32_t recordIndex) {
+        static const uint8_t zeroId[32];
+        const uint8_t *skipIdBytes = [self recordAtIndex:recordIndex]->skipId;
+        if (memcmp(skipIdBytes, zeroId, sizeof(zeroId)) == 0) {
+            return WSMappedBlockStoreNoRecord;
+        }
+        return [self recordIndexForIdBytes:skipIdBytes slot:NULL];
+    });
+}
+
+#pragma mark Transactions
+
+- (BOOL)loadTransactionsWithError:(NSError *__autoreleasing *)error
+{
+    NSData *data = [NSData dataWithContentsOfFile:self.transactionsPath options:NSDataReadingMappedIfSafe error:error];
+    if (!data) {
+        return NO;
+    }
+    if (data.length == 0) {
+        return [self resetTransactionsWithError:error];
+    }
+
+    WSMappedTransactionsHeader header;
+    if (data.length < sizeof(header)) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Transactions file too short (%lu bytes)", (unsigned long)data.length);
+        return NO;
+    }
+    memcpy(&header, data.bytes, sizeof(header));
+    if ((header.magic != WSMappedBlockStoreTransactionsMagic) || (header.version != WSMappedBlockStoreVersion)) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unexpected transactions file header (%x, %u)", header.magic, header.version);
+        return NO;
+    }
+
+    [self.transactionOffsetsById removeAllObjects];
+    self.transactionsGarbageLength = 0;
+
+    const uint8_t *bytes = data.bytes;
+    off_t offset = sizeof(header);
+    while (offset + (off_t)sizeof(WSMappedTransactionsEntry) <= (off_t)data.length) {
+        WSMappedTransactionsEntry entry;
+        memcpy(&entry, bytes + offset, sizeof(entry));
+
+        const off_t entryLength = sizeof(entry) + CFSwapInt32LittleToHost(entry.length);
+        if (offset + entryLength > (off_t)data.length) {
+            break;
+        }
+
+        WSHash256 *blockId = WSHash256FromData([NSData dataWithBytes:entry.blockId length:WSHash256Length]);
+        NSNumber *previousOffset = self.transactionOffsetsById[blockId];
+        if (previousOffset) {
+            self.transactionsGarbageLength += [self transactionsEntryLengthAtOffset:[previousOffset longLongValue]];
+        }
+        if (entry.length > 0) {
+            self.transactionOffsetsById[blockId] = @(offset);
+        }
+        else {
+            [self.transactionOffsetsById removeObjectForKey:blockId];
+            self.transactionsGarbageLength += entryLength;
+        }
+        offset += entryLength;
+    }
+
+    // interrupted append
+    if (offset < (off_t)data.length) {
+        DDLogWarn(@"Discarding truncated transactions entry at offset %lld", (long long)offset);
+
+        if (ftruncate(self.transactionsFileDescriptor, offset) < 0) {
+            WSMappedErrorSetPOSIX(error);
+            return NO;
+        }
+    }
+    self.transactionsLength = offset;
+
+    DDLogDebug(@"Loaded transactions of %lu blocks", (unsigned long)self.transactionOffsetsById.count);
+    return YES;
+}
+
+- (BOOL)resetTransactionsWithError:(NSError *__autoreleasing *)error
+{
+    if (ftruncate(self.transactionsFileDescriptor, 0) < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+
+    WSMappedTransactionsHeader header;
+    header.magic = WSMappedBlockStoreTransactionsMagic;
+    header.version = WSMappedBlockStoreVersion;
+    if (pwrite(self.transactionsFileDescriptor, &header, sizeof(header), 0) != sizeof(header)) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+
+    [self.transactionOffsetsById removeAllObjects];
+    self.transactionsLength = sizeof(header);
+    self.transactionsGarbageLength = 0;
+    return YES;
+}
+
+- (NSOrderedSet *)transactionsForBlockId:(WSHash256 *)blockId
+{
+    NSNumber *offset = self.transactionOffsetsById[blockId];
+    if (!offset) {
+        return nil;
+    }
+
+    const off_t dataOffset = [offset longLongValue] + sizeof(WSMappedTransactionsEntry);
+    const off_t dataLength = [self transactionsEntryLengthAtOffset:[offset longLongValue]] - sizeof(WSMappedTransactionsEntry);
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:(NSUInteger)dataLength];
+    if (pread(self.transactionsFileDescriptor, data.mutableBytes, data.length, dataOffset) != (ssize_t)data.length) {
+        DDLogError(@"Unable to read transactions of block %@ (%s)", blockId, strerror(errno));
+        return nil;
+    }
+
+    WSBuffer *buffer = [[WSBuffer alloc] initWithData:data];
+    NSMutableOrderedSet *transactions = [[NSMutableOrderedSet alloc] init];
+    NSUInteger txOffset = 0;
+    while (txOffset + sizeof(uint32_t) <= data.length) {
+        uint32_t txLength;
+        memcpy(&txLength, (const uint8_t *)data.bytes + txOffset, sizeof(txLength));
+        txLength = CFSwapInt32LittleToHost(txLength);
+        txOffset += sizeof(txLength);
+        if (txOffset + txLength > data.length) {
+            DDLogError(@"Truncated transaction in block %@", blockId);
+            break;
+        }
+
+        NSError *error;
+        WSSignedTransaction *tx = [[WSSignedTransaction alloc] initWithParameters:self.parameters buffer:buffer from:txOffset available:txLength error:&error];
+        if (tx) {
+            [transactions addObject:tx];
+        }
+        else {
+            DDLogError(@"Skipping malformed transaction in block %@ (%@)", blockId, error);
+        }
+        txOffset += txLength;
+    }
+    return transactions;
+}
+
+// empty transactions only drop previous entries of the block, if any
+- (void)writeTransactions:(NSOrderedSet *)transactions forBlockId:(WSHash256 *)blockId
+{
+    NSNumber *previousOffset = self.transactionOffsetsById[blockId];
+    if ((transactions.count == 0) && !previousOffset) {
+        return;
+    }
+
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:sizeof(WSMappedTransactionsEntry)];
+    for (WSSignedTransaction *tx in transactions) {
+        NSData *txData = [[tx toBuffer] data];
+        const uint32_t txLength = CFSwapInt32HostToLittle((uint32_t)txData.length);
+        [data appendBytes:&txLength length:sizeof(txLength)];
+        [data appendData:txData];
+    }
+    WSMappedTransactionsEntry *entry = data.mutableBytes;
+    memcpy(entry->blockId, blockId.bytes, WSHash256Length);
+    entry->length = CFSwapInt32HostToLittle((uint32_t)(data.length - sizeof(WSMappedTransactionsEntry)));
+
+    const off_t offset = self.transactionsLength;
+    WSExceptionCheck(pwrite(self.transactionsFileDescriptor, data.bytes, data.length, offset) == (ssize_t)data.length,
+                     NSInternalInconsistencyException, @"Unable to write transactions of block %@ (%s)", blockId, strerror(errno));
+    self.transactionsLength += data.length;
+
+    if (previousOffset) {
+        self.transactionsGarbageLength += [self transactionsEntryLengthAtOffset:[previousOffset longLongValue]];
+    }
+    if (transactions.count > 0) {
+        self.transactionOffsetsById[blockId] = @(offset);
+    }
+    else {
+        [self.transactionOffsetsById removeObjectForKey:blockId];
+        self.transactionsGarbageLength += data.length;
+    }
+
+    const off_t garbageLength = self.transactionsGarbageLength;
+    if ((garbageLength >= WSMappedBlockStoreMinTransactionsCompaction) && (garbageLength > self.transactionsLength - garbageLength)) {
+        [self compactTransactions];
+    }
+}
+
+- (off_t)transactionsEntryLengthAtOffset:(off_t)offset
+{
+    WSMappedTransactionsEntry entry;
+    WSExceptionCheck(pread(self.transactionsFileDescriptor, &entry, sizeof(entry), offset) == sizeof(entry),
+                     NSInternalInconsistencyException, @"Unable to read transactions entry at offset %lld (%s)", (long long)offset, strerror(errno));
+
+    return sizeof(entry) + CFSwapInt32LittleToHost(entry.length);
+}
+
+// copies live entries to a new log, then replaces the old one
+- (void)compactTransactions
+{
+    DDLogDebug(@"Compacting transactions (%lld dead out of %lld bytes)", (long long)self.transactionsGarbageLength, (long long)self.transactionsLength);
+
+    NSString *compactedPath = [self.transactionsPath stringByAppendingString:@"-compacted"];
+    const int fd = open(compactedPath.fileSystemRepresentation, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    WSExceptionCheck(fd >= 0, NSInternalInconsistencyException, @"Unable to create %@ (%s)", compactedPath, strerror(errno));
+
+    WSMappedTransactionsHeader header;
+    header.magic = WSMappedBlockStoreTransactionsMagic;
+    header.version = WSMappedBlockStoreVersion;
+    BOOL success = (pwrite(fd, &header, sizeof(header), 0) == sizeof(header));
+
+    NSMutableDictionary *offsetsById = [[NSMutableDictionary alloc] initWithCapacity:self.transactionOffsetsById.count];
+    __block off_t length = sizeof(header);
+    [self.transactionOffsetsById enumerateKeysAndObjectsUsingBlock:^(WSHash256 *blockId, NSNumber *offset, BOOL *stop) {
+        const off_t entryLength = [self transactionsEntryLengthAtOffset:[offset longLongValue]];
+        NSMutableData *data = [[NSMutableData alloc] initWithLength:(NSUInteger)entryLength];
+        if ((pread(self.transactionsFileDescriptor, data.mutableBytes, data.length, [offset longLongValue]) != (ssize_t)data.length) ||
+            (pwrite(fd, data.bytes, data.length, length) != (ssize_t)data.length)) {
+
+            *stop = YES;
+            return;
+        }
+        offsetsById[blockId] = @(length);
+        length += entryLength;
+    }];
+    success = success && (offsetsById.count == self.transactionOffsetsById.count);
+    success = success && (fsync(fd) == 0) && (rename(compactedPath.fileSystemRepresentation, self.transactionsPath.fileSystemRepresentation) == 0);
+    if (!success) {
+        DDLogError(@"Unable to compact transactions (%s)", strerror(errno));
+        close(fd);
+        unlink(compactedPath.fileSystemRepresentation);
+        return;
+    }
+
+    close(self.transactionsFileDescriptor);
+    self.transactionsFileDescriptor = fd;
+    self.transactionOffsetsById = offsetsById;
+    self.transactionsLength = length;
+    self.transactionsGarbageLength = 0;
+}
+
+@end
+
+#pragma mark -
+
+static BOOL WSMappedRegionResize(int fd, uint8_t **bytes, size_t *length, size_t newLength, NSError **error)
+{
+    WSMappedRegionUnmap(bytes, length);
+
+    if (ftruncate(fd, (off_t)newLength) < 0) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    void *mapped = mmap(NULL, newLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        WSMappedErrorSetPOSIX(error);
+        return NO;
+    }
+    *bytes = mapped;
+    *length = newLength;
+    return YES;
+}
+
+static void WSMappedRegionUnmap(uint8_t **bytes, size_t *length)
+{
+    if (*bytes) {
+        munmap(*bytes, *length);
+    }
+    *bytes = NULL;
+    *length = 0;
+}
+
+static void WSMappedErrorSetPOSIX(NSError **error)
+{
+    if (error) {
+        *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+    }
+}
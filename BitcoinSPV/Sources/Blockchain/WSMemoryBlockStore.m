@@ -34,13 +34,27 @@
 #import "WSMacrosCore.h"
 #import "WSErrors.h"
 
+//
+// main chain blocks from tail to head are kept in a window ordered by
+// height, so that removing the tail is a pop from the front; blocks off
+// the main chain are bucketed by height and dropped once the tail moves
+// past them
+//
 @interface WSMemoryBlockStore ()
 
 @property (nonatomic, strong) WSFilteredBlock *genesisBlock;
 @property (nonatomic, strong) NSMutableDictionary *blocks;          // WSHash256 -> WSStorableBlock
-@property (nonatomic, strong) NSMutableDictionary *nextIdsById;     // WSHash256 -> WSHash256
+@property (nonatomic, strong) NSMutableArray *windowIds;            // WSHash256 (ascending height, tail first)
+@property (nonatomic, assign) uint32_t windowBaseHeight;
+@property (nonatomic, strong) NSMutableDictionary *sideIdsByHeight; // NSNumber -> NSMutableSet (WSHash256)
+@property (nonatomic, strong) NSMutableIndexSet *sideHeights;
 @property (nonatomic, strong) WSStorableBlock *head;
-@property (nonatomic, strong) WSStorableBlock *tail;
+
+- (BOOL)isWindowBlock:(WSStorableBlock *)block;
+- (void)addSideBlockId:(WSHash256 *)blockId height:(uint32_t)height;
+- (void)removeSideBlockId:(WSHash256 *)blockId height:(uint32_t)height;
+- (void)truncateWindowAfterHeight:(uint32_t)height;
+- (void)resetWindowWithHead:(WSStorableBlock *)head;
 
 @end
 
@@ -77,13 +91,25 @@
     return self.blocks[blockId];
 }
 
+- (BOOL)containsBlockIdBytes:(const uint8_t *)blockIdBytes
+{
+    NSParameterAssert(blockIdBytes);
+
+    return (self.blocks[WSHash256FromData([NSData dataWithBytes:blockIdBytes length:WSHash256Length])] != nil);
+}
+
 - (void)putBlock:(WSStorableBlock *)block
 {
     WSExceptionCheckIllegal(block);
 
     WSHash256 *blockId = block.blockId;
+    const BOOL isNew = (self.blocks[blockId] == nil);
     self.blocks[blockId] = block;
-    self.nextIdsById[block.previousBlockId] = blockId;
+
+    // side block until it becomes part of head chain
+    if (isNew) {
+        [self addSideBlockId:blockId height:block.height];
+    }
 }
 
 - (void)setHead:(WSStorableBlock *)head
@@ -91,38 +117,75 @@
     WSExceptionCheckIllegal(head);
     
     _head = head;
+
+    // walk back to window, usually just one block
+    NSMutableArray *path = [[NSMutableArray alloc] init];
+    WSStorableBlock *block = head;
+    while (block && ![self isWindowBlock:block]) {
+        [path addObject:block];
+        block = self.blocks[block.previousBlockId];
+    }
+
+    // disconnected from window (e.g. checkpoint)
+    if (!block) {
+        [self resetWindowWithHead:head];
+        return;
+    }
+
+    [self truncateWindowAfterHeight:block.height];
+    for (WSStorableBlock *pathBlock in [path reverseObjectEnumerator]) {
+        [self removeSideBlockId:pathBlock.blockId height:pathBlock.height];
+        [self.windowIds addObject:pathBlock.blockId];
+    }
 }
 
 - (void)removeTail
 {
     NSAssert(self.blocks.count > 0, @"Empty blocks");
+    NSAssert(self.windowIds.count > 0, @"Tail is nil, store truncated without resetting?");
     
-    WSHash256 *tailId = self.tail.blockId;
-    NSAssert(tailId, @"Tail is nil, store truncated without resetting?");
-    
-    WSHash256 *newTailId = self.nextIdsById[tailId];
-    if (!newTailId) {
-        WSStorableBlock *block = self.head;
-        while (block) {
-            newTailId = block.blockId;
-            block = self.blocks[block.previousBlockId];
+    WSHash256 *tailId = [self.windowIds firstObject];
+    const uint32_t tailHeight = self.windowBaseHeight;
+
+    [self.blocks removeObjectForKey:tailId];
+    [self.windowIds removeObjectAtIndex:0];
+    ++self.windowBaseHeight;
+
+    // side branches forking at or before tail can't be reached anymore
+    NSMutableSet *removedIds = [[NSMutableSet alloc] initWithObjects:tailId, nil];
+    while ((self.sideHeights.count > 0) && (self.sideHeights.firstIndex <= tailHeight)) {
+        NSNumber *height = @(self.sideHeights.firstIndex);
+        for (WSHash256 *blockId in self.sideIdsByHeight[height]) {
+            [self.blocks removeObjectForKey:blockId];
+            [removedIds addObject:blockId];
+        }
+        [self.sideIdsByHeight removeObjectForKey:height];
+        [self.sideHeights removeIndex:[height unsignedIntegerValue]];
+    }
+
+    // nor can their descendants, height by height until no child is left
+    for (uint32_t height = tailHeight + 1; self.sideHeights.count > 0; ++height) {
+        NSMutableArray *childIds = [[NSMutableArray alloc] init];
+        for (WSHash256 *blockId in self.sideIdsByHeight[@(height)]) {
+            WSStorableBlock *block = self.blocks[blockId];
+            if ([removedIds containsObject:block.previousBlockId]) {
+                [childIds addObject:blockId];
+            }
+        }
+        if (childIds.count == 0) {
+            break;
+        }
+        for (WSHash256 *blockId in childIds) {
+            [self.blocks removeObjectForKey:blockId];
+            [self removeSideBlockId:blockId height:height];
+            [removedIds addObject:blockId];
         }
     }
-    
-    [self.blocks removeObjectForKey:tailId];
-    [self.nextIdsById removeObjectForKey:tailId];
-    self.tail = self.blocks[newTailId];
 }
 
 - (void)findAndRestoreTail
 {
-    WSStorableBlock *block = self.head;
-    WSStorableBlock *tail;
-    while (block) {
-        tail = block;
-        block = self.blocks[block.previousBlockId];
-    }
-    self.tail = tail;
+    [self resetWindowWithHead:self.head];
 }
 
 - (NSArray *)allBlocks
@@ -138,12 +201,89 @@
 - (void)truncate
 {
     self.blocks = [[NSMutableDictionary alloc] init];
-    self.nextIdsById = [[NSMutableDictionary alloc] init];
+    self.windowIds = [[NSMutableArray alloc] init];
+    self.sideIdsByHeight = [[NSMutableDictionary alloc] init];
+    self.sideHeights = [[NSMutableIndexSet alloc] init];
     
     WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:self.genesisBlock.header transactions:nil height:0];
     [self putBlock:block];
     self.head = block;
-    self.tail = self.head;
+}
+
+- (void)synchronize
+{
+}
+
+#pragma mark Window
+
+- (BOOL)isWindowBlock:(WSStorableBlock *)block
+{
+    NSParameterAssert(block);
+
+    if ((self.windowIds.count == 0) || (block.height < self.windowBaseHeight)) {
+        return NO;
+    }
+    const NSUInteger index = block.height - self.windowBaseHeight;
+    return ((index < self.windowIds.count) && [self.windowIds[index] isEqual:block.blockId]);
+}
+
+- (void)addSideBlockId:(WSHash256 *)blockId height:(uint32_t)height
+{
+    NSParameterAssert(blockId);
+
+    NSNumber *key = @(height);
+    NSMutableSet *blockIds = self.sideIdsByHeight[key];
+    if (!blockIds) {
+        blockIds = [[NSMutableSet alloc] init];
+        self.sideIdsByHeight[key] = blockIds;
+        [self.sideHeights addIndex:height];
+    }
+    [blockIds addObject:blockId];
+}
+
+- (void)removeSideBlockId:(WSHash256 *)blockId height:(uint32_t)height
+{
+    NSParameterAssert(blockId);
+
+    NSNumber *key = @(height);
+    NSMutableSet *blockIds = self.sideIdsByHeight[key];
+    [blockIds removeObject:blockId];
+    if (blockIds && (blockIds.count == 0)) {
+        [self.sideIdsByHeight removeObjectForKey:key];
+        [self.sideHeights removeIndex:height];
+    }
+}
+
+// blocks above height leave main chain (e.g. reorganization)
+- (void)truncateWindowAfterHeight:(uint32_t)height
+{
+    const NSUInteger count = height - self.windowBaseHeight + 1;
+    while (self.windowIds.count > count) {
+        WSHash256 *blockId = [self.windowIds lastObject];
+        [self addSideBlockId:blockId height:(self.windowBaseHeight + (uint32_t)self.windowIds.count - 1)];
+        [self.windowIds removeLastObject];
+    }
+}
+
+- (void)resetWindowWithHead:(WSStorableBlock *)head
+{
+    NSParameterAssert(head);
+
+    [self.windowIds removeAllObjects];
+    [self.sideIdsByHeight removeAllObjects];
+    [self.sideHeights removeAllIndexes];
+
+    WSStorableBlock *block = head;
+    while (block) {
+        [self.windowIds insertObject:block.blockId atIndex:0];
+        self.windowBaseHeight = block.height;
+        block = self.blocks[block.previousBlockId];
+    }
+    for (WSStorableBlock *block in [self.blocks allValues]) {
+        if (![self isWindowBlock:block]) {
+            [self addSideBlockId:block.blockId height:block.height];
+        }
+    }
 }
 
 @end
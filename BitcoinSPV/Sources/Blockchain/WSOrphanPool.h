@@ -0,0 +1,56 @@
+//
+//  WSOrphanPool.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+@class WSHash256;
+@class WSStorableBlock;
+
+//
+// thread-safety: not required
+//
+// orphans are indexed by parent id and evicted in LRU order
+// when exceeding maxSize or older than maxAge
+//
+@interface WSOrphanPool : NSObject
+
+- (instancetype)initWithMaxSize:(NSUInteger)maxSize maxAge:(NSTimeInterval)maxAge;
+- (NSUInteger)maxSize;
+- (NSTimeInterval)maxAge;
+
+- (NSUInteger)count;
+- (WSStorableBlock *)orphanForId:(WSHash256 *)blockId; // marks orphan as recently used
+- (BOOL)containsOrphanWithId:(WSHash256 *)blockId; // leaves LRU order untouched
+- (void)addOrphan:(WSStorableBlock *)orphan;
+- (NSArray *)removeOrphansWithParentId:(WSHash256 *)parentId; // WSStorableBlock
+- (void)removeAllOrphans;
+
+// monitoring
+- (NSUInteger)numberOfAddedOrphans;
+- (NSUInteger)numberOfConnectedOrphans;
+- (NSUInteger)numberOfEvictedOrphans;
+- (NSUInteger)numberOfExpiredOrphans;
+
+@end
@@ -0,0 +1,212 @@
+//
+//  WSOrphanPool.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSOrphanPool.h"
+#import "WSStorableBlock.h"
+#import "WSHash256.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+@interface WSOrphanPool ()
+
+@property (nonatomic, assign) NSUInteger maxSize;
+@property (nonatomic, assign) NSTimeInterval maxAge;
+@property (nonatomic, strong) NSMutableDictionary *orphans; // WSHash256 -> WSStorableBlock
+@property (nonatomic, strong) NSMutableDictionary *orphanIdsByParentId; // WSHash256 -> NSMutableSet (WSHash256)
+@property (nonatomic, strong) NSMutableOrderedSet *usedIds; // WSHash256 (least recently used first)
+@property (nonatomic, strong) NSMutableDictionary *usedTimes; // WSHash256 -> NSNumber (NSTimeInterval)
+@property (nonatomic, assign) NSUInteger numberOfAddedOrphans;
+@property (nonatomic, assign) NSUInteger numberOfConnectedOrphans;
+@property (nonatomic, assign) NSUInteger numberOfEvictedOrphans;
+@property (nonatomic, assign) NSUInteger numberOfExpiredOrphans;
+
+- (void)touchOrphanWithId:(WSHash256 *)blockId;
+- (void)unlinkOrphan:(WSStorableBlock *)orphan;
+- (void)expireOrphans;
+
+@end
+
+@implementation WSOrphanPool
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithMaxSize:maxAge:");
+    return nil;
+}
+
+- (instancetype)initWithMaxSize:(NSUInteger)maxSize maxAge:(NSTimeInterval)maxAge
+{
+    WSExceptionCheckIllegal(maxSize > 0);
+    WSExceptionCheckIllegal(maxAge > 0.0);
+    
+    if ((self = [super init])) {
+        self.maxSize = maxSize;
+        self.maxAge = maxAge;
+        self.orphans = [[NSMutableDictionary alloc] init];
+        self.orphanIdsByParentId = [[NSMutableDictionary alloc] init];
+        self.usedIds = [[NSMutableOrderedSet alloc] init];
+        self.usedTimes = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (NSUInteger)count
+{
+    return self.orphans.count;
+}
+
+- (WSStorableBlock *)orphanForId:(WSHash256 *)blockId
+{
+    WSExceptionCheckIllegal(blockId);
+    
+    WSStorableBlock *orphan = self.orphans[blockId];
+    if (orphan) {
+        [self touchOrphanWithId:blockId];
+    }
+    return orphan;
+}
+
+- (BOOL)containsOrphanWithId:(WSHash256 *)blockId
+{
+    WSExceptionCheckIllegal(blockId);
+
+    return (self.orphans[blockId] != nil);
+}
+
+- (void)addOrphan:(WSStorableBlock *)orphan
+{
+    WSExceptionCheckIllegal(orphan);
+    
+    [self expireOrphans];
+
+    WSHash256 *blockId = orphan.blockId;
+    WSStorableBlock *existingOrphan = self.orphans[blockId];
+    if (existingOrphan) {
+        [self unlinkOrphan:existingOrphan];
+    }
+    else {
+        ++self.numberOfAddedOrphans;
+    }
+
+    self.orphans[blockId] = orphan;
+    NSMutableSet *siblingIds = self.orphanIdsByParentId[orphan.previousBlockId];
+    if (!siblingIds) {
+        siblingIds = [[NSMutableSet alloc] init];
+        self.orphanIdsByParentId[orphan.previousBlockId] = siblingIds;
+    }
+    [siblingIds addObject:blockId];
+    [self touchOrphanWithId:blockId];
+
+    while (self.orphans.count > self.maxSize) {
+        WSStorableBlock *evictedOrphan = self.orphans[[self.usedIds firstObject]];
+        DDLogDebug(@"Evicting least recently used orphan %@", evictedOrphan.blockId);
+        [self unlinkOrphan:evictedOrphan];
+        ++self.numberOfEvictedOrphans;
+    }
+}
+
+- (NSArray *)removeOrphansWithParentId:(WSHash256 *)parentId
+{
+    WSExceptionCheckIllegal(parentId);
+    
+    NSSet *orphanIds = self.orphanIdsByParentId[parentId];
+    if (!orphanIds) {
+        return @[];
+    }
+
+    NSMutableArray *removedOrphans = [[NSMutableArray alloc] initWithCapacity:orphanIds.count];
+    for (WSHash256 *blockId in [orphanIds copy]) {
+        WSStorableBlock *orphan = self.orphans[blockId];
+        [removedOrphans addObject:orphan];
+        [self unlinkOrphan:orphan];
+    }
+    self.numberOfConnectedOrphans += removedOrphans.count;
+    return removedOrphans;
+}
+
+- (void)removeAllOrphans
+{
+    [self.orphans removeAllObjects];
+    [self.orphanIdsByParentId removeAllObjects];
+    [self.usedIds removeAllObjects];
+    [self.usedTimes removeAllObjects];
+}
+
+- (void)touchOrphanWithId:(WSHash256 *)blockId
+{
+    NSParameterAssert(blockId);
+
+    [self.usedIds removeObject:blockId];
+    [self.usedIds addObject:blockId];
+    self.usedTimes[blockId] = @([NSDate timeIntervalSinceReferenceDate]);
+}
+
+- (void)unlinkOrphan:(WSStorableBlock *)orphan
+{
+    NSParameterAssert(orphan);
+
+    WSHash256 *blockId = orphan.blockId;
+    [self.orphans removeObjectForKey:blockId];
+    [self.usedIds removeObject:blockId];
+    [self.usedTimes removeObjectForKey:blockId];
+
+    NSMutableSet *siblingIds = self.orphanIdsByParentId[orphan.previousBlockId];
+    [siblingIds removeObject:blockId];
+    if (siblingIds.count == 0) {
+        [self.orphanIdsByParentId removeObjectForKey:orphan.previousBlockId];
+    }
+}
+
+// least recently used first, stop at first fresh orphan
+- (void)expireOrphans
+{
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    while (self.usedIds.count > 0) {
+        WSHash256 *blockId = [self.usedIds firstObject];
+        if (now - [self.usedTimes[blockId] doubleValue] < self.maxAge) {
+            break;
+        }
+        DDLogDebug(@"Expiring orphan %@", blockId);
+        [self unlinkOrphan:self.orphans[blockId]];
+        ++self.numberOfExpiredOrphans;
+    }
+}
+
+#pragma mark NSObject
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"{count = %lu/%lu, added = %lu, connected = %lu, evicted = %lu, expired = %lu}",
+            (unsigned long)self.orphans.count,
+            (unsigned long)self.maxSize,
+            (unsigned long)self.numberOfAddedOrphans,
+            (unsigned long)self.numberOfConnectedOrphans,
+            (unsigned long)self.numberOfEvictedOrphans,
+            (unsigned long)self.numberOfExpiredOrphans];
+}
+
+@end
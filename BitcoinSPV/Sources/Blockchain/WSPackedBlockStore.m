@@ -0,0 +1,236 @@
+//
+//  WSPackedBlockStore.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSPackedBlockStore.h"
+#import "WSHeaderTable.h"
+#import "WSBlockRecord.h"
+#import "WSHash256.h"
+#import "WSStorableBlock.h"
+#import "WSBlockHeader.h"
+#import "WSFilteredBlock.h"
+#import "WSConfig.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+@interface WSPackedBlockStore ()
+
+@property (nonatomic, strong) WSFilteredBlock *genesisBlock;
+@property (nonatomic, strong) WSHeaderTable *table;
+@property (nonatomic, strong) NSMutableDictionary *transactionBlocksById;   // WSHash256 -> WSStorableBlock (transactions source)
+@property (nonatomic, strong) WSStorableBlock *cachedHead;
+@property (nonatomic, assign) uint32_t headIndex;
+@property (nonatomic, assign) uint32_t tailIndex;
+
+- (WSStorableBlock *)blockAtIndex:(uint32_t)index;
+- (uint32_t)nextIndexForTailIndex:(uint32_t)tailIndex;
+
+@end
+
+@implementation WSPackedBlockStore
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithParameters:");
+    return nil;
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters
+{
+    return [self initWithParameters:parameters capacity:WSBlockChainDefaultMaxSize];
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters capacity:(NSUInteger)capacity
+{
+    WSExceptionCheckIllegal(parameters);
+
+    if ((self = [super init])) {
+        self.genesisBlock = [parameters genesisBlock];
+        self.table = [[WSHeaderTable alloc] initWithParameters:parameters capacity:capacity];
+        [self truncate];
+    }
+    return self;
+}
+
+#pragma mark WSBlockStore
+
+- (WSParameters *)parameters
+{
+    return self.genesisBlock.parameters;
+}
+
+- (WSStorableBlock *)blockForId:(WSHash256 *)blockId
+{
+    WSExceptionCheckIllegal(blockId);
+
+    if ([blockId isEqual:self.cachedHead.blockId]) {
+        return self.cachedHead;
+    }
+    const uint32_t index = [self.table indexOfBlockId:blockId];
+    if (index == WSHeaderTableNoIndex) {
+        return nil;
+    }
+    return [self blockAtIndex:index];
+}
+
+- (BOOL)containsBlockIdBytes:(const uint8_t *)blockIdBytes
+{
+    NSParameterAssert(blockIdBytes);
+
+    return ([self.table indexOfBlockIdBytes:blockIdBytes] != WSHeaderTableNoIndex);
+}
+
+- (void)putBlock:(WSStorableBlock *)block
+{
+    WSExceptionCheckIllegal(block);
+
+    WSHash256 *blockId = block.blockId;
+    [self.table putBlock:block];
+
+    // pending lazy loads are kept pending, see takeTransactionsFromBlock:
+    if (![block hasLoadedTransactions] || (block.transactions.count > 0)) {
+        self.transactionBlocksById[blockId] = block;
+    }
+    else {
+        [self.transactionBlocksById removeObjectForKey:blockId];
+    }
+    if ([blockId isEqual:self.cachedHead.blockId]) {
+        self.cachedHead = block;
+    }
+}
+
+- (WSStorableBlock *)head
+{
+    return self.cachedHead;
+}
+
+- (void)setHead:(WSStorableBlock *)head
+{
+    WSExceptionCheckIllegal(head);
+
+    uint32_t index = [self.table indexOfBlockId:head.blockId];
+    if (index == WSHeaderTableNoIndex) {
+        [self putBlock:head];
+        index = [self.table indexOfBlockId:head.blockId];
+    }
+    self.headIndex = index;
+    self.cachedHead = head;
+}
+
+- (void)removeTail
+{
+    NSAssert(self.table.count > 0, @"Empty blocks");
+
+    const uint32_t tailIndex = self.tailIndex;
+    NSAssert(tailIndex != WSHeaderTableNoIndex, @"Tail is nil, store truncated without resetting?");
+
+    const uint32_t newTailIndex = [self nextIndexForTailIndex:tailIndex];
+
+    if (self.transactionBlocksById.count > 0) {
+        NSData *tailIdData = [NSData dataWithBytes:[self.table blockIdBytesAtIndex:tailIndex] length:WSHash256Length];
+        [self.transactionBlocksById removeObjectForKey:WSHash256FromData(tailIdData)];
+    }
+    [self.table removeEntryAtIndex:tailIndex];
+    self.tailIndex = newTailIndex;
+
+    if ([self.table needsCompaction]) {
+        uint32_t indexes[] = { self.headIndex, self.tailIndex };
+        [self.table compactRemappingIndexes:indexes count:2];
+        self.headIndex = indexes[0];
+        self.tailIndex = indexes[1];
+    }
+}
+
+- (void)findAndRestoreTail
+{
+    WSHeaderTable *table = self.table;
+
+    self.tailIndex = WSBlockRecordFindTail(self.headIndex, WSHeaderTableNoIndex, ^uint32_t(uint32_t index) {
+        return [table indexOfBlockIdBytes:[table previousBlockIdBytesAtIndex:index]];
+    });
+}
+
+- (NSArray *)allBlocks
+{
+    WSHeaderTable *table = self.table;
+
+    NSMutableArray *blocks = [[NSMutableArray alloc] initWithCapacity:table.count];
+    for (uint32_t i = 0; i < table.endIndex; ++i) {
+        if ([table isRemovedEntryAtIndex:i]) {
+            continue;
+        }
+        [blocks addObject:[self blockAtIndex:i]];
+    }
+    return blocks;
+}
+
+- (NSUInteger)size
+{
+    return self.table.count;
+}
+
+- (void)truncate
+{
+    [self.table removeAllEntries];
+    self.transactionBlocksById = [[NSMutableDictionary alloc] init];
+
+    WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:self.genesisBlock.header transactions:nil height:0];
+    [self putBlock:block];
+    self.cachedHead = nil;
+    [self setHead:block];
+    self.tailIndex = self.headIndex;
+}
+
+- (void)synchronize
+{
+}
+
+#pragma mark Entries
+
+- (WSStorableBlock *)blockAtIndex:(uint32_t)index
+{
+    WSStorableBlock *transactionsBlock = nil;
+    if (self.transactionBlocksById.count > 0) {
+        NSData *blockIdData = [NSData dataWithBytes:[self.table blockIdBytesAtIndex:index] length:WSHash256Length];
+        transactionsBlock = self.transactionBlocksById[WSHash256FromData(blockIdData)];
+    }
+    return [self.table blockAtIndex:index transactionsBlock:transactionsBlock];
+}
+
+// first child may be on a side branch, see WSBlockRecordAncestorIndex()
+- (uint32_t)nextIndexForTailIndex:(uint32_t)tailIndex
+{
+    WSHeaderTable *table = self.table;
+
+    return WSBlockRecordAncestorIndex(self.headIndex, [table heightAtIndex:tailIndex] + 1, WSHeaderTableNoIndex, ^uint32_t(uint32_t index) {
+        return [table heightAtIndex:index];
+    }, ^uint32_t(uint32_t index) {
+        return [table indexOfBlockIdBytes:[table previousBlockIdBytesAtIndex:index]];
+    }, ^uint32_t(uint32_t index) {
+        const uint8_t *skipIdBytes = [table skipBlockIdBytesAtIndex:index];
+        return (skipIdBytes ? [table indexOfBlockIdBytes:skipIdBytes] : WSHeaderTableNoIndex);
+    });
+}
+
+@end
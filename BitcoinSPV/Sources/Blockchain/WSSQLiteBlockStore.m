@@ -0,0 +1,752 @@
+//
+//  WSSQLiteBlockStore.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <sqlite3.h>
+
+#import "WSSQLiteBlockStore.h"
+#import "WSBlockRecord.h"
+#import "WSHash256.h"
+#import "WSStorableBlock.h"
+#import "WSStorableBlock+BlockChain.h"
+#import "WSBlockHeader.h"
+#import "WSFilteredBlock.h"
+#import "WSTransaction.h"
+#import "WSBuffer.h"
+#import "WSParameters.h"
+#import "WSBitcoinConstants.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+//
+// schema:
+//
+// meta (key, value)                                        genesis/head/tail ids
+// blocks (id, previous_id, header, height, work, tx_count, skip_id)
+//                                                          80-byte headers, big endian work
+// transactions (block_id, position, txid, data)            serialized signed transactions
+//
+// blocks reference their transactions by block id, so that headers-only
+// blocks never hit the transactions table
+//
+// blocks whose transactions are still lazily loaded (e.g. from Core Data)
+// are stored with tx_count 0 and keep being served by their original
+// loader until they're put again with loaded transactions
+//
+
+static NSString *const WSSQLiteBlockStoreErrorDomain        = @"WSSQLiteBlockStoreErrorDomain";
+static const int WSSQLiteBlockStoreVersion                  = 1;
+static const NSUInteger WSSQLiteBlockStoreMaxPendingWrites  = 256;
+
+#define WSSQLiteBlockStoreHeaderLength                      80
+
+static NSString *const WSSQLiteMetaKeyGenesis               = @"genesis";
+static NSString *const WSSQLiteMetaKeyHead                  = @"head";
+static NSString *const WSSQLiteMetaKeyTail                  = @"tail";
+
+static const char *const WSSQLiteBlockStoreSchema =
+    "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value BLOB NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS blocks (id BLOB PRIMARY KEY, previous_id BLOB NOT NULL, header BLOB NOT NULL,"
+    " height INTEGER NOT NULL, work BLOB NOT NULL, tx_count INTEGER NOT NULL, skip_id BLOB) WITHOUT ROWID;"
+    "CREATE INDEX IF NOT EXISTS blocks_previous_id ON blocks (previous_id);"
+    "CREATE TABLE IF NOT EXISTS transactions (block_id BLOB NOT NULL, position INTEGER NOT NULL, txid BLOB NOT NULL,"
+    " data BLOB NOT NULL, PRIMARY KEY (block_id, position)) WITHOUT ROWID;"
+    "CREATE INDEX IF NOT EXISTS transactions_txid ON transactions (txid);";
+
+typedef enum {
+    WSSQLiteStatementSelectMeta,
+    WSSQLiteStatementReplaceMeta,
+    WSSQLiteStatementSelectBlock,
+    WSSQLiteStatementSelectChildren,
+    WSSQLiteStatementReplaceBlock,
+    WSSQLiteStatementDeleteBlock,
+    WSSQLiteStatementSelectTransactions,
+    WSSQLiteStatementInsertTransaction,
+    WSSQLiteStatementDeleteTransactions,
+    WSSQLiteStatementCount
+} WSSQLiteStatement;
+
+static const char *const WSSQLiteStatementQueries[WSSQLiteStatementCount] = {
+    "SELECT value FROM meta WHERE key = ?",
+    "INSERT OR REPLACE INTO meta (key, value) VALUES (?, ?)",
+    "SELECT header, height, work, tx_count, skip_id FROM blocks WHERE id = ?",
+    "SELECT id FROM blocks WHERE previous_id = ?",
+    "INSERT OR REPLACE INTO blocks (id, previous_id, header, height, work, tx_count, skip_id) VALUES (?, ?, ?, ?, ?, ?, ?)",
+    "DELETE FROM blocks WHERE id = ?",
+    "SELECT data FROM transactions WHERE block_id = ? ORDER BY position",
+    "INSERT INTO transactions (block_id, position, txid, data) VALUES (?, ?, ?, ?)",
+    "DELETE FROM transactions WHERE block_id = ?"
+};
+
+static void WSSQLiteErrorSet(sqlite3 *db, NSError **error);
+static inline void WSSQLiteBindBytes(sqlite3_stmt *statement, int index, const void *bytes, NSUInteger length);
+static inline NSData *WSSQLiteColumnData(sqlite3_stmt *statement, int column);
+
+@interface WSSQLiteBlockStore () {
+    sqlite3_stmt *_statements[WSSQLiteStatementCount];
+}
+
+@property (nonatomic, strong) WSFilteredBlock *genesisBlock;
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, assign) sqlite3 *db;
+@property (nonatomic, assign) NSUInteger liveCount;
+@property (nonatomic, assign) NSUInteger pendingWrites;
+@property (nonatomic, strong) WSStorableBlock *cachedHead;
+@property (nonatomic, strong) WSHash256 *tailId;
+@property (nonatomic, strong) NSMutableDictionary *lazyBlocksById; // WSHash256 -> WSStorableBlock (transactions source)
+
+- (BOOL)openWithError:(NSError **)error;
+- (BOOL)resetWithError:(NSError **)error;
+- (BOOL)executeSQL:(const char *)sql error:(NSError **)error;
+- (sqlite3_stmt *)statement:(WSSQLiteStatement)statement;
+- (void)beginWrite;
+- (void)endWrite;
+
+- (NSData *)metaValueForKey:(NSString *)key;
+- (void)setMetaValue:(NSData *)value forKey:(NSString *)key;
+- (WSStorableBlock *)blockForId:(WSHash256 *)blockId error:(NSError **)error;
+- (WSStorableBlock *)blockFromStatement:(sqlite3_stmt *)statement blockId:(WSHash256 *)blockId firstColumn:(int)firstColumn error:(NSError **)error;
+- (NSOrderedSet *)transactionsForBlockId:(WSHash256 *)blockId;
+- (void)writeTransactions:(NSOrderedSet *)transactions forBlockId:(WSHash256 *)blockId;
+- (BOOL)containsBlockId:(WSHash256 *)blockId;
+- (WSHash256 *)previousIdForBlockId:(WSHash256 *)blockId;
+- (NSArray *)childIdsForBlockId:(WSHash256 *)blockId;
+- (WSHash256 *)nextTailIdForTailId:(WSHash256 *)tailId childIds:(NSArray *)childIds;
+- (void)deleteBlockWithId:(WSHash256 *)blockId;
+- (NSUInteger)deleteBranchAtBlockId:(WSHash256 *)blockId;
+
+@end
+
+@implementation WSSQLiteBlockStore
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithParameters:path:error:");
+    return nil;
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters path:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(parameters);
+    WSExceptionCheckIllegal(path);
+
+    if ((self = [super init])) {
+        self.genesisBlock = [parameters genesisBlock];
+        self.path = path;
+
+        if (![self openWithError:error]) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self synchronize];
+
+    for (int i = 0; i < WSSQLiteStatementCount; ++i) {
+        sqlite3_finalize(_statements[i]);
+        _statements[i] = NULL;
+    }
+    if (self.db) {
+        sqlite3_close(self.db);
+    }
+}
+
+- (void)synchronize
+{
+    if (self.db && !sqlite3_get_autocommit(self.db)) {
+        NSError *error;
+        if (![self executeSQL:"COMMIT" error:&error]) {
+            DDLogError(@"Unable to commit block store (%@)", error);
+        }
+    }
+    self.pendingWrites = 0;
+}
+
+#pragma mark WSBlockStore
+
+- (WSParameters *)parameters
+{
+    return self.genesisBlock.parameters;
+}
+
+- (WSStorableBlock *)blockForId:(WSHash256 *)blockId
+{
+    WSExceptionCheckIllegal(blockId);
+
+    NSError *error;
+    WSStorableBlock *block = [self blockForId:blockId error:&error];
+    if (!block && error) {
+        DDLogError(@"Unable to read block %@ (%@)", blockId, error);
+    }
+    return block;
+}
+
+- (BOOL)containsBlockIdBytes:(const uint8_t *)blockIdBytes
+{
+    NSParameterAssert(blockIdBytes);
+
+    WSHash256 *headId = self.cachedHead.blockId;
+    if (headId && (memcmp(blockIdBytes, headId.bytes, WSHash256Length) == 0)) {
+        return YES;
+    }
+
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementSelectBlock];
+    WSSQLiteBindBytes(statement, 1, blockIdBytes, WSHash256Length);
+    const BOOL found = (sqlite3_step(statement) == SQLITE_ROW);
+    sqlite3_reset(statement);
+    return found;
+}
+
+- (void)putBlock:(WSStorableBlock *)block
+{
+    WSExceptionCheckIllegal(block);
+
+    WSHash256 *blockId = block.blockId;
+    const BOOL isNew = ![self containsBlockId:blockId];
+
+    WSBuffer *headerBuffer = [block.header toBuffer];
+    NSAssert(headerBuffer.length == WSBlockHeaderSize, @"Unexpected header length (%lu != %lu)",
+             (unsigned long)headerBuffer.length, (unsigned long)WSBlockHeaderSize);
+    NSData *workData = block.workData;
+
+    [self beginWrite];
+
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementReplaceBlock];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+    WSSQLiteBindBytes(statement, 2, block.header.previousBlockId.bytes, WSHash256Length);
+    WSSQLiteBindBytes(statement, 3, headerBuffer.bytes, WSSQLiteBlockStoreHeaderLength);
+    sqlite3_bind_int64(statement, 4, block.height);
+    WSSQLiteBindBytes(statement, 5, workData.bytes, workData.length);
+    const BOOL hasLoadedTransactions = [block hasLoadedTransactions];
+    sqlite3_bind_int64(statement, 6, (hasLoadedTransactions ? (sqlite3_int64)block.transactions.count : 0));
+    if (block.skipBlockId) {
+        WSSQLiteBindBytes(statement, 7, block.skipBlockId.bytes, WSHash256Length);
+    }
+    else {
+        sqlite3_bind_null(statement, 7);
+    }
+    const int result = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    WSExceptionCheck(result == SQLITE_DONE, NSInternalInconsistencyException, @"Unable to write block %@ (%s)", blockId, sqlite3_errmsg(self.db));
+
+    if (hasLoadedTransactions) {
+        [self writeTransactions:block.transactions forBlockId:blockId];
+        [self.lazyBlocksById removeObjectForKey:blockId];
+    }
+    else {
+        [self writeTransactions:nil forBlockId:blockId];
+        self.lazyBlocksById[blockId] = block;
+    }
+
+    [self endWrite];
+
+    if (isNew) {
+        ++self.liveCount;
+    }
+    if ([blockId isEqual:self.cachedHead.blockId]) {
+        self.cachedHead = block;
+    }
+}
+
+- (WSStorableBlock *)head
+{
+    return self.cachedHead;
+}
+
+- (void)setHead:(WSStorableBlock *)head
+{
+    WSExceptionCheckIllegal(head);
+
+    if (![self containsBlockId:head.blockId]) {
+        [self putBlock:head];
+    }
+
+    // head and its blocks are committed together (see synchronize)
+    [self beginWrite];
+    [self setMetaValue:head.blockId.data forKey:WSSQLiteMetaKeyHead];
+    [self endWrite];
+
+    self.cachedHead = head;
+}
+
+- (void)removeTail
+{
+    NSAssert(self.liveCount > 0, @"Empty blocks");
+
+    WSHash256 *tailId = self.tailId;
+    NSAssert(tailId, @"Tail is nil, store truncated without resetting?");
+
+    NSArray *childIds = [self childIdsForBlockId:tailId];
+    WSHash256 *nextTailId = [self nextTailIdForTailId:tailId childIds:childIds];
+
+    [self beginWrite];
+
+    [self deleteBlockWithId:tailId];
+    NSUInteger removedCount = 1;
+
+    // side branches forking off old tail would never be reached again
+    for (WSHash256 *childId in childIds) {
+        if (![childId isEqual:nextTailId]) {
+            removedCount += [self deleteBranchAtBlockId:childId];
+        }
+    }
+
+    if (nextTailId) {
+        [self setMetaValue:nextTailId.data forKey:WSSQLiteMetaKeyTail];
+    }
+
+    [self endWrite];
+
+    self.liveCount -= removedCount;
+    self.tailId = nextTailId;
+}
+
+- (void)findAndRestoreTail
+{
+    WSHash256 *blockId = self.cachedHead.blockId;
+    WSHash256 *tailId = nil;
+    while (blockId && [self containsBlockId:blockId]) {
+        tailId = blockId;
+        blockId = [self previousIdForBlockId:blockId];
+    }
+    self.tailId = tailId;
+
+    if (tailId) {
+        [self beginWrite];
+        [self setMetaValue:tailId.data forKey:WSSQLiteMetaKeyTail];
+        [self endWrite];
+    }
+}
+
+- (NSArray *)allBlocks
+{
+    sqlite3_stmt *statement = NULL;
+    if (sqlite3_prepare_v2(self.db, "SELECT id, header, height, work, tx_count, skip_id FROM blocks", -1, &statement, NULL) != SQLITE_OK) {
+        DDLogError(@"Unable to query blocks (%s)", sqlite3_errmsg(self.db));
+        return @[];
+    }
+
+    NSMutableArray *blocks = [[NSMutableArray alloc] initWithCapacity:self.liveCount];
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        WSHash256 *blockId = WSHash256FromData(WSSQLiteColumnData(statement, 0));
+
+        NSError *error;
+        WSStorableBlock *block = [self blockFromStatement:statement blockId:blockId firstColumn:1 error:&error];
+        if (!block) {
+            DDLogError(@"Skipping malformed block %@ (%@)", blockId, error);
+            continue;
+        }
+        [blocks addObject:block];
+    }
+    sqlite3_finalize(statement);
+    return blocks;
+}
+
+- (NSUInteger)size
+{
+    return self.liveCount;
+}
+
+- (void)truncate
+{
+    NSError *error;
+    WSExceptionCheck([self resetWithError:&error], NSInternalInconsistencyException, @"Unable to truncate block store (%@)", error);
+}
+
+#pragma mark Database
+
+- (BOOL)openWithError:(NSError *__autoreleasing *)error
+{
+    self.lazyBlocksById = [[NSMutableDictionary alloc] init];
+
+    sqlite3 *db = NULL;
+    const int result = sqlite3_open_v2(self.path.fileSystemRepresentation, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL);
+    self.db = db;
+    if (result != SQLITE_OK) {
+        WSSQLiteErrorSet(db, error);
+        return NO;
+    }
+
+    if (![self executeSQL:"PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;" error:error]) {
+        return NO;
+    }
+
+    sqlite3_stmt *statement = NULL;
+    int version = 0;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &statement, NULL) != SQLITE_OK) {
+        WSSQLiteErrorSet(db, error);
+        return NO;
+    }
+    if (sqlite3_step(statement) == SQLITE_ROW) {
+        version = sqlite3_column_int(statement, 0);
+    }
+    sqlite3_finalize(statement);
+
+    const BOOL isNew = (version == 0);
+    if (isNew) {
+        DDLogDebug(@"Creating block store at %@", self.path);
+
+        NSString *sql = [NSString stringWithFormat:@"%s PRAGMA user_version = %d;", WSSQLiteBlockStoreSchema, WSSQLiteBlockStoreVersion];
+        if (![self executeSQL:sql.UTF8String error:error]) {
+            return NO;
+        }
+    }
+    else if (version != WSSQLiteBlockStoreVersion) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unsupported block store version (%d != %d)", version, WSSQLiteBlockStoreVersion);
+        return NO;
+    }
+
+    for (int i = 0; i < WSSQLiteStatementCount; ++i) {
+        if (sqlite3_prepare_v2(db, WSSQLiteStatementQueries[i], -1, &_statements[i], NULL) != SQLITE_OK) {
+            WSSQLiteErrorSet(db, error);
+            return NO;
+        }
+    }
+
+    if (isNew) {
+        return [self resetWithError:error];
+    }
+
+    NSData *genesisId = [self metaValueForKey:WSSQLiteMetaKeyGenesis];
+    if (![genesisId isEqualToData:self.genesisBlock.header.blockId.data]) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store belongs to another network");
+        return NO;
+    }
+    NSData *headId = [self metaValueForKey:WSSQLiteMetaKeyHead];
+    NSData *tailId = [self metaValueForKey:WSSQLiteMetaKeyTail];
+    if (!headId) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Block store head is missing");
+        return NO;
+    }
+    NSError *headError;
+    self.cachedHead = [self blockForId:WSHash256FromData(headId) error:&headError];
+    if (!self.cachedHead) {
+        if (headError) {
+            if (error) {
+                *error = headError;
+            }
+        }
+        else {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Block store head is missing");
+        }
+        return NO;
+    }
+    self.tailId = (tailId ? WSHash256FromData(tailId) : nil);
+
+    if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM blocks", -1, &statement, NULL) != SQLITE_OK) {
+        WSSQLiteErrorSet(db, error);
+        return NO;
+    }
+    if (sqlite3_step(statement) == SQLITE_ROW) {
+        self.liveCount = (NSUInteger)sqlite3_column_int64(statement, 0);
+    }
+    sqlite3_finalize(statement);
+
+    DDLogDebug(@"Opened block store at %@ (%lu blocks, head: %u)", self.path, (unsigned long)self.liveCount, self.cachedHead.height);
+    return YES;
+}
+
+- (BOOL)resetWithError:(NSError *__autoreleasing *)error
+{
+    [self beginWrite];
+    if (![self executeSQL:"DELETE FROM transactions; DELETE FROM blocks; DELETE FROM meta;" error:error]) {
+        return NO;
+    }
+    self.liveCount = 0;
+    self.cachedHead = nil;
+    self.tailId = nil;
+    [self.lazyBlocksById removeAllObjects];
+
+    [self setMetaValue:self.genesisBlock.header.blockId.data forKey:WSSQLiteMetaKeyGenesis];
+
+    WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:self.genesisBlock.header transactions:nil height:0];
+    [self putBlock:block];
+    self.head = block;
+    [self setMetaValue:block.blockId.data forKey:WSSQLiteMetaKeyTail];
+    self.tailId = block.blockId;
+
+    [self synchronize];
+    return YES;
+}
+
+- (BOOL)executeSQL:(const char *)sql error:(NSError *__autoreleasing *)error
+{
+    if (sqlite3_exec(self.db, sql, NULL, NULL, NULL) != SQLITE_OK) {
+        WSSQLiteErrorSet(self.db, error);
+        return NO;
+    }
+    return YES;
+}
+
+- (sqlite3_stmt *)statement:(WSSQLiteStatement)statement
+{
+    return _statements[statement];
+}
+
+- (void)beginWrite
+{
+    if (sqlite3_get_autocommit(self.db)) {
+        NSError *error;
+        WSExceptionCheck([self executeSQL:"BEGIN" error:&error], NSInternalInconsistencyException, @"Unable to begin block store transaction (%@)", error);
+    }
+}
+
+// group writes in a single transaction, commit is what actually costs
+- (void)endWrite
+{
+    ++self.pendingWrites;
+    if (self.pendingWrites >= WSSQLiteBlockStoreMaxPendingWrites) {
+        [self synchronize];
+    }
+}
+
+#pragma mark Rows
+
+- (WSStorableBlock *)blockForId:(WSHash256 *)blockId error:(NSError *__autoreleasing *)error
+{
+    if ([blockId isEqual:self.cachedHead.blockId]) {
+        return self.cachedHead;
+    }
+
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementSelectBlock];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+
+    WSStorableBlock *block = nil;
+    if (sqlite3_step(statement) == SQLITE_ROW) {
+        block = [self blockFromStatement:statement blockId:blockId firstColumn:0 error:error];
+    }
+    sqlite3_reset(statement);
+    return block;
+}
+
+- (NSData *)metaValueForKey:(NSString *)key
+{
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementSelectMeta];
+    sqlite3_bind_text(statement, 1, key.UTF8String, -1, SQLITE_TRANSIENT);
+
+    NSData *value = nil;
+    if (sqlite3_step(statement) == SQLITE_ROW) {
+        value = WSSQLiteColumnData(statement, 0);
+    }
+    sqlite3_reset(statement);
+    return value;
+}
+
+- (void)setMetaValue:(NSData *)value forKey:(NSString *)key
+{
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementReplaceMeta];
+    sqlite3_bind_text(statement, 1, key.UTF8String, -1, SQLITE_TRANSIENT);
+    WSSQLiteBindBytes(statement, 2, value.bytes, value.length);
+    const int result = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    WSExceptionCheck(result == SQLITE_DONE, NSInternalInconsistencyException, @"Unable to write block store %@ (%s)", key, sqlite3_errmsg(self.db));
+}
+
+// columns: header, height, work, tx_count, skip_id
+- (WSStorableBlock *)blockFromStatement:(sqlite3_stmt *)statement blockId:(WSHash256 *)blockId firstColumn:(int)firstColumn error:(NSError *__autoreleasing *)error
+{
+    const int headerLength = sqlite3_column_bytes(statement, firstColumn);
+    if (headerLength != WSSQLiteBlockStoreHeaderLength) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unexpected header length (%d != %d)", headerLength, WSSQLiteBlockStoreHeaderLength);
+        return nil;
+    }
+
+    WSBlockHeader *header = WSBlockRecordDecodeHeader(self.parameters, blockId.bytes, sqlite3_column_blob(statement, firstColumn));
+
+    const uint32_t height = (uint32_t)sqlite3_column_int64(statement, firstColumn + 1);
+    NSData *workData = WSSQLiteColumnData(statement, firstColumn + 2);
+    const sqlite3_int64 txCount = sqlite3_column_int64(statement, firstColumn + 3);
+
+    WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:header
+                                                        transactions:((txCount > 0) ? [self transactionsForBlockId:blockId] : nil)
+                                                              height:height
+                                                                work:workData];
+
+    WSStorableBlock *lazyBlock = self.lazyBlocksById[blockId];
+    if (lazyBlock) {
+        [block takeTransactionsFromBlock:lazyBlock];
+    }
+    if ((NSUInteger)sqlite3_column_bytes(statement, firstColumn + 4) == WSHash256Length) {
+        [block restoreSkipBlockId:WSHash256FromData(WSSQLiteColumnData(statement, firstColumn + 4))];
+    }
+    return block;
+}
+
+- (NSOrderedSet *)transactionsForBlockId:(WSHash256 *)blockId
+{
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementSelectTransactions];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+
+    NSMutableOrderedSet *transactions = [[NSMutableOrderedSet alloc] init];
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        WSBuffer *buffer = [[WSBuffer alloc] initWithData:WSSQLiteColumnData(statement, 0)];
+
+        NSError *error;
+        WSSignedTransaction *tx = [[WSSignedTransaction alloc] initWithParameters:self.parameters buffer:buffer from:0 available:buffer.length error:&error];
+        if (!tx) {
+            DDLogError(@"Skipping malformed transaction in block %@ (%@)", blockId, error);
+            continue;
+        }
+        [transactions addObject:tx];
+    }
+    sqlite3_reset(statement);
+    return transactions;
+}
+
+- (void)writeTransactions:(NSOrderedSet *)transactions forBlockId:(WSHash256 *)blockId
+{
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementDeleteTransactions];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+    int result = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    WSExceptionCheck(result == SQLITE_DONE, NSInternalInconsistencyException, @"Unable to remove transactions of block %@ (%s)", blockId, sqlite3_errmsg(self.db));
+
+    statement = [self statement:WSSQLiteStatementInsertTransaction];
+    sqlite3_int64 position = 0;
+    for (WSSignedTransaction *tx in transactions) {
+        NSData *data = [[tx toBuffer] data];
+
+        WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+        sqlite3_bind_int64(statement, 2, position);
+        WSSQLiteBindBytes(statement, 3, tx.txId.bytes, WSHash256Length);
+        WSSQLiteBindBytes(statement, 4, data.bytes, data.length);
+        result = sqlite3_step(statement);
+        sqlite3_reset(statement);
+        WSExceptionCheck(result == SQLITE_DONE, NSInternalInconsistencyException, @"Unable to write transaction %@ (%s)", tx.txId, sqlite3_errmsg(self.db));
+
+        ++position;
+    }
+}
+
+- (BOOL)containsBlockId:(WSHash256 *)blockId
+{
+    return [self containsBlockIdBytes:blockId.bytes];
+}
+
+- (WSHash256 *)previousIdForBlockId:(WSHash256 *)blockId
+{
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementSelectBlock];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+
+    WSHash256 *previousId = nil;
+    if ((sqlite3_step(statement) == SQLITE_ROW) && (sqlite3_column_bytes(statement, 0) == WSSQLiteBlockStoreHeaderLength)) {
+
+        // previous block id lies at offset 4 of the serialized header
+        const uint8_t *bytes = sqlite3_column_blob(statement, 0);
+        previousId = WSHash256FromData([NSData dataWithBytes:(bytes + sizeof(uint32_t)) length:WSHash256Length]);
+    }
+    sqlite3_reset(statement);
+    return previousId;
+}
+
+- (NSArray *)childIdsForBlockId:(WSHash256 *)blockId
+{
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementSelectChildren];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+
+    NSMutableArray *childIds = [[NSMutableArray alloc] initWithCapacity:1];
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        [childIds addObject:WSHash256FromData(WSSQLiteColumnData(statement, 0))];
+    }
+    sqlite3_reset(statement);
+    return childIds;
+}
+
+//
+// tail usually has a single child, otherwise fall back
+// to walking back from head like WSMemoryBlockStore
+//
+- (WSHash256 *)nextTailIdForTailId:(WSHash256 *)tailId childIds:(NSArray *)childIds
+{
+    if (childIds.count <= 1) {
+        return [childIds firstObject];
+    }
+
+    WSHash256 *blockId = self.cachedHead.blockId;
+    WSHash256 *nextId = nil;
+    while (blockId && ![blockId isEqual:tailId]) {
+        nextId = blockId;
+        blockId = [self previousIdForBlockId:blockId];
+    }
+    return nextId;
+}
+
+- (void)deleteBlockWithId:(WSHash256 *)blockId
+{
+    [self writeTransactions:nil forBlockId:blockId];
+    [self.lazyBlocksById removeObjectForKey:blockId];
+
+    sqlite3_stmt *statement = [self statement:WSSQLiteStatementDeleteBlock];
+    WSSQLiteBindBytes(statement, 1, blockId.bytes, WSHash256Length);
+    const int result = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    WSExceptionCheck(result == SQLITE_DONE, NSInternalInconsistencyException, @"Unable to remove block %@ (%s)", blockId, sqlite3_errmsg(self.db));
+}
+
+// returns number of removed blocks
+- (NSUInteger)deleteBranchAtBlockId:(WSHash256 *)blockId
+{
+    NSMutableArray *pendingIds = [[NSMutableArray alloc] initWithObjects:blockId, nil];
+    NSUInteger count = 0;
+    while (pendingIds.count > 0) {
+        WSHash256 *nextId = [pendingIds lastObject];
+        [pendingIds removeLastObject];
+        [pendingIds addObjectsFromArray:[self childIdsForBlockId:nextId]];
+
+        [self deleteBlockWithId:nextId];
+        ++count;
+    }
+
+    DDLogDebug(@"Pruned %lu side blocks below tail", (unsigned long)count);
+    return count;
+}
+
+@end
+
+#pragma mark -
+
+static void WSSQLiteErrorSet(sqlite3 *db, NSError **error)
+{
+    if (error) {
+        NSString *message = (db ? @(sqlite3_errmsg(db)) : @"Out of memory");
+        *error = [NSError errorWithDomain:WSSQLiteBlockStoreErrorDomain
+                                     code:(db ? sqlite3_extended_errcode(db) : SQLITE_NOMEM)
+                                 userInfo:@{NSLocalizedDescriptionKey: message}];
+    }
+}
+
+static inline void WSSQLiteBindBytes(sqlite3_stmt *statement, int index, const void *bytes, NSUInteger length)
+{
+    // empty blobs must not be bound as NULL
+    sqlite3_bind_blob(statement, index, (bytes ? bytes : ""), (int)length, SQLITE_TRANSIENT);
+}
+
+static inline NSData *WSSQLiteColumnData(sqlite3_stmt *statement, int column)
+{
+    return [NSData dataWithBytes:sqlite3_column_blob(statement, column) length:(NSUInteger)sqlite3_column_bytes(statement, column)];
+}
@@ -33,6 +33,9 @@
 
 - (WSStorableBlock *)previousBlockInChain:(WSBlockChain *)blockChain;
 - (WSStorableBlock *)previousBlockInChain:(WSBlockChain *)blockChain maxStep:(NSUInteger)maxStep lastPreviousBlock:(WSStorableBlock **)lastPreviousBlock;
+- (WSStorableBlock *)ancestorAtHeight:(uint32_t)height inChain:(WSBlockChain *)blockChain;
+- (void)buildSkipInChain:(WSBlockChain *)blockChain;
+- (void)restoreSkipBlockId:(WSHash256 *)skipBlockId; // for stores persisting skip pointers
 - (BOOL)isBehindBlock:(WSStorableBlock *)block inChain:(WSBlockChain *)blockChain;
 - (BOOL)isOrphanInChain:(WSBlockChain *)blockChain;
 - (BOOL)validateTargetInChain:(WSBlockChain *)blockChain error:(NSError **)error;
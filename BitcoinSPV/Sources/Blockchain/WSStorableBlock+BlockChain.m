@@ -23,15 +23,38 @@
 //  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#import <openssl/bn.h>
-
 #import "WSStorableBlock+BlockChain.h"
 #import "WSBlockChain.h"
 #import "WSBlockHeader.h"
 #import "WSParameters.h"
 #import "WSErrors.h"
 #import "WSMacrosCore.h"
-#import "WSMacrosPrivate.h"
+#import "WSUInt256.h"
+#import "WSBitcoinConstants.h"
+
+// skip heights as in bitcoin/src/chain.cpp
+
+static inline uint32_t WSBlockInvertLowestOne(uint32_t n)
+{
+    return n & (n - 1);
+}
+
+static inline uint32_t WSBlockSkipHeight(uint32_t height)
+{
+    if (height < 2) {
+        return 0;
+    }
+
+    // any number strictly lower than height is acceptable, but the
+    // following expression seems to perform well in simulations
+    return ((height & 1) ? WSBlockInvertLowestOne(WSBlockInvertLowestOne(height - 1)) + 1 : WSBlockInvertLowestOne(height));
+}
+
+@interface WSStorableBlock ()
+
+- (void)setSkipBlockId:(WSHash256 *)skipBlockId;
+
+@end
 
 @implementation WSStorableBlock (BlockChain)
 
@@ -62,11 +85,72 @@
     return previousBlock;
 }
 
+- (WSStorableBlock *)ancestorAtHeight:(uint32_t)height inChain:(WSBlockChain *)blockChain
+{
+    WSExceptionCheckIllegal(blockChain);
+
+    if ((self.height == WSBlockUnknownHeight) || (height > self.height)) {
+        return nil;
+    }
+
+    WSStorableBlock *walk = self;
+    uint32_t heightWalk = self.height;
+    while (walk && (heightWalk > height)) {
+
+        // reached main chain, ancestor is indexed by height
+        if ([[blockChain blockAtHeight:heightWalk] isEqual:walk]) {
+            return [blockChain blockAtHeight:height];
+        }
+
+        const uint32_t heightSkip = WSBlockSkipHeight(heightWalk);
+        const uint32_t heightSkipPrev = WSBlockSkipHeight(heightWalk - 1);
+        WSStorableBlock *skip = nil;
+
+        // only follow skip when previous skip isn't better
+        if (walk.skipBlockId &&
+            ((heightSkip == height) ||
+             ((heightSkip > height) && !(((int64_t)heightSkipPrev < (int64_t)heightSkip - 2) && (heightSkipPrev >= height))))) {
+
+            skip = [blockChain blockForId:walk.skipBlockId];
+        }
+        if (skip) {
+            walk = skip;
+            heightWalk = heightSkip;
+        }
+        else {
+            walk = [walk previousBlockInChain:blockChain];
+            --heightWalk;
+        }
+    }
+    return walk;
+}
+
+- (void)buildSkipInChain:(WSBlockChain *)blockChain
+{
+    WSExceptionCheckIllegal(blockChain);
+
+    if ((self.height == WSBlockUnknownHeight) || (self.height < 2)) {
+        return;
+    }
+    WSStorableBlock *previousBlock = [self previousBlockInChain:blockChain];
+    WSStorableBlock *skip = [previousBlock ancestorAtHeight:WSBlockSkipHeight(self.height) inChain:blockChain];
+    self.skipBlockId = skip.blockId;
+}
+
+- (void)restoreSkipBlockId:(WSHash256 *)skipBlockId
+{
+    self.skipBlockId = skipBlockId;
+}
+
 - (BOOL)isBehindBlock:(WSStorableBlock *)block inChain:(WSBlockChain *)blockChain
 {
     WSExceptionCheckIllegal(block);
     WSExceptionCheckIllegal(blockChain);
-    
+
+    if ((self.height != WSBlockUnknownHeight) && (block.height != WSBlockUnknownHeight)) {
+        return [[block ancestorAtHeight:self.height inChain:blockChain] isEqual:self];
+    }
+
     WSStorableBlock *ancestor = block;
     while (ancestor && ![ancestor.blockId isEqual:self.blockId]) {
         ancestor = [ancestor previousBlockInChain:blockChain];
@@ -101,10 +185,18 @@
         return YES;
     }
     
-    WSStorableBlock *retargetBlock = previousBlock;
+    WSStorableBlock *retargetBlock = nil;
     const uint32_t retargetInterval = [self.parameters retargetInterval];
-    for (NSUInteger i = 1; i < retargetInterval; ++i) {
-        retargetBlock = [retargetBlock previousBlockInChain:blockChain];
+
+    // main chain extension, pick retarget block by height
+    if ([[blockChain blockAtHeight:previousBlock.height] isEqual:previousBlock]) {
+        retargetBlock = [blockChain blockAtHeight:(self.height - retargetInterval)];
+    }
+    else {
+        retargetBlock = previousBlock;
+        for (NSUInteger i = 1; i < retargetInterval; ++i) {
+            retargetBlock = [retargetBlock previousBlockInChain:blockChain];
+        }
     }
     if (!retargetBlock) {
         WSErrorSet(error, WSErrorCodeInvalidBlock, @"Incomplete chain, last retarget block not found at height %u", self.height - retargetInterval + 1);
@@ -129,37 +221,20 @@
         span = maxRetargetTimespan;
     }
     
-    BIGNUM *bnTarget = BN_new();
-    BIGNUM *bnMaxTarget = BN_new();
-    BIGNUM *bnSpan = BN_new();
-    BIGNUM *bnRetargetSpan = BN_new();
-    BIGNUM *bnTargetXSpan = BN_new();
+    WSUInt256 target;
+    WSUInt256 maxTarget;
     
-    BN_CTX *ctx = BN_CTX_new();
-    BN_CTX_start(ctx);
-    
-    WSBlockSetBits(bnTarget, retargetBlock.header.bits);
-    WSBlockSetBits(bnMaxTarget, [self.parameters maxProofOfWork]);
-    BN_set_word(bnSpan, span);
-    BN_set_word(bnRetargetSpan, [self.parameters retargetTimespan]);
-    BN_mul(bnTargetXSpan, bnTarget, bnSpan, ctx);
-    BN_div(bnTarget, NULL, bnTargetXSpan, bnRetargetSpan, ctx);
+    WSUInt256SetCompact(&target, retargetBlock.header.bits, NULL, NULL);
+    WSUInt256SetCompact(&maxTarget, [self.parameters maxProofOfWork], NULL, NULL);
+    WSUInt256MultiplyUInt64(&target, &target, span);
+    WSUInt256DivideUInt64(&target, &target, [self.parameters retargetTimespan]);
     
     // cap target to max target
-    if (BN_cmp(bnTarget, bnMaxTarget) > 0) {
-        BN_copy(bnTarget, bnMaxTarget);
+    if (WSUInt256Compare(&target, &maxTarget) > 0) {
+        target = maxTarget;
     }
     
-    const uint32_t expectedBits = WSBlockGetBits(bnTarget);
-    
-    BN_CTX_end(ctx);
-    BN_CTX_free(ctx);
-    
-    BN_clear_free(bnTarget);
-    BN_clear_free(bnMaxTarget);
-    BN_clear_free(bnSpan);
-    BN_clear_free(bnRetargetSpan);
-    BN_clear_free(bnTargetXSpan);
+    const uint32_t expectedBits = WSUInt256GetCompact(&target);
     
     if (self.header.bits != expectedBits) {
         WSErrorSet(error, WSErrorCodeInvalidBlock, @"Unexpected target at height %u (%x != %x)",
@@ -56,4 +56,7 @@
 - (NSString *)workString;
 - (BOOL)verifyWithError:(NSError **)error;
 
+// proof-of-work is verified concurrently, linkage in order
++ (BOOL)verifyHeaders:(NSArray *)headers error:(NSError **)error; // WSBlockHeader
+
 @end
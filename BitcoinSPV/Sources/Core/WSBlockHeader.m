@@ -23,13 +23,13 @@
 //  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#import <openssl/bn.h>
-
 #import "WSBlockHeader.h"
 #import "WSBitcoinConstants.h"
 #import "WSMacrosCore.h"
 #import "WSMacrosPrivate.h"
+#import "WSUInt256.h"
 #import "WSErrors.h"
+#import "WSConfig.h"
 #import "NSData+Hash.h"
 
 @interface WSBlockHeader ()
@@ -45,7 +45,6 @@
 @property (nonatomic, strong) WSHash256 *blockId;
 
 - (WSHash256 *)computeBlockId;
-+ (BIGNUM *)largestHash;
 
 @end
 
@@ -123,60 +122,43 @@
 
 - (NSData *)workData
 {
-    BIGNUM *bnWork = BN_new();
-    BIGNUM *bnTargetPlusOne = BN_new();
-
-    BN_CTX *ctx = BN_CTX_new();
-    BN_CTX_start(ctx);
-    WSBlockSetBits(bnTargetPlusOne, self.bits);
-    BN_add(bnTargetPlusOne, bnTargetPlusOne, BN_value_one());
-    BN_div(bnWork, NULL, [[self class] largestHash], bnTargetPlusOne, ctx);
-    BN_CTX_end(ctx);
-    BN_CTX_free(ctx);
-
-    NSMutableData *workData = [[NSMutableData alloc] initWithLength:BN_num_bytes(bnWork)];
-    BN_bn2bin(bnWork, workData.mutableBytes);
-
-    BN_clear_free(bnWork);
-    BN_clear_free(bnTargetPlusOne);
-
-    return workData;
+    WSUInt256 work;
+    WSUInt256SetWorkFromCompact(&work, self.bits);
+    return WSUInt256Data(&work);
 }
 
 - (NSString *)workString
 {
-    BIGNUM *work = BN_new();
-    
-    WSBlockWorkFromData(work, self.workData);
-    NSString *workString = [[NSString alloc] initWithCString:BN_bn2dec(work) encoding:NSUTF8StringEncoding];
-    BN_clear_free(work);
-    
-    return workString;
+    WSUInt256 work;
+    WSUInt256SetWorkFromCompact(&work, self.bits);
+    return WSUInt256DecimalString(&work);
 }
 
 - (BOOL)verifyWithError:(NSError *__autoreleasing *)error
 {
     BOOL verificationFailed = NO;
-    BIGNUM *target = BN_new();
-    BIGNUM *maxTarget = BN_new();
-    BIGNUM *hash = BN_new();
+    WSUInt256 target;
+    WSUInt256 maxTarget;
+    WSUInt256 hash;
+    BOOL negative;
+    BOOL overflow;
 
-    WSBlockSetBits(target, self.bits);
-    WSBlockSetBits(maxTarget, [self.parameters maxProofOfWork]);
+    WSUInt256SetCompact(&target, self.bits, &negative, &overflow);
+    WSUInt256SetCompact(&maxTarget, [self.parameters maxProofOfWork], NULL, NULL);
 
     // range out of [1, maxProofOfWork]
-    if ((BN_cmp(target, BN_value_one()) < 0) || (BN_cmp(target, maxTarget) > 0)) {
+    if (negative || overflow || WSUInt256IsZero(&target) || (WSUInt256Compare(&target, &maxTarget) > 0)) {
         WSErrorSet(error, WSErrorCodeInvalidBlock, @"Target out of range (%x)", self.bits);
         verificationFailed = YES;
     }
 
     // invalid proof-of-work (smaller values are more difficult)
     if (!verificationFailed) {
-        WSBlockSetHash(hash, self.blockId);
+        WSUInt256SetHashBytes(&hash, self.blockId.bytes);
 
-        if (BN_cmp(hash, target) > 0) {
+        if (WSUInt256Compare(&hash, &target) > 0) {
             WSErrorSet(error, WSErrorCodeInvalidBlock, @"Block less difficult (greater) than target (%x > %x)",
-                       WSBlockGetBits(hash), self.bits);
+                       WSUInt256GetCompact(&hash), self.bits);
 
             verificationFailed = YES;
         }
@@ -196,22 +178,58 @@
         }
     }
     
-    BN_clear_free(target);
-    BN_clear_free(maxTarget);
-    BN_clear_free(hash);
-
     return !verificationFailed;
 }
 
-+ (BIGNUM *)largestHash
++ (BOOL)verifyHeaders:(NSArray *)headers error:(NSError *__autoreleasing *)error
 {
-    static BIGNUM *largest = NULL;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        largest = BN_new();
-        BN_set_bit(largest, 256);
+    NSParameterAssert(headers);
+    
+    const NSUInteger count = headers.count;
+    const size_t batches = (count + WSBlockHeaderConcurrentBatchSize - 1) / WSBlockHeaderConcurrentBatchSize;
+    NSUInteger *failedIndexes = malloc(batches * sizeof(NSUInteger));
+
+    // independent checks, each batch records its first failure
+    dispatch_apply(batches, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t batch) {
+        const NSUInteger start = batch * WSBlockHeaderConcurrentBatchSize;
+        const NSUInteger end = MIN(start + WSBlockHeaderConcurrentBatchSize, count);
+
+        failedIndexes[batch] = NSNotFound;
+        for (NSUInteger i = start; i < end; ++i) {
+            if (![headers[i] verifyWithError:NULL]) {
+                failedIndexes[batch] = i;
+                break;
+            }
+        }
     });
-    return largest;
+
+    NSUInteger failedIndex = NSNotFound;
+    for (size_t batch = 0; batch < batches; ++batch) {
+        if (failedIndexes[batch] != NSNotFound) {
+            failedIndex = failedIndexes[batch];
+            break;
+        }
+    }
+    free(failedIndexes);
+
+    // repeat first failure to report error
+    if (failedIndex != NSNotFound) {
+        [headers[failedIndex] verifyWithError:error];
+        return NO;
+    }
+
+    // sequential linkage
+    for (NSUInteger i = 1; i < count; ++i) {
+        WSBlockHeader *previousHeader = headers[i - 1];
+        WSBlockHeader *header = headers[i];
+        if (![header.previousBlockId isEqual:previousHeader.blockId]) {
+            WSErrorSet(error, WSErrorCodeInvalidBlock, @"Non-contiguous headers at index %lu (%@ -> %@)",
+                       (unsigned long)i, header.previousBlockId, previousHeader.blockId);
+            return NO;
+        }
+    }
+    
+    return YES;
 }
 
 - (BOOL)isEqual:(id)object
@@ -37,6 +37,7 @@
 
 - (instancetype)init;
 - (instancetype)initWithData:(NSData *)data;
+- (instancetype)initWithBytesNoCopy:(const void *)bytes length:(NSUInteger)length; // borrowed, bytes must outlive buffer
 - (NSData *)data;
 
 - (uint8_t)uint8AtOffset:(NSUInteger)offset;
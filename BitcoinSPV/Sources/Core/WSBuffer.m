@@ -63,6 +63,16 @@
     return self;
 }
 
+- (instancetype)initWithBytesNoCopy:(const void *)bytes length:(NSUInteger)length
+{
+    WSExceptionCheckIllegal(bytes || (length == 0));
+    
+    if ((self = [super init])) {
+        self.mutableData = [[NSMutableData alloc] initWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO];
+    }
+    return self;
+}
+
 - (instancetype)initWithCapacity:(NSUInteger)capacity
 {
     if ((self = [super init])) {
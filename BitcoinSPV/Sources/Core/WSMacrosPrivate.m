@@ -24,6 +24,7 @@
 //
 
 #import "WSMacrosPrivate.h"
+#import "WSUInt256.h"
 
 #pragma mark - Blocks
 
@@ -36,55 +37,34 @@
 // difficulty = maxTarget / target > 1.0
 // maxDifficulty = maxTarget / maxTarget = 1.0
 //
-static inline void WSBlockGetDifficultyInteger(WSParameters *parameters, BIGNUM *diffInteger, BIGNUM *diffFraction, const BIGNUM *target)
+static inline void WSBlockGetDifficultyInteger(WSParameters *parameters, WSUInt256 *diffInteger, uint32_t bits)
 {
     NSCParameterAssert(parameters);
     
-    BIGNUM *maxTarget = BN_new();
+    WSUInt256 target;
+    WSUInt256 maxTarget;
     
-    WSBlockSetBits(maxTarget, [parameters maxProofOfWork]);
-    
-    BN_CTX *ctx = BN_CTX_new();
-    BN_CTX_start(ctx);
-    BN_div(diffInteger, diffFraction, maxTarget, target, ctx);
-    BN_CTX_end(ctx);
-    BN_CTX_free(ctx);
-    
-    BN_clear_free(maxTarget);
+    WSUInt256SetCompact(&target, bits, NULL, NULL);
+    WSUInt256SetCompact(&maxTarget, [parameters maxProofOfWork], NULL, NULL);
+    if (WSUInt256IsZero(&target)) {
+        WSUInt256SetZero(diffInteger);
+        return;
+    }
+    WSUInt256Divide(diffInteger, &maxTarget, &target);
 }
 
 NSData *WSBlockGetDifficultyFromBits(WSParameters *parameters, uint32_t bits)
 {
-    BIGNUM *target = BN_new();
-    BIGNUM *diffInteger = BN_new();
-    BIGNUM *diffFraction = BN_new();
-    
-    WSBlockSetBits(target, bits);
-    WSBlockGetDifficultyInteger(parameters, diffInteger, diffFraction, target);
-    NSData *difficulty = WSBlockDataFromWork(diffInteger);
+    WSUInt256 diffInteger;
     
-    BN_clear_free(target);
-    BN_clear_free(diffInteger);
-    BN_clear_free(diffFraction);
-    
-    return difficulty;
+    WSBlockGetDifficultyInteger(parameters, &diffInteger, bits);
+    return WSUInt256Data(&diffInteger);
 }
 
 NSString *WSBlockGetDifficultyStringFromBits(WSParameters *parameters, uint32_t bits)
 {
-    BIGNUM *target = BN_new();
-    BIGNUM *diffInteger = BN_new();
-//    BIGNUM *diffFraction = BN_new();
-    
-    WSBlockSetBits(target, bits);
-//    WSBlockGetDifficultyInteger(diffInteger, diffFraction, target);
-//    NSString *string = [NSString stringWithFormat:@"%s.%s", BN_bn2dec(diffInteger), BN_bn2dec(diffFraction)];
-    WSBlockGetDifficultyInteger(parameters, diffInteger, NULL, target);
-    NSString *string = [NSString stringWithUTF8String:BN_bn2dec(diffInteger)];
-    
-    BN_clear_free(target);
-    BN_clear_free(diffInteger);
-//    BN_clear_free(diffFraction);
+    WSUInt256 diffInteger;
     
-    return string;
+    WSBlockGetDifficultyInteger(parameters, &diffInteger, bits);
+    return WSUInt256DecimalString(&diffInteger);
 }
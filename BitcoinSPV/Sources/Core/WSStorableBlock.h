@@ -42,12 +42,18 @@
 - (instancetype)initWithHeader:(WSBlockHeader *)header transactions:(NSOrderedSet *)transactions height:(uint32_t)height;
 - (instancetype)initWithHeader:(WSBlockHeader *)header transactions:(NSOrderedSet *)transactions height:(uint32_t)height work:(NSData *)work;
 
+// transactionsLoader is invoked once on first access to transactions
+- (instancetype)initWithHeader:(WSBlockHeader *)header transactionsLoader:(NSOrderedSet *(^)(void))transactionsLoader height:(uint32_t)height work:(NSData *)work;
+
 - (WSParameters *)parameters;
 - (WSBlockHeader *)header;
 - (uint32_t)height;
 - (NSData *)workData;
 - (NSString *)workString;
 - (NSOrderedSet *)transactions; // WSSignedTransaction
+- (BOOL)hasLoadedTransactions; // NO while transactionsLoader is pending
+- (void)takeTransactionsFromBlock:(WSStorableBlock *)block; // same block id, doesn't trigger a pending load
+- (WSHash256 *)skipBlockId; // ancestor at WSBlockSkipHeight(height), if any
 
 - (WSHash256 *)blockId;
 - (WSHash256 *)previousBlockId;
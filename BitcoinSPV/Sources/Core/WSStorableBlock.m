@@ -23,7 +23,6 @@
 //  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#import <openssl/bn.h>
 #import "AutoCoding.h"
 
 #import "WSStorableBlock.h"
@@ -33,15 +32,17 @@
 #import "WSPartialMerkleTree.h"
 #import "WSBitcoinConstants.h"
 #import "WSMacrosCore.h"
-#import "WSMacrosPrivate.h"
+#import "WSUInt256.h"
 #import "WSErrors.h"
 
 @interface WSStorableBlock ()
 
 @property (nonatomic, strong) WSBlockHeader *header;
 @property (nonatomic, assign) uint32_t height;
-@property (nonatomic, unsafe_unretained) BIGNUM *work;
+@property (nonatomic, assign) WSUInt256 work;
 @property (nonatomic, strong) NSOrderedSet *transactions; // WSSignedTransaction
+@property (nonatomic, strong) WSHash256 *skipBlockId;
+@property (nonatomic, copy) NSOrderedSet *(^transactionsLoader)(void);
 
 - (instancetype)initWithHeader:(WSBlockHeader *)header transactions:(NSOrderedSet *)transactions previousBlock:(WSStorableBlock *)previousBlock;
 
@@ -67,9 +68,20 @@
         self.header = header;
         self.transactions = transactions;
         self.height = height;
-        self.work = BN_new();
-        
-        WSBlockWorkFromData(self.work, work);
+
+        WSUInt256 blockWork;
+        WSUInt256SetData(&blockWork, work);
+        self.work = blockWork;
+    }
+    return self;
+}
+
+- (instancetype)initWithHeader:(WSBlockHeader *)header transactionsLoader:(NSOrderedSet *(^)(void))transactionsLoader height:(uint32_t)height work:(NSData *)work
+{
+    WSExceptionCheckIllegal(transactionsLoader);
+
+    if ((self = [self initWithHeader:header transactions:nil height:height work:work])) {
+        self.transactionsLoader = transactionsLoader;
     }
     return self;
 }
@@ -82,13 +94,11 @@
         self.header = header;
         self.transactions = transactions;
         self.height = WSBlockUnknownHeight;
-        self.work = BN_new();
-        NSAssert(self.work, @"Unable to allocate work BIGNUM");
-        
+
         // start from own work
-        NSData *workData = [header workData];
-        BN_bin2bn(workData.bytes, (int)workData.length, self.work);
-        
+        WSUInt256 blockWork;
+        WSUInt256SetWorkFromCompact(&blockWork, header.bits);
+
         // accumulate previous block work (if any)
         if (previousBlock) {
             if (previousBlock.height == WSBlockUnknownHeight) {
@@ -97,26 +107,78 @@
             else {
                 self.height = previousBlock.height + 1;
             }
-            BN_add(self.work, self.work, previousBlock.work);
+            const WSUInt256 previousWork = previousBlock.work;
+            WSUInt256Add(&blockWork, &blockWork, &previousWork);
         }
+        self.work = blockWork;
     }
     return self;
 }
 
-- (void)dealloc
+//
+// loader runs outside the lock because it may wait on a queue that is
+// itself reading this block (e.g. a Core Data save), concurrent callers
+// may both load but only the first result is kept
+//
+- (NSOrderedSet *)transactions
+{
+    NSOrderedSet *(^transactionsLoader)(void) = nil;
+    @synchronized (self) {
+        transactionsLoader = _transactionsLoader;
+        if (!transactionsLoader) {
+            return _transactions;
+        }
+    }
+
+    NSOrderedSet *transactions = transactionsLoader();
+
+    @synchronized (self) {
+        if (_transactionsLoader == transactionsLoader) {
+            _transactions = transactions;
+            _transactionsLoader = nil;
+        }
+        return _transactions;
+    }
+}
+
+- (BOOL)hasLoadedTransactions
+{
+    @synchronized (self) {
+        return (_transactionsLoader == nil);
+    }
+}
+
+- (void)takeTransactionsFromBlock:(WSStorableBlock *)block
 {
-    BN_clear_free(self.work);
-    self.work = NULL;
+    WSExceptionCheckIllegal(block);
+    NSAssert([block.blockId isEqual:self.blockId], @"Taking transactions from another block (%@ != %@)", block.blockId, self.blockId);
+
+    NSOrderedSet *transactions = nil;
+    NSOrderedSet *(^transactionsLoader)(void) = nil;
+    if ([block hasLoadedTransactions]) {
+        transactions = block.transactions;
+    }
+    else {
+        transactionsLoader = ^NSOrderedSet *{
+            return block.transactions;
+        };
+    }
+    @synchronized (self) {
+        _transactions = transactions;
+        _transactionsLoader = [transactionsLoader copy];
+    }
 }
 
 - (NSData *)workData
 {
-    return WSBlockDataFromWork(self.work);
+    const WSUInt256 work = self.work;
+    return WSUInt256Data(&work);
 }
 
 - (NSString *)workString
 {
-    return [NSString stringWithUTF8String:BN_bn2dec(self.work)];
+    const WSUInt256 work = self.work;
+    return WSUInt256DecimalString(&work);
 }
 
 - (BOOL)isEqual:(id)object
@@ -165,7 +227,9 @@
 
 - (BOOL)hasMoreWorkThanBlock:(WSStorableBlock *)block
 {
-    return (BN_cmp(self.work, block.work) > 0);
+    const WSUInt256 work = self.work;
+    const WSUInt256 otherWork = block.work;
+    return (WSUInt256Compare(&work, &otherWork) > 0);
 }
 
 - (WSStorableBlock *)buildNextBlockFromHeader:(WSBlockHeader *)header transactions:(NSOrderedSet *)transactions
@@ -217,7 +281,8 @@
 
 - (NSUInteger)estimatedSize
 {
-    const NSUInteger workLength = BN_num_bytes(self.work);
+    const WSUInt256 work = self.work;
+    const NSUInteger workLength = (WSUInt256Bits(&work) + 7) / 8;
     const NSUInteger workLengthLength = WSBufferVarIntSize(workLength);
     
     return WSBlockHeaderSize + sizeof(uint32_t) + workLengthLength + workLength;
@@ -240,8 +305,9 @@
 - (id)initWithCoder:(NSCoder *)aDecoder
 {
     if ((self = [super initWithCoder:aDecoder])) {
-        self.work = BN_new();
-        WSBlockWorkFromData(self.work, [aDecoder decodeDataObject]);
+        WSUInt256 work;
+        WSUInt256SetData(&work, [aDecoder decodeDataObject]);
+        self.work = work;
     }
     return self;
 }
@@ -250,7 +316,7 @@
 {
     [super encodeWithCoder:aCoder];
  
-    [aCoder encodeDataObject:WSBlockDataFromWork(self.work)];
+    [aCoder encodeDataObject:self.workData];
 }
 
 + (NSDictionary *)codableProperties
@@ -0,0 +1,114 @@
+//
+//  WSUInt256.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+//
+// allocation-free 256-bit unsigned integer for work and targets,
+// operations are modulo 2^256 and results may alias operands
+//
+// adapted from: https://github.com/bitcoin/bitcoin/blob/master/src/arith_uint256.cpp
+//
+
+#define WSUInt256Words      8
+
+typedef struct {
+    uint32_t words[WSUInt256Words]; // least significant first
+} WSUInt256;
+
+static inline void WSUInt256SetZero(WSUInt256 *n)
+{
+    memset(n->words, 0, sizeof(n->words));
+}
+
+static inline void WSUInt256SetUInt64(WSUInt256 *n, uint64_t value)
+{
+    WSUInt256SetZero(n);
+    n->words[0] = (uint32_t)value;
+    n->words[1] = (uint32_t)(value >> 32);
+}
+
+static inline BOOL WSUInt256IsZero(const WSUInt256 *n)
+{
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        if (n->words[i] != 0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+static inline int WSUInt256Compare(const WSUInt256 *a, const WSUInt256 *b)
+{
+    for (int i = WSUInt256Words - 1; i >= 0; --i) {
+        if (a->words[i] < b->words[i]) {
+            return -1;
+        }
+        if (a->words[i] > b->words[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline void WSUInt256Add(WSUInt256 *r, const WSUInt256 *a, const WSUInt256 *b)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        const uint64_t n = carry + a->words[i] + b->words[i];
+        r->words[i] = (uint32_t)n;
+        carry = n >> 32;
+    }
+}
+
+static inline void WSUInt256Subtract(WSUInt256 *r, const WSUInt256 *a, const WSUInt256 *b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        const uint64_t n = (uint64_t)a->words[i] - b->words[i] - borrow;
+        r->words[i] = (uint32_t)n;
+        borrow = (n >> 32) & 1;
+    }
+}
+
+unsigned WSUInt256Bits(const WSUInt256 *n);
+void WSUInt256ShiftLeft(WSUInt256 *r, const WSUInt256 *a, unsigned shift);
+void WSUInt256ShiftRight(WSUInt256 *r, const WSUInt256 *a, unsigned shift);
+void WSUInt256MultiplyUInt64(WSUInt256 *r, const WSUInt256 *a, uint64_t b);
+void WSUInt256Divide(WSUInt256 *q, const WSUInt256 *a, const WSUInt256 *b);
+void WSUInt256DivideUInt64(WSUInt256 *q, const WSUInt256 *a, uint64_t b);
+
+// see WSBlockSetBits/WSBlockGetBits
+void WSUInt256SetCompact(WSUInt256 *n, uint32_t bits, BOOL *negative, BOOL *overflow);
+uint32_t WSUInt256GetCompact(const WSUInt256 *n);
+
+// floor(2^256 / (target + 1)), zero for invalid targets
+void WSUInt256SetWorkFromCompact(WSUInt256 *work, uint32_t bits);
+
+// hash bytes are little endian, data is big endian with no leading zeros
+void WSUInt256SetHashBytes(WSUInt256 *n, const void *bytes);
+void WSUInt256SetData(WSUInt256 *n, NSData *data);
+NSData *WSUInt256Data(const WSUInt256 *n);
+NSString *WSUInt256DecimalString(const WSUInt256 *n);
@@ -0,0 +1,264 @@
+//
+//  WSUInt256.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSUInt256.h"
+
+unsigned WSUInt256Bits(const WSUInt256 *n)
+{
+    for (int i = WSUInt256Words - 1; i >= 0; --i) {
+        if (n->words[i] == 0) {
+            continue;
+        }
+        for (int bit = 31; bit > 0; --bit) {
+            if (n->words[i] & (1U << bit)) {
+                return 32 * i + bit + 1;
+            }
+        }
+        return 32 * i + 1;
+    }
+    return 0;
+}
+
+void WSUInt256ShiftLeft(WSUInt256 *r, const WSUInt256 *a, unsigned shift)
+{
+    WSUInt256 x = *a;
+    const unsigned k = shift / 32;
+    shift %= 32;
+
+    WSUInt256SetZero(r);
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        if ((i + k + 1 < WSUInt256Words) && (shift != 0)) {
+            r->words[i + k + 1] |= (x.words[i] >> (32 - shift));
+        }
+        if (i + k < WSUInt256Words) {
+            r->words[i + k] |= (x.words[i] << shift);
+        }
+    }
+}
+
+void WSUInt256ShiftRight(WSUInt256 *r, const WSUInt256 *a, unsigned shift)
+{
+    WSUInt256 x = *a;
+    const unsigned k = shift / 32;
+    shift %= 32;
+
+    WSUInt256SetZero(r);
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        if ((i - (int)k - 1 >= 0) && (shift != 0)) {
+            r->words[i - k - 1] |= (x.words[i] << (32 - shift));
+        }
+        if (i - (int)k >= 0) {
+            r->words[i - k] |= (x.words[i] >> shift);
+        }
+    }
+}
+
+void WSUInt256MultiplyUInt64(WSUInt256 *r, const WSUInt256 *a, uint64_t b)
+{
+    const uint32_t factors[2] = {(uint32_t)b, (uint32_t)(b >> 32)};
+    WSUInt256 x = *a;
+
+    WSUInt256SetZero(r);
+    for (int j = 0; j < 2; ++j) {
+        uint64_t carry = 0;
+        for (int i = 0; i + j < WSUInt256Words; ++i) {
+            const uint64_t n = carry + r->words[i + j] + (uint64_t)x.words[i] * factors[j];
+            r->words[i + j] = (uint32_t)n;
+            carry = n >> 32;
+        }
+    }
+}
+
+void WSUInt256Divide(WSUInt256 *q, const WSUInt256 *a, const WSUInt256 *b)
+{
+    NSCParameterAssert(!WSUInt256IsZero(b));
+
+    WSUInt256 num = *a;
+    WSUInt256 div = *b;
+    const unsigned numBits = WSUInt256Bits(&num);
+    const unsigned divBits = WSUInt256Bits(&div);
+
+    WSUInt256SetZero(q);
+    if (divBits > numBits) {
+        return;
+    }
+
+    // shift so that div and num align
+    int shift = numBits - divBits;
+    WSUInt256ShiftLeft(&div, &div, shift);
+    while (shift >= 0) {
+        if (WSUInt256Compare(&num, &div) >= 0) {
+            WSUInt256Subtract(&num, &num, &div);
+            q->words[shift / 32] |= (1U << (shift & 31));
+        }
+        WSUInt256ShiftRight(&div, &div, 1);
+        --shift;
+    }
+}
+
+void WSUInt256DivideUInt64(WSUInt256 *q, const WSUInt256 *a, uint64_t b)
+{
+    WSUInt256 div;
+    WSUInt256SetUInt64(&div, b);
+    WSUInt256Divide(q, a, &div);
+}
+
+void WSUInt256SetCompact(WSUInt256 *n, uint32_t bits, BOOL *negative, BOOL *overflow)
+{
+    const uint32_t size = bits >> 24;
+    uint32_t word = bits & 0x007fffff;
+
+    if (size <= 3) {
+        word >>= 8 * (3 - size);
+        WSUInt256SetUInt64(n, word);
+    }
+    else {
+        WSUInt256SetUInt64(n, word);
+        WSUInt256ShiftLeft(n, n, 8 * (size - 3));
+    }
+    if (negative) {
+        *negative = ((word != 0) && ((bits & 0x00800000) != 0));
+    }
+    if (overflow) {
+        *overflow = ((word != 0) && ((size > 34) ||
+                                     ((word > 0xff) && (size > 33)) ||
+                                     ((word > 0xffff) && (size > 32))));
+    }
+}
+
+uint32_t WSUInt256GetCompact(const WSUInt256 *n)
+{
+    uint32_t size = (WSUInt256Bits(n) + 7) / 8;
+    uint32_t compact = 0;
+
+    if (size <= 3) {
+        compact = n->words[0] << (8 * (3 - size));
+    }
+    else {
+        WSUInt256 x;
+        WSUInt256ShiftRight(&x, n, 8 * (size - 3));
+        compact = x.words[0];
+    }
+
+    // if sign is already set, divide the mantissa by 256 and increment the exponent
+    if (compact & 0x00800000) {
+        compact >>= 8;
+        ++size;
+    }
+
+    return (compact | (size << 24));
+}
+
+void WSUInt256SetWorkFromCompact(WSUInt256 *work, uint32_t bits)
+{
+    WSUInt256 target;
+    BOOL negative;
+    BOOL overflow;
+
+    WSUInt256SetCompact(&target, bits, &negative, &overflow);
+    if (negative || overflow || WSUInt256IsZero(&target)) {
+        WSUInt256SetZero(work);
+        return;
+    }
+
+    // 2^256 doesn't fit, but 2^256 / (target + 1) == ~target / (target + 1) + 1
+    WSUInt256 one;
+    WSUInt256 targetPlusOne;
+    WSUInt256SetUInt64(&one, 1);
+    WSUInt256Add(&targetPlusOne, &target, &one);
+    if (WSUInt256IsZero(&targetPlusOne)) {
+        *work = one;
+        return;
+    }
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        target.words[i] = ~target.words[i];
+    }
+    WSUInt256Divide(work, &target, &targetPlusOne);
+    WSUInt256Add(work, work, &one);
+}
+
+void WSUInt256SetHashBytes(WSUInt256 *n, const void *bytes)
+{
+    const uint8_t *b = bytes;
+    for (int i = 0; i < WSUInt256Words; ++i) {
+        n->words[i] = (uint32_t)b[4 * i] |
+                      ((uint32_t)b[4 * i + 1] << 8) |
+                      ((uint32_t)b[4 * i + 2] << 16) |
+                      ((uint32_t)b[4 * i + 3] << 24);
+    }
+}
+
+void WSUInt256SetData(WSUInt256 *n, NSData *data)
+{
+    NSCParameterAssert(data.length <= 4 * WSUInt256Words);
+
+    const uint8_t *bytes = data.bytes;
+    const NSUInteger length = data.length;
+
+    WSUInt256SetZero(n);
+    for (NSUInteger i = 0; i < length; ++i) {
+        const NSUInteger shift = length - 1 - i;
+        n->words[shift / 4] |= ((uint32_t)bytes[i] << (8 * (shift % 4)));
+    }
+}
+
+NSData *WSUInt256Data(const WSUInt256 *n)
+{
+    const NSUInteger length = (WSUInt256Bits(n) + 7) / 8;
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+
+    for (NSUInteger i = 0; i < length; ++i) {
+        const NSUInteger shift = length - 1 - i;
+        bytes[i] = (uint8_t)(n->words[shift / 4] >> (8 * (shift % 4)));
+    }
+    return data;
+}
+
+NSString *WSUInt256DecimalString(const WSUInt256 *n)
+{
+    static const uint32_t chunk = 1000000000;
+
+    // 78 digits at most
+    uint32_t chunks[9];
+    int count = 0;
+    WSUInt256 x = *n;
+
+    do {
+        uint64_t remainder = 0;
+        for (int i = WSUInt256Words - 1; i >= 0; --i) {
+            const uint64_t value = (remainder << 32) | x.words[i];
+            x.words[i] = (uint32_t)(value / chunk);
+            remainder = value % chunk;
+        }
+        chunks[count++] = (uint32_t)remainder;
+    } while (!WSUInt256IsZero(&x));
+
+    NSMutableString *string = [[NSMutableString alloc] initWithFormat:@"%u", chunks[count - 1]];
+    for (int i = count - 2; i >= 0; --i) {
+        [string appendFormat:@"%09u", chunks[i]];
+    }
+    return string;
+}
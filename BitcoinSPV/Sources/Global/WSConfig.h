@@ -50,21 +50,40 @@ extern const uint32_t           WSSeedGeneratorDefaultEntropyBits;
 
 extern const uint32_t           WSBlockUnknownHeight;
 extern const uint32_t           WSBlockUnknownTimestamp;
+extern const NSUInteger         WSBlockHeaderConcurrentBatchSize;
 
 extern const NSUInteger         WSBlockChainDefaultMaxSize;
+extern const NSUInteger         WSBlockChainDefaultMaxOrphans;
+extern const NSTimeInterval     WSBlockChainDefaultMaxOrphanAge;
+extern const NSUInteger         WSBlockChainCoreDataFetchBatchSize;
 
 extern const NSTimeInterval     WSPeerConnectTimeout;
 extern const uint32_t           WSPeerProtocol;
 extern const uint32_t           WSPeerMinProtocol;
 extern const NSUInteger         WSPeerEnabledServices;
 extern const NSUInteger         WSPeerMaxFilteredBlockCount;
+extern const NSTimeInterval     WSPeerThroughputSampleInterval;
+extern const NSTimeInterval     WSPeerRequestTimeout;
+extern const NSUInteger         WSPeerOutputBacklogHighWaterMark;
+
+extern const NSUInteger         WSProtocolDeserializerBufferCapacity;
+extern const NSUInteger         WSProtocolDeserializerReadLength;
+extern const NSUInteger         WSConnectionOutputGatherLength;
 
 extern const NSUInteger         WSPeerGroupDefaultMaxConnections;
 extern const NSUInteger         WSPeerGroupDefaultMaxConnectionFailures;
 extern const NSTimeInterval     WSPeerGroupDefaultReconnectionDelay;
 //extern const NSTimeInterval     WSPeerGroupDefaultPingInterval;
 //extern const NSUInteger         WSPeerGroupMaxPeerHours;
-extern const NSUInteger         WSPeerGroupMaxInactivePeers;
+
+extern const NSUInteger         WSAddressManagerNewBucketCount;
+extern const NSUInteger         WSAddressManagerTriedBucketCount;
+extern const NSUInteger         WSAddressManagerBucketSize;
+extern const NSUInteger         WSAddressManagerNewBucketsPerSourceGroup;
+extern const NSUInteger         WSAddressManagerTriedBucketsPerGroup;
+extern const uint32_t           WSAddressManagerHorizon;
+extern const NSUInteger         WSAddressManagerMaxRetries;
+extern const NSUInteger         WSAddressManagerMaxFailures;
 
 extern const double             WSBlockChainDownloaderDefaultBFRateMin;
 extern const double             WSBlockChainDownloaderDefaultBFRateDelta;
@@ -72,6 +91,18 @@ extern const double             WSBlockChainDownloaderDefaultBFObservedRateMax;
 extern const double             WSBlockChainDownloaderDefaultBFLowPassRatio;
 extern const NSUInteger         WSBlockChainDownloaderDefaultBFTxsPerBlock;
 extern const NSTimeInterval     WSBlockChainDownloaderDefaultRequestTimeout;
+extern const uint32_t           WSBlockChainDownloaderPeerHeightTolerance;
+extern const NSUInteger         WSBlockChainDownloaderPeerScoreLength;
+extern const double             WSBlockChainDownloaderPeerDefaultThroughput;
+extern const double             WSBlockChainDownloaderPeerSwitchRatio;
+extern const NSTimeInterval     WSBlockChainDownloaderPeerEvaluationInterval;
+
+extern const NSUInteger         WSBlockDownloadSchedulerChunkSize;
+extern const NSUInteger         WSBlockDownloadSchedulerMinRequestsPerPeer;
+extern const NSUInteger         WSBlockDownloadSchedulerInitialRequestsPerPeer;
+extern const NSUInteger         WSBlockDownloadSchedulerMaxRequestsPerPeer;
+extern const double             WSBlockDownloadSchedulerLatencyTolerance;
+extern const NSTimeInterval     WSBlockDownloadSchedulerDefaultRequestTimeout;
 
 extern const uint32_t           WSMessageVersionLocalhost;
 
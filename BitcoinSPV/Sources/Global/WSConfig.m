@@ -43,21 +43,40 @@ const uint32_t          WSSeedGeneratorDefaultEntropyBits               = 128;
 
 const uint32_t          WSBlockUnknownHeight                            = UINT32_MAX;
 const uint32_t          WSBlockUnknownTimestamp                         = UINT32_MAX;
+const NSUInteger        WSBlockHeaderConcurrentBatchSize                = 100;      // headers per concurrent work item
 
 const NSUInteger        WSBlockChainDefaultMaxSize                      = 2500;
+const NSUInteger        WSBlockChainDefaultMaxOrphans                   = 750;
+const NSTimeInterval    WSBlockChainDefaultMaxOrphanAge                 = 1200.0;   // 20 minutes
+const NSUInteger        WSBlockChainCoreDataFetchBatchSize              = 500;
 
 const NSTimeInterval    WSPeerConnectTimeout                            = 3.0;
 const uint32_t          WSPeerProtocol                                  = 70002;
 const uint32_t          WSPeerMinProtocol                               = 70001;    // SPV mode required
 const NSUInteger        WSPeerEnabledServices                           = 0;        // we don't provide full blocks to remote nodes
 const NSUInteger        WSPeerMaxFilteredBlockCount                     = 2000;
+const NSTimeInterval    WSPeerThroughputSampleInterval                  = 1.0;
+const NSTimeInterval    WSPeerRequestTimeout                            = 10.0;     // unanswered requests stop counting for metrics
+const NSUInteger        WSPeerOutputBacklogHighWaterMark                = 256 * 1024;   // unsent bytes before deferring getdata/tx
+
+const NSUInteger        WSProtocolDeserializerBufferCapacity            = 256 * 1024;
+const NSUInteger        WSProtocolDeserializerReadLength                = 64 * 1024;    // bytes per socket read
+const NSUInteger        WSConnectionOutputGatherLength                  = 64 * 1024;    // bytes per socket write
 
 const NSUInteger        WSPeerGroupDefaultMaxConnections                = 3;
 const NSUInteger        WSPeerGroupDefaultMaxConnectionFailures         = 15;
 const NSTimeInterval    WSPeerGroupDefaultReconnectionDelay             = 10.0;
 //const NSTimeInterval    WSPeerGroupDefaultPingInterval                  = 5.0;
 //const NSUInteger        WSPeerGroupMaxPeerHours                         = 4;
-const NSUInteger        WSPeerGroupMaxInactivePeers                     = 1000;
+
+const NSUInteger        WSAddressManagerNewBucketCount                  = 64;
+const NSUInteger        WSAddressManagerTriedBucketCount                = 16;
+const NSUInteger        WSAddressManagerBucketSize                      = 32;
+const NSUInteger        WSAddressManagerNewBucketsPerSourceGroup        = 16;
+const NSUInteger        WSAddressManagerTriedBucketsPerGroup            = 4;
+const uint32_t          WSAddressManagerHorizon                         = 30 * 24 * 60 * 60;    // 30 days
+const NSUInteger        WSAddressManagerMaxRetries                      = 3;        // without any success
+const NSUInteger        WSAddressManagerMaxFailures                     = 10;       // a week after last success
 
 const double            WSBlockChainDownloaderDefaultBFRateMin          = 0.0001;
 const double            WSBlockChainDownloaderDefaultBFRateDelta        = 0.0004;
@@ -65,6 +84,18 @@ const double            WSBlockChainDownloaderDefaultBFObservedRateMax  = 10.0 *
 const double            WSBlockChainDownloaderDefaultBFLowPassRatio     = 0.01;     // 1%
 const NSUInteger        WSBlockChainDownloaderDefaultBFTxsPerBlock      = 600;
 const NSTimeInterval    WSBlockChainDownloaderDefaultRequestTimeout     = 5.0;
+const uint32_t          WSBlockChainDownloaderPeerHeightTolerance       = 10;
+const NSUInteger        WSBlockChainDownloaderPeerScoreLength           = 256 * 1024;   // reference bytes to deliver
+const double            WSBlockChainDownloaderPeerDefaultThroughput     = 64 * 1024;    // bytes/s when not measured
+const double            WSBlockChainDownloaderPeerSwitchRatio           = 2.0;
+const NSTimeInterval    WSBlockChainDownloaderPeerEvaluationInterval    = 30.0;
+
+const NSUInteger        WSBlockDownloadSchedulerChunkSize               = 100;
+const NSUInteger        WSBlockDownloadSchedulerMinRequestsPerPeer      = 10;
+const NSUInteger        WSBlockDownloadSchedulerInitialRequestsPerPeer  = 100;
+const NSUInteger        WSBlockDownloadSchedulerMaxRequestsPerPeer      = 500;
+const double            WSBlockDownloadSchedulerLatencyTolerance        = 2.0;      // shrink window above 2x base latency
+const NSTimeInterval    WSBlockDownloadSchedulerDefaultRequestTimeout   = 10.0;
 
 const uint32_t          WSMessageVersionLocalhost                       = 0x0100007f;
 
@@ -53,6 +53,7 @@ typedef enum {
     WSErrorCodeInvalidBlock,
     WSErrorCodeInvalidPartialMerkleTree,
     WSErrorCodeInvalidTransaction,
+    WSErrorCodeInvalidFilter,
     //
     WSErrorCodeMaskWallet               = 0x0800,
     WSErrorCodeInsufficientFunds,
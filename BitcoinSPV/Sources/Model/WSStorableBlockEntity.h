@@ -41,7 +41,9 @@
 @property (nonatomic, retain) NSOrderedSet *transactions;
 
 - (void)copyFromStorableBlock:(WSStorableBlock *)block;
+- (void)updateFromStorableBlock:(WSStorableBlock *)block; // same block id, header and unfetched transactions are kept
 - (WSStorableBlock *)toStorableBlockWithParameters:(WSParameters *)parameters;
+- (WSStorableBlock *)toLazyStorableBlockWithParameters:(WSParameters *)parameters; // transactions are fetched on first access
 
 @end
 
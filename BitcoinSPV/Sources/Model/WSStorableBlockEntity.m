@@ -28,6 +28,14 @@
 #import "WSPartialMerkleTreeEntity.h"
 #import "WSTransactionEntity.h"
 #import "WSCoreDataManager.h"
+#import "WSHash256.h"
+#import "WSLogging.h"
+
+@interface WSStorableBlockEntity ()
+
+- (void)copyTransactionsFromStorableBlock:(WSStorableBlock *)block;
+
+@end
 
 @implementation WSStorableBlockEntity
 
@@ -44,7 +52,28 @@
 
     self.height = @(block.height);
     self.work = [[block workData] copy];
+    [self copyTransactionsFromStorableBlock:block];
+}
+
+- (void)updateFromStorableBlock:(WSStorableBlock *)block
+{
+    NSAssert([self.header.blockIdData isEqualToData:block.blockId.data], @"Updating entity with another block (%@)", block.blockId);
+
+    self.height = @(block.height);
+    self.work = [[block workData] copy];
+
+    // lazy block still backed by this entity, transactions didn't change
+    if (![block hasLoadedTransactions]) {
+        return;
+    }
+    for (WSTransactionEntity *txEntity in self.transactions) {
+        [self.managedObjectContext deleteObject:txEntity];
+    }
+    [self copyTransactionsFromStorableBlock:block];
+}
 
+- (void)copyTransactionsFromStorableBlock:(WSStorableBlock *)block
+{
     NSMutableOrderedSet *txEntities = [[NSMutableOrderedSet alloc] initWithCapacity:block.transactions.count];
     for (WSSignedTransaction *tx in block.transactions) {
         WSTransactionEntity *txEntity = [[WSTransactionEntity alloc] initWithContext:self.managedObjectContext];
@@ -68,4 +97,35 @@
     return [[WSStorableBlock alloc] initWithHeader:header transactions:transactions height:height work:self.work];
 }
 
+- (WSStorableBlock *)toLazyStorableBlockWithParameters:(WSParameters *)parameters
+{
+    WSBlockHeader *header = [self.header toBlockHeaderWithParameters:parameters];
+    const uint32_t height = (uint32_t)[self.height unsignedIntegerValue];
+
+    // object ids are safe to use outside the context queue, entities are not
+    NSManagedObjectContext *context = self.managedObjectContext;
+    NSManagedObjectID *objectID = self.objectID;
+    WSHash256 *blockId = header.blockId;
+
+    return [[WSStorableBlock alloc] initWithHeader:header transactionsLoader:^NSOrderedSet *{
+        __block NSMutableOrderedSet *transactions = nil;
+        [context performBlockAndWait:^{
+            NSError *error;
+            WSStorableBlockEntity *entity = (WSStorableBlockEntity *)[context existingObjectWithID:objectID error:&error];
+            if (!entity || entity.isDeleted) {
+                DDLogError(@"Unable to load transactions of block %@, entity was deleted (%@)", blockId, error);
+                return;
+            }
+            if (entity.transactions.count == 0) {
+                return;
+            }
+            transactions = [[NSMutableOrderedSet alloc] initWithCapacity:entity.transactions.count];
+            for (WSTransactionEntity *txEntity in entity.transactions) {
+                [transactions addObject:[txEntity toSignedTransactionWithParameters:parameters]];
+            }
+        }];
+        return transactions;
+    } height:height work:self.work];
+}
+
 @end
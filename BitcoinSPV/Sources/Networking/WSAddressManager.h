@@ -0,0 +1,70 @@
+//
+//  WSAddressManager.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+@class WSParameters;
+@class WSNetworkAddress;
+
+#pragma mark -
+
+//
+// known peer addresses split into "new" (heard of) and "tried" (connected
+// at least once) tables, each made of fixed-size buckets keyed by a salted
+// hash of network groups (/16 for IPv4): new buckets by source and address
+// group, tried buckets by address group and address, so that a flood of
+// addresses from a single source or group can only evict a few buckets
+//
+// selection is random and weighted on failures and recent attempts,
+// no sorting is involved
+//
+// thread-safe: no (should only run in group queue)
+//
+@interface WSAddressManager : NSObject
+
+- (instancetype)initWithParameters:(WSParameters *)parameters;
+- (WSParameters *)parameters;
+
+- (NSUInteger)count;
+- (NSUInteger)numberOfNewAddresses;
+- (NSUInteger)numberOfTriedAddresses;
+- (BOOL)containsHost:(NSString *)host;
+
+- (BOOL)addAddress:(WSNetworkAddress *)address; // self as source, e.g. DNS seeds
+- (BOOL)addAddress:(WSNetworkAddress *)address source:(WSNetworkAddress *)source;
+- (NSUInteger)addAddresses:(NSArray *)addresses; // WSNetworkAddress
+- (NSUInteger)addAddresses:(NSArray *)addresses source:(WSNetworkAddress *)source; // WSNetworkAddress
+- (void)removeHost:(NSString *)host;
+- (void)markAttemptWithHost:(NSString *)host;
+- (void)markSuccessWithHost:(NSString *)host;
+- (void)markFailureWithHost:(NSString *)host;
+
+- (WSNetworkAddress *)selectAddressPassingTest:(BOOL (^)(WSNetworkAddress *address))test;
+
+// replaces current addresses on load
+- (BOOL)saveToPath:(NSString *)path error:(NSError **)error;
+- (BOOL)loadFromPath:(NSString *)path error:(NSError **)error;
+
+@end
@@ -0,0 +1,599 @@
+//
+//  WSAddressManager.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSAddressManager.h"
+#import "WSParameters.h"
+#import "WSNetworkAddress.h"
+#import "WSConfig.h"
+#import "WSLogging.h"
+#import "WSBitcoinConstants.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+#import "NSData+Hash.h"
+
+static const uint32_t WSAddressManagerFileMagic         = 0x4d415357; // 'WSAM'
+static const uint32_t WSAddressManagerFileVersion       = 1;
+static const NSUInteger WSAddressManagerMaxSelections   = 100;
+static const NSUInteger WSAddressManagerGroupLength     = 5;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t networkMagic;
+    uint32_t key;
+    uint32_t count;
+} WSAddressManagerFileHeader;
+
+typedef struct {
+    uint64_t services;
+    uint8_t ipv6Address[16];
+    uint32_t timestamp;
+    uint32_t lastAttemptTime;
+    uint32_t lastSuccessTime;
+    uint32_t failures;
+    uint16_t port;
+    uint8_t isTried;
+    uint8_t sourceGroup[5];     // zero if unknown
+} WSAddressManagerFileRecord;
+
+typedef struct {
+    uint8_t checksum[32];
+} WSAddressManagerFileTrailer;
+
+_Static_assert(sizeof(WSAddressManagerFileHeader) == 20, "Unexpected WSAddressManagerFileHeader size");
+_Static_assert(sizeof(WSAddressManagerFileRecord) == 48, "Unexpected WSAddressManagerFileRecord size");
+_Static_assert(sizeof(WSAddressManagerFileTrailer) == 32, "Unexpected WSAddressManagerFileTrailer size");
+
+//
+// network group an address belongs to, i.e. the portion of the address
+// space a single operator can easily get many addresses from: /16 for
+// IPv4 (also mapped), /32 for IPv6, prefixed by type
+//
+static NSData *WSAddressManagerGroupOfAddress(NSData *ipv6Address)
+{
+    static const uint8_t ipv4MappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    const uint8_t *bytes = ipv6Address.bytes;
+
+    uint8_t group[WSAddressManagerGroupLength];
+    memset(group, 0, sizeof(group));
+    if (memcmp(bytes, ipv4MappedPrefix, sizeof(ipv4MappedPrefix)) == 0) {
+        group[0] = 4;
+        memcpy(group + 1, bytes + sizeof(ipv4MappedPrefix), 2);
+    }
+    else {
+        group[0] = 6;
+        memcpy(group + 1, bytes, 4);
+    }
+    return [NSData dataWithBytes:group length:sizeof(group)];
+}
+
+@interface WSAddressManagerEntry : NSObject
+
+@property (nonatomic, strong) WSNetworkAddress *address;
+@property (nonatomic, strong) NSData *sourceGroup;
+@property (nonatomic, assign) BOOL isTried;
+@property (nonatomic, assign) uint32_t lastAttemptTime;
+@property (nonatomic, assign) uint32_t lastSuccessTime;
+@property (nonatomic, assign) uint32_t failures;
+@property (nonatomic, assign) NSUInteger bucket;
+@property (nonatomic, assign) NSUInteger tableIndex;
+
+- (BOOL)isTerribleAtTime:(uint32_t)now;
+- (double)chanceAtTime:(uint32_t)now;
+
+@end
+
+@implementation WSAddressManagerEntry
+
+- (BOOL)isTerribleAtTime:(uint32_t)now
+{
+    // just tried, give it a chance to complete
+    if (self.lastAttemptTime + WSDatesOneMinute >= now) {
+        return NO;
+    }
+
+    // from the future or not seen for too long
+    if ((self.address.timestamp > now + 10 * WSDatesOneMinute) || (self.address.timestamp + WSAddressManagerHorizon < now)) {
+        return YES;
+    }
+
+    // never succeeded or failed many times since last success
+    if ((self.lastSuccessTime == 0) && (self.failures >= WSAddressManagerMaxRetries)) {
+        return YES;
+    }
+    if ((self.lastSuccessTime + WSDatesOneWeek < now) && (self.failures >= WSAddressManagerMaxFailures)) {
+        return YES;
+    }
+    return NO;
+}
+
+- (double)chanceAtTime:(uint32_t)now
+{
+    double chance = 1.0;
+
+    // deprioritize very recent attempts
+    if (self.lastAttemptTime + 10 * WSDatesOneMinute > now) {
+        chance *= 0.01;
+    }
+
+    // each failure reduces chance by a third
+    chance *= pow(0.66, MIN(self.failures, 8));
+
+    return chance;
+}
+
+@end
+
+#pragma mark -
+
+@interface WSAddressManager ()
+
+@property (nonatomic, strong) WSParameters *parameters;
+@property (nonatomic, assign) uint32_t key;
+@property (nonatomic, strong) NSMutableDictionary *entriesByHost;    // NSString -> WSAddressManagerEntry
+@property (nonatomic, strong) NSMutableArray *untriedEntries;        // WSAddressManagerEntry
+@property (nonatomic, strong) NSMutableArray *triedEntries;          // WSAddressManagerEntry
+@property (nonatomic, strong) NSArray *untriedBuckets;               // NSMutableArray (WSAddressManagerEntry)
+@property (nonatomic, strong) NSArray *triedBuckets;                 // NSMutableArray (WSAddressManagerEntry)
+
+- (void)resetWithKey:(uint32_t)key;
+- (NSUInteger)bucketForAddress:(WSNetworkAddress *)address sourceGroup:(NSData *)sourceGroup isTried:(BOOL)isTried;
+- (uint32_t)hashOfTable:(uint8_t)table datas:(NSArray *)datas; // NSData
+- (BOOL)insertEntry:(WSAddressManagerEntry *)entry isTried:(BOOL)isTried;
+- (void)removeEntry:(WSAddressManagerEntry *)entry;
+- (WSAddressManagerEntry *)evictableEntryInBucket:(NSArray *)bucket; // WSAddressManagerEntry
+
+@end
+
+@implementation WSAddressManager
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithParameters:");
+    return nil;
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters
+{
+    WSExceptionCheckIllegal(parameters);
+
+    if ((self = [super init])) {
+        self.parameters = parameters;
+        [self resetWithKey:arc4random()];
+    }
+    return self;
+}
+
+- (NSUInteger)count
+{
+    return self.entriesByHost.count;
+}
+
+- (NSUInteger)numberOfNewAddresses
+{
+    return self.untriedEntries.count;
+}
+
+- (NSUInteger)numberOfTriedAddresses
+{
+    return self.triedEntries.count;
+}
+
+- (BOOL)containsHost:(NSString *)host
+{
+    return (self.entriesByHost[host] != nil);
+}
+
+- (BOOL)addAddress:(WSNetworkAddress *)address
+{
+    return [self addAddress:address source:nil];
+}
+
+- (BOOL)addAddress:(WSNetworkAddress *)address source:(WSNetworkAddress *)source
+{
+    WSExceptionCheckIllegal(address);
+
+    WSAddressManagerEntry *entry = self.entriesByHost[address.host];
+    if (entry) {
+        if (address.timestamp > entry.address.timestamp) {
+            entry.address = address;
+        }
+        return NO;
+    }
+
+    entry = [[WSAddressManagerEntry alloc] init];
+    entry.address = address;
+    entry.sourceGroup = WSAddressManagerGroupOfAddress((source ? source : address).ipv6Address);
+    if ([entry isTerribleAtTime:WSCurrentTimestamp()]) {
+        return NO;
+    }
+    return [self insertEntry:entry isTried:NO];
+}
+
+- (NSUInteger)addAddresses:(NSArray *)addresses
+{
+    return [self addAddresses:addresses source:nil];
+}
+
+- (NSUInteger)addAddresses:(NSArray *)addresses source:(WSNetworkAddress *)source
+{
+    WSExceptionCheckIllegal(addresses);
+
+    NSUInteger added = 0;
+    for (WSNetworkAddress *address in addresses) {
+        if ([self addAddress:address source:source]) {
+            ++added;
+        }
+    }
+
+    DDLogDebug(@"Added %lu/%lu addresses (new: %lu, tried: %lu)", (unsigned long)added, (unsigned long)addresses.count,
+               (unsigned long)self.untriedEntries.count, (unsigned long)self.triedEntries.count);
+
+    return added;
+}
+
+- (void)removeHost:(NSString *)host
+{
+    WSAddressManagerEntry *entry = self.entriesByHost[host];
+    if (!entry) {
+        return;
+    }
+    [self removeEntry:entry];
+
+    DDLogDebug(@"Removed host %@ from addresses (available: %lu)", host, (unsigned long)self.entriesByHost.count);
+}
+
+- (void)markAttemptWithHost:(NSString *)host
+{
+    WSAddressManagerEntry *entry = self.entriesByHost[host];
+    entry.lastAttemptTime = WSCurrentTimestamp();
+}
+
+- (void)markSuccessWithHost:(NSString *)host
+{
+    WSAddressManagerEntry *entry = self.entriesByHost[host];
+    if (!entry) {
+        return;
+    }
+
+    const uint32_t now = WSCurrentTimestamp();
+    WSNetworkAddress *address = entry.address;
+    entry.address = [[WSNetworkAddress alloc] initWithTimestamp:now services:address.services ipv6Address:address.ipv6Address port:address.port];
+    entry.lastSuccessTime = now;
+    entry.failures = 0;
+
+    if (entry.isTried) {
+        return;
+    }
+
+    // promote to tried
+    [self removeEntry:entry];
+    [self insertEntry:entry isTried:YES];
+}
+
+- (void)markFailureWithHost:(NSString *)host
+{
+    WSAddressManagerEntry *entry = self.entriesByHost[host];
+    if (!entry) {
+        return;
+    }
+
+    ++entry.failures;
+    if ([entry isTerribleAtTime:WSCurrentTimestamp()]) {
+        DDLogDebug(@"Host %@ failed too many times (%u), removing", host, entry.failures);
+        [self removeEntry:entry];
+    }
+}
+
+- (WSNetworkAddress *)selectAddressPassingTest:(BOOL (^)(WSNetworkAddress *))test
+{
+    if (self.entriesByHost.count == 0) {
+        return nil;
+    }
+
+    const uint32_t now = WSCurrentTimestamp();
+    double chanceFactor = 1.0;
+
+    //
+    // pick a random entry from a random table and accept it with its
+    // chance, raising acceptance after each miss keeps it O(1) on average
+    //
+    for (NSUInteger i = 0; i < WSAddressManagerMaxSelections; ++i) {
+        NSArray *entries;
+        if ((self.triedEntries.count > 0) && ((self.untriedEntries.count == 0) || (arc4random_uniform(2) == 0))) {
+            entries = self.triedEntries;
+        }
+        else {
+            entries = self.untriedEntries;
+        }
+
+        WSAddressManagerEntry *entry = entries[arc4random_uniform((uint32_t)entries.count)];
+        if (test && !test(entry.address)) {
+            continue;
+        }
+        if (arc4random_uniform(1 << 30) < chanceFactor * [entry chanceAtTime:now] * (1 << 30)) {
+            return entry.address;
+        }
+        chanceFactor *= 1.2;
+    }
+    return nil;
+}
+
+#pragma mark Serialization
+
+- (BOOL)saveToPath:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(path);
+
+    const NSUInteger count = self.entriesByHost.count;
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:(sizeof(WSAddressManagerFileHeader) +
+                                                                   count * sizeof(WSAddressManagerFileRecord) +
+                                                                   sizeof(WSAddressManagerFileTrailer))];
+
+    WSAddressManagerFileHeader header;
+    header.magic = CFSwapInt32HostToLittle(WSAddressManagerFileMagic);
+    header.version = CFSwapInt32HostToLittle(WSAddressManagerFileVersion);
+    header.networkMagic = CFSwapInt32HostToLittle([self.parameters magicNumber]);
+    header.key = CFSwapInt32HostToLittle(self.key);
+    header.count = CFSwapInt32HostToLittle((uint32_t)count);
+    [data appendBytes:&header length:sizeof(header)];
+
+    for (NSArray *entries in @[self.triedEntries, self.untriedEntries]) {
+        for (WSAddressManagerEntry *entry in entries) {
+            WSAddressManagerFileRecord record;
+            memset(&record, 0, sizeof(record));
+            record.services = CFSwapInt64HostToLittle(entry.address.services);
+            memcpy(record.ipv6Address, entry.address.ipv6Address.bytes, sizeof(record.ipv6Address));
+            record.timestamp = CFSwapInt32HostToLittle(entry.address.timestamp);
+            record.lastAttemptTime = CFSwapInt32HostToLittle(entry.lastAttemptTime);
+            record.lastSuccessTime = CFSwapInt32HostToLittle(entry.lastSuccessTime);
+            record.failures = CFSwapInt32HostToLittle(entry.failures);
+            record.port = CFSwapInt16HostToLittle(entry.address.port);
+            record.isTried = entry.isTried;
+            memcpy(record.sourceGroup, entry.sourceGroup.bytes, sizeof(record.sourceGroup));
+            [data appendBytes:&record length:sizeof(record)];
+        }
+    }
+
+    NSData *checksum = [data hash256];
+    [data appendData:checksum];
+
+    if (![data writeToFile:path options:NSDataWritingAtomic error:error]) {
+        return NO;
+    }
+    DDLogInfo(@"Saved %lu addresses (new: %lu, tried: %lu) to %@", (unsigned long)count,
+              (unsigned long)self.untriedEntries.count, (unsigned long)self.triedEntries.count, path);
+    return YES;
+}
+
+- (BOOL)loadFromPath:(NSString *)path error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(path);
+
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:error];
+    if (!data) {
+        return NO;
+    }
+    const uint8_t *bytes = data.bytes;
+    const NSUInteger minLength = sizeof(WSAddressManagerFileHeader) + sizeof(WSAddressManagerFileTrailer);
+    if (data.length < minLength) {
+        WSErrorSetNotEnoughBytes(error, [self class], data.length, minLength);
+        return NO;
+    }
+
+    WSAddressManagerFileHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if ((CFSwapInt32LittleToHost(header.magic) != WSAddressManagerFileMagic) ||
+        (CFSwapInt32LittleToHost(header.version) != WSAddressManagerFileVersion)) {
+
+        WSErrorSet(error, WSErrorCodeMalformed, @"Not an addresses file or unsupported version");
+        return NO;
+    }
+    if (CFSwapInt32LittleToHost(header.networkMagic) != [self.parameters magicNumber]) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Addresses file from another network (%x)", CFSwapInt32LittleToHost(header.networkMagic));
+        return NO;
+    }
+    const NSUInteger count = CFSwapInt32LittleToHost(header.count);
+    const NSUInteger expectedLength = minLength + count * sizeof(WSAddressManagerFileRecord);
+    if (data.length != expectedLength) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Unexpected addresses file length (%lu != %lu)",
+                   (unsigned long)data.length, (unsigned long)expectedLength);
+        return NO;
+    }
+    NSData *checkedData = [NSData dataWithBytesNoCopy:(void *)bytes length:(expectedLength - sizeof(WSAddressManagerFileTrailer)) freeWhenDone:NO];
+    if (memcmp([[checkedData hash256] bytes], bytes + expectedLength - sizeof(WSAddressManagerFileTrailer), sizeof(WSAddressManagerFileTrailer)) != 0) {
+        WSErrorSet(error, WSErrorCodeMalformed, @"Addresses file checksum mismatch");
+        return NO;
+    }
+
+    // same key, same buckets
+    [self resetWithKey:CFSwapInt32LittleToHost(header.key)];
+
+    const uint32_t now = WSCurrentTimestamp();
+    const uint8_t *recordBytes = bytes + sizeof(header);
+    for (NSUInteger i = 0; i < count; ++i, recordBytes += sizeof(WSAddressManagerFileRecord)) {
+        WSAddressManagerFileRecord record;
+        memcpy(&record, recordBytes, sizeof(record));
+
+        NSData *ipv6Address = [NSData dataWithBytes:record.ipv6Address length:sizeof(record.ipv6Address)];
+        WSAddressManagerEntry *entry = [[WSAddressManagerEntry alloc] init];
+        entry.address = [[WSNetworkAddress alloc] initWithTimestamp:CFSwapInt32LittleToHost(record.timestamp)
+                                                           services:CFSwapInt64LittleToHost(record.services)
+                                                        ipv6Address:ipv6Address
+                                                               port:CFSwapInt16LittleToHost(record.port)];
+        entry.lastAttemptTime = CFSwapInt32LittleToHost(record.lastAttemptTime);
+        entry.lastSuccessTime = CFSwapInt32LittleToHost(record.lastSuccessTime);
+        entry.failures = CFSwapInt32LittleToHost(record.failures);
+        if (record.sourceGroup[0] != 0) {
+            entry.sourceGroup = [NSData dataWithBytes:record.sourceGroup length:sizeof(record.sourceGroup)];
+        }
+        else {
+            entry.sourceGroup = WSAddressManagerGroupOfAddress(ipv6Address);
+        }
+
+        if (self.entriesByHost[entry.address.host] || [entry isTerribleAtTime:now]) {
+            continue;
+        }
+        [self insertEntry:entry isTried:(record.isTried != 0)];
+    }
+
+    DDLogInfo(@"Loaded %lu addresses (new: %lu, tried: %lu) from %@", (unsigned long)self.entriesByHost.count,
+              (unsigned long)self.untriedEntries.count, (unsigned long)self.triedEntries.count, path);
+    return YES;
+}
+
+#pragma mark Helpers
+
+- (void)resetWithKey:(uint32_t)key
+{
+    self.key = key;
+    self.entriesByHost = [[NSMutableDictionary alloc] init];
+    self.untriedEntries = [[NSMutableArray alloc] init];
+    self.triedEntries = [[NSMutableArray alloc] init];
+
+    NSMutableArray *untriedBuckets = [[NSMutableArray alloc] initWithCapacity:WSAddressManagerNewBucketCount];
+    for (NSUInteger i = 0; i < WSAddressManagerNewBucketCount; ++i) {
+        [untriedBuckets addObject:[[NSMutableArray alloc] initWithCapacity:WSAddressManagerBucketSize]];
+    }
+    NSMutableArray *triedBuckets = [[NSMutableArray alloc] initWithCapacity:WSAddressManagerTriedBucketCount];
+    for (NSUInteger i = 0; i < WSAddressManagerTriedBucketCount; ++i) {
+        [triedBuckets addObject:[[NSMutableArray alloc] initWithCapacity:WSAddressManagerBucketSize]];
+    }
+    self.untriedBuckets = untriedBuckets;
+    self.triedBuckets = triedBuckets;
+}
+
+- (NSUInteger)bucketForAddress:(WSNetworkAddress *)address sourceGroup:(NSData *)sourceGroup isTried:(BOOL)isTried
+{
+    NSParameterAssert(address);
+    NSParameterAssert(sourceGroup);
+
+    NSData *group = WSAddressManagerGroupOfAddress(address.ipv6Address);
+    uint32_t slot;
+
+    //
+    // addresses from a single group only span a few tried buckets, and
+    // a single source group can only fill a few new buckets whatever
+    // addresses it relays, so that no group can take over a table
+    //
+    if (isTried) {
+        slot = CFSwapInt32HostToLittle([self hashOfTable:1 datas:@[address.ipv6Address]] % WSAddressManagerTriedBucketsPerGroup);
+        return [self hashOfTable:1 datas:@[group, [NSData dataWithBytes:&slot length:sizeof(slot)]]] % WSAddressManagerTriedBucketCount;
+    }
+    else {
+        slot = CFSwapInt32HostToLittle([self hashOfTable:0 datas:@[group, sourceGroup]] % WSAddressManagerNewBucketsPerSourceGroup);
+        return [self hashOfTable:0 datas:@[sourceGroup, [NSData dataWithBytes:&slot length:sizeof(slot)]]] % WSAddressManagerNewBucketCount;
+    }
+}
+
+- (uint32_t)hashOfTable:(uint8_t)table datas:(NSArray *)datas
+{
+    NSMutableData *data = [[NSMutableData alloc] init];
+    const uint32_t key = CFSwapInt32HostToLittle(self.key);
+    [data appendBytes:&key length:sizeof(key)];
+    [data appendBytes:&table length:sizeof(table)];
+    for (NSData *chunk in datas) {
+        [data appendData:chunk];
+    }
+
+    uint32_t hash;
+    memcpy(&hash, [[data hash256] bytes], sizeof(hash));
+    return CFSwapInt32LittleToHost(hash);
+}
+
+- (BOOL)insertEntry:(WSAddressManagerEntry *)entry isTried:(BOOL)isTried
+{
+    NSParameterAssert(entry);
+
+    const NSUInteger bucketIndex = [self bucketForAddress:entry.address sourceGroup:entry.sourceGroup isTried:isTried];
+    NSMutableArray *bucket = (isTried ? self.triedBuckets : self.untriedBuckets)[bucketIndex];
+
+    if (bucket.count >= WSAddressManagerBucketSize) {
+        WSAddressManagerEntry *victim = [self evictableEntryInBucket:bucket];
+
+        if (isTried) {
+
+            // demote to new rather than forgetting a good address
+            [self removeEntry:victim];
+            [self insertEntry:victim isTried:NO];
+        }
+        else {
+
+            // don't replace fresher addresses with an older unknown one
+            if (![victim isTerribleAtTime:WSCurrentTimestamp()] &&
+                (entry.lastSuccessTime == 0) && (entry.address.timestamp <= victim.address.timestamp)) {
+
+                return NO;
+            }
+            [self removeEntry:victim];
+        }
+    }
+
+    NSMutableArray *entries = (isTried ? self.triedEntries : self.untriedEntries);
+    entry.isTried = isTried;
+    entry.bucket = bucketIndex;
+    entry.tableIndex = entries.count;
+    [entries addObject:entry];
+    [bucket addObject:entry];
+    self.entriesByHost[entry.address.host] = entry;
+
+    return YES;
+}
+
+- (void)removeEntry:(WSAddressManagerEntry *)entry
+{
+    NSParameterAssert(entry);
+
+    // swap with last for O(1) removal
+    NSMutableArray *entries = (entry.isTried ? self.triedEntries : self.untriedEntries);
+    WSAddressManagerEntry *lastEntry = [entries lastObject];
+    entries[entry.tableIndex] = lastEntry;
+    lastEntry.tableIndex = entry.tableIndex;
+    [entries removeLastObject];
+
+    NSMutableArray *bucket = (entry.isTried ? self.triedBuckets : self.untriedBuckets)[entry.bucket];
+    [bucket removeObjectIdenticalTo:entry];
+
+    [self.entriesByHost removeObjectForKey:entry.address.host];
+}
+
+- (WSAddressManagerEntry *)evictableEntryInBucket:(NSArray *)bucket
+{
+    NSParameterAssert(bucket.count > 0);
+
+    const uint32_t now = WSCurrentTimestamp();
+    WSAddressManagerEntry *oldestEntry = nil;
+    for (WSAddressManagerEntry *entry in bucket) {
+        if ([entry isTerribleAtTime:now]) {
+            return entry;
+        }
+        if (!oldestEntry || (entry.address.timestamp < oldestEntry.address.timestamp)) {
+            oldestEntry = entry;
+        }
+    }
+    return oldestEntry;
+}
+
+@end
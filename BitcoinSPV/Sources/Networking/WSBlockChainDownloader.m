@@ -25,6 +25,8 @@
 
 #import "WSBlockChainDownloader.h"
 #import "WSPeerGroup+Download.h"
+#import "WSBlockDownloadScheduler.h"
+#import "WSBlockChainSync.h"
 #import "WSBlockStore.h"
 #import "WSBlockChain.h"
 #import "WSBlockHeader.h"
@@ -44,7 +46,65 @@
 #import "WSErrors.h"
 #import "WSConfig.h"
 
-@interface WSBlockChainDownloader ()
+// headers between two checkpoints, downloaded by a single peer at a time
+// with locator + hashStop and buffered until stitched into the blockchain
+@interface WSHeadersSegment : NSObject
+
+@property (nonatomic, strong) WSHash256 *startId;
+@property (nonatomic, assign) uint32_t startHeight;
+@property (nonatomic, strong) WSStorableBlock *stopCheckpoint;
+@property (nonatomic, strong) NSMutableArray *headers;          // WSBlockHeader
+@property (nonatomic, strong) WSHash256 *lastId;
+@property (nonatomic, assign) uint32_t lastHeight;
+@property (nonatomic, strong) WSPeer *peer;                     // nil if unassigned
+@property (nonatomic, strong) WSPeer *stalledPeer;
+@property (nonatomic, assign) NSTimeInterval lastRequestTime;
+
+- (instancetype)initWithStartId:(WSHash256 *)startId startHeight:(uint32_t)startHeight stopCheckpoint:(WSStorableBlock *)stopCheckpoint;
+- (BOOL)isComplete;
+- (BOOL)shouldAcceptHeader:(WSBlockHeader *)header;
+- (void)reset;
+
+@end
+
+@implementation WSHeadersSegment
+
+- (instancetype)initWithStartId:(WSHash256 *)startId startHeight:(uint32_t)startHeight stopCheckpoint:(WSStorableBlock *)stopCheckpoint
+{
+    if ((self = [super init])) {
+        self.startId = startId;
+        self.startHeight = startHeight;
+        self.stopCheckpoint = stopCheckpoint;
+        self.headers = [[NSMutableArray alloc] initWithCapacity:(stopCheckpoint.height - startHeight)];
+        [self reset];
+    }
+    return self;
+}
+
+- (BOOL)isComplete
+{
+    return ((self.lastHeight == self.stopCheckpoint.height) && [self.lastId isEqual:self.stopCheckpoint.blockId]);
+}
+
+- (BOOL)shouldAcceptHeader:(WSBlockHeader *)header
+{
+    // must extend this segment without going past its checkpoint
+    return ((self.lastHeight >= self.startHeight) && (self.lastHeight < self.stopCheckpoint.height) &&
+            [header.previousBlockId isEqual:self.lastId]);
+}
+
+- (void)reset
+{
+    [self.headers removeAllObjects];
+    self.lastId = self.startId;
+    self.lastHeight = self.startHeight;
+}
+
+@end
+
+#pragma mark -
+
+@interface WSBlockChainDownloader () <WSBlockChainSyncDelegate>
 
 // configuration
 @property (nonatomic, strong) WSParameters *parameters;
@@ -53,13 +113,16 @@
 @property (nonatomic, assign) uint32_t fastCatchUpTimestamp;
 @property (nonatomic, assign) BOOL shouldDownloadBlocks;
 @property (nonatomic, strong) WSBIP37FilterParameters *bloomFilterParameters;
+@property (nonatomic, strong) WSBlockChainSync *sync;
 
 // state
 @property (nonatomic, weak) WSPeerGroup *peerGroup;
 @property (nonatomic, strong) WSPeer *downloadPeer;
 @property (nonatomic, strong) WSBloomFilter *bloomFilter;
 @property (nonatomic, strong) NSCountedSet *pendingBlockIds;
-@property (nonatomic, strong) NSMutableOrderedSet *processingBlockIds;
+@property (nonatomic, strong) WSBlockDownloadScheduler *blockScheduler;
+@property (nonatomic, strong) NSArray *deferredBlockHashes;
+@property (nonatomic, strong) NSMutableArray *headersSegments; // WSHeadersSegment
 @property (nonatomic, strong) WSBlockLocator *startingBlockChainLocator;
 @property (nonatomic, assign) NSTimeInterval lastKeepAliveTime;
 
@@ -68,34 +131,33 @@
 // business
 - (BOOL)needsBloomFiltering;
 - (WSPeer *)bestPeerAmongPeers:(NSArray *)peers; // WSPeer
+- (double)scoreOfPeer:(WSPeer *)peer;
 - (void)downloadBlockChain;
+- (void)maybeAddDownloadHelperPeer:(WSPeer *)peer;
+- (void)appendReadyBlocks;
 - (void)rebuildBloomFilter;
 - (void)requestHeadersWithLocator:(WSBlockLocator *)locator;
 - (void)requestBlocksWithLocator:(WSBlockLocator *)locator;
 - (void)aheadRequestOnReceivedHeaders:(NSArray *)headers; // WSBlockHeader
 - (void)aheadRequestOnReceivedBlockHashes:(NSArray *)hashes; // WSHash256
 - (void)requestOutdatedBlocks;
-- (void)trySaveBlockChainToCoreData;
 - (void)detectDownloadTimeout;
+- (void)evaluateDownloadPeer;
+
+// segments
+- (BOOL)startHeadersSegments;
+- (void)assignHeadersSegments;
+- (void)requestHeadersSegment:(WSHeadersSegment *)segment;
+- (void)handleHeaders:(NSArray *)headers forSegmentFromPeer:(WSPeer *)peer; // WSBlockHeader
+- (void)stitchHeadersSegments;
+- (void)finishHeadersSegments;
+- (void)unassignHeadersSegmentsFromPeer:(WSPeer *)peer;
+- (void)rescheduleStalledHeadersSegments;
 
 // blockchain
 - (BOOL)appendBlockHeaders:(NSArray *)headers error:(NSError **)error; // WSBlockHeader
-- (BOOL)appendBlock:(WSBlock *)fullBlock error:(NSError **)error;
-- (BOOL)appendFilteredBlock:(WSFilteredBlock *)filteredBlock withTransactions:(NSOrderedSet *)transactions error:(NSError **)error; // WSSignedTransaction
-- (void)truncateBlockChainForRescan;
-
-// entity handlers
-- (void)handleAddedBlock:(WSStorableBlock *)block previousHead:(WSStorableBlock *)previousHead originalEntity:(id)entity;
-- (void)handleReceivedTransaction:(WSSignedTransaction *)transaction;
-- (void)handleReorganizeAtBase:(WSStorableBlock *)base oldBlocks:(NSArray *)oldBlocks newBlocks:(NSArray *)newBlocks;
-- (void)recoverMissedBlockTransactions:(WSStorableBlock *)block originalEntity:(id)entity;
 - (BOOL)maybeRebuildAndSendBloomFilter;
 
-// macros
-- (void)logAddedBlock:(WSStorableBlock *)block location:(WSBlockChainLocation)location;
-- (void)logRejectedEntity:(id)entity location:(WSBlockChainLocation)location error:(NSError *)error;
-- (void)storeRelevantError:(NSError *)error intoError:(NSError **)outError;
-
 @end
 
 @implementation WSBlockChainDownloader
@@ -115,7 +177,6 @@
         self.requestTimeout = WSBlockChainDownloaderDefaultRequestTimeout;
 
         self.pendingBlockIds = [[NSCountedSet alloc] init];
-        self.processingBlockIds = [[NSMutableOrderedSet alloc] initWithCapacity:(2 * WSMessageBlocksMaxCount)];
     }
     return self;
 }
@@ -143,6 +204,8 @@
         self.blockChain = [[WSBlockChain alloc] initWithStore:store maxSize:maxSize];
         self.wallet = nil;
         self.fastCatchUpTimestamp = 0;
+        self.sync = [[WSBlockChainSync alloc] initWithBlockChain:self.blockChain wallet:nil];
+        self.sync.delegate = self;
 
         self.shouldDownloadBlocks = !headersOnly;
         self.bloomFilterParameters = nil;
@@ -158,6 +221,8 @@
         self.blockChain = [[WSBlockChain alloc] initWithStore:store maxSize:maxSize];
         self.wallet = nil;
         self.fastCatchUpTimestamp = fastCatchUpTimestamp;
+        self.sync = [[WSBlockChainSync alloc] initWithBlockChain:self.blockChain wallet:nil];
+        self.sync.delegate = self;
 
         self.shouldDownloadBlocks = YES;
         self.bloomFilterParameters = nil;
@@ -174,6 +239,8 @@
         self.blockChain = [[WSBlockChain alloc] initWithStore:store maxSize:maxSize];
         self.wallet = wallet;
         self.fastCatchUpTimestamp = [self.wallet earliestKeyTimestamp];
+        self.sync = [[WSBlockChainSync alloc] initWithBlockChain:self.blockChain wallet:self.wallet];
+        self.sync.delegate = self;
 
         self.shouldDownloadBlocks = YES;
         self.bloomFilterParameters = [[WSBIP37FilterParameters alloc] init];
@@ -189,6 +256,7 @@
 - (void)setCoreDataManager:(WSCoreDataManager *)coreDataManager
 {
     _coreDataManager = coreDataManager;
+    self.sync.coreDataManager = _coreDataManager;
 
     if (_coreDataManager) {
         [self.blockChain loadFromCoreDataManager:_coreDataManager];
@@ -209,6 +277,7 @@
     WSExceptionCheckIllegal(peerGroup);
     
     self.peerGroup = peerGroup;
+    self.sync.peerGroup = peerGroup;
     self.downloadPeer = [self bestPeerAmongPeers:[peerGroup allConnectedPeers]];
     if (!self.downloadPeer) {
         DDLogInfo(@"Delayed download until peer selection");
@@ -221,7 +290,10 @@
 
 - (void)stop
 {
-    [self trySaveBlockChainToCoreData];
+    [self.sync save];
+    if (self.coreDataManager) {
+        [self.blockChain waitForPendingSavesToCoreDataManager:self.coreDataManager];
+    }
     
     if (self.downloadPeer) {
         DDLogInfo(@"Download from peer %@ is being stopped", self.downloadPeer);
@@ -231,6 +303,7 @@
     }
     self.downloadPeer = nil;
     self.peerGroup = nil;
+    self.sync.peerGroup = nil;
 }
 
 - (uint32_t)lastBlockHeight
@@ -266,10 +339,15 @@
     WSExceptionCheckIllegal(count > 0);
 
     NSMutableArray *recentBlocks = [[NSMutableArray alloc] initWithCapacity:count];
-    WSStorableBlock *block = self.blockChain.head;
+    uint32_t height = self.blockChain.currentHeight;
+    WSStorableBlock *block = [self.blockChain blockAtHeight:height];
     while (block && (recentBlocks.count < count)) {
         [recentBlocks addObject:block];
-        block = [block previousBlockInChain:self.blockChain];
+        if (height == 0) {
+            break;
+        }
+        --height;
+        block = [self.blockChain blockAtHeight:height];
     }
     return recentBlocks;
 }
@@ -286,7 +364,7 @@
 - (void)rescanBlockChain
 {
     if (!self.downloadPeer) {
-        [self truncateBlockChainForRescan];
+        [self.sync truncateForRescan];
         return;
     }
     [self.peerGroup disconnectPeer:self.downloadPeer
@@ -295,7 +373,7 @@
 
 - (void)saveState
 {
-    [self trySaveBlockChainToCoreData];
+    [self.sync save];
     if (self.shouldAutoSaveWallet) {
         [self.wallet save];
     }
@@ -312,32 +390,42 @@
         [self downloadBlockChain];
     }
     // new peer is way ahead
-    else if (peer.lastBlockHeight > self.downloadPeer.lastBlockHeight + 10) {
+    else if (peer.lastBlockHeight > self.downloadPeer.lastBlockHeight + WSBlockChainDownloaderPeerHeightTolerance) {
         DDLogInfo(@"Peer %@ connected, is way ahead of current download peer (%u >> %u)",
                   peer, peer.lastBlockHeight, self.downloadPeer.lastBlockHeight);
         
         [self.peerGroup disconnectPeer:self.downloadPeer
                                  error:WSErrorMake(WSErrorCodePeerGroupDownload, @"Found a better download peer")];
     }
+    else {
+        [self maybeAddDownloadHelperPeer:peer];
+    }
 }
 
 - (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didDisconnectWithError:(NSError *)error
 {
     if (peer != self.downloadPeer) {
+        if ([self.blockScheduler containsPeer:peer]) {
+            DDLogDebug(@"Peer %@ disconnected, reassigning its block requests", peer);
+            [self.blockScheduler removePeer:peer];
+            [self unassignHeadersSegmentsFromPeer:peer];
+        }
         return;
     }
 
     DDLogDebug(@"Peer %@ disconnected, was download peer", peer);
 
     [self.pendingBlockIds removeAllObjects];
-    [self.processingBlockIds removeAllObjects];
+    self.blockScheduler = nil;
+    self.deferredBlockHashes = nil;
+    self.headersSegments = nil;
 
     switch (error.code) {
         case WSErrorCodePeerGroupDownload: {
             break;
         }
         case WSErrorCodePeerGroupRescan: {
-            [self truncateBlockChainForRescan];
+            [self.sync truncateForRescan];
             break;
         }
     }
@@ -371,6 +459,10 @@
 
 - (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveHeaders:(NSArray *)headers
 {
+    if (self.headersSegments) {
+        [self handleHeaders:headers forSegmentFromPeer:peer];
+        return;
+    }
     if (peer != self.downloadPeer) {
         return;
     }
@@ -402,49 +494,60 @@
         }
     }
     
+    // blocks are sharded across peers by scheduler
     for (WSInventory *inv in inventories) {
         if ([inv isBlockInventory]) {
-            if ([self needsBloomFiltering]) {
-                [requestInventories addObject:WSInventoryFilteredBlock(inv.inventoryHash)];
-            }
-            else {
-                [requestInventories addObject:WSInventoryBlock(inv.inventoryHash)];
-            }
             [requestBlockHashes addObject:inv.inventoryHash];
         }
         else {
             [requestInventories addObject:inv];
         }
     }
-    NSAssert(requestBlockHashes.count <= requestInventories.count, @"Requesting more blocks than total inventories?");
     
     if (requestInventories.count > 0) {
-        [self.pendingBlockIds addObjectsFromArray:requestBlockHashes];
-        [self.processingBlockIds addObjectsFromArray:requestBlockHashes];
-        
         [peer sendGetdataMessageWithInventories:requestInventories];
-        
-        if (requestBlockHashes.count > 0) {
+    }
+    if (requestBlockHashes.count > 0) {
+        for (WSHash256 *blockId in requestBlockHashes) {
+            if (![self.blockScheduler containsBlockId:blockId]) {
+                [self.pendingBlockIds addObject:blockId];
+            }
+        }
+        [self.blockScheduler scheduleBlockIds:requestBlockHashes];
+
+        // don't let peers run too far ahead of reassembly
+        if (self.blockScheduler.numberOfScheduledBlocks <= 2 * WSMessageBlocksMaxCount) {
             [self aheadRequestOnReceivedBlockHashes:requestBlockHashes];
         }
+        else {
+            self.deferredBlockHashes = requestBlockHashes;
+        }
     }
 }
 
 - (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveBlock:(WSBlock *)block
 {
-    if (peer != self.downloadPeer) {
+    if (![self.blockScheduler containsPeer:peer]) {
+        return;
+    }
+
+    WSHash256 *blockId = block.header.blockId;
+
+    [self.pendingBlockIds removeObject:blockId];
+    if ([self.blockScheduler receiveBlockWithId:blockId entity:block transactions:nil fromPeer:peer]) {
+        [self appendReadyBlocks];
         return;
     }
 
     NSError *error;
-    if (![self appendBlock:block error:&error] && error) {
-        [peerGroup reportMisbehavingPeer:self.downloadPeer error:error];
+    if (![self.sync appendBlockWithHeader:block.header transactions:block.transactions originalEntity:block error:&error] && error) {
+        [peerGroup reportMisbehavingPeer:peer error:error];
     }
 }
 
 - (BOOL)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer shouldAddTransaction:(WSSignedTransaction *)transaction toFilteredBlock:(WSFilteredBlock *)filteredBlock
 {
-    if (peer != self.downloadPeer) {
+    if (![self.blockScheduler containsPeer:peer]) {
         return YES;
     }
 
@@ -461,7 +564,7 @@
 
 - (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveFilteredBlock:(WSFilteredBlock *)filteredBlock withTransactions:(NSOrderedSet *)transactions
 {
-    if (peer != self.downloadPeer) {
+    if (![self.blockScheduler containsPeer:peer]) {
         return;
     }
 
@@ -473,11 +576,15 @@
         return;
     }
     
-    [self.processingBlockIds removeObject:blockId];
+    // reassemble in scheduling (height) order
+    if ([self.blockScheduler receiveBlockWithId:blockId entity:filteredBlock transactions:transactions fromPeer:peer]) {
+        [self appendReadyBlocks];
+        return;
+    }
 
     NSError *error;
-    if (![self appendFilteredBlock:filteredBlock withTransactions:transactions error:&error] && error) {
-        [peerGroup reportMisbehavingPeer:self.downloadPeer error:error];
+    if (![self.sync appendBlockWithHeader:filteredBlock.header transactions:transactions originalEntity:filteredBlock error:&error] && error) {
+        [peerGroup reportMisbehavingPeer:peer error:error];
     }
 }
 
@@ -487,11 +594,16 @@
 //        return;
 //    }
 
-    [self handleReceivedTransaction:transaction];
+    [self.sync registerTransaction:transaction];
 }
 
 - (BOOL)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer shouldAcceptHeader:(WSBlockHeader *)header error:(NSError *__autoreleasing *)error
 {
+    // segments are validated against their boundary checkpoints
+    if (self.headersSegments) {
+        return YES;
+    }
+
     WSStorableBlock *expected = [self.parameters checkpointAtHeight:(uint32_t)(self.blockChain.currentHeight + 1)];
     if (!expected) {
         return YES;
@@ -520,25 +632,60 @@
 
 - (WSPeer *)bestPeerAmongPeers:(NSArray *)peers
 {
-    WSPeer *bestPeer = nil;
+    NSMutableArray *connectedPeers = [[NSMutableArray alloc] initWithCapacity:peers.count];
+    uint32_t maxHeight = 0;
     for (WSPeer *peer in peers) {
 
         // double check connection status
         if (peer.peerStatus != WSPeerStatusConnected) {
             continue;
         }
+        [connectedPeers addObject:peer];
+        maxHeight = MAX(maxHeight, peer.lastBlockHeight);
+    }
 
-        // max chain height or min ping
-        if (!bestPeer ||
-            (peer.lastBlockHeight > bestPeer.lastBlockHeight) ||
-            ((peer.lastBlockHeight == bestPeer.lastBlockHeight) && (peer.connectionTime < bestPeer.connectionTime))) {
+    // best score among peers close enough to max chain height
+    WSPeer *bestPeer = nil;
+    double bestScore = 0.0;
+    for (WSPeer *peer in connectedPeers) {
+        if (peer.lastBlockHeight + WSBlockChainDownloaderPeerHeightTolerance < maxHeight) {
+            continue;
+        }
 
+        const double score = [self scoreOfPeer:peer];
+        if (!bestPeer || (score > bestScore)) {
             bestPeer = peer;
+            bestScore = score;
         }
     }
     return bestPeer;
 }
 
+- (double)scoreOfPeer:(WSPeer *)peer
+{
+    NSParameterAssert(peer);
+
+    // fall back to handshake time when not measured yet
+    NSTimeInterval latency = peer.responseTime;
+    if (latency == DBL_MAX) {
+        latency = peer.pingTime;
+    }
+    if (latency == DBL_MAX) {
+        latency = peer.connectionTime;
+    }
+    if (latency == DBL_MAX) {
+        latency = self.requestTimeout;
+    }
+
+    double throughput = peer.throughput;
+    if (throughput == 0.0) {
+        throughput = WSBlockChainDownloaderPeerDefaultThroughput;
+    }
+
+    // inverse of expected time to deliver a reference amount of blocks
+    return 1.0 / (latency + WSBlockChainDownloaderPeerScoreLength / throughput);
+}
+
 - (void)downloadBlockChain
 {
     if (self.wallet) {
@@ -554,6 +701,15 @@
         DDLogDebug(@"No wallet provided, downloading block headers");
     }
 
+    const WSInventoryType inventoryType = ([self needsBloomFiltering] ? WSInventoryTypeFilteredBlock : WSInventoryTypeBlock);
+    self.blockScheduler = [[WSBlockDownloadScheduler alloc] initWithInventoryType:inventoryType];
+    [self.blockScheduler addPeer:self.downloadPeer];
+    self.deferredBlockHashes = nil;
+
+    for (WSPeer *peer in [self.peerGroup allConnectedPeers]) {
+        [self maybeAddDownloadHelperPeer:peer];
+    }
+
     DDLogInfo(@"Preparing for blockchain download");
 
     if (self.blockChain.currentHeight >= self.downloadPeer.lastBlockHeight) {
@@ -562,7 +718,7 @@
         
         DDLogInfo(@"Blockchain is up to date");
         
-        [self trySaveBlockChainToCoreData];
+        [self.sync save];
         
         [self.peerGroup.notifier notifyDownloadFinished];
         return;
@@ -592,16 +748,71 @@
     dispatch_async(dispatch_get_main_queue(), ^{
         [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(detectDownloadTimeout) object:nil];
         [self performSelector:@selector(detectDownloadTimeout) withObject:nil afterDelay:self.requestTimeout];
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evaluateDownloadPeer) object:nil];
+        [self performSelector:@selector(evaluateDownloadPeer) withObject:nil afterDelay:WSBlockChainDownloaderPeerEvaluationInterval];
     });
     
     if (!self.shouldDownloadBlocks || (self.blockChain.currentTimestamp < self.fastCatchUpTimestamp)) {
-        [self requestHeadersWithLocator:self.startingBlockChainLocator];
+        if (![self startHeadersSegments]) {
+            [self requestHeadersWithLocator:self.startingBlockChainLocator];
+        }
     }
     else {
         [self requestBlocksWithLocator:self.startingBlockChainLocator];
     }
 }
 
+- (void)maybeAddDownloadHelperPeer:(WSPeer *)peer
+{
+    NSParameterAssert(peer);
+
+    if (!self.blockScheduler || (peer == self.downloadPeer) || [self.blockScheduler containsPeer:peer]) {
+        return;
+    }
+    if (peer.peerStatus != WSPeerStatusConnected) {
+        return;
+    }
+
+    // handshake heights age quickly, only skip peers behind local chain
+    // (blocks a helper can't serve stall and are reassigned to other peers)
+    if (peer.lastBlockHeight < self.blockChain.currentHeight) {
+        return;
+    }
+    
+    if ([self needsBloomFiltering]) {
+        DDLogDebug(@"Loading Bloom filter for download helper peer %@", peer);
+        [peer sendFilterloadMessageWithFilter:self.bloomFilter];
+    }
+    [self.blockScheduler addPeer:peer];
+    [self assignHeadersSegments];
+}
+
+- (void)appendReadyBlocks
+{
+    [self.blockScheduler dequeueReadyBlocksWithBlock:^(id entity, NSOrderedSet *transactions, WSPeer *peer) {
+        WSBlockHeader *header;
+        if ([entity isKindOfClass:[WSFilteredBlock class]]) {
+            header = [(WSFilteredBlock *)entity header];
+        }
+        else {
+            WSBlock *fullBlock = entity;
+            header = fullBlock.header;
+            transactions = fullBlock.transactions;
+        }
+
+        NSError *error;
+        if (![self.sync appendBlockWithHeader:header transactions:transactions originalEntity:entity error:&error] && error) {
+            [self.peerGroup reportMisbehavingPeer:peer error:error];
+        }
+    }];
+
+    if (self.deferredBlockHashes && (self.blockScheduler.numberOfScheduledBlocks <= WSMessageBlocksMaxCount)) {
+        NSArray *hashes = self.deferredBlockHashes;
+        self.deferredBlockHashes = nil;
+        [self aheadRequestOnReceivedBlockHashes:hashes];
+    }
+}
+
 - (void)rebuildBloomFilter
 {
     const NSTimeInterval rebuildStartTime = [NSDate timeIntervalSinceReferenceDate];
@@ -696,63 +907,26 @@
 - (void)requestOutdatedBlocks
 {
     //
-    // since receive* and delegate methods run on the same queue,
-    // a peer should never request more hashes until delegate processed
-    // all blocks with last received hashes
-    //
-    //
-    // 1. start download calling getblocks with current chain locator
-    // ...
-    // 2. receiveInv called with max 500 inventories (in response to 1)
-    // 3. receiveInv: call getblocks with new locator
-    // 4. receiveInv: call getdata with received inventories
-    // 5. processingBlocksIds.count <= 500
-    // ...
-    // 6. receiveInv called with max 500 inventories (in response to 3)
-    // 7. receiveInv: call getblocks with new locator
-    // 8. receiveInv: call getdata with received inventories
-    // 9. processingBlocksIds.count <= 1000
-    // ...
-    // 10. receiveMerkleblock + receiveTx (in response to 4)
-    // 11. processingBlockIds.count <= 500
-    // ...
-    // 12. receiveInv called with max 500 inventories (in response to 7)
-    // 13. receiveInv: call getblocks with new locator
-    // 14. receiveInv: call getdata with received inventories
-    // 15. processingBlockIds.count <= 1000
-    // ...
+    // block requests are sharded across download peers by the scheduler,
+    // in-flight requests are bounded by its per-peer window and reassembly
+    // backlog is bounded by deferring getblocks (2 * max scheduled blocks)
     //
+    // outdated requests are resent to the same peers they were assigned to,
+    // which were just loaded with the updated Bloom filter
     //
-    // that's why processingBlockIds should reach 1000 at most (2 * max)
-    //
-    
-    //        NSAssert(self.processingBlockIds.count <= 2 * WSMessageBlocksMaxCount, @"Processing too many blocks (%u > %u)",
-    //                 self.processingBlockIds.count, 2 * WSMessageBlocksMaxCount);
-    
-    NSArray *outdatedIds = [self.processingBlockIds array];
     
-#warning XXX: outdatedIds size shouldn't overflow WSMessageMaxInventories
-    
-    if (outdatedIds.count > 0) {
-        DDLogDebug(@"Requesting %lu outdated blocks with updated Bloom filter: %@", (unsigned long)outdatedIds.count, outdatedIds);
-        [self.downloadPeer sendGetdataMessageWithHashes:outdatedIds forInventoryType:WSInventoryTypeFilteredBlock];
-    }
-    else {
-        DDLogDebug(@"No outdated blocks to request with updated Bloom filter");
-    }
-}
+    DDLogDebug(@"Requesting outdated blocks with updated Bloom filter from %lu peers",
+               (unsigned long)self.blockScheduler.allPeers.count);
 
-- (void)trySaveBlockChainToCoreData
-{
-    if (self.coreDataManager) {
-        [self.blockChain saveToCoreDataManager:self.coreDataManager];
-    }
+    [self.blockScheduler resendPendingRequests];
 }
 
-// main queue
 - (void)detectDownloadTimeout
 {
     [self.peerGroup executeBlockInGroupQueue:^{
+        [self.blockScheduler rescheduleStalledRequests];
+        [self rescheduleStalledHeadersSegments];
+
         const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
         const NSTimeInterval elapsed = now - self.lastKeepAliveTime;
         
@@ -772,274 +946,340 @@
     } synchronously:NO];
 }
 
-#pragma mark Blockchain
-
-- (BOOL)appendBlockHeaders:(NSArray *)headers error:(NSError *__autoreleasing *)error
+// main queue
+- (void)evaluateDownloadPeer
 {
-    NSParameterAssert(headers.count > 0);
-    
-    for (WSBlockHeader *header in headers) {
-        
-        // download peer should stop requesting headers when fast catch-up reached
-        if (self.shouldDownloadBlocks && (header.timestamp >= self.fastCatchUpTimestamp)) {
-            break;
+    [self.peerGroup executeBlockInGroupQueue:^{
+        if (!self.downloadPeer || [self isSynced]) {
+            return;
         }
 
-        NSError *localError;
-        WSStorableBlock *addedBlock = nil;
-        WSStorableBlock *previousHead = nil;
-        __weak WSBlockChainDownloader *weakSelf = self;
-        
-        WSBlockChainLocation location;
-        NSArray *connectedOrphans;
-        previousHead = self.blockChain.head;
-        addedBlock = [self.blockChain addBlockWithHeader:header
-                                            transactions:nil
-                                                location:&location
-                                        connectedOrphans:&connectedOrphans
-                                         reorganizeBlock:^(WSStorableBlock *base, NSArray *oldBlocks, NSArray *newBlocks) {
-            
-            [weakSelf handleReorganizeAtBase:base oldBlocks:oldBlocks newBlocks:newBlocks];
-            
-        } error:&localError];
-        
-        if (!addedBlock) {
-            [self logRejectedEntity:header location:location error:localError];
-            [self storeRelevantError:localError intoError:error];
-            return NO;
+        NSArray *peers = [self.peerGroup allConnectedPeers];
+        WSPeer *bestPeer = [self bestPeerAmongPeers:peers];
+        const double downloadScore = [self scoreOfPeer:self.downloadPeer];
+        const double bestScore = (bestPeer ? [self scoreOfPeer:bestPeer] : 0.0);
+
+        // refresh round trip times for next evaluation
+        for (WSPeer *peer in peers) {
+            if (peer.peerStatus == WSPeerStatusConnected) {
+                [peer sendPingMessage];
+            }
         }
-        
-        [self logAddedBlock:addedBlock location:location];
 
-        [self handleAddedBlock:addedBlock previousHead:previousHead originalEntity:header];
-        for (WSStorableBlock *block in connectedOrphans) {
-            [self handleAddedBlock:block previousHead:previousHead originalEntity:nil];
+        // hysteresis, switching discards in-flight requests
+        if (bestPeer && (bestPeer != self.downloadPeer) && (bestScore > WSBlockChainDownloaderPeerSwitchRatio * downloadScore)) {
+            DDLogInfo(@"Peer %@ scores much better than current download peer (%.3f >> %.3f)",
+                      bestPeer, bestScore, downloadScore);
+
+            [self.peerGroup disconnectPeer:self.downloadPeer
+                                     error:WSErrorMake(WSErrorCodePeerGroupDownload, @"Found a better download peer")];
+            return;
         }
-    }
 
-    return YES;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evaluateDownloadPeer) object:nil];
+            [self performSelector:@selector(evaluateDownloadPeer) withObject:nil afterDelay:WSBlockChainDownloaderPeerEvaluationInterval];
+        });
+    } synchronously:NO];
 }
 
-- (BOOL)appendBlock:(WSBlock *)fullBlock error:(NSError *__autoreleasing *)error
+#pragma mark Segments
+
+- (BOOL)startHeadersSegments
 {
-    NSParameterAssert(fullBlock);
+    const uint32_t maxHeight = self.downloadPeer.lastBlockHeight;
+    WSHash256 *startId = self.blockChain.head.blockId;
+    uint32_t startHeight = self.blockChain.currentHeight;
+
+    // disjoint ranges between sorted checkpoints, all below fast catch-up
+    NSMutableArray *segments = [[NSMutableArray alloc] init];
+    for (WSStorableBlock *checkpoint in [self.parameters checkpoints]) {
+        if (checkpoint.height <= startHeight) {
+            continue;
+        }
+        if (checkpoint.height > maxHeight) {
+            break;
+        }
+        if (self.shouldDownloadBlocks && (checkpoint.header.timestamp >= self.fastCatchUpTimestamp)) {
+            break;
+        }
 
-    NSError *localError;
-    WSStorableBlock *addedBlock = nil;
-    WSStorableBlock *previousHead = nil;
-    __weak WSBlockChainDownloader *weakSelf = self;
-    
-    WSBlockChainLocation location;
-    NSArray *connectedOrphans;
-    previousHead = self.blockChain.head;
-    addedBlock = [self.blockChain addBlockWithHeader:fullBlock.header
-                                        transactions:fullBlock.transactions
-                                            location:&location
-                                    connectedOrphans:&connectedOrphans
-                                     reorganizeBlock:^(WSStorableBlock *base, NSArray *oldBlocks, NSArray *newBlocks) {
-        
-        [weakSelf handleReorganizeAtBase:base oldBlocks:oldBlocks newBlocks:newBlocks];
-        
-    } error:&localError];
-    
-    if (!addedBlock) {
-        [self logRejectedEntity:fullBlock location:location error:localError];
-        [self storeRelevantError:localError intoError:error];
+        WSHeadersSegment *segment = [[WSHeadersSegment alloc] initWithStartId:startId startHeight:startHeight stopCheckpoint:checkpoint];
+        [segments addObject:segment];
+
+        startId = checkpoint.blockId;
+        startHeight = checkpoint.height;
+    }
+    if (segments.count < 2) {
         return NO;
     }
-    
-    [self logAddedBlock:addedBlock location:location];
 
-    [self handleAddedBlock:addedBlock previousHead:previousHead originalEntity:fullBlock];
-    for (WSStorableBlock *block in connectedOrphans) {
-        [self handleAddedBlock:block previousHead:previousHead originalEntity:nil];
-    }
+    DDLogInfo(@"Requesting headers up to height %u in %lu checkpoint segments",
+              startHeight, (unsigned long)segments.count);
 
+    self.headersSegments = segments;
+    [self assignHeadersSegments];
     return YES;
 }
 
-- (BOOL)appendFilteredBlock:(WSFilteredBlock *)filteredBlock withTransactions:(NSOrderedSet *)transactions error:(NSError *__autoreleasing *)error
+- (void)assignHeadersSegments
 {
-    NSParameterAssert(filteredBlock);
-    NSParameterAssert(transactions);
+    if (!self.headersSegments) {
+        return;
+    }
 
-    NSError *localError;
-    WSStorableBlock *addedBlock = nil;
-    WSStorableBlock *previousHead = nil;
-    __weak WSBlockChainDownloader *weakSelf = self;
-    
-    WSBlockChainLocation location;
-    NSArray *connectedOrphans;
-    previousHead = self.blockChain.head;
-    addedBlock = [self.blockChain addBlockWithHeader:filteredBlock.header
-                                        transactions:transactions
-                                            location:&location
-                                    connectedOrphans:&connectedOrphans
-                                     reorganizeBlock:^(WSStorableBlock *base, NSArray *oldBlocks, NSArray *newBlocks) {
-        
-        [weakSelf handleReorganizeAtBase:base oldBlocks:oldBlocks newBlocks:newBlocks];
-        
-    } error:&localError];
-    
-    if (!addedBlock) {
-        [self logRejectedEntity:filteredBlock location:location error:localError];
-        [self storeRelevantError:localError intoError:error];
-        return NO;
+    NSMutableSet *busyPeers = [[NSMutableSet alloc] init];
+    for (WSHeadersSegment *segment in self.headersSegments) {
+        if (segment.peer) {
+            [busyPeers addObject:segment.peer];
+        }
     }
-    
-    [self logAddedBlock:addedBlock location:location];
 
-    [self handleAddedBlock:addedBlock previousHead:previousHead originalEntity:filteredBlock];
-    for (WSStorableBlock *block in connectedOrphans) {
-        [self handleAddedBlock:block previousHead:previousHead originalEntity:nil];
+    // earliest segments first, they are stitched in order
+    for (WSHeadersSegment *segment in self.headersSegments) {
+        if (segment.peer || [segment isComplete]) {
+            continue;
+        }
+
+        WSPeer *freePeer = nil;
+        for (WSPeer *peer in [self.blockScheduler allPeers]) {
+            if ([busyPeers containsObject:peer] || (peer.peerStatus != WSPeerStatusConnected)) {
+                continue;
+            }
+            if (!freePeer || (freePeer == segment.stalledPeer)) {
+                freePeer = peer;
+            }
+        }
+        if (!freePeer) {
+            break;
+        }
+
+        segment.peer = freePeer;
+        [busyPeers addObject:freePeer];
+        [self requestHeadersSegment:segment];
     }
-    
-    return YES;
 }
 
-- (void)truncateBlockChainForRescan
+- (void)requestHeadersSegment:(WSHeadersSegment *)segment
 {
-    DDLogDebug(@"Rescan, preparing to truncate blockchain and wallet (if any)");
-    
-    [self.blockChain truncate];
-    NSAssert(self.blockChain.currentHeight == 0, @"Expected genesis blockchain");
-    [self.wallet removeAllTransactions];
-    
-    DDLogDebug(@"Rescan, truncate complete");
-    [self.peerGroup.notifier notifyRescan];
-}
+    NSParameterAssert(segment.peer);
+
+    WSBlockLocator *locator = [[WSBlockLocator alloc] initWithHashes:@[segment.lastId]];
+    segment.lastRequestTime = [NSDate timeIntervalSinceReferenceDate];
+
+    DDLogDebug(@"Requesting headers segment (%u-%u) from peer %@ at height %u",
+               segment.startHeight, segment.stopCheckpoint.height, segment.peer, segment.lastHeight);
 
-#pragma mark Entity handlers
+    [segment.peer sendGetheadersMessageWithLocator:locator hashStop:segment.stopCheckpoint.blockId];
+}
 
-- (void)handleAddedBlock:(WSStorableBlock *)block previousHead:(WSStorableBlock *)previousHead originalEntity:(id)entity
+- (void)handleHeaders:(NSArray *)headers forSegmentFromPeer:(WSPeer *)peer
 {
-    NSParameterAssert(block);
-    NSParameterAssert(previousHead);
+    NSParameterAssert(headers.count > 0);
+    NSParameterAssert(peer);
 
-    // new block
-    if (![block.blockId isEqual:previousHead.blockId]) {
-        [self.peerGroup.notifier notifyBlock:block];
-        
-        // download finished
-        if (block.height == self.downloadPeer.lastBlockHeight) {
-            for (WSPeer *peer in [self.peerGroup allConnectedPeers]) {
-                if ([self needsBloomFiltering] && (peer != self.downloadPeer)) {
-                    DDLogDebug(@"Loading Bloom filter for peer %@", peer);
-                    [peer sendFilterloadMessageWithFilter:self.bloomFilter];
-                }
-                DDLogDebug(@"Requesting mempool from peer %@", peer);
-                [peer sendMempoolMessage];
-            }
-            
-            [self trySaveBlockChainToCoreData];
-            
-            dispatch_async(dispatch_get_main_queue(), ^{
-                [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(detectDownloadTimeout) object:nil];
-            });
-            [self.peerGroup.notifier notifyDownloadFinished];
+    WSHeadersSegment *segment = nil;
+    for (WSHeadersSegment *candidate in self.headersSegments) {
+        if (candidate.peer == peer) {
+            segment = candidate;
+            break;
         }
     }
-    
-    if (self.wallet) {
-        [self recoverMissedBlockTransactions:block originalEntity:entity];
+
+    // late response to a reassigned request
+    WSBlockHeader *firstHeader = [headers firstObject];
+    if (!segment || ![segment shouldAcceptHeader:firstHeader]) {
+        DDLogDebug(@"Ignoring unrequested headers from peer %@", peer);
+        return;
+    }
+
+    // headers are internally linked (verified by peer), stop at checkpoint
+    const NSUInteger count = MIN(headers.count, segment.stopCheckpoint.height - segment.lastHeight);
+    WSBlockHeader *lastHeader = headers[count - 1];
+    const uint32_t lastHeight = segment.lastHeight + (uint32_t)count;
+
+    if ((lastHeight == segment.stopCheckpoint.height) && ![lastHeader.blockId isEqual:segment.stopCheckpoint.blockId]) {
+        NSError *error = WSErrorMake(WSErrorCodeInvalidBlock, @"Checkpoint validation failed at %u (%@ != %@)",
+                                     lastHeight, lastHeader.blockId, segment.stopCheckpoint.blockId);
+
+        // earlier headers might belong to the same wrong chain, refetch segment
+        [segment reset];
+        segment.stalledPeer = peer;
+        segment.peer = nil;
+        [self.peerGroup reportMisbehavingPeer:peer error:error];
+        [self assignHeadersSegments];
+        return;
     }
+
+    [segment.headers addObjectsFromArray:((count < headers.count) ? [headers subarrayWithRange:NSMakeRange(0, count)] : headers)];
+    segment.lastId = lastHeader.blockId;
+    segment.lastHeight = lastHeight;
+    segment.stalledPeer = nil;
+
+    // any segment progress keeps download alive
+    self.lastKeepAliveTime = [NSDate timeIntervalSinceReferenceDate];
+
+    if (![segment isComplete]) {
+        [self requestHeadersSegment:segment];
+        return;
+    }
+
+    DDLogDebug(@"Completed headers segment (%u-%u) from peer %@",
+               segment.startHeight, segment.stopCheckpoint.height, peer);
+
+    segment.peer = nil;
+    [self stitchHeadersSegments];
+    [self assignHeadersSegments];
 }
 
-- (void)handleReceivedTransaction:(WSSignedTransaction *)transaction
+- (void)stitchHeadersSegments
 {
-    NSParameterAssert(transaction);
-
-    if (self.wallet) {
-        BOOL didGenerateNewAddresses = NO;
-        if (![self.wallet registerTransaction:transaction didGenerateNewAddresses:&didGenerateNewAddresses]) {
+    while (self.headersSegments.count > 0) {
+        WSHeadersSegment *segment = [self.headersSegments firstObject];
+        if (![segment isComplete]) {
             return;
         }
-    
-        if (didGenerateNewAddresses) {
-            DDLogDebug(@"Last transaction triggered new addresses generation");
-            
-            if ([self maybeRebuildAndSendBloomFilter]) {
-                [self requestOutdatedBlocks];
+        if (![segment.startId isEqual:self.blockChain.head.blockId]) {
+            DDLogWarn(@"Headers segment (%u-%u) not linked to blockchain head %@, falling back to serial download",
+                      segment.startHeight, segment.stopCheckpoint.height, self.blockChain.head);
+            [self finishHeadersSegments];
+            return;
+        }
+
+        for (NSUInteger i = 0; i < segment.headers.count; i += WSMessageHeadersMaxCount) {
+            const NSUInteger count = MIN(WSMessageHeadersMaxCount, segment.headers.count - i);
+            NSArray *headers = [segment.headers subarrayWithRange:NSMakeRange(i, count)];
+
+            NSError *error;
+            if (![self appendBlockHeaders:headers error:&error]) {
+                DDLogWarn(@"Headers segment (%u-%u) rejected, falling back to serial download: %@",
+                          segment.startHeight, segment.stopCheckpoint.height, error);
+                [self finishHeadersSegments];
+                return;
             }
         }
+        [self.headersSegments removeObjectAtIndex:0];
     }
+
+    DDLogInfo(@"All headers segments stitched at height %u", self.blockChain.currentHeight);
+    [self finishHeadersSegments];
 }
 
-- (void)handleReorganizeAtBase:(WSStorableBlock *)base oldBlocks:(NSArray *)oldBlocks newBlocks:(NSArray *)newBlocks
+- (void)finishHeadersSegments
 {
-    NSParameterAssert(base);
-    NSParameterAssert(oldBlocks);
-    NSParameterAssert(newBlocks);
+    self.headersSegments = nil;
 
-    DDLogDebug(@"Reorganized blockchain at block: %@", base);
-    DDLogDebug(@"Reorganize, old blocks: %@", oldBlocks);
-    DDLogDebug(@"Reorganize, new blocks: %@", newBlocks);
-    
-    [self.peerGroup.notifier notifyReorganizationWithOldBlocks:oldBlocks newBlocks:newBlocks];
-    
-    //
-    // wallet should already contain transactions from new blocks, reorganize will only
-    // change their parent block (thus updating wallet metadata)
-    //
-    // that's because after a 'merkleblock' message the following 'tx' messages are received
-    // and registered anyway, even if the 'merkleblock' is later considered orphan or on fork
-    // by local blockchain
-    //
-    // for the above reason, a reorg should never generate new addresses
-    //
-    
-    if (self.wallet) {
-        BOOL didGenerateNewAddresses = NO;
-        [self.wallet reorganizeWithOldBlocks:oldBlocks newBlocks:newBlocks didGenerateNewAddresses:&didGenerateNewAddresses];
-        
-        if (didGenerateNewAddresses) {
-            DDLogWarn(@"Reorganize triggered (unexpected) new addresses generation");
-            
-            if ([self maybeRebuildAndSendBloomFilter]) {
-                [self requestOutdatedBlocks];
-            }
+    // resume serial download from current head (beyond last checkpoint or on fallback)
+    self.startingBlockChainLocator = [self.blockChain currentLocator];
+    [self requestHeadersWithLocator:self.startingBlockChainLocator];
+}
+
+- (void)unassignHeadersSegmentsFromPeer:(WSPeer *)peer
+{
+    NSParameterAssert(peer);
+
+    BOOL didUnassign = NO;
+    for (WSHeadersSegment *segment in self.headersSegments) {
+        if (segment.peer == peer) {
+            segment.peer = nil;
+            didUnassign = YES;
         }
     }
+    if (didUnassign) {
+        [self assignHeadersSegments];
+    }
 }
 
-- (void)recoverMissedBlockTransactions:(WSStorableBlock *)block originalEntity:(id)entity
+- (void)rescheduleStalledHeadersSegments
 {
-    NSParameterAssert(block);
-    
-    // don't register orphan blocks
-    if ([self.blockChain isKnownOrphanBlockWithId:block.blockId]) {
-        return;
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    BOOL didUnassign = NO;
+    for (WSHeadersSegment *segment in self.headersSegments) {
+        if (!segment.peer || (now - segment.lastRequestTime < self.requestTimeout)) {
+            continue;
+        }
+
+        DDLogDebug(@"Peer %@ stalled headers segment (%u-%u), reassigning",
+                   segment.peer, segment.startHeight, segment.stopCheckpoint.height);
+
+        segment.stalledPeer = segment.peer;
+        segment.peer = nil;
+        didUnassign = YES;
+    }
+    if (didUnassign) {
+        [self assignHeadersSegments];
     }
+}
 
-    //
-    // enforce registration in case we lost these transactions
-    //
-    // see note in [WSHDWallet isRelevantTransaction:savingReceivingAddresses:]
-    //
-    BOOL didGenerateNewAddresses = NO;
-    for (WSSignedTransaction *transaction in block.transactions) {
-        BOOL txDidGenerateNewAddresses = NO;
-        [self.wallet registerTransaction:transaction didGenerateNewAddresses:&txDidGenerateNewAddresses];
+#pragma mark Blockchain
 
-        didGenerateNewAddresses |= txDidGenerateNewAddresses;
+- (BOOL)appendBlockHeaders:(NSArray *)headers error:(NSError *__autoreleasing *)error
+{
+    NSParameterAssert(headers.count > 0);
+    
+    // download peer should stop requesting headers when fast catch-up reached
+    NSUInteger count = headers.count;
+    if (self.shouldDownloadBlocks) {
+        count = 0;
+        for (WSBlockHeader *header in headers) {
+            if (header.timestamp >= self.fastCatchUpTimestamp) {
+                break;
+            }
+            ++count;
+        }
+        if (count == 0) {
+            return YES;
+        }
+        if (count < headers.count) {
+            headers = [headers subarrayWithRange:NSMakeRange(0, count)];
+        }
     }
 
-    // optionally merge txids from empty filtered block
-    WSFilteredBlock *filteredBlock;
-    if ([entity isKindOfClass:[WSFilteredBlock class]]) {
-        filteredBlock = entity;
+    return [self.sync appendBlockHeaders:headers error:error];
+}
+
+#pragma mark WSBlockChainSyncDelegate
+
+- (BOOL)blockChainSyncIsSynced:(WSBlockChainSync *)sync
+{
+    return [self isSynced];
+}
+
+- (void)blockChainSyncDidGenerateNewAddresses:(WSBlockChainSync *)sync
+{
+    if ([self maybeRebuildAndSendBloomFilter]) {
+        [self requestOutdatedBlocks];
     }
-    [self.wallet registerBlock:block matchingFilteredBlock:filteredBlock];
+}
 
-    if (didGenerateNewAddresses) {
-        DDLogWarn(@"Block registration triggered new addresses generation");
+- (void)blockChainSync:(WSBlockChainSync *)sync didAddNewBlock:(WSStorableBlock *)block
+{
+    NSParameterAssert(block);
 
-        if ([self maybeRebuildAndSendBloomFilter]) {
-            [self requestOutdatedBlocks];
+    // download finished
+    if (block.height == self.downloadPeer.lastBlockHeight) {
+        for (WSPeer *peer in [self.peerGroup allConnectedPeers]) {
+            if ([self needsBloomFiltering] && (peer != self.downloadPeer)) {
+                DDLogDebug(@"Loading Bloom filter for peer %@", peer);
+                [peer sendFilterloadMessageWithFilter:self.bloomFilter];
+            }
+            DDLogDebug(@"Requesting mempool from peer %@", peer);
+            [peer sendMempoolMessage];
         }
+        
+        [self.sync save];
+        
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(detectDownloadTimeout) object:nil];
+            [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(evaluateDownloadPeer) object:nil];
+        });
+        [self.peerGroup.notifier notifyDownloadFinished];
     }
 }
 
+#pragma mark Bloom filter
+
 - (BOOL)maybeRebuildAndSendBloomFilter
 {
     if (![self needsBloomFiltering]) {
@@ -1072,8 +1312,10 @@
     
     if ([self needsBloomFiltering]) {
         if (self.blockChain.currentHeight < self.downloadPeer.lastBlockHeight) {
-            DDLogDebug(@"Still syncing, loading rebuilt Bloom filter only for download peer %@", self.downloadPeer);
-            [self.downloadPeer sendFilterloadMessageWithFilter:self.bloomFilter];
+            for (WSPeer *peer in [self.blockScheduler allPeers]) {
+                DDLogDebug(@"Still syncing, loading rebuilt Bloom filter for download peer %@", peer);
+                [peer sendFilterloadMessageWithFilter:self.bloomFilter];
+            }
         }
         else {
             for (WSPeer *peer in [self.peerGroup allConnectedPeers]) {
@@ -1086,58 +1328,4 @@
     return YES;
 }
 
-#pragma mark Macros
-
-- (void)logAddedBlock:(WSStorableBlock *)block location:(WSBlockChainLocation)location
-{
-    NSParameterAssert(block);
-    
-    if ([self isSynced]) {
-        switch (location) {
-            case WSBlockChainLocationMain: {
-                DDLogInfo(@"New head: %@", self.blockChain.head);
-                break;
-            }
-            case WSBlockChainLocationFork: {
-                DDLogInfo(@"New fork block: %@", block);
-                DDLogInfo(@"Fork base: %@", [self.blockChain findForkBaseFromHead:block]);
-                break;
-            }
-            case WSBlockChainLocationOrphan: {
-                DDLogInfo(@"New orphan: %@", block);
-                break;
-            }
-            case WSBlockChainLocationNone: {
-                break;
-            }
-        }
-    }
-}
-
-- (void)logRejectedEntity:(id)entity location:(WSBlockChainLocation)location error:(NSError *)error
-{
-    NSParameterAssert(entity);
-
-    if (location == WSBlockChainLocationOrphan) {
-        return;
-    }
-    if (!error) {
-        DDLogDebug(@"%@ not added: %@", [entity class], entity);
-    }
-    else {
-        DDLogDebug(@"Error adding %@ (%@): %@", [entity class], error, entity);
-    }
-    DDLogDebug(@"Current head: %@", self.blockChain.head);
-}
-
-- (void)storeRelevantError:(NSError *)error intoError:(NSError *__autoreleasing *)outError
-{
-    if (!error || !outError) {
-        return;
-    }
-    if ((error.domain == WSErrorDomain) && (error.code == WSErrorCodeInvalidBlock)) {
-        *outError = error;
-    }
-}
-
 @end
@@ -0,0 +1,76 @@
+//
+//  WSBlockChainSync.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+@class WSBlockChain;
+@class WSBlockHeader;
+@class WSStorableBlock;
+@class WSSignedTransaction;
+@class WSPeerGroup;
+@class WSCoreDataManager;
+@protocol WSSynchronizableWallet;
+@protocol WSBlockChainSyncDelegate;
+
+#pragma mark -
+
+//
+// blockchain and wallet bookkeeping shared by downloaders: appends headers
+// and blocks, registers transactions to the wallet and notifies the peer
+// group, while what to request next is up to the delegate
+//
+// thread-safe: no (should only run in group queue)
+//
+@interface WSBlockChainSync : NSObject
+
+@property (nonatomic, weak) id<WSBlockChainSyncDelegate> delegate;
+@property (nonatomic, weak) WSPeerGroup *peerGroup;
+@property (nonatomic, strong) WSCoreDataManager *coreDataManager;
+
+- (instancetype)initWithBlockChain:(WSBlockChain *)blockChain wallet:(id<WSSynchronizableWallet>)wallet;
+- (WSBlockChain *)blockChain;
+- (id<WSSynchronizableWallet>)wallet;
+
+- (BOOL)appendBlockHeaders:(NSArray *)headers error:(NSError **)error; // WSBlockHeader
+- (BOOL)appendBlockWithHeader:(WSBlockHeader *)header transactions:(NSOrderedSet *)transactions originalEntity:(id)entity error:(NSError **)error; // WSSignedTransaction
+- (void)registerTransaction:(WSSignedTransaction *)transaction;
+- (void)truncateForRescan;
+- (void)save;
+
+@end
+
+#pragma mark -
+
+@protocol WSBlockChainSyncDelegate <NSObject>
+
+- (BOOL)blockChainSyncIsSynced:(WSBlockChainSync *)sync;
+- (void)blockChainSyncDidGenerateNewAddresses:(WSBlockChainSync *)sync;
+
+@optional
+- (void)blockChainSync:(WSBlockChainSync *)sync didAddNewBlock:(WSStorableBlock *)block;
+- (void)blockChainSync:(WSBlockChainSync *)sync didReorganizeAtBase:(WSStorableBlock *)base;
+- (void)blockChainSyncDidTruncate:(WSBlockChainSync *)sync;
+
+@end
@@ -0,0 +1,342 @@
+//
+//  WSBlockChainSync.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSBlockChainSync.h"
+#import "WSPeerGroup+Download.h"
+#import "WSBlockChain.h"
+#import "WSBlockHeader.h"
+#import "WSFilteredBlock.h"
+#import "WSTransaction.h"
+#import "WSStorableBlock.h"
+#import "WSWallet.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+@interface WSBlockChainSync ()
+
+@property (nonatomic, strong) WSBlockChain *blockChain;
+@property (nonatomic, strong) id<WSSynchronizableWallet> wallet;
+
+- (void)handleAddedBlock:(WSStorableBlock *)block previousHead:(WSStorableBlock *)previousHead originalEntity:(id)entity;
+- (void)handleReorganizeAtBase:(WSStorableBlock *)base oldBlocks:(NSArray *)oldBlocks newBlocks:(NSArray *)newBlocks;
+- (void)registerBlock:(WSStorableBlock *)block originalEntity:(id)entity;
+
+// macros
+- (void)logAddedBlock:(WSStorableBlock *)block location:(WSBlockChainLocation)location;
+- (void)logRejectedEntity:(id)entity location:(WSBlockChainLocation)location error:(NSError *)error;
+- (void)storeRelevantError:(NSError *)error intoError:(NSError **)outError;
+
+@end
+
+@implementation WSBlockChainSync
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithBlockChain:wallet:");
+    return nil;
+}
+
+- (instancetype)initWithBlockChain:(WSBlockChain *)blockChain wallet:(id<WSSynchronizableWallet>)wallet
+{
+    WSExceptionCheckIllegal(blockChain);
+
+    if ((self = [super init])) {
+        self.blockChain = blockChain;
+        self.wallet = wallet;
+    }
+    return self;
+}
+
+- (BOOL)appendBlockHeaders:(NSArray *)headers error:(NSError *__autoreleasing *)error
+{
+    NSParameterAssert(headers.count > 0);
+
+    NSError *localError;
+    WSStorableBlock *previousHead = self.blockChain.head;
+    __weak WSBlockChainSync *weakSelf = self;
+
+    WSBlockChainLocation location;
+    NSArray *connectedOrphans;
+    NSArray *addedBlocks = [self.blockChain addBlockHeaders:headers
+                                                   location:&location
+                                           connectedOrphans:&connectedOrphans
+                                            reorganizeBlock:^(WSStorableBlock *base, NSArray *oldBlocks, NSArray *newBlocks) {
+        
+        [weakSelf handleReorganizeAtBase:base oldBlocks:oldBlocks newBlocks:newBlocks];
+        
+    } error:&localError];
+
+    if (addedBlocks.count > 0) {
+        [self logAddedBlock:[addedBlocks lastObject] location:location];
+    }
+
+    for (WSStorableBlock *block in addedBlocks) {
+        [self handleAddedBlock:block previousHead:previousHead originalEntity:nil];
+    }
+    for (WSStorableBlock *block in connectedOrphans) {
+        [self handleAddedBlock:block previousHead:previousHead originalEntity:nil];
+    }
+
+    if (addedBlocks.count < headers.count) {
+        [self logRejectedEntity:headers[addedBlocks.count] location:WSBlockChainLocationNone error:localError];
+        [self storeRelevantError:localError intoError:error];
+        return NO;
+    }
+
+    return YES;
+}
+
+- (BOOL)appendBlockWithHeader:(WSBlockHeader *)header transactions:(NSOrderedSet *)transactions originalEntity:(id)entity error:(NSError *__autoreleasing *)error
+{
+    NSParameterAssert(header);
+    NSParameterAssert(entity);
+
+    NSError *localError;
+    __weak WSBlockChainSync *weakSelf = self;
+
+    WSBlockChainLocation location;
+    NSArray *connectedOrphans;
+    WSStorableBlock *previousHead = self.blockChain.head;
+    WSStorableBlock *addedBlock = [self.blockChain addBlockWithHeader:header
+                                                         transactions:transactions
+                                                             location:&location
+                                                     connectedOrphans:&connectedOrphans
+                                                      reorganizeBlock:^(WSStorableBlock *base, NSArray *oldBlocks, NSArray *newBlocks) {
+        
+        [weakSelf handleReorganizeAtBase:base oldBlocks:oldBlocks newBlocks:newBlocks];
+        
+    } error:&localError];
+    
+    if (!addedBlock) {
+        [self logRejectedEntity:entity location:location error:localError];
+        [self storeRelevantError:localError intoError:error];
+        return NO;
+    }
+    
+    [self logAddedBlock:addedBlock location:location];
+
+    [self handleAddedBlock:addedBlock previousHead:previousHead originalEntity:entity];
+    for (WSStorableBlock *block in connectedOrphans) {
+        [self handleAddedBlock:block previousHead:previousHead originalEntity:nil];
+    }
+
+    return YES;
+}
+
+- (void)registerTransaction:(WSSignedTransaction *)transaction
+{
+    NSParameterAssert(transaction);
+
+    if (!self.wallet) {
+        return;
+    }
+
+    BOOL didGenerateNewAddresses = NO;
+    if (![self.wallet registerTransaction:transaction didGenerateNewAddresses:&didGenerateNewAddresses]) {
+        return;
+    }
+
+    if (didGenerateNewAddresses) {
+        DDLogDebug(@"Last transaction triggered new addresses generation");
+
+        [self.delegate blockChainSyncDidGenerateNewAddresses:self];
+    }
+}
+
+- (void)truncateForRescan
+{
+    DDLogDebug(@"Rescan, preparing to truncate blockchain and wallet (if any)");
+    
+    [self.blockChain truncate];
+    NSAssert(self.blockChain.currentHeight == 0, @"Expected genesis blockchain");
+    [self.wallet removeAllTransactions];
+
+    if ([self.delegate respondsToSelector:@selector(blockChainSyncDidTruncate:)]) {
+        [self.delegate blockChainSyncDidTruncate:self];
+    }
+    
+    DDLogDebug(@"Rescan, truncate complete");
+    [self.peerGroup.notifier notifyRescan];
+}
+
+- (void)save
+{
+    [self.blockChain synchronize];
+    if (self.coreDataManager) {
+        [self.blockChain saveToCoreDataManager:self.coreDataManager];
+    }
+}
+
+#pragma mark Entity handlers
+
+- (void)handleAddedBlock:(WSStorableBlock *)block previousHead:(WSStorableBlock *)previousHead originalEntity:(id)entity
+{
+    NSParameterAssert(block);
+    NSParameterAssert(previousHead);
+
+    // new block
+    if (![block.blockId isEqual:previousHead.blockId]) {
+        [self.peerGroup.notifier notifyBlock:block];
+
+        if ([self.delegate respondsToSelector:@selector(blockChainSync:didAddNewBlock:)]) {
+            [self.delegate blockChainSync:self didAddNewBlock:block];
+        }
+    }
+
+    if (self.wallet) {
+        [self registerBlock:block originalEntity:entity];
+    }
+}
+
+- (void)handleReorganizeAtBase:(WSStorableBlock *)base oldBlocks:(NSArray *)oldBlocks newBlocks:(NSArray *)newBlocks
+{
+    NSParameterAssert(base);
+    NSParameterAssert(oldBlocks);
+    NSParameterAssert(newBlocks);
+
+    DDLogDebug(@"Reorganized blockchain at block: %@", base);
+    DDLogDebug(@"Reorganize, old blocks: %@", oldBlocks);
+    DDLogDebug(@"Reorganize, new blocks: %@", newBlocks);
+    
+    [self.peerGroup.notifier notifyReorganizationWithOldBlocks:oldBlocks newBlocks:newBlocks];
+
+    if ([self.delegate respondsToSelector:@selector(blockChainSync:didReorganizeAtBase:)]) {
+        [self.delegate blockChainSync:self didReorganizeAtBase:base];
+    }
+    
+    //
+    // wallet should already contain transactions from new blocks, reorganize will only
+    // change their parent block (thus updating wallet metadata)
+    //
+    // that's because transactions are registered as soon as they're received, even if
+    // their block is later considered orphan or on fork by local blockchain
+    //
+    // for the above reason, a reorg should never generate new addresses
+    //
+    
+    if (self.wallet) {
+        BOOL didGenerateNewAddresses = NO;
+        [self.wallet reorganizeWithOldBlocks:oldBlocks newBlocks:newBlocks didGenerateNewAddresses:&didGenerateNewAddresses];
+        
+        if (didGenerateNewAddresses) {
+            DDLogWarn(@"Reorganize triggered (unexpected) new addresses generation");
+            
+            [self.delegate blockChainSyncDidGenerateNewAddresses:self];
+        }
+    }
+}
+
+- (void)registerBlock:(WSStorableBlock *)block originalEntity:(id)entity
+{
+    NSParameterAssert(block);
+    
+    // don't register orphan blocks
+    if ([self.blockChain isKnownOrphanBlockWithId:block.blockId]) {
+        return;
+    }
+
+    //
+    // enforce registration in case we lost these transactions
+    //
+    // see note in [WSHDWallet isRelevantTransaction:savingReceivingAddresses:]
+    //
+    BOOL didGenerateNewAddresses = NO;
+    for (WSSignedTransaction *transaction in block.transactions) {
+        BOOL txDidGenerateNewAddresses = NO;
+        [self.wallet registerTransaction:transaction didGenerateNewAddresses:&txDidGenerateNewAddresses];
+
+        didGenerateNewAddresses |= txDidGenerateNewAddresses;
+    }
+
+    // optionally merge txids from empty filtered block
+    WSFilteredBlock *filteredBlock;
+    if ([entity isKindOfClass:[WSFilteredBlock class]]) {
+        filteredBlock = entity;
+    }
+    [self.wallet registerBlock:block matchingFilteredBlock:filteredBlock];
+
+    if (didGenerateNewAddresses) {
+        DDLogDebug(@"Block registration triggered new addresses generation");
+
+        [self.delegate blockChainSyncDidGenerateNewAddresses:self];
+    }
+}
+
+#pragma mark Macros
+
+- (void)logAddedBlock:(WSStorableBlock *)block location:(WSBlockChainLocation)location
+{
+    NSParameterAssert(block);
+    
+    if ([self.delegate blockChainSyncIsSynced:self]) {
+        switch (location) {
+            case WSBlockChainLocationMain: {
+                DDLogInfo(@"New head: %@", self.blockChain.head);
+                break;
+            }
+            case WSBlockChainLocationFork: {
+                DDLogInfo(@"New fork block: %@", block);
+                DDLogInfo(@"Fork base: %@", [self.blockChain findForkBaseFromHead:block]);
+                break;
+            }
+            case WSBlockChainLocationOrphan: {
+                DDLogInfo(@"New orphan: %@", block);
+                break;
+            }
+            case WSBlockChainLocationNone: {
+                break;
+            }
+        }
+    }
+}
+
+- (void)logRejectedEntity:(id)entity location:(WSBlockChainLocation)location error:(NSError *)error
+{
+    NSParameterAssert(entity);
+
+    if (location == WSBlockChainLocationOrphan) {
+        return;
+    }
+    if (!error) {
+        DDLogDebug(@"%@ not added: %@", [entity class], entity);
+    }
+    else {
+        DDLogDebug(@"Error adding %@ (%@): %@", [entity class], error, entity);
+    }
+    DDLogDebug(@"Current head: %@", self.blockChain.head);
+}
+
+- (void)storeRelevantError:(NSError *)error intoError:(NSError *__autoreleasing *)outError
+{
+    if (!error || !outError) {
+        return;
+    }
+    if ((error.domain == WSErrorDomain) && (error.code == WSErrorCodeInvalidBlock)) {
+        *outError = error;
+    }
+}
+
+@end
@@ -0,0 +1,74 @@
+//
+//  WSBlockDownloadScheduler.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "WSInventory.h"
+
+@class WSPeer;
+@class WSHash256;
+
+#pragma mark -
+
+//
+// shards block requests across peers and releases received blocks
+// in the same order they were scheduled (e.g. height order)
+//
+// in-flight requests are bounded by a per-peer window adjusted on
+// response latency (AIMD): the window grows by one chunk per round
+// trip while latency stays close to the best observed, and is halved
+// when it builds up (peer is overrun) or reset when the peer stalls
+//
+// thread-safe: no (should only run in group queue)
+//
+@interface WSBlockDownloadScheduler : NSObject
+
+@property (nonatomic, assign) NSUInteger chunkSize;                         // 100
+@property (nonatomic, assign) NSUInteger minRequestsPerPeer;                // 10
+@property (nonatomic, assign) NSUInteger initialRequestsPerPeer;            // 100
+@property (nonatomic, assign) NSUInteger maxRequestsPerPeer;                // 500
+@property (nonatomic, assign) double latencyTolerance;                      // 2.0
+@property (nonatomic, assign) NSTimeInterval requestTimeout;                // 10.0
+
+- (instancetype)initWithInventoryType:(WSInventoryType)inventoryType;
+- (WSInventoryType)inventoryType;
+
+- (void)addPeer:(WSPeer *)peer;
+- (void)removePeer:(WSPeer *)peer;
+- (BOOL)containsPeer:(WSPeer *)peer;
+- (NSArray *)allPeers; // WSPeer
+- (NSUInteger)numberOfPendingRequestsForPeer:(WSPeer *)peer;
+- (NSUInteger)windowSizeForPeer:(WSPeer *)peer;
+
+- (void)scheduleBlockIds:(NSArray *)blockIds; // WSHash256
+- (BOOL)containsBlockId:(WSHash256 *)blockId;
+- (NSUInteger)numberOfScheduledBlocks;
+- (BOOL)receiveBlockWithId:(WSHash256 *)blockId entity:(id)entity transactions:(NSOrderedSet *)transactions fromPeer:(WSPeer *)peer;
+- (void)dequeueReadyBlocksWithBlock:(void (^)(id entity, NSOrderedSet *transactions, WSPeer *peer))block;
+
+- (void)resendPendingRequests;
+- (void)rescheduleStalledRequests;
+
+@end
@@ -0,0 +1,433 @@
+//
+//  WSBlockDownloadScheduler.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSBlockDownloadScheduler.h"
+#import "WSPeer.h"
+#import "WSHash256.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSConfig.h"
+
+@interface WSBlockDownloadWindow : NSObject
+
+@property (nonatomic, assign) double size;
+@property (nonatomic, assign) NSTimeInterval smoothedLatency;
+@property (nonatomic, assign) NSTimeInterval minLatency;
+@property (nonatomic, assign) NSTimeInterval lastDecreaseTime;
+
+@end
+
+@implementation WSBlockDownloadWindow
+
+@end
+
+#pragma mark -
+
+@interface WSBlockDownloadScheduler ()
+
+@property (nonatomic, assign) WSInventoryType inventoryType;
+@property (nonatomic, strong) NSMutableOrderedSet *peers;                   // WSPeer
+@property (nonatomic, strong) NSMutableSet *stalledPeers;                   // WSPeer
+@property (nonatomic, strong) NSMapTable *pendingIdsByPeer;                 // WSPeer -> NSMutableOrderedSet (WSHash256)
+@property (nonatomic, strong) NSMapTable *windowsByPeer;                    // WSPeer -> WSBlockDownloadWindow
+@property (nonatomic, strong) NSMutableOrderedSet *scheduledIds;            // WSHash256
+@property (nonatomic, strong) NSMutableDictionary *peersById;               // WSHash256 -> WSPeer
+@property (nonatomic, strong) NSMutableDictionary *requestTimesById;        // WSHash256 -> NSNumber
+@property (nonatomic, strong) NSMutableDictionary *receivedEntitiesById;    // WSHash256 -> id
+@property (nonatomic, strong) NSMutableDictionary *receivedTransactionsById;// WSHash256 -> NSOrderedSet
+@property (nonatomic, strong) NSMutableDictionary *receivedPeersById;       // WSHash256 -> WSPeer
+
+- (void)unassignPendingRequestsForPeer:(WSPeer *)peer;
+- (void)dispatchRequests;
+- (WSPeer *)leastBusyAvailablePeer;
+- (NSUInteger)availableRequestsForPeer:(WSPeer *)peer;
+- (void)sendRequestsWithIds:(NSArray *)blockIds toPeer:(WSPeer *)peer;
+- (void)updateWindowForPeer:(WSPeer *)peer withLatency:(NSTimeInterval)latency;
+
+@end
+
+@implementation WSBlockDownloadScheduler
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithInventoryType:");
+    return nil;
+}
+
+- (instancetype)initWithInventoryType:(WSInventoryType)inventoryType
+{
+    if ((self = [super init])) {
+        self.chunkSize = WSBlockDownloadSchedulerChunkSize;
+        self.minRequestsPerPeer = WSBlockDownloadSchedulerMinRequestsPerPeer;
+        self.initialRequestsPerPeer = WSBlockDownloadSchedulerInitialRequestsPerPeer;
+        self.maxRequestsPerPeer = WSBlockDownloadSchedulerMaxRequestsPerPeer;
+        self.latencyTolerance = WSBlockDownloadSchedulerLatencyTolerance;
+        self.requestTimeout = WSBlockDownloadSchedulerDefaultRequestTimeout;
+
+        self.inventoryType = inventoryType;
+        self.peers = [[NSMutableOrderedSet alloc] init];
+        self.stalledPeers = [[NSMutableSet alloc] init];
+        self.pendingIdsByPeer = [NSMapTable strongToStrongObjectsMapTable];
+        self.windowsByPeer = [NSMapTable strongToStrongObjectsMapTable];
+        self.scheduledIds = [[NSMutableOrderedSet alloc] initWithCapacity:(2 * WSMessageBlocksMaxCount)];
+        self.peersById = [[NSMutableDictionary alloc] init];
+        self.requestTimesById = [[NSMutableDictionary alloc] init];
+        self.receivedEntitiesById = [[NSMutableDictionary alloc] init];
+        self.receivedTransactionsById = [[NSMutableDictionary alloc] init];
+        self.receivedPeersById = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)addPeer:(WSPeer *)peer
+{
+    WSExceptionCheckIllegal(peer);
+
+    if ([self.peers containsObject:peer]) {
+        return;
+    }
+    [self.peers addObject:peer];
+    [self.pendingIdsByPeer setObject:[[NSMutableOrderedSet alloc] init] forKey:peer];
+
+    WSBlockDownloadWindow *window = [[WSBlockDownloadWindow alloc] init];
+    window.size = MIN(MAX(self.initialRequestsPerPeer, self.minRequestsPerPeer), self.maxRequestsPerPeer);
+    [self.windowsByPeer setObject:window forKey:peer];
+
+    DDLogDebug(@"Added peer %@ to block download (peers: %lu)", peer, (unsigned long)self.peers.count);
+
+    [self dispatchRequests];
+}
+
+- (void)removePeer:(WSPeer *)peer
+{
+    WSExceptionCheckIllegal(peer);
+
+    if (![self.peers containsObject:peer]) {
+        return;
+    }
+    [self unassignPendingRequestsForPeer:peer];
+    [self.pendingIdsByPeer removeObjectForKey:peer];
+    [self.windowsByPeer removeObjectForKey:peer];
+    [self.stalledPeers removeObject:peer];
+    [self.peers removeObject:peer];
+
+    DDLogDebug(@"Removed peer %@ from block download (peers: %lu)", peer, (unsigned long)self.peers.count);
+
+    [self dispatchRequests];
+}
+
+- (BOOL)containsPeer:(WSPeer *)peer
+{
+    return [self.peers containsObject:peer];
+}
+
+- (NSArray *)allPeers
+{
+    return [self.peers array];
+}
+
+- (NSUInteger)numberOfPendingRequestsForPeer:(WSPeer *)peer
+{
+    return [[self.pendingIdsByPeer objectForKey:peer] count];
+}
+
+- (NSUInteger)windowSizeForPeer:(WSPeer *)peer
+{
+    return (NSUInteger)[[self.windowsByPeer objectForKey:peer] size];
+}
+
+- (void)scheduleBlockIds:(NSArray *)blockIds
+{
+    WSExceptionCheckIllegal(blockIds);
+
+    [self.scheduledIds addObjectsFromArray:blockIds];
+    [self dispatchRequests];
+}
+
+- (BOOL)containsBlockId:(WSHash256 *)blockId
+{
+    return [self.scheduledIds containsObject:blockId];
+}
+
+- (NSUInteger)numberOfScheduledBlocks
+{
+    return self.scheduledIds.count;
+}
+
+- (BOOL)receiveBlockWithId:(WSHash256 *)blockId entity:(id)entity transactions:(NSOrderedSet *)transactions fromPeer:(WSPeer *)peer
+{
+    WSExceptionCheckIllegal(blockId);
+    WSExceptionCheckIllegal(entity);
+    WSExceptionCheckIllegal(peer);
+
+    if (![self.scheduledIds containsObject:blockId]) {
+        return NO;
+    }
+    if (self.receivedEntitiesById[blockId]) {
+        DDLogDebug(@"Ignoring duplicate block %@ from peer %@", blockId, peer);
+        return YES;
+    }
+
+    // accept from any peer, the request might have been reassigned
+    WSPeer *assignedPeer = self.peersById[blockId];
+    if (assignedPeer) {
+        if (assignedPeer == peer) {
+            const NSTimeInterval latency = [NSDate timeIntervalSinceReferenceDate] - [self.requestTimesById[blockId] doubleValue];
+            [self updateWindowForPeer:peer withLatency:latency];
+        }
+        [[self.pendingIdsByPeer objectForKey:assignedPeer] removeObject:blockId];
+        [self.peersById removeObjectForKey:blockId];
+        [self.requestTimesById removeObjectForKey:blockId];
+    }
+    [self.stalledPeers removeObject:peer];
+
+    self.receivedEntitiesById[blockId] = entity;
+    if (transactions) {
+        self.receivedTransactionsById[blockId] = transactions;
+    }
+    self.receivedPeersById[blockId] = peer;
+
+    [self dispatchRequests];
+    return YES;
+}
+
+- (void)dequeueReadyBlocksWithBlock:(void (^)(id, NSOrderedSet *, WSPeer *))block
+{
+    WSExceptionCheckIllegal(block);
+
+    NSMutableArray *readyIds = [[NSMutableArray alloc] init];
+    for (WSHash256 *blockId in self.scheduledIds) {
+        if (!self.receivedEntitiesById[blockId]) {
+            break;
+        }
+        [readyIds addObject:blockId];
+    }
+    if (readyIds.count == 0) {
+        return;
+    }
+    [self.scheduledIds removeObjectsInRange:NSMakeRange(0, readyIds.count)];
+
+    // callback may reenter the scheduler (e.g. Bloom filter rebuild)
+    for (WSHash256 *blockId in readyIds) {
+        id entity = self.receivedEntitiesById[blockId];
+        NSOrderedSet *transactions = self.receivedTransactionsById[blockId];
+        WSPeer *peer = self.receivedPeersById[blockId];
+
+        [self.receivedEntitiesById removeObjectForKey:blockId];
+        [self.receivedTransactionsById removeObjectForKey:blockId];
+        [self.receivedPeersById removeObjectForKey:blockId];
+
+        block(entity, transactions, peer);
+    }
+}
+
+- (void)resendPendingRequests
+{
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    for (WSPeer *peer in self.peers) {
+        NSArray *pendingIds = [[self.pendingIdsByPeer objectForKey:peer] array];
+        if (pendingIds.count == 0) {
+            continue;
+        }
+        for (WSHash256 *blockId in pendingIds) {
+            self.requestTimesById[blockId] = @(now);
+        }
+
+        DDLogDebug(@"Resending %lu pending block requests to peer %@", (unsigned long)pendingIds.count, peer);
+        [self sendRequestsWithIds:pendingIds toPeer:peer];
+    }
+}
+
+- (void)rescheduleStalledRequests
+{
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    for (WSPeer *peer in self.peers) {
+        WSHash256 *oldestId = [[self.pendingIdsByPeer objectForKey:peer] firstObject];
+        if (!oldestId) {
+            continue;
+        }
+        const NSTimeInterval elapsed = now - [self.requestTimesById[oldestId] doubleValue];
+        if (elapsed < self.requestTimeout) {
+            continue;
+        }
+
+        DDLogDebug(@"Peer %@ stalled block download (%.3fs), reassigning %lu requests",
+                   peer, elapsed, (unsigned long)[self numberOfPendingRequestsForPeer:peer]);
+
+        [self unassignPendingRequestsForPeer:peer];
+        [self.stalledPeers addObject:peer];
+
+        // restart from the smallest window, like a TCP retransmission timeout
+        WSBlockDownloadWindow *window = [self.windowsByPeer objectForKey:peer];
+        window.size = self.minRequestsPerPeer;
+        window.lastDecreaseTime = now;
+    }
+
+    // retry all peers rather than halting download
+    if (self.stalledPeers.count == self.peers.count) {
+        [self.stalledPeers removeAllObjects];
+    }
+
+    [self dispatchRequests];
+}
+
+#pragma mark Helpers
+
+- (void)unassignPendingRequestsForPeer:(WSPeer *)peer
+{
+    NSMutableOrderedSet *pendingIds = [self.pendingIdsByPeer objectForKey:peer];
+    [self.peersById removeObjectsForKeys:[pendingIds array]];
+    [self.requestTimesById removeObjectsForKeys:[pendingIds array]];
+    [pendingIds removeAllObjects];
+}
+
+- (void)dispatchRequests
+{
+    NSMutableArray *unassignedIds = [[NSMutableArray alloc] init];
+    for (WSHash256 *blockId in self.scheduledIds) {
+        if (!self.peersById[blockId] && !self.receivedEntitiesById[blockId]) {
+            [unassignedIds addObject:blockId];
+        }
+    }
+    if (unassignedIds.count == 0) {
+        return;
+    }
+
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSMapTable *requestsByPeer = [NSMapTable strongToStrongObjectsMapTable];
+
+    NSUInteger index = 0;
+    while (index < unassignedIds.count) {
+        WSPeer *peer = [self leastBusyAvailablePeer];
+        if (!peer) {
+            break;
+        }
+
+        NSMutableOrderedSet *pendingIds = [self.pendingIdsByPeer objectForKey:peer];
+        const NSUInteger left = unassignedIds.count - index;
+        const NSUInteger count = MIN(MIN(self.chunkSize, [self availableRequestsForPeer:peer]), left);
+
+        NSArray *chunk = [unassignedIds subarrayWithRange:NSMakeRange(index, count)];
+        for (WSHash256 *blockId in chunk) {
+            self.peersById[blockId] = peer;
+            self.requestTimesById[blockId] = @(now);
+        }
+        [pendingIds addObjectsFromArray:chunk];
+
+        NSMutableArray *requests = [requestsByPeer objectForKey:peer];
+        if (!requests) {
+            requests = [[NSMutableArray alloc] init];
+            [requestsByPeer setObject:requests forKey:peer];
+        }
+        [requests addObjectsFromArray:chunk];
+
+        index += count;
+    }
+
+    for (WSPeer *peer in requestsByPeer) {
+        NSArray *requests = [requestsByPeer objectForKey:peer];
+
+        DDLogDebug(@"Requesting %lu blocks from peer %@ (window: %lu)", (unsigned long)requests.count, peer,
+                   (unsigned long)[self windowSizeForPeer:peer]);
+        [self sendRequestsWithIds:requests toPeer:peer];
+    }
+}
+
+- (WSPeer *)leastBusyAvailablePeer
+{
+    WSPeer *bestPeer = nil;
+    NSUInteger bestAvailable = 0;
+    for (WSPeer *peer in self.peers) {
+        if ([self.stalledPeers containsObject:peer]) {
+            continue;
+        }
+
+        // don't fragment requests, wait for room of a whole chunk (or window)
+        const NSUInteger available = [self availableRequestsForPeer:peer];
+        if (available < MIN(self.chunkSize, [self windowSizeForPeer:peer])) {
+            continue;
+        }
+        if (available > bestAvailable) {
+            bestPeer = peer;
+            bestAvailable = available;
+        }
+    }
+    return bestPeer;
+}
+
+- (NSUInteger)availableRequestsForPeer:(WSPeer *)peer
+{
+    const NSUInteger windowSize = [self windowSizeForPeer:peer];
+    const NSUInteger count = [self numberOfPendingRequestsForPeer:peer];
+    return ((count < windowSize) ? (windowSize - count) : 0);
+}
+
+- (void)sendRequestsWithIds:(NSArray *)blockIds toPeer:(WSPeer *)peer
+{
+    // split into protocol-legal getdata messages
+    for (NSUInteger i = 0; i < blockIds.count; i += WSMessageMaxInventories) {
+        const NSUInteger count = MIN(WSMessageMaxInventories, blockIds.count - i);
+        [peer sendGetdataMessageWithHashes:[blockIds subarrayWithRange:NSMakeRange(i, count)] forInventoryType:self.inventoryType];
+    }
+}
+
+- (void)updateWindowForPeer:(WSPeer *)peer withLatency:(NSTimeInterval)latency
+{
+    WSBlockDownloadWindow *window = [self.windowsByPeer objectForKey:peer];
+    if (!window) {
+        return;
+    }
+
+    if (window.smoothedLatency == 0.0) {
+        window.smoothedLatency = latency;
+        window.minLatency = latency;
+    }
+    else {
+        window.smoothedLatency = (7.0 * window.smoothedLatency + latency) / 8.0;
+        window.minLatency = MIN(window.minLatency, window.smoothedLatency);
+    }
+
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    if (window.smoothedLatency > self.latencyTolerance * window.minLatency) {
+
+        // multiplicative decrease, at most once per round trip
+        if (now - window.lastDecreaseTime >= window.smoothedLatency) {
+            window.size = MAX(window.size / 2.0, self.minRequestsPerPeer);
+            window.lastDecreaseTime = now;
+
+            DDLogDebug(@"Peer %@ block latency increased (%.3fs > %.3fs), shrinking window to %lu",
+                       peer, window.smoothedLatency, window.minLatency, (unsigned long)window.size);
+        }
+    }
+    else {
+
+        // additive increase, about one chunk per window of responses
+        window.size = MIN(window.size + (double)self.chunkSize / window.size, self.maxRequestsPerPeer);
+    }
+}
+
+@end
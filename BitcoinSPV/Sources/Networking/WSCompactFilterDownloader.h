@@ -0,0 +1,62 @@
+//
+//  WSCompactFilterDownloader.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "WSPeerGroup.h"
+
+@protocol WSBlockStore;
+@class WSParameters;
+@protocol WSSynchronizableWallet;
+@class WSCoreDataManager;
+
+#pragma mark -
+
+//
+// BIP157 client mode, alternative to BIP37 filtering
+//
+// headers are downloaded in batches and only appended to the blockchain
+// once their compact filters (validated against the filter header chain)
+// have been matched locally against wallet scripts, matching blocks are
+// downloaded in full
+//
+// download peer must advertise WSPeerServicesNodeCompactFilters, when the
+// filter header chain can't be anchored at the previous batch (e.g. after
+// restart or reorg) it's cross-checked with a second filter peer if any
+//
+// thread-safe: no (should only run in group queue)
+//
+@interface WSCompactFilterDownloader : NSObject <WSPeerGroupDownloader>
+
+@property (nonatomic, strong) WSCoreDataManager *coreDataManager;           // nil
+@property (nonatomic, assign) BOOL shouldAutoSaveWallet;                    // YES
+
+// tuning
+@property (nonatomic, assign) NSTimeInterval requestTimeout;                // 5.0
+
+- (instancetype)initWithStore:(id<WSBlockStore>)store wallet:(id<WSSynchronizableWallet>)wallet;
+- (instancetype)initWithStore:(id<WSBlockStore>)store maxSize:(NSUInteger)maxSize wallet:(id<WSSynchronizableWallet>)wallet;
+
+@end
@@ -0,0 +1,936 @@
+//
+//  WSCompactFilterDownloader.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSCompactFilterDownloader.h"
+#import "WSPeerGroup+Download.h"
+#import "WSBlockChainSync.h"
+#import "WSBlockStore.h"
+#import "WSBlockChain.h"
+#import "WSBlockHeader.h"
+#import "WSBlock.h"
+#import "WSTransaction.h"
+#import "WSStorableBlock.h"
+#import "WSWallet.h"
+#import "WSAddress.h"
+#import "WSScript.h"
+#import "WSBIP158.h"
+#import "WSInventory.h"
+#import "WSMessage.h"
+#import "WSMessageCfheaders.h"
+#import "WSMessageCfilter.h"
+#import "WSBlockLocator.h"
+#import "WSParameters.h"
+#import "WSHash256.h"
+#import "WSBitcoinConstants.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+#import "WSConfig.h"
+
+//
+// headers past fast catch-up waiting for their filters, appended to the
+// blockchain in height order as filters are matched
+//
+@interface WSCompactFilterBatch : NSObject
+
+@property (nonatomic, strong) NSArray *headers;                 // WSBlockHeader
+@property (nonatomic, assign) uint32_t startHeight;
+@property (nonatomic, strong) NSArray *filterHashes;            // WSHash256, nil until cfheaders
+@property (nonatomic, assign) NSUInteger appendedIndex;         // headers before are in blockchain
+@property (nonatomic, assign) NSUInteger filteredIndex;         // filters before are matched
+@property (nonatomic, strong) NSMutableArray *queuedFilters;    // WSBIP158Filter, received while waiting for block
+@property (nonatomic, strong) WSHash256 *pendingBlockId;        // matching block requested
+@property (nonatomic, strong) WSMessageCfheaders *filterHeaders;        // from download peer, pending cross-check
+@property (nonatomic, strong) WSPeer *verifyPeer;                       // cross-checks unanchored filter headers
+@property (nonatomic, strong) WSMessageCfheaders *verifyFilterHeaders;  // from verify peer
+@property (nonatomic, assign) NSTimeInterval verifyRequestTime;
+
+- (instancetype)initWithHeaders:(NSArray *)headers startHeight:(uint32_t)startHeight;
+- (BOOL)isComplete;
+
+@end
+
+@implementation WSCompactFilterBatch
+
+- (instancetype)initWithHeaders:(NSArray *)headers startHeight:(uint32_t)startHeight
+{
+    if ((self = [super init])) {
+        self.headers = headers;
+        self.startHeight = startHeight;
+        self.queuedFilters = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (BOOL)isComplete
+{
+    return (self.appendedIndex == self.headers.count);
+}
+
+@end
+
+#pragma mark -
+
+@interface WSCompactFilterDownloader () <WSBlockChainSyncDelegate>
+
+// configuration
+@property (nonatomic, strong) WSParameters *parameters;
+@property (nonatomic, strong) WSBlockChain *blockChain;
+@property (nonatomic, strong) id<WSSynchronizableWallet> wallet;
+@property (nonatomic, assign) uint32_t fastCatchUpTimestamp;
+@property (nonatomic, strong) WSBlockChainSync *sync;
+
+// state
+@property (nonatomic, weak) WSPeerGroup *peerGroup;
+@property (nonatomic, strong) WSPeer *downloadPeer;
+@property (nonatomic, strong) NSArray *walletScripts;           // NSData
+@property (nonatomic, strong) WSCompactFilterBatch *batch;
+@property (nonatomic, strong) WSHash256 *lastFilterHeader;
+@property (nonatomic, strong) WSHash256 *lastFilterBlockId;
+@property (nonatomic, assign) BOOL isRequestingHeaders;
+@property (nonatomic, assign) NSTimeInterval lastKeepAliveTime;
+
+// business
+- (WSPeer *)bestPeerAmongPeers:(NSArray *)peers; // WSPeer
+- (BOOL)isFilterPeer:(WSPeer *)peer;
+- (void)downloadBlockChain;
+- (void)rebuildWalletScripts;
+- (void)requestHeaders;
+- (void)handleHeaders:(NSArray *)headers; // WSBlockHeader
+- (void)crossCheckFilterHeadersExcludingPeer:(WSPeer *)excludedPeer;
+- (void)handleFilterHeaders:(WSMessageCfheaders *)message fromPeer:(WSPeer *)peer;
+- (void)processFilterHeaders;
+- (void)handleFilter:(WSBIP158Filter *)filter;
+- (void)processQueuedFilters;
+- (BOOL)matchFilter:(WSBIP158Filter *)filter;
+- (void)flushHeadersToIndex:(NSUInteger)index;
+- (void)finishBatch;
+- (void)finishDownload;
+- (void)detectDownloadTimeout;
+
+// blockchain
+- (BOOL)isValidMerkleRootOfBlock:(WSBlock *)block;
+
+@end
+
+@implementation WSCompactFilterDownloader
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithStore:wallet:");
+    return nil;
+}
+
+- (instancetype)initWithStore:(id<WSBlockStore>)store wallet:(id<WSSynchronizableWallet>)wallet
+{
+    return [self initWithStore:store maxSize:WSBlockChainDefaultMaxSize wallet:wallet];
+}
+
+- (instancetype)initWithStore:(id<WSBlockStore>)store maxSize:(NSUInteger)maxSize wallet:(id<WSSynchronizableWallet>)wallet
+{
+    WSExceptionCheckIllegal(store);
+    WSExceptionCheckIllegal(wallet);
+
+    if ((self = [super init])) {
+        self.parameters = store.parameters;
+        self.blockChain = [[WSBlockChain alloc] initWithStore:store maxSize:maxSize];
+        self.wallet = wallet;
+        self.fastCatchUpTimestamp = [self.wallet earliestKeyTimestamp];
+        self.sync = [[WSBlockChainSync alloc] initWithBlockChain:self.blockChain wallet:self.wallet];
+        self.sync.delegate = self;
+        self.shouldAutoSaveWallet = YES;
+        self.requestTimeout = WSBlockChainDownloaderDefaultRequestTimeout;
+    }
+    return self;
+}
+
+- (void)setCoreDataManager:(WSCoreDataManager *)coreDataManager
+{
+    _coreDataManager = coreDataManager;
+    self.sync.coreDataManager = _coreDataManager;
+
+    if (_coreDataManager) {
+        [self.blockChain loadFromCoreDataManager:_coreDataManager];
+    }
+}
+
+- (void)setShouldAutoSaveWallet:(BOOL)shouldAutoSaveWallet
+{
+    _shouldAutoSaveWallet = shouldAutoSaveWallet;
+
+    [self.wallet setShouldAutoSave:_shouldAutoSaveWallet];
+}
+
+#pragma mark WSPeerGroupDownloader
+
+- (void)startWithPeerGroup:(WSPeerGroup *)peerGroup
+{
+    WSExceptionCheckIllegal(peerGroup);
+
+    self.peerGroup = peerGroup;
+    self.sync.peerGroup = peerGroup;
+    self.downloadPeer = [self bestPeerAmongPeers:[peerGroup allConnectedPeers]];
+    if (!self.downloadPeer) {
+        DDLogInfo(@"Delayed download until compact filters peer selection");
+        return;
+    }
+    DDLogInfo(@"Peer %@ is new download peer", self.downloadPeer);
+
+    [self downloadBlockChain];
+}
+
+- (void)stop
+{
+    [self.sync save];
+    if (self.coreDataManager) {
+        [self.blockChain waitForPendingSavesToCoreDataManager:self.coreDataManager];
+    }
+
+    if (self.downloadPeer) {
+        DDLogInfo(@"Download from peer %@ is being stopped", self.downloadPeer);
+
+        [self.peerGroup disconnectPeer:self.downloadPeer
+                                 error:WSErrorMake(WSErrorCodePeerGroupStop, @"Download stopped")];
+    }
+    self.downloadPeer = nil;
+    self.peerGroup = nil;
+    self.sync.peerGroup = nil;
+    self.batch = nil;
+}
+
+- (uint32_t)lastBlockHeight
+{
+    if (!self.downloadPeer) {
+        return WSBlockUnknownHeight;
+    }
+    return self.downloadPeer.lastBlockHeight;
+}
+
+- (uint32_t)currentHeight
+{
+    return self.blockChain.currentHeight;
+}
+
+- (NSUInteger)numberOfBlocksLeft
+{
+    return (self.downloadPeer.lastBlockHeight - self.blockChain.currentHeight);
+}
+
+- (BOOL)isSynced
+{
+    return (self.blockChain.currentHeight >= self.downloadPeer.lastBlockHeight);
+}
+
+- (BOOL)isPeerDownloadPeer:(WSPeer *)peer
+{
+    return (peer == self.downloadPeer);
+}
+
+- (NSArray *)recentBlocksWithCount:(NSUInteger)count
+{
+    WSExceptionCheckIllegal(count > 0);
+
+    NSMutableArray *recentBlocks = [[NSMutableArray alloc] initWithCapacity:count];
+    uint32_t height = self.blockChain.currentHeight;
+    WSStorableBlock *block = [self.blockChain blockAtHeight:height];
+    while (block && (recentBlocks.count < count)) {
+        [recentBlocks addObject:block];
+        if (height == 0) {
+            break;
+        }
+        --height;
+        block = [self.blockChain blockAtHeight:height];
+    }
+    return recentBlocks;
+}
+
+- (void)reconnectForDownload
+{
+    if (!self.downloadPeer) {
+        return;
+    }
+    [self.peerGroup disconnectPeer:self.downloadPeer
+                             error:WSErrorMake(WSErrorCodePeerGroupDownload, @"Rehashing download peer")];
+}
+
+- (void)rescanBlockChain
+{
+    if (!self.downloadPeer) {
+        [self.sync truncateForRescan];
+        return;
+    }
+    [self.peerGroup disconnectPeer:self.downloadPeer
+                             error:WSErrorMake(WSErrorCodePeerGroupRescan, @"Preparing for rescan")];
+}
+
+- (void)saveState
+{
+    [self.sync save];
+    if (self.shouldAutoSaveWallet) {
+        [self.wallet save];
+    }
+}
+
+#pragma mark WSPeerGroupDownloadDelegate
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peerDidConnect:(WSPeer *)peer
+{
+    if (![self isFilterPeer:peer]) {
+        DDLogDebug(@"Peer %@ connected, does not serve compact filters", peer);
+        return;
+    }
+    if (self.downloadPeer) {
+        return;
+    }
+
+    self.downloadPeer = peer;
+    DDLogInfo(@"Peer %@ connected, is new download peer", self.downloadPeer);
+
+    [self downloadBlockChain];
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didDisconnectWithError:(NSError *)error
+{
+    if (peer == self.batch.verifyPeer) {
+        DDLogDebug(@"Peer %@ disconnected before cross-checking filter headers", peer);
+
+        [self crossCheckFilterHeadersExcludingPeer:peer];
+        [self processFilterHeaders];
+        return;
+    }
+    if (peer != self.downloadPeer) {
+        return;
+    }
+
+    DDLogDebug(@"Peer %@ disconnected, was download peer", peer);
+
+    // unappended headers are simply downloaded again
+    self.batch = nil;
+    self.isRequestingHeaders = NO;
+
+    switch (error.code) {
+        case WSErrorCodePeerGroupDownload: {
+            break;
+        }
+        case WSErrorCodePeerGroupRescan: {
+            [self.sync truncateForRescan];
+            break;
+        }
+    }
+
+    self.downloadPeer = [self bestPeerAmongPeers:[peerGroup allConnectedPeers]];
+    if (!self.downloadPeer) {
+        [self.peerGroup.notifier notifyDownloadFailedWithError:WSErrorMake(WSErrorCodePeerGroupDownload, @"No more peers for download")];
+        return;
+    }
+
+    [self.peerGroup.notifier notifyDownloadFailedWithError:error];
+
+    DDLogDebug(@"Switched to next best download peer %@", self.downloadPeer);
+
+    [self downloadBlockChain];
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peerDidKeepAlive:(WSPeer *)peer
+{
+    if (peer != self.downloadPeer) {
+        return;
+    }
+
+    self.lastKeepAliveTime = [NSDate timeIntervalSinceReferenceDate];
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveHeaders:(NSArray *)headers
+{
+    if ((peer != self.downloadPeer) || !self.isRequestingHeaders) {
+        return;
+    }
+    self.isRequestingHeaders = NO;
+
+    [self handleHeaders:headers];
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveInventories:(NSArray *)inventories
+{
+    if (peer != self.downloadPeer) {
+        return;
+    }
+
+    NSMutableArray *requestInventories = [[NSMutableArray alloc] initWithCapacity:inventories.count];
+    BOOL hasNewBlocks = NO;
+    for (WSInventory *inv in inventories) {
+        if ([inv isBlockInventory]) {
+            hasNewBlocks = YES;
+        }
+        else {
+            [requestInventories addObject:inv];
+        }
+    }
+
+    if (requestInventories.count > 0) {
+        [peer sendGetdataMessageWithInventories:requestInventories];
+    }
+
+    // announced blocks go through headers and filters like the others
+    if (hasNewBlocks && !self.batch && !self.isRequestingHeaders) {
+        [self requestHeaders];
+    }
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveBlock:(WSBlock *)block
+{
+    if ((peer != self.downloadPeer) || ![block.header.blockId isEqual:self.batch.pendingBlockId]) {
+        return;
+    }
+
+    WSCompactFilterBatch *batch = self.batch;
+    WSBlockHeader *expectedHeader = batch.headers[batch.appendedIndex];
+    if (![block.header.blockId isEqual:expectedHeader.blockId] || ![self isValidMerkleRootOfBlock:block]) {
+        [peerGroup reportMisbehavingPeer:peer
+                                   error:WSErrorMake(WSErrorCodeInvalidBlock, @"Block %@ does not match its header", block.header.blockId)];
+        return;
+    }
+
+    batch.pendingBlockId = nil;
+    batch.appendedIndex += 1;
+
+    NSError *error;
+    if (![self.sync appendBlockWithHeader:block.header transactions:block.transactions originalEntity:block error:&error] && error) {
+        [peerGroup reportMisbehavingPeer:peer error:error];
+        return;
+    }
+
+    [self processQueuedFilters];
+}
+
+- (BOOL)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer shouldAddTransaction:(WSSignedTransaction *)transaction toFilteredBlock:(WSFilteredBlock *)filteredBlock
+{
+    return YES;
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveFilteredBlock:(WSFilteredBlock *)filteredBlock withTransactions:(NSOrderedSet *)transactions
+{
+    // compact filters download, merkleblocks are never requested
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveTransaction:(WSSignedTransaction *)transaction
+{
+    [self.sync registerTransaction:transaction];
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveFilterHeaders:(WSMessageCfheaders *)message
+{
+    if (!self.batch || self.batch.filterHashes) {
+        return;
+    }
+    if ((peer != self.downloadPeer) && (peer != self.batch.verifyPeer)) {
+        return;
+    }
+
+    [self handleFilterHeaders:message fromPeer:peer];
+}
+
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveFilter:(WSMessageCfilter *)message
+{
+    if ((peer != self.downloadPeer) || !self.batch.filterHashes || !message.filter) {
+        return;
+    }
+
+    [self handleFilter:message.filter];
+}
+
+- (BOOL)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer shouldAcceptHeader:(WSBlockHeader *)header error:(NSError *__autoreleasing *)error
+{
+    // headers are validated against checkpoints per batch
+    return YES;
+}
+
+#pragma mark Business
+
+- (WSPeer *)bestPeerAmongPeers:(NSArray *)peers
+{
+    WSPeer *bestPeer = nil;
+    for (WSPeer *peer in peers) {
+        if ((peer.peerStatus != WSPeerStatusConnected) || ![self isFilterPeer:peer]) {
+            continue;
+        }
+        if (!bestPeer || (peer.lastBlockHeight > bestPeer.lastBlockHeight)) {
+            bestPeer = peer;
+        }
+    }
+    return bestPeer;
+}
+
+- (BOOL)isFilterPeer:(WSPeer *)peer
+{
+    NSParameterAssert(peer);
+
+    return ((peer.services & WSPeerServicesNodeCompactFilters) != 0);
+}
+
+- (void)downloadBlockChain
+{
+    DDLogInfo(@"Preparing for blockchain download with compact filters");
+
+    [self rebuildWalletScripts];
+
+    WSStorableBlock *checkpoint = [self.parameters lastCheckpointBeforeTimestamp:self.fastCatchUpTimestamp];
+    if (checkpoint) {
+        DDLogDebug(@"Last checkpoint before catch-up: %@ (%@)",
+                   checkpoint, [NSDate dateWithTimeIntervalSince1970:checkpoint.header.timestamp]);
+
+        if (![self.blockChain addCheckpoint:checkpoint error:NULL]) {
+            DDLogDebug(@"Checkpoint discarded, local blockchain is ahead");
+        }
+    }
+    else {
+        DDLogDebug(@"No fast catch-up checkpoint");
+    }
+
+    const uint32_t fromHeight = self.blockChain.currentHeight;
+    const uint32_t toHeight = MAX(fromHeight, self.downloadPeer.lastBlockHeight);
+    [self.peerGroup.notifier notifyDownloadStartedFromHeight:fromHeight toHeight:toHeight];
+
+    if (fromHeight >= self.downloadPeer.lastBlockHeight) {
+        DDLogInfo(@"Blockchain is up to date");
+
+        [self finishDownload];
+        return;
+    }
+
+    self.lastKeepAliveTime = [NSDate timeIntervalSinceReferenceDate];
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(detectDownloadTimeout) object:nil];
+        [self performSelector:@selector(detectDownloadTimeout) withObject:nil afterDelay:self.requestTimeout];
+    });
+
+    [self requestHeaders];
+}
+
+- (void)rebuildWalletScripts
+{
+    // basic filters contain output scripts and spent prevout scripts
+    NSMutableArray *scripts = [[NSMutableArray alloc] init];
+    for (NSOrderedSet *addresses in @[self.wallet.allReceiveAddresses, self.wallet.allChangeAddresses]) {
+        for (WSAddress *address in addresses) {
+            [scripts addObject:[[WSScript scriptWithAddress:address] toBuffer].data];
+        }
+    }
+    self.walletScripts = scripts;
+
+    DDLogDebug(@"Matching compact filters against %lu wallet scripts", (unsigned long)self.walletScripts.count);
+}
+
+- (void)requestHeaders
+{
+    WSBlockLocator *locator = [self.blockChain currentLocator];
+
+    DDLogDebug(@"Requesting headers with locator: %@", locator.hashes);
+    self.isRequestingHeaders = YES;
+    [self.downloadPeer sendGetheadersMessageWithLocator:locator hashStop:nil];
+}
+
+- (void)handleHeaders:(NSArray *)headers
+{
+    NSParameterAssert(headers.count > 0);
+
+    WSBlockHeader *firstHeader = [headers firstObject];
+    WSStorableBlock *parent = [self.blockChain blockForId:firstHeader.previousBlockId];
+    if (!parent) {
+        DDLogDebug(@"Received headers do not connect to blockchain, rerequesting");
+        [self requestHeaders];
+        return;
+    }
+
+    // checkpoints within batch
+    for (NSUInteger i = 0; i < headers.count; ++i) {
+        WSBlockHeader *header = headers[i];
+        WSStorableBlock *expected = [self.parameters checkpointAtHeight:(uint32_t)(parent.height + 1 + i)];
+        if (expected && ![header.blockId isEqual:expected.header.blockId]) {
+            [self.peerGroup reportMisbehavingPeer:self.downloadPeer
+                                            error:WSErrorMake(WSErrorCodePeerGroupRescan, @"Checkpoint validation failed at %u (%@ != %@)",
+                                                              expected.height, header.blockId, expected.blockId)];
+            return;
+        }
+    }
+
+    // no wallet keys before fast catch-up, headers are enough
+    NSUInteger count = 0;
+    for (WSBlockHeader *header in headers) {
+        if (header.timestamp >= self.fastCatchUpTimestamp) {
+            break;
+        }
+        ++count;
+    }
+    if (count > 0) {
+        NSError *error;
+        if (![self.sync appendBlockHeaders:[headers subarrayWithRange:NSMakeRange(0, count)] error:&error] && error) {
+            [self.peerGroup reportMisbehavingPeer:self.downloadPeer error:error];
+            return;
+        }
+    }
+
+    const BOOL isLastBatch = (headers.count < WSMessageHeadersMaxCount);
+    if (count == headers.count) {
+        if (isLastBatch) {
+            [self finishDownload];
+        }
+        else {
+            [self requestHeaders];
+        }
+        return;
+    }
+
+    NSArray *filteredHeaders = [headers subarrayWithRange:NSMakeRange(count, headers.count - count)];
+    const uint32_t startHeight = (uint32_t)(parent.height + 1 + count);
+    WSBlockHeader *lastHeader = [filteredHeaders lastObject];
+
+    self.batch = [[WSCompactFilterBatch alloc] initWithHeaders:filteredHeaders startHeight:startHeight];
+
+    DDLogDebug(@"Requesting filter headers for %lu blocks from height %u", (unsigned long)filteredHeaders.count, startHeight);
+    [self.downloadPeer sendGetcfheadersMessageWithStartHeight:startHeight stopHash:lastHeader.blockId];
+
+    //
+    // filter header chain is anchored at previous batch, otherwise (e.g. after
+    // restart or reorg) the anchor is cross-checked with another filter peer
+    //
+    WSBlockHeader *firstHeader = [filteredHeaders firstObject];
+    if (![firstHeader.previousBlockId isEqual:self.lastFilterBlockId]) {
+        [self crossCheckFilterHeadersExcludingPeer:nil];
+    }
+}
+
+- (void)crossCheckFilterHeadersExcludingPeer:(WSPeer *)excludedPeer
+{
+    WSCompactFilterBatch *batch = self.batch;
+    WSBlockHeader *lastHeader = [batch.headers lastObject];
+    const uint32_t stopHeight = (uint32_t)(batch.startHeight + batch.headers.count - 1);
+
+    batch.verifyPeer = nil;
+    batch.verifyFilterHeaders = nil;
+    for (WSPeer *peer in [self.peerGroup allConnectedPeers]) {
+        if ((peer == self.downloadPeer) || (peer == excludedPeer) || (peer.peerStatus != WSPeerStatusConnected)) {
+            continue;
+        }
+        if (![self isFilterPeer:peer] || (peer.lastBlockHeight < stopHeight)) {
+            continue;
+        }
+        batch.verifyPeer = peer;
+        break;
+    }
+    if (!batch.verifyPeer) {
+        DDLogWarn(@"No other compact filters peer, trusting filter headers anchor from download peer %@", self.downloadPeer);
+        return;
+    }
+
+    DDLogDebug(@"Cross-checking filter headers from height %u with peer %@", batch.startHeight, batch.verifyPeer);
+    batch.verifyRequestTime = [NSDate timeIntervalSinceReferenceDate];
+    [batch.verifyPeer sendGetcfheadersMessageWithStartHeight:batch.startHeight stopHash:lastHeader.blockId];
+}
+
+- (void)handleFilterHeaders:(WSMessageCfheaders *)message fromPeer:(WSPeer *)peer
+{
+    NSParameterAssert(message);
+    NSParameterAssert(peer);
+
+    WSCompactFilterBatch *batch = self.batch;
+    WSBlockHeader *lastHeader = [batch.headers lastObject];
+
+    if (![message.stopHash isEqual:lastHeader.blockId] || (message.filterHashes.count != batch.headers.count)) {
+        [self.peerGroup reportMisbehavingPeer:peer
+                                        error:WSErrorMake(WSErrorCodeInvalidFilter, @"Unexpected filter headers range (%lu, stop %@)",
+                                                          (unsigned long)message.filterHashes.count, message.stopHash)];
+        return;
+    }
+
+    if (peer == batch.verifyPeer) {
+        batch.verifyFilterHeaders = message;
+    }
+    else {
+        batch.filterHeaders = message;
+    }
+    [self processFilterHeaders];
+}
+
+- (void)processFilterHeaders
+{
+    WSCompactFilterBatch *batch = self.batch;
+    WSMessageCfheaders *message = batch.filterHeaders;
+    if (!message || batch.filterHashes) {
+        return;
+    }
+
+    WSBlockHeader *firstHeader = [batch.headers firstObject];
+    WSBlockHeader *lastHeader = [batch.headers lastObject];
+
+    if (batch.verifyPeer) {
+        WSMessageCfheaders *verifyMessage = batch.verifyFilterHeaders;
+        if (!verifyMessage) {
+            return;
+        }
+
+        // can't tell which peer is lying, just rotate download peer
+        if (![message.previousFilterHeader isEqual:verifyMessage.previousFilterHeader] ||
+            ![message.filterHashes isEqualToArray:verifyMessage.filterHashes]) {
+
+            [self.peerGroup disconnectPeer:self.downloadPeer
+                                     error:WSErrorMake(WSErrorCodeInvalidFilter, @"Filter headers conflict with peer %@", batch.verifyPeer)];
+            return;
+        }
+        DDLogDebug(@"Filter headers anchor confirmed by peer %@", batch.verifyPeer);
+
+        batch.verifyPeer = nil;
+        batch.verifyFilterHeaders = nil;
+    }
+    else if ([firstHeader.previousBlockId isEqual:self.lastFilterBlockId] && ![message.previousFilterHeader isEqual:self.lastFilterHeader]) {
+        [self.peerGroup reportMisbehavingPeer:self.downloadPeer
+                                        error:WSErrorMake(WSErrorCodeInvalidFilter, @"Filter header chain broken at %@", firstHeader.previousBlockId)];
+        return;
+    }
+
+    batch.filterHashes = message.filterHashes;
+
+    WSHash256 *filterHeader = message.previousFilterHeader;
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:(2 * WSHash256Length)];
+    for (WSHash256 *filterHash in batch.filterHashes) {
+        [data replaceBytesInRange:NSMakeRange(0, WSHash256Length) withBytes:filterHash.bytes];
+        [data replaceBytesInRange:NSMakeRange(WSHash256Length, WSHash256Length) withBytes:filterHeader.bytes];
+        filterHeader = WSHash256Compute(data);
+    }
+    self.lastFilterHeader = filterHeader;
+    self.lastFilterBlockId = lastHeader.blockId;
+
+    // filters come back in height order
+    for (NSUInteger start = 0; start < batch.headers.count; start += WSMessageCfiltersMaxCount) {
+        const NSUInteger stop = MIN(start + WSMessageCfiltersMaxCount, batch.headers.count) - 1;
+        WSBlockHeader *stopHeader = batch.headers[stop];
+
+        [self.downloadPeer sendGetcfiltersMessageWithStartHeight:(uint32_t)(batch.startHeight + start) stopHash:stopHeader.blockId];
+    }
+}
+
+- (void)handleFilter:(WSBIP158Filter *)filter
+{
+    NSParameterAssert(filter);
+
+    WSCompactFilterBatch *batch = self.batch;
+    const NSUInteger index = batch.filteredIndex + batch.queuedFilters.count;
+    if (index >= batch.headers.count) {
+        return;
+    }
+
+    WSBlockHeader *expectedHeader = batch.headers[index];
+    if (![filter.blockId isEqual:expectedHeader.blockId] || ![filter.filterHash isEqual:batch.filterHashes[index]]) {
+        [self.peerGroup reportMisbehavingPeer:self.downloadPeer
+                                        error:WSErrorMake(WSErrorCodeInvalidFilter, @"Filter for %@ does not match filter header chain", filter.blockId)];
+        return;
+    }
+
+    [batch.queuedFilters addObject:filter];
+    [self processQueuedFilters];
+}
+
+- (void)processQueuedFilters
+{
+    WSCompactFilterBatch *batch = self.batch;
+
+    // wallet may grow with matching blocks, match in strict height order
+    while (!batch.pendingBlockId && (batch.queuedFilters.count > 0)) {
+        WSBIP158Filter *filter = [batch.queuedFilters firstObject];
+        [batch.queuedFilters removeObjectAtIndex:0];
+
+        if ([self matchFilter:filter]) {
+            DDLogDebug(@"Filter matched block %@, requesting full block", filter.blockId);
+
+            // unmatched headers before matching block
+            [self flushHeadersToIndex:batch.filteredIndex];
+            if (self.batch != batch) {
+                return;
+            }
+            batch.pendingBlockId = filter.blockId;
+            [self.downloadPeer sendGetdataMessageWithHashes:@[filter.blockId] forInventoryType:WSInventoryTypeBlock];
+        }
+        batch.filteredIndex += 1;
+    }
+
+    if (!batch.pendingBlockId && (batch.filteredIndex == batch.headers.count)) {
+        [self flushHeadersToIndex:batch.filteredIndex];
+        if (self.batch != batch) {
+            return;
+        }
+        [self finishBatch];
+    }
+}
+
+- (BOOL)matchFilter:(WSBIP158Filter *)filter
+{
+    NSParameterAssert(filter);
+
+    return [filter matchesAnyData:self.walletScripts];
+}
+
+- (void)flushHeadersToIndex:(NSUInteger)index
+{
+    WSCompactFilterBatch *batch = self.batch;
+    NSParameterAssert(index <= batch.headers.count);
+
+    if (index <= batch.appendedIndex) {
+        return;
+    }
+
+    NSArray *headers = [batch.headers subarrayWithRange:NSMakeRange(batch.appendedIndex, index - batch.appendedIndex)];
+    batch.appendedIndex = index;
+
+    NSError *error;
+    if (![self.sync appendBlockHeaders:headers error:&error] && error) {
+        [self.peerGroup reportMisbehavingPeer:self.downloadPeer error:error];
+    }
+}
+
+- (void)finishBatch
+{
+    self.batch = nil;
+
+    if (self.blockChain.currentHeight >= self.downloadPeer.lastBlockHeight) {
+        [self finishDownload];
+    }
+    else {
+        [self requestHeaders];
+    }
+}
+
+- (void)finishDownload
+{
+    // blocks announced after sync go through the same batches
+    if (![self.peerGroup.notifier didNotifyDownloadStarted]) {
+        return;
+    }
+
+    for (WSPeer *peer in [self.peerGroup allConnectedPeers]) {
+        DDLogDebug(@"Requesting mempool from peer %@", peer);
+        [peer sendMempoolMessage];
+    }
+
+    [self.sync save];
+
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(detectDownloadTimeout) object:nil];
+    });
+    [self.peerGroup.notifier notifyDownloadFinished];
+}
+
+// main queue
+- (void)detectDownloadTimeout
+{
+    [self.peerGroup executeBlockInGroupQueue:^{
+        const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+        const NSTimeInterval elapsed = now - self.lastKeepAliveTime;
+
+        WSPeer *verifyPeer = self.batch.verifyPeer;
+        if (verifyPeer && (now - self.batch.verifyRequestTime >= self.requestTimeout)) {
+            [self.peerGroup disconnectPeer:verifyPeer
+                                     error:WSErrorMake(WSErrorCodePeerGroupTimeout, @"Filter headers cross-check timed out, disconnecting")];
+        }
+
+        if (elapsed < self.requestTimeout) {
+            const NSTimeInterval delay = self.requestTimeout - elapsed;
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(detectDownloadTimeout) object:nil];
+                [self performSelector:@selector(detectDownloadTimeout) withObject:nil afterDelay:delay];
+            });
+            return;
+        }
+
+        if (self.downloadPeer) {
+            [self.peerGroup disconnectPeer:self.downloadPeer
+                                     error:WSErrorMake(WSErrorCodePeerGroupTimeout, @"Download timed out, disconnecting")];
+        }
+    } synchronously:NO];
+}
+
+#pragma mark Blockchain
+
+- (BOOL)isValidMerkleRootOfBlock:(WSBlock *)block
+{
+    NSParameterAssert(block);
+
+    if (block.transactions.count == 0) {
+        return NO;
+    }
+
+    // full block is not authenticated by filter, check transactions against header
+    NSMutableArray *hashes = [[NSMutableArray alloc] initWithCapacity:block.transactions.count];
+    for (WSSignedTransaction *transaction in block.transactions) {
+        [hashes addObject:transaction.txId];
+    }
+
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:(2 * WSHash256Length)];
+    while (hashes.count > 1) {
+        NSMutableArray *parentHashes = [[NSMutableArray alloc] initWithCapacity:((hashes.count + 1) / 2)];
+        for (NSUInteger i = 0; i < hashes.count; i += 2) {
+            WSHash256 *left = hashes[i];
+            WSHash256 *right = ((i + 1 < hashes.count) ? hashes[i + 1] : left);
+
+            data.length = 0;
+            [data appendData:left.data];
+            [data appendData:right.data];
+            [parentHashes addObject:WSHash256Compute(data)];
+        }
+        hashes = parentHashes;
+    }
+    return [[hashes firstObject] isEqual:block.header.merkleRoot];
+}
+
+#pragma mark WSBlockChainSyncDelegate
+
+- (BOOL)blockChainSyncIsSynced:(WSBlockChainSync *)sync
+{
+    return [self isSynced];
+}
+
+- (void)blockChainSyncDidGenerateNewAddresses:(WSBlockChainSync *)sync
+{
+    //
+    // filters are matched in height order, so following filters are
+    // matched against the new scripts without any re-download
+    //
+    [self rebuildWalletScripts];
+}
+
+- (void)blockChainSync:(WSBlockChainSync *)sync didReorganizeAtBase:(WSStorableBlock *)base
+{
+    // filter header chain is anchored again at next batch
+    self.lastFilterHeader = nil;
+    self.lastFilterBlockId = nil;
+}
+
+- (void)blockChainSyncDidTruncate:(WSBlockChainSync *)sync
+{
+    self.lastFilterHeader = nil;
+    self.lastFilterBlockId = nil;
+}
+
+@end
@@ -40,7 +40,8 @@
 
 - (BOOL)isConnected;
 - (void)submitBlock:(void (^)(void))block;
-- (void)writeMessage:(id<WSMessage>)message; // MUST be executed from within submitBlock:
+- (NSUInteger)writeMessage:(id<WSMessage>)message; // MUST be executed from within submitBlock:, returns bytes enqueued (0 if dropped)
+- (NSUInteger)outputBacklogLength; // MUST be executed from within submitBlock:
 - (void)disconnectWithError:(NSError *)error;
 
 @end
@@ -55,7 +56,8 @@
 @protocol WSConnectionProcessor <NSObject>
 
 - (void)openedConnectionToHost:(NSString *)host port:(uint16_t)port handler:(id<WSConnectionHandler>)handler;
-- (void)processMessage:(id<WSMessage>)message;
+- (void)processMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime;
+- (void)drainedOutputWithBacklogLength:(NSUInteger)backlogLength; // backlog fell below WSPeerOutputBacklogHighWaterMark
 - (void)closedConnectionWithError:(NSError *)error;
 
 @end
@@ -28,6 +28,7 @@
 #import "WSConnection.h"
 
 @class WSParameters;
+@class WSConnectionReactor;
 
 #pragma mark -
 
@@ -39,6 +40,8 @@
 @property (nonatomic, assign) NSTimeInterval connectionTimeout;
 
 - (instancetype)initWithParameters:(WSParameters *)parameters;
+- (instancetype)initWithParameters:(WSParameters *)parameters reactor:(WSConnectionReactor *)reactor; // nil for NSStream handlers
+- (WSConnectionReactor *)reactor;
 
 - (BOOL)openConnectionToHost:(NSString *)host port:(uint16_t)port processor:(id<WSConnectionProcessor>)processor;
 - (void)closeConnectionForProcessor:(id<WSConnectionProcessor>)processor;
@@ -24,6 +24,7 @@
 //
 
 #import "WSConnectionPool.h"
+#import "WSConnectionReactor.h"
 #import "WSProtocolDeserializer.h"
 #import "WSBuffer.h"
 #import "WSMessage.h"
@@ -46,6 +47,7 @@
 @interface WSConnectionPool ()
 
 @property (nonatomic, strong) WSParameters *parameters;
+@property (nonatomic, strong) WSConnectionReactor *reactor;
 @property (nonatomic, strong) NSMutableDictionary *handlers;    // NSString -> WSConnectionHandler
 
 - (id<WSConnectionHandler>)unsafeHandlerForProcessor:(id<WSConnectionProcessor>)processor;
@@ -63,11 +65,17 @@
 }
 
 - (instancetype)initWithParameters:(WSParameters *)parameters
+{
+    return [self initWithParameters:parameters reactor:nil];
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters reactor:(WSConnectionReactor *)reactor
 {
     WSExceptionCheckIllegal(parameters);
     
     if ((self = [super init])) {
         self.parameters = parameters;
+        self.reactor = reactor;
         self.handlers = [[NSMutableDictionary alloc] init];
         self.connectionTimeout = 5.0;
     }
@@ -78,22 +86,31 @@
 {
     WSExceptionCheckIllegal(host);
 
-    WSStreamConnectionHandler *handler;
-
     @synchronized (self.handlers) {
-        for (handler in [self.handlers allValues]) {
+        for (id<WSConnectionHandler> handler in [self.handlers allValues]) {
             if ([handler.host isEqualToString:host] && (handler.port == port)) {
                 return NO;
             }
         }
         
-        handler = [[WSStreamConnectionHandler alloc] initWithParameters:self.parameters host:host port:port processor:processor];
-        handler.delegate = self;
-        self.handlers[handler.identifier] = handler;
+        if (self.reactor) {
+            WSReactorConnectionHandler *handler = [[WSReactorConnectionHandler alloc] initWithParameters:self.parameters host:host port:port processor:processor reactor:self.reactor];
+            handler.delegate = self;
+            self.handlers[handler.identifier] = handler;
 
-        DDLogDebug(@"%@ Added to pool (current: %lu)", handler, (unsigned long)self.handlers.count);
+            DDLogDebug(@"%@ Added to pool (current: %lu)", handler, (unsigned long)self.handlers.count);
 
-        [handler connectWithTimeout:self.connectionTimeout error:NULL];
+            [handler connectWithTimeout:self.connectionTimeout error:NULL];
+        }
+        else {
+            WSStreamConnectionHandler *handler = [[WSStreamConnectionHandler alloc] initWithParameters:self.parameters host:host port:port processor:processor];
+            handler.delegate = self;
+            self.handlers[handler.identifier] = handler;
+
+            DDLogDebug(@"%@ Added to pool (current: %lu)", handler, (unsigned long)self.handlers.count);
+
+            [handler connectWithTimeout:self.connectionTimeout error:NULL];
+        }
     }
 
     return YES;
@@ -166,7 +183,8 @@
 {
     NSParameterAssert(handler);
 
-    if ([handler isConnected]) {
+    // reactor handlers also abort a pending connect
+    if ([handler isConnected] || [handler isKindOfClass:[WSReactorConnectionHandler class]]) {
         [handler disconnectWithError:error];
     }
     else {
@@ -204,10 +222,14 @@
 @property (nonatomic, strong) NSInputStream *inputStream;
 @property (nonatomic, strong) NSOutputStream *outputStream;
 @property (nonatomic, strong) WSProtocolDeserializer *inputDeserializer;
-@property (nonatomic, strong) NSMutableData *outputBuffer;
+@property (nonatomic, strong) NSMutableArray *outputChunks;     // NSData
+@property (nonatomic, assign) NSUInteger outputChunkOffset;     // written bytes of first chunk
+@property (nonatomic, assign) NSUInteger outputBacklogLength;
+@property (nonatomic, strong) NSMutableData *outputGatherBuffer;
 
 - (void)unsafeEnqueueData:(NSData *)data;
 - (void)unsafeFlush;
+- (void)unsafeDrainLength:(NSUInteger)length;
 
 @end
 
@@ -245,7 +267,10 @@
     
     self.queue = dispatch_queue_create(label.UTF8String, NULL);
     self.inputDeserializer = [[WSProtocolDeserializer alloc] initWithParameters:self.parameters host:self.host port:self.port];
-    self.outputBuffer = [[NSMutableData alloc] initWithCapacity:10240];
+    self.outputChunks = [[NSMutableArray alloc] init];
+    self.outputChunkOffset = 0;
+    self.outputBacklogLength = 0;
+    self.outputGatherBuffer = [[NSMutableData alloc] initWithLength:WSConnectionOutputGatherLength];
     
     dispatch_async(self.queue, ^{
         self.runLoop = [NSRunLoop currentRunLoop];
@@ -296,7 +321,7 @@
 }
 
 // unsafe
-- (void)writeMessage:(id<WSMessage>)message
+- (NSUInteger)writeMessage:(id<WSMessage>)message
 {
 //    @synchronized (self) {
 //        if (_peerStatus == WSPeerStatusDisconnected) {
@@ -310,7 +335,7 @@
     if (buffer.length > WSMessageMaxLength) {
         DDLogError(@"%@ Error sending '%@', message is too long (%lu > %lu)", self, message.messageType,
                    (unsigned long)buffer.length, (unsigned long)WSMessageMaxLength);
-        return;
+        return 0;
     }
     
     DDLogVerbose(@"%@ Sending %@ (%lu+%lu bytes)", self, message,
@@ -320,6 +345,14 @@
     
     [self unsafeEnqueueData:buffer.data];
     [self unsafeFlush];
+
+    return buffer.length;
+}
+
+// unsafe
+- (NSUInteger)outputBacklogLength
+{
+    return _outputBacklogLength;
 }
 
 - (void)disconnectWithError:(NSError *)error
@@ -331,6 +364,9 @@
         [self.outputStream close];
         [self.inputStream removeFromRunLoop:self.runLoop forMode:NSRunLoopCommonModes];
         [self.outputStream removeFromRunLoop:self.runLoop forMode:NSRunLoopCommonModes];
+        [self.outputChunks removeAllObjects];
+        self.outputChunkOffset = 0;
+        self.outputBacklogLength = 0;
         
         [self.delegate connectionHandler:self didDisconnectWithError:error];
         [self.processor closedConnectionWithError:error];
@@ -359,7 +395,11 @@
             if (aStream != self.outputStream) {
                 return;
             }
+            const NSUInteger previousBacklogLength = self.outputBacklogLength;
             [self unsafeFlush];
+            if ((previousBacklogLength >= WSPeerOutputBacklogHighWaterMark) && (self.outputBacklogLength < WSPeerOutputBacklogHighWaterMark)) {
+                [self.processor drainedOutputWithBacklogLength:self.outputBacklogLength];
+            }
             break;
         }
         case NSStreamEventHasBytesAvailable: {
@@ -367,17 +407,25 @@
                 return;
             }
             while ([self.inputStream hasBytesAvailable]) {
-                NSError *error;
-                id<WSMessage> message = [self.inputDeserializer parseMessageFromStream:self.inputStream error:&error];
-                if (message) {
-                    [self.processor processMessage:message];
+                if (![self.inputDeserializer readFromStream:self.inputStream]) {
+                    break;
                 }
-                else {
-                    if (error) {
-                        DDLogError(@"%@ Error deserializing message: %@", self, error);
-                        if (error.code == WSErrorCodeMalformed) {
-                            [self disconnectWithError:error];
-                        }
+
+                // a single read may carry several messages
+                while (YES) {
+                    NSError *error;
+                    id<WSMessage> message = [self.inputDeserializer parseMessageWithError:&error];
+                    if (message) {
+                        [self.processor processMessage:message decodeTime:self.inputDeserializer.lastDecodeTime];
+                        continue;
+                    }
+                    if (!error) {
+                        break;
+                    }
+
+                    DDLogError(@"%@ Error deserializing message: %@", self, error);
+                    if (error.code == WSErrorCodeMalformed) {
+                        [self disconnectWithError:error];
                         return;
                     }
                 }
@@ -405,16 +453,69 @@
 {
     NSParameterAssert(data);
     
-    [self.outputBuffer appendData:data];
+    if (data.length == 0) {
+        return;
+    }
+    
+    // chunks are immutable, enqueueing never touches the backlog
+    [self.outputChunks addObject:[data copy]];
+    self.outputBacklogLength += data.length;
 }
 
 - (void)unsafeFlush
 {
-    while ((self.outputBuffer.length > 0) && [self.outputStream hasSpaceAvailable]) {
-        const NSInteger written = [self.outputStream write:self.outputBuffer.bytes maxLength:self.outputBuffer.length];
-        if (written > 0) {
-            [self.outputBuffer replaceBytesInRange:NSMakeRange(0, written) withBytes:NULL length:0];
+    while ((self.outputBacklogLength > 0) && [self.outputStream hasSpaceAvailable]) {
+        NSData *firstChunk = self.outputChunks[0];
+        const uint8_t *bytes = (const uint8_t *)firstChunk.bytes + self.outputChunkOffset;
+        NSUInteger length = firstChunk.length - self.outputChunkOffset;
+        
+        // NSOutputStream has no writev(), gather small chunks into a single write
+        if ((length < WSConnectionOutputGatherLength) && (self.outputChunks.count > 1)) {
+            uint8_t *gather = self.outputGatherBuffer.mutableBytes;
+            NSUInteger gatheredLength = 0;
+            NSUInteger offset = self.outputChunkOffset;
+            
+            for (NSData *chunk in self.outputChunks) {
+                const NSUInteger copiedLength = MIN(chunk.length - offset, WSConnectionOutputGatherLength - gatheredLength);
+                memcpy(gather + gatheredLength, (const uint8_t *)chunk.bytes + offset, copiedLength);
+                gatheredLength += copiedLength;
+                offset = 0;
+                
+                if (gatheredLength == WSConnectionOutputGatherLength) {
+                    break;
+                }
+            }
+            bytes = gather;
+            length = gatheredLength;
+        }
+        
+        const NSInteger written = [self.outputStream write:bytes maxLength:length];
+        if (written <= 0) {
+            break;
+        }
+        [self unsafeDrainLength:written];
+    }
+}
+
+- (void)unsafeDrainLength:(NSUInteger)length
+{
+    NSAssert(length <= self.outputBacklogLength, @"Draining more than backlog (%lu > %lu)",
+             (unsigned long)length, (unsigned long)self.outputBacklogLength);
+    
+    self.outputBacklogLength -= length;
+    
+    // release chunks as soon as they're fully written
+    while (length > 0) {
+        NSData *firstChunk = self.outputChunks[0];
+        const NSUInteger remainingLength = firstChunk.length - self.outputChunkOffset;
+        
+        if (length < remainingLength) {
+            self.outputChunkOffset += length;
+            break;
         }
+        length -= remainingLength;
+        [self.outputChunks removeObjectAtIndex:0];
+        self.outputChunkOffset = 0;
     }
 }
 
@@ -0,0 +1,86 @@
+//
+//  WSConnectionReactor.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "WSConnection.h"
+
+@class WSParameters;
+@class WSConnectionReactor;
+
+#pragma mark -
+
+//
+// thread-safety: not required (always invoked on reactor thread)
+//
+@protocol WSConnectionReactorSocketHandler <NSObject>
+
+- (void)reactor:(WSConnectionReactor *)reactor socketIsReadable:(int)socket;
+- (void)reactor:(WSConnectionReactor *)reactor socketIsWritable:(int)socket;
+
+@end
+
+#pragma mark -
+
+//
+// single thread multiplexing many non-blocking sockets (epoll on Linux,
+// kqueue elsewhere), several connection pools may share one reactor
+//
+// thread-safe: performBlock: only, everything else must run from within it
+//
+@interface WSConnectionReactor : NSObject
+
++ (instancetype)sharedReactor; // never stopped
+- (instancetype)initWithName:(NSString *)name;
+- (NSString *)name;
+- (void)stop;
+
+- (void)performBlock:(void (^)(void))block;
+- (BOOL)isReactorThread;
+
+- (BOOL)addSocket:(int)socket handler:(id<WSConnectionReactorSocketHandler>)handler error:(NSError **)error;
+- (void)setWritable:(BOOL)writable forSocket:(int)socket;
+- (void)removeSocket:(int)socket;
+- (NSUInteger)numberOfSockets;
+
+- (id)scheduleTimerWithDelay:(NSTimeInterval)delay block:(void (^)(void))block;
+- (void)cancelTimer:(id)timer;
+
+@end
+
+#pragma mark -
+
+//
+// WSConnectionHandler over a reactor socket, processor and delegate
+// are called on reactor thread
+//
+@interface WSReactorConnectionHandler : NSObject <WSConnectionHandler, WSConnectionReactorSocketHandler>
+
+@property (nonatomic, weak) id<WSConnectionHandlerDelegate> delegate;
+
+- (instancetype)initWithParameters:(WSParameters *)parameters host:(NSString *)host port:(uint16_t)port processor:(id<WSConnectionProcessor>)processor reactor:(WSConnectionReactor *)reactor;
+- (void)connectWithTimeout:(NSTimeInterval)timeout error:(NSError **)error;
+
+@end
@@ -0,0 +1,899 @@
+//
+//  WSConnectionReactor.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <sys/socket.h>
+#import <sys/uio.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <netdb.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+#if defined(__linux__)
+#import <sys/epoll.h>
+#else
+#import <sys/event.h>
+#endif
+
+#import "WSConnectionReactor.h"
+#import "WSProtocolDeserializer.h"
+#import "WSBuffer.h"
+#import "WSMessage.h"
+#import "WSConfig.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+static const int WSConnectionReactorMaxEvents       = 64;
+static const int WSConnectionReactorMaxIOVectors    = 64;
+
+// SO_NOSIGPIPE is not available everywhere (e.g. Linux)
+#ifdef MSG_NOSIGNAL
+static const int WSConnectionReactorSendFlags       = MSG_NOSIGNAL;
+#else
+static const int WSConnectionReactorSendFlags       = 0;
+#endif
+
+typedef struct {
+    int socket;
+    BOOL isReadable;
+    BOOL isWritable;
+} WSConnectionReactorEvent;
+
+static NSError *WSConnectionReactorPOSIXError(int code);
+static BOOL WSConnectionReactorSetNonBlocking(int fd);
+
+#pragma mark - Backend
+
+#if defined(__linux__)
+
+static int WSConnectionReactorBackendCreate(void)
+{
+    return epoll_create1(EPOLL_CLOEXEC);
+}
+
+static BOOL WSConnectionReactorBackendAdd(int backend, int fd)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return (epoll_ctl(backend, EPOLL_CTL_ADD, fd, &event) == 0);
+}
+
+static void WSConnectionReactorBackendSetWritable(int backend, int fd, BOOL writable)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = (writable ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+    event.data.fd = fd;
+    epoll_ctl(backend, EPOLL_CTL_MOD, fd, &event);
+}
+
+static void WSConnectionReactorBackendRemove(int backend, int fd)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    epoll_ctl(backend, EPOLL_CTL_DEL, fd, &event);
+}
+
+static int WSConnectionReactorBackendWait(int backend, WSConnectionReactorEvent *events, int maxEvents, int timeoutMillis)
+{
+    struct epoll_event rawEvents[WSConnectionReactorMaxEvents];
+    const int count = epoll_wait(backend, rawEvents, MIN(maxEvents, WSConnectionReactorMaxEvents), timeoutMillis);
+    for (int i = 0; i < count; ++i) {
+
+        // errors surface on the next read/write
+        const BOOL isFailed = ((rawEvents[i].events & (EPOLLERR | EPOLLHUP)) != 0);
+        events[i].socket = rawEvents[i].data.fd;
+        events[i].isReadable = (isFailed || ((rawEvents[i].events & EPOLLIN) != 0));
+        events[i].isWritable = (isFailed || ((rawEvents[i].events & EPOLLOUT) != 0));
+    }
+    return count;
+}
+
+#else
+
+static int WSConnectionReactorBackendCreate(void)
+{
+    return kqueue();
+}
+
+static BOOL WSConnectionReactorBackendAdd(int backend, int fd)
+{
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | EV_DISABLE, 0, 0, NULL);
+    return (kevent(backend, changes, 2, NULL, 0, NULL) == 0);
+}
+
+static void WSConnectionReactorBackendSetWritable(int backend, int fd, BOOL writable)
+{
+    struct kevent change;
+    EV_SET(&change, fd, EVFILT_WRITE, (writable ? EV_ENABLE : EV_DISABLE), 0, 0, NULL);
+    kevent(backend, &change, 1, NULL, 0, NULL);
+}
+
+static void WSConnectionReactorBackendRemove(int backend, int fd)
+{
+    struct kevent changes[2];
+    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(backend, changes, 2, NULL, 0, NULL);
+}
+
+static int WSConnectionReactorBackendWait(int backend, WSConnectionReactorEvent *events, int maxEvents, int timeoutMillis)
+{
+    struct kevent rawEvents[WSConnectionReactorMaxEvents];
+    struct timespec timeout;
+    struct timespec *timeoutPtr = NULL;
+    if (timeoutMillis >= 0) {
+        timeout.tv_sec = timeoutMillis / 1000;
+        timeout.tv_nsec = (timeoutMillis % 1000) * 1000000L;
+        timeoutPtr = &timeout;
+    }
+
+    const int count = kevent(backend, NULL, 0, rawEvents, MIN(maxEvents, WSConnectionReactorMaxEvents), timeoutPtr);
+    for (int i = 0; i < count; ++i) {
+
+        // EV_EOF/EV_ERROR surface on the next read/write
+        events[i].socket = (int)rawEvents[i].ident;
+        events[i].isReadable = (rawEvents[i].filter == EVFILT_READ);
+        events[i].isWritable = (rawEvents[i].filter == EVFILT_WRITE);
+    }
+    return count;
+}
+
+#endif
+
+#pragma mark -
+
+@interface WSConnectionReactorTimer : NSObject
+
+@property (nonatomic, assign) NSTimeInterval fireTime;
+@property (nonatomic, copy) void (^block)(void);
+@property (nonatomic, assign) BOOL isCancelled;
+
+@end
+
+@implementation WSConnectionReactorTimer
+
+@end
+
+#pragma mark -
+
+@interface WSConnectionReactor ()
+
+@property (nonatomic, strong) NSString *name;
+@property (nonatomic, strong) NSThread *thread;
+@property (nonatomic, assign) int backend;
+@property (nonatomic, assign) int wakeUpReadFd;
+@property (nonatomic, assign) int wakeUpWriteFd;
+@property (nonatomic, assign) BOOL isStopped;                           // reactor thread
+@property (nonatomic, strong) NSMutableArray *pendingBlocks;            // void (^)(void), locked
+@property (nonatomic, strong) NSMutableDictionary *handlersBySocket;    // NSNumber -> id<WSConnectionReactorSocketHandler>
+@property (nonatomic, strong) NSMutableArray *timers;                   // WSConnectionReactorTimer
+
+- (void)run;
+- (int)timeoutMillisUntilNextTimer;
+- (void)fireDueTimers;
+- (void)runPendingBlocks;
+- (void)drainWakeUp;
+
+@end
+
+@implementation WSConnectionReactor
+
++ (instancetype)sharedReactor
+{
+    static WSConnectionReactor *sharedReactor;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedReactor = [[self alloc] initWithName:@"WSConnectionReactor"];
+    });
+    return sharedReactor;
+}
+
+- (instancetype)init
+{
+    WSExceptionRaiseUnsupported(@"Use initWithName:");
+    return nil;
+}
+
+- (instancetype)initWithName:(NSString *)name
+{
+    WSExceptionCheckIllegal(name);
+
+    if ((self = [super init])) {
+        self.name = name;
+        self.backend = WSConnectionReactorBackendCreate();
+        WSExceptionCheck(self.backend >= 0, NSInternalInconsistencyException, @"Unable to create reactor backend (%d)", errno);
+
+        int wakeUpFds[2];
+        WSExceptionCheck(pipe(wakeUpFds) == 0, NSInternalInconsistencyException, @"Unable to create reactor wake-up pipe (%d)", errno);
+        WSConnectionReactorSetNonBlocking(wakeUpFds[0]);
+        WSConnectionReactorSetNonBlocking(wakeUpFds[1]);
+        self.wakeUpReadFd = wakeUpFds[0];
+        self.wakeUpWriteFd = wakeUpFds[1];
+        WSConnectionReactorBackendAdd(self.backend, self.wakeUpReadFd);
+
+        self.pendingBlocks = [[NSMutableArray alloc] init];
+        self.handlersBySocket = [[NSMutableDictionary alloc] init];
+        self.timers = [[NSMutableArray alloc] init];
+
+        // the thread retains the reactor until stopped
+        self.thread = [[NSThread alloc] initWithTarget:self selector:@selector(run) object:nil];
+        self.thread.name = name;
+        [self.thread start];
+    }
+    return self;
+}
+
+- (void)stop
+{
+    [self performBlock:^{
+        self.isStopped = YES;
+    }];
+}
+
+- (void)performBlock:(void (^)(void))block
+{
+    WSExceptionCheckIllegal(block);
+
+    @synchronized (self.pendingBlocks) {
+        [self.pendingBlocks addObject:[block copy]];
+
+        // first pending block wakes up the loop
+        if (self.pendingBlocks.count == 1) {
+            const uint8_t byte = 0;
+            write(self.wakeUpWriteFd, &byte, sizeof(byte));
+        }
+    }
+}
+
+- (BOOL)isReactorThread
+{
+    return ([NSThread currentThread] == self.thread);
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<%@: %@, %lu sockets>", [self class], self.name, (unsigned long)self.handlersBySocket.count];
+}
+
+#pragma mark Reactor thread
+
+- (BOOL)addSocket:(int)socket handler:(id<WSConnectionReactorSocketHandler>)handler error:(NSError *__autoreleasing *)error
+{
+    NSAssert([self isReactorThread], @"Not on reactor thread");
+    WSExceptionCheckIllegal(socket >= 0);
+    WSExceptionCheckIllegal(handler);
+
+    if (!WSConnectionReactorBackendAdd(self.backend, socket)) {
+        if (error) {
+            *error = WSConnectionReactorPOSIXError(errno);
+        }
+        return NO;
+    }
+    self.handlersBySocket[@(socket)] = handler;
+    return YES;
+}
+
+- (void)setWritable:(BOOL)writable forSocket:(int)socket
+{
+    NSAssert([self isReactorThread], @"Not on reactor thread");
+
+    WSConnectionReactorBackendSetWritable(self.backend, socket, writable);
+}
+
+- (void)removeSocket:(int)socket
+{
+    NSAssert([self isReactorThread], @"Not on reactor thread");
+
+    if (!self.handlersBySocket[@(socket)]) {
+        return;
+    }
+    WSConnectionReactorBackendRemove(self.backend, socket);
+    [self.handlersBySocket removeObjectForKey:@(socket)];
+}
+
+- (NSUInteger)numberOfSockets
+{
+    return self.handlersBySocket.count;
+}
+
+- (id)scheduleTimerWithDelay:(NSTimeInterval)delay block:(void (^)(void))block
+{
+    NSAssert([self isReactorThread], @"Not on reactor thread");
+    WSExceptionCheckIllegal(block);
+
+    WSConnectionReactorTimer *timer = [[WSConnectionReactorTimer alloc] init];
+    timer.fireTime = [NSDate timeIntervalSinceReferenceDate] + delay;
+    timer.block = block;
+    [self.timers addObject:timer];
+    return timer;
+}
+
+- (void)cancelTimer:(id)timer
+{
+    NSAssert([self isReactorThread], @"Not on reactor thread");
+
+    WSConnectionReactorTimer *reactorTimer = timer;
+    reactorTimer.isCancelled = YES;
+    [self.timers removeObjectIdenticalTo:reactorTimer];
+}
+
+#pragma mark Loop
+
+- (void)run
+{
+    DDLogDebug(@"%@ Started", self);
+
+    WSConnectionReactorEvent events[WSConnectionReactorMaxEvents];
+
+    while (!self.isStopped) {
+        @autoreleasepool {
+            const int count = WSConnectionReactorBackendWait(self.backend, events, WSConnectionReactorMaxEvents, [self timeoutMillisUntilNextTimer]);
+            if ((count < 0) && (errno != EINTR)) {
+                DDLogError(@"%@ Error waiting for events (%d)", self, errno);
+                break;
+            }
+
+            for (int i = 0; i < count; ++i) {
+                const int socket = events[i].socket;
+                if (socket == self.wakeUpReadFd) {
+                    [self drainWakeUp];
+                    continue;
+                }
+
+                // handler may remove itself on either event
+                if (events[i].isReadable) {
+                    [self.handlersBySocket[@(socket)] reactor:self socketIsReadable:socket];
+                }
+                if (events[i].isWritable) {
+                    [self.handlersBySocket[@(socket)] reactor:self socketIsWritable:socket];
+                }
+            }
+
+            [self fireDueTimers];
+            [self runPendingBlocks];
+        }
+    }
+
+    if (self.handlersBySocket.count > 0) {
+        DDLogWarn(@"%@ Stopped with registered sockets", self);
+    }
+    close(self.wakeUpReadFd);
+    close(self.wakeUpWriteFd);
+    close(self.backend);
+
+    DDLogDebug(@"%@ Stopped", self);
+}
+
+- (int)timeoutMillisUntilNextTimer
+{
+    if (self.timers.count == 0) {
+        return -1;
+    }
+
+    NSTimeInterval nextFireTime = DBL_MAX;
+    for (WSConnectionReactorTimer *timer in self.timers) {
+        nextFireTime = MIN(nextFireTime, timer.fireTime);
+    }
+    const NSTimeInterval delay = nextFireTime - [NSDate timeIntervalSinceReferenceDate];
+    return ((delay > 0.0) ? (int)ceil(delay * 1000.0) : 0);
+}
+
+- (void)fireDueTimers
+{
+    if (self.timers.count == 0) {
+        return;
+    }
+
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    NSMutableArray *dueTimers = [[NSMutableArray alloc] init];
+    for (WSConnectionReactorTimer *timer in self.timers) {
+        if (timer.fireTime <= now) {
+            [dueTimers addObject:timer];
+        }
+    }
+    [self.timers removeObjectsInArray:dueTimers];
+
+    // a timer may cancel another
+    for (WSConnectionReactorTimer *timer in dueTimers) {
+        if (!timer.isCancelled) {
+            timer.block();
+        }
+    }
+}
+
+- (void)runPendingBlocks
+{
+    NSArray *blocks;
+    @synchronized (self.pendingBlocks) {
+        if (self.pendingBlocks.count == 0) {
+            return;
+        }
+        blocks = [self.pendingBlocks copy];
+        [self.pendingBlocks removeAllObjects];
+    }
+
+    for (void (^block)(void) in blocks) {
+        block();
+    }
+}
+
+- (void)drainWakeUp
+{
+    uint8_t bytes[64];
+    while (read(self.wakeUpReadFd, bytes, sizeof(bytes)) > 0) {
+    }
+}
+
+@end
+
+#pragma mark -
+
+@interface WSReactorConnectionHandler ()
+
+@property (nonatomic, strong) WSParameters *parameters;
+@property (nonatomic, strong) NSString *host;
+@property (nonatomic, assign) uint16_t port;
+@property (nonatomic, strong) NSString *identifier;
+@property (nonatomic, weak) id<WSConnectionProcessor> processor;
+@property (nonatomic, strong) WSConnectionReactor *reactor;
+
+// locked
+@property (nonatomic, assign) BOOL isOpen;
+@property (nonatomic, assign) BOOL isEstablished;
+
+// reactor thread
+@property (nonatomic, assign) int socket;
+@property (nonatomic, assign) BOOL isConnecting;
+@property (nonatomic, strong) NSMutableArray *remainingAddresses;   // NSData (struct sockaddr)
+@property (nonatomic, strong) NSError *lastConnectError;
+@property (nonatomic, strong) id connectionTimer;
+@property (nonatomic, strong) WSProtocolDeserializer *inputDeserializer;
+@property (nonatomic, strong) NSMutableArray *outputChunks;     // NSData
+@property (nonatomic, assign) NSUInteger outputChunkOffset;     // written bytes of first chunk
+@property (nonatomic, assign) NSUInteger outputBacklogLength;
+
+- (BOOL)isOpenLocked;
+- (void)unsafeStartConnectingToAddresses:(NSArray *)addresses timeout:(NSTimeInterval)timeout;
+- (void)unsafeConnectToNextAddress;
+- (void)unsafeCloseSocket;
+- (void)unsafeFinishConnecting;
+- (void)unsafeDisconnectWithError:(NSError *)error;
+- (void)unsafeEnqueueData:(NSData *)data;
+- (void)unsafeFlush;
+- (void)unsafeDrainLength:(NSUInteger)length;
+
+@end
+
+@implementation WSReactorConnectionHandler
+
+- (instancetype)initWithParameters:(WSParameters *)parameters host:(NSString *)host port:(uint16_t)port processor:(id<WSConnectionProcessor>)processor reactor:(WSConnectionReactor *)reactor
+{
+    WSExceptionCheckIllegal(parameters);
+    WSExceptionCheckIllegal(host);
+    WSExceptionCheckIllegal(port > 0);
+    WSExceptionCheckIllegal(reactor);
+
+    if ((self = [super init])) {
+        self.parameters = parameters;
+        self.host = host;
+        self.port = port;
+        self.identifier = [NSString stringWithFormat:@"(%@:%u)", self.host, self.port];
+        self.processor = processor;
+        self.reactor = reactor;
+        self.socket = -1;
+    }
+    return self;
+}
+
+- (void)connectWithTimeout:(NSTimeInterval)timeout error:(NSError *__autoreleasing *)error
+{
+    @synchronized (self) {
+        if (self.isOpen) {
+            return;
+        }
+        self.isOpen = YES;
+    }
+
+    self.inputDeserializer = [[WSProtocolDeserializer alloc] initWithParameters:self.parameters host:self.host port:self.port];
+    self.outputChunks = [[NSMutableArray alloc] init];
+    self.outputChunkOffset = 0;
+    self.outputBacklogLength = 0;
+
+    // name resolution may block, keep it off the reactor
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICSERV;
+
+        NSString *service = [NSString stringWithFormat:@"%u", self.port];
+        struct addrinfo *info = NULL;
+        const int result = getaddrinfo(self.host.UTF8String, service.UTF8String, &hints, &info);
+
+        // fall back on next address when connect fails, like getStreamsToHostWithName:
+        NSMutableArray *addresses = [[NSMutableArray alloc] init];
+        for (struct addrinfo *next = info; next; next = next->ai_next) {
+            [addresses addObject:[NSData dataWithBytes:next->ai_addr length:next->ai_addrlen]];
+        }
+        if (info) {
+            freeaddrinfo(info);
+        }
+
+        [self.reactor performBlock:^{
+            if (![self isOpenLocked]) {
+                return;
+            }
+            if (result != 0) {
+                [self unsafeDisconnectWithError:WSErrorMake(WSErrorCodeNetworking, @"Unable to resolve host (%s)", gai_strerror(result))];
+                return;
+            }
+            [self unsafeStartConnectingToAddresses:addresses timeout:timeout];
+        }];
+    });
+}
+
+- (NSString *)description
+{
+    return self.identifier;
+}
+
+#pragma mark WSConnectionHandler (any queue)
+
+- (BOOL)isConnected
+{
+    @synchronized (self) {
+        return (self.isOpen && self.isEstablished);
+    }
+}
+
+- (void)submitBlock:(void (^)(void))block
+{
+    WSExceptionCheckIllegal(block);
+
+    [self.reactor performBlock:block];
+}
+
+// unsafe
+- (NSUInteger)writeMessage:(id<WSMessage>)message
+{
+    NSUInteger headerLength;
+    WSBuffer *buffer = [message toNetworkBufferWithHeaderLength:&headerLength];
+    if (buffer.length > WSMessageMaxLength) {
+        DDLogError(@"%@ Error sending '%@', message is too long (%lu > %lu)", self, message.messageType,
+                   (unsigned long)buffer.length, (unsigned long)WSMessageMaxLength);
+        return 0;
+    }
+
+    DDLogVerbose(@"%@ Sending %@ (%lu+%lu bytes)", self, message,
+                 (unsigned long)headerLength, (unsigned long)(buffer.length - headerLength));
+
+    [self unsafeEnqueueData:buffer.data];
+    if (!self.isConnecting) {
+        [self unsafeFlush];
+    }
+
+    return buffer.length;
+}
+
+// unsafe
+- (NSUInteger)outputBacklogLength
+{
+    return _outputBacklogLength;
+}
+
+- (void)disconnectWithError:(NSError *)error
+{
+    [self submitBlock:^{
+        [self unsafeDisconnectWithError:error];
+    }];
+}
+
+#pragma mark WSConnectionReactorSocketHandler (reactor thread)
+
+- (void)reactor:(WSConnectionReactor *)reactor socketIsReadable:(int)socket
+{
+    if (self.isConnecting) {
+        return;
+    }
+
+    // level-triggered, one read per event is fair to other sockets
+    const NSInteger actuallyRead = [self.inputDeserializer readFromSocket:socket];
+    if (actuallyRead == 0) {
+        [self unsafeDisconnectWithError:nil];
+        return;
+    }
+    if (actuallyRead < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            [self unsafeDisconnectWithError:WSConnectionReactorPOSIXError(errno)];
+        }
+        return;
+    }
+
+    // a single read may carry several messages
+    while (YES) {
+        NSError *error;
+        id<WSMessage> message = [self.inputDeserializer parseMessageWithError:&error];
+        if (message) {
+            [self.processor processMessage:message decodeTime:self.inputDeserializer.lastDecodeTime];
+            continue;
+        }
+        if (!error) {
+            break;
+        }
+
+        DDLogError(@"%@ Error deserializing message: %@", self, error);
+        if (error.code == WSErrorCodeMalformed) {
+            [self unsafeDisconnectWithError:error];
+            return;
+        }
+    }
+}
+
+- (void)reactor:(WSConnectionReactor *)reactor socketIsWritable:(int)socket
+{
+    if (self.isConnecting) {
+        [self unsafeFinishConnecting];
+        return;
+    }
+
+    const NSUInteger previousBacklogLength = self.outputBacklogLength;
+    [self unsafeFlush];
+    if ((previousBacklogLength >= WSPeerOutputBacklogHighWaterMark) && (self.outputBacklogLength < WSPeerOutputBacklogHighWaterMark)) {
+        [self.processor drainedOutputWithBacklogLength:self.outputBacklogLength];
+    }
+}
+
+#pragma mark Helpers (unsafe)
+
+- (BOOL)isOpenLocked
+{
+    @synchronized (self) {
+        return self.isOpen;
+    }
+}
+
+- (void)unsafeStartConnectingToAddresses:(NSArray *)addresses timeout:(NSTimeInterval)timeout
+{
+    NSParameterAssert(addresses);
+
+    self.remainingAddresses = [addresses mutableCopy];
+    self.lastConnectError = nil;
+
+    // timeout covers all addresses
+    __weak WSReactorConnectionHandler *weakSelf = self;
+    self.connectionTimer = [self.reactor scheduleTimerWithDelay:timeout block:^{
+        [weakSelf unsafeDisconnectWithError:WSErrorMake(WSErrorCodeConnectionTimeout, @"Connection timed out")];
+    }];
+
+    [self unsafeConnectToNextAddress];
+}
+
+- (void)unsafeConnectToNextAddress
+{
+    [self unsafeCloseSocket];
+
+    while (self.remainingAddresses.count > 0) {
+        NSData *addressData = self.remainingAddresses[0];
+        [self.remainingAddresses removeObjectAtIndex:0];
+
+        const struct sockaddr *address = addressData.bytes;
+        const int fd = socket(address->sa_family, SOCK_STREAM, IPPROTO_TCP);
+        if (fd < 0) {
+            self.lastConnectError = WSConnectionReactorPOSIXError(errno);
+            continue;
+        }
+        WSConnectionReactorSetNonBlocking(fd);
+
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+        NSError *error;
+        if (![self.reactor addSocket:fd handler:self error:&error]) {
+            close(fd);
+            self.lastConnectError = error;
+            continue;
+        }
+        self.socket = fd;
+
+        // non-blocking connect completes on writability
+        if ((connect(fd, address, (socklen_t)addressData.length) < 0) && (errno != EINPROGRESS)) {
+            self.lastConnectError = WSConnectionReactorPOSIXError(errno);
+            [self unsafeCloseSocket];
+            continue;
+        }
+        self.isConnecting = YES;
+        [self.reactor setWritable:YES forSocket:fd];
+        return;
+    }
+
+    [self unsafeDisconnectWithError:(self.lastConnectError ?: WSErrorMake(WSErrorCodeNetworking, @"No address to connect to"))];
+}
+
+- (void)unsafeCloseSocket
+{
+    if (self.socket < 0) {
+        return;
+    }
+    [self.reactor removeSocket:self.socket];
+    close(self.socket);
+    self.socket = -1;
+}
+
+- (void)unsafeFinishConnecting
+{
+    int socketError = 0;
+    socklen_t socketErrorLength = sizeof(socketError);
+    if (getsockopt(self.socket, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorLength) < 0) {
+        socketError = errno;
+    }
+    if (socketError != 0) {
+        DDLogDebug(@"%@ Connect failed (%d), trying next address", self, socketError);
+
+        self.isConnecting = NO;
+        self.lastConnectError = WSConnectionReactorPOSIXError(socketError);
+        [self unsafeConnectToNextAddress];
+        return;
+    }
+
+    self.isConnecting = NO;
+    self.remainingAddresses = nil;
+    [self.reactor cancelTimer:self.connectionTimer];
+    self.connectionTimer = nil;
+    [self.reactor setWritable:NO forSocket:self.socket];
+    @synchronized (self) {
+        self.isEstablished = YES;
+    }
+
+    [self.delegate connectionHandlerDidConnect:self];
+    [self.processor openedConnectionToHost:self.host port:self.port handler:self];
+    [self unsafeFlush];
+}
+
+- (void)unsafeDisconnectWithError:(NSError *)error
+{
+    @synchronized (self) {
+        if (!self.isOpen) {
+            return;
+        }
+        self.isOpen = NO;
+        self.isEstablished = NO;
+    }
+
+    if (self.connectionTimer) {
+        [self.reactor cancelTimer:self.connectionTimer];
+        self.connectionTimer = nil;
+    }
+    [self unsafeCloseSocket];
+    self.isConnecting = NO;
+    self.remainingAddresses = nil;
+    [self.outputChunks removeAllObjects];
+    self.outputChunkOffset = 0;
+    self.outputBacklogLength = 0;
+
+    [self.delegate connectionHandler:self didDisconnectWithError:error];
+    [self.processor closedConnectionWithError:error];
+}
+
+- (void)unsafeEnqueueData:(NSData *)data
+{
+    NSParameterAssert(data);
+
+    if (data.length == 0) {
+        return;
+    }
+    [self.outputChunks addObject:[data copy]];
+    self.outputBacklogLength += data.length;
+}
+
+- (void)unsafeFlush
+{
+    if (self.socket < 0) {
+        return;
+    }
+
+    while (self.outputBacklogLength > 0) {
+        struct iovec vectors[WSConnectionReactorMaxIOVectors];
+        int count = 0;
+        NSUInteger offset = self.outputChunkOffset;
+
+        // gather queued chunks into a single send
+        for (NSData *chunk in self.outputChunks) {
+            vectors[count].iov_base = (uint8_t *)chunk.bytes + offset;
+            vectors[count].iov_len = chunk.length - offset;
+            offset = 0;
+            if (++count == WSConnectionReactorMaxIOVectors) {
+                break;
+            }
+        }
+
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = vectors;
+        header.msg_iovlen = count;
+
+        const ssize_t written = sendmsg(self.socket, &header, WSConnectionReactorSendFlags);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
+            }
+            [self unsafeDisconnectWithError:WSConnectionReactorPOSIXError(errno)];
+            return;
+        }
+        [self unsafeDrainLength:written];
+    }
+
+    // wait for room only while backlogged
+    [self.reactor setWritable:(self.outputBacklogLength > 0) forSocket:self.socket];
+}
+
+- (void)unsafeDrainLength:(NSUInteger)length
+{
+    NSAssert(length <= self.outputBacklogLength, @"Draining more than backlog (%lu > %lu)",
+             (unsigned long)length, (unsigned long)self.outputBacklogLength);
+
+    self.outputBacklogLength -= length;
+
+    // release chunks as soon as they're fully written
+    while (length > 0) {
+        NSData *firstChunk = self.outputChunks[0];
+        const NSUInteger remainingLength = firstChunk.length - self.outputChunkOffset;
+
+        if (length < remainingLength) {
+            self.outputChunkOffset += length;
+            break;
+        }
+        length -= remainingLength;
+        [self.outputChunks removeObjectAtIndex:0];
+        self.outputChunkOffset = 0;
+    }
+}
+
+@end
+
+#pragma mark -
+
+static NSError *WSConnectionReactorPOSIXError(int code)
+{
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+}
+
+static BOOL WSConnectionReactorSetNonBlocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return ((flags >= 0) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0));
+}
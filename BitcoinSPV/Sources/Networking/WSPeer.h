@@ -35,6 +35,7 @@
 @class WSBlockLocator;
 @class WSBlockChain;
 @class WSStorableBlock;
+@class WSTrafficStats;
 
 typedef enum {
     WSPeerStatusConnecting,
@@ -43,7 +44,8 @@ typedef enum {
 } WSPeerStatus;
 
 typedef enum {
-    WSPeerServicesNodeNetwork = 0x01    // indicates a node offers full blocks, not just headers
+    WSPeerServicesNodeNetwork           = 0x01, // indicates a node offers full blocks, not just headers
+    WSPeerServicesNodeCompactFilters    = 0x40  // indicates a node serves BIP157 compact block filters
 } WSPeerServices;
 
 #pragma mark -
@@ -85,6 +87,12 @@ typedef enum {
 - (uint32_t)lastBlockHeight;
 //- (void)cleanUpConnectionData;
 
+// metrics (rolling, DBL_MAX or 0.0 if unknown)
+- (NSTimeInterval)pingTime;
+- (NSTimeInterval)responseTime; // first block after getdata
+- (double)throughput; // bytes per second while blocks are requested
+- (WSTrafficStats *)trafficStats; // snapshot, since connection
+
 // protocol
 - (void)sendInvMessageWithInventory:(WSInventory *)inventory;
 - (void)sendInvMessageWithInventories:(NSArray *)inventories; // WSInventory
@@ -98,6 +106,8 @@ typedef enum {
 - (void)sendMempoolMessage;
 - (void)sendPingMessage;
 - (void)sendFilterloadMessageWithFilter:(WSBloomFilter *)filter;
+- (void)sendGetcfheadersMessageWithStartHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash; // basic filters
+- (void)sendGetcfiltersMessageWithStartHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash; // basic filters
 
 // for testing, needs BSPV_TEST_MESSAGE_QUEUE to work
 - (id<WSMessage>)dequeueMessageSynchronouslyWithTimeout:(NSUInteger)timeout;
@@ -119,6 +129,8 @@ typedef enum {
 - (BOOL)peer:(WSPeer *)peer shouldAddTransaction:(WSSignedTransaction *)transaction toFilteredBlock:(WSFilteredBlock *)filteredBlock;
 - (void)peer:(WSPeer *)peer didReceiveFilteredBlock:(WSFilteredBlock *)filteredBlock withTransactions:(NSOrderedSet *)transactions; // WSSignedTransaction
 - (void)peer:(WSPeer *)peer didReceiveTransaction:(WSSignedTransaction *)transaction;
+- (void)peer:(WSPeer *)peer didReceiveFilterHeaders:(WSMessageCfheaders *)message;
+- (void)peer:(WSPeer *)peer didReceiveFilter:(WSMessageCfilter *)message;
 
 - (void)peer:(WSPeer *)peer didReceiveAddresses:(NSArray *)addresses isLastRelay:(BOOL)isLastRelay; // WSNetworkAddress
 - (void)peer:(WSPeer *)peer didReceivePongMesage:(WSMessagePong *)pong;
@@ -34,6 +34,8 @@
 #import "WSBlockLocator.h"
 #import "WSInventory.h"
 #import "WSTransaction.h"
+#import "WSBIP158.h"
+#import "WSTrafficStats.h"
 #import "WSConfig.h"
 #import "WSLogging.h"
 #import "WSMacrosCore.h"
@@ -60,6 +62,20 @@
 
 #pragma mark -
 
+@interface WSPeerBlockRequest : NSObject
+
+@property (nonatomic, assign) NSTimeInterval requestTime;
+@property (nonatomic, assign) NSUInteger count;
+@property (nonatomic, assign) BOOL didRespond;
+
+@end
+
+@implementation WSPeerBlockRequest
+
+@end
+
+#pragma mark -
+
 @interface WSPeer () {
     WSPeerStatus _peerStatus;
     BOOL _didReceiveVerack;
@@ -73,6 +89,18 @@
     NSTimeInterval _connectionTime;
     NSTimeInterval _lastSeenTimestamp;
     WSMessageVersion *_receivedVersion;
+
+    // metrics
+    uint64_t _pingNonce;
+    NSTimeInterval _pingStartTime;
+    NSTimeInterval _pingTime;
+    NSTimeInterval _responseTime;
+    double _throughput;
+    NSTimeInterval _throughputStartTime;
+    NSUInteger _throughputLength;
+    NSMutableArray *_pendingBlockRequests; // WSPeerBlockRequest
+    NSMutableArray *_pendingHeadersRequests; // NSNumber (request time)
+    WSTrafficStats *_trafficStats;
 }
 
 // set on creation
@@ -84,6 +112,9 @@
 // set on [WSConnectionProcessor openedConnectionToHost:port:handler:]
 @property (nonatomic, strong) id<WSConnectionHandler> handler;
 
+// flow control (handler queue)
+@property (nonatomic, strong) NSMutableArray *deferredSends; // void (^)(void)
+
 // stateful messages
 @property (nonatomic, strong) WSFilteredBlock *currentFilteredBlock;
 @property (nonatomic, strong) NSMutableOrderedSet *currentFilteredTransactions;
@@ -105,6 +136,17 @@
 - (void)receivePongMessage:(WSMessagePong *)message;
 - (void)receiveMerkleblockMessage:(WSMessageMerkleblock *)message;
 - (void)receiveRejectMessage:(WSMessageReject *)message;
+- (void)receiveCfheadersMessage:(WSMessageCfheaders *)message;
+- (void)receiveCfilterMessage:(WSMessageCfilter *)message;
+
+// metrics
+- (void)resetMetrics;
+- (void)trackHeadersRequest;
+- (void)trackBlockRequestWithCount:(NSUInteger)count;
+- (void)trackSentMessage:(id<WSMessage>)message length:(NSUInteger)length;
+- (void)trackReceivedMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime;
+- (void)trackNotfoundBlocksWithCount:(NSUInteger)count;
+- (void)trackPongWithNonce:(uint64_t)nonce;
 
 // stateful messages
 - (void)beginFilteredBlock:(WSFilteredBlock *)filteredBlock;
@@ -113,6 +155,8 @@
 
 // helpers
 - (void)unsafeSendMessage:(id<WSMessage>)message;
+- (void)unsafeSendOrDeferBlock:(void (^)(void))block;
+- (void)unsafeFlushDeferredSends;
 - (void)safelyDelegateBlock:(void (^)(void))block;
 - (BOOL)tryFinishHandshake;
 
@@ -141,6 +185,7 @@
         _remotePort = [self.parameters peerPort];
 
         self.identifier = [NSString stringWithFormat:@"(%@:%u)", _remoteHost, _remotePort];
+        self.deferredSends = [[NSMutableArray alloc] init];
 
 #ifdef BSPV_TEST_MESSAGE_QUEUE
         self.messageQueueCondition = [[NSCondition alloc] init];
@@ -197,6 +242,7 @@
 
     @synchronized (self) {
         self.handler = handler;
+        self.deferredSends = [[NSMutableArray alloc] init];
 
         _peerStatus = WSPeerStatusConnecting;
         _didReceiveVerack = NO;
@@ -208,13 +254,14 @@
         _lastSeenTimestamp = NSTimeIntervalSince1970;
         _receivedVersion = nil;
     }
+    [self resetMetrics];
 
     DDLogDebug(@"%@ Connection opened", self);
 
     [self sendVersionMessageWithRelayTransactions:(uint8_t)!self.needsBloomFiltering];
 }
 
-- (void)processMessage:(id<WSMessage>)message
+- (void)processMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime
 {
     [self safelyDelegateBlock:^{
         [self.delegate peer:self didReceiveNumberOfBytes:message.length];
@@ -231,23 +278,83 @@
                          self, [message class], (unsigned long)WSMessageHeaderLength, (unsigned long)message.originalLength);
         }
         
+        [self trackReceivedMessage:message decodeTime:decodeTime];
+
         // stop reading txs for current merkleblock
-        if (self.currentFilteredBlock && ![message isKindOfClass:[WSMessageTx class]]) {
+        if (self.currentFilteredBlock && (message.messageCommand != WSMessageCommandTx)) {
             [self endCurrentFilteredBlock];
         }
 
-        SEL selector = NSSelectorFromString([NSString stringWithFormat:@"receive%@Message:", [message.messageType capitalizedString]]);
-        if ([self respondsToSelector:selector]) {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Warc-performSelector-leaks"
-            
-            [self performSelector:selector withObject:message];
-            
-#pragma clang diagnostic pop
-        }
-        else {
-            DDLogDebug(@"%@ Unhandled message '%@'", self, message.messageType);
+        switch (message.messageCommand) {
+            case WSMessageCommandVersion: {
+                [self receiveVersionMessage:(WSMessageVersion *)message];
+                break;
+            }
+            case WSMessageCommandVerack: {
+                [self receiveVerackMessage:(WSMessageVerack *)message];
+                break;
+            }
+            case WSMessageCommandAddr: {
+                [self receiveAddrMessage:(WSMessageAddr *)message];
+                break;
+            }
+            case WSMessageCommandInv: {
+                [self receiveInvMessage:(WSMessageInv *)message];
+                break;
+            }
+            case WSMessageCommandGetdata: {
+                [self receiveGetdataMessage:(WSMessageGetdata *)message];
+                break;
+            }
+            case WSMessageCommandNotfound: {
+                [self receiveNotfoundMessage:(WSMessageNotfound *)message];
+                break;
+            }
+            case WSMessageCommandTx: {
+                [self receiveTxMessage:(WSMessageTx *)message];
+                break;
+            }
+            case WSMessageCommandBlock: {
+                [self receiveBlockMessage:(WSMessageBlock *)message];
+                break;
+            }
+            case WSMessageCommandHeaders: {
+                [self receiveHeadersMessage:(WSMessageHeaders *)message];
+                break;
+            }
+            case WSMessageCommandPing: {
+                [self receivePingMessage:(WSMessagePing *)message];
+                break;
+            }
+            case WSMessageCommandPong: {
+                [self receivePongMessage:(WSMessagePong *)message];
+                break;
+            }
+            case WSMessageCommandReject: {
+                [self receiveRejectMessage:(WSMessageReject *)message];
+                break;
+            }
+            case WSMessageCommandMerkleblock: {
+                [self receiveMerkleblockMessage:(WSMessageMerkleblock *)message];
+                break;
+            }
+            case WSMessageCommandCfilter: {
+                [self receiveCfilterMessage:(WSMessageCfilter *)message];
+                break;
+            }
+            case WSMessageCommandCfheaders: {
+                [self receiveCfheadersMessage:(WSMessageCfheaders *)message];
+                break;
+            }
+            case WSMessageCommandUnknown:
+            case WSMessageCommandMax: {
+                DDLogDebug(@"%@ Unhandled message '%@'", self, message.messageType);
+                break;
+            }
         }
+
+        // responses usually mean the remote end is reading again, drains are notified separately
+        [self unsafeFlushDeferredSends];
         
 #ifdef BSPV_TEST_MESSAGE_QUEUE
         [self.messageQueueCondition lock];
@@ -258,6 +365,16 @@
     }];
 }
 
+- (void)drainedOutputWithBacklogLength:(NSUInteger)backlogLength
+{
+    [self.handler submitBlock:^{
+        DDLogVerbose(@"%@ Output drained (%lu bytes left)", self, (unsigned long)backlogLength);
+
+        // don't wait for the remote end to talk before resuming requests
+        [self unsafeFlushDeferredSends];
+    }];
+}
+
 - (void)closedConnectionWithError:(NSError *)error
 {
     DDLogDebug(@"%@ Connection closed%@", self, WSStringOptional(error, @" (%@)"));
@@ -363,6 +480,34 @@
     }
 }
 
+- (NSTimeInterval)pingTime
+{
+    @synchronized (self) {
+        return _pingTime;
+    }
+}
+
+- (NSTimeInterval)responseTime
+{
+    @synchronized (self) {
+        return _responseTime;
+    }
+}
+
+- (double)throughput
+{
+    @synchronized (self) {
+        return _throughput;
+    }
+}
+
+- (WSTrafficStats *)trafficStats
+{
+    @synchronized (self) {
+        return [_trafficStats copy];
+    }
+}
+
 //
 // VERY IMPORTANT: since the delegate (peer group) is the master peer controller, let it also do the
 // clean up in didDisconnectWithError.
@@ -456,24 +601,29 @@
     WSExceptionCheckIllegal(inventories.count > 0);
 
     [self.handler submitBlock:^{
-        NSMutableArray *blockHashes = [[NSMutableArray alloc] initWithCapacity:inventories.count];
-        BOOL willRequestFilteredBlocks = NO;
-
-        for (WSInventory *inv in inventories) {
-            if ([inv isBlockInventory]) {
-                [blockHashes addObject:inv.inventoryHash];
-
-                // enforce ping as non-tx separator after merkleblock + tx messages
-                if (inv.inventoryType == WSInventoryTypeFilteredBlock) {
-                    willRequestFilteredBlocks = YES;
+        [self unsafeSendOrDeferBlock:^{
+            NSMutableArray *blockHashes = [[NSMutableArray alloc] initWithCapacity:inventories.count];
+            BOOL willRequestFilteredBlocks = NO;
+
+            for (WSInventory *inv in inventories) {
+                if ([inv isBlockInventory]) {
+                    [blockHashes addObject:inv.inventoryHash];
+
+                    // enforce ping as non-tx separator after merkleblock + tx messages
+                    if (inv.inventoryType == WSInventoryTypeFilteredBlock) {
+                        willRequestFilteredBlocks = YES;
+                    }
                 }
             }
-        }
 
-        [self unsafeSendMessage:[WSMessageGetdata messageWithParameters:self.parameters inventories:inventories]];
-        if (willRequestFilteredBlocks) {
-            [self unsafeSendMessage:[WSMessagePing messageWithParameters:self.parameters]];
-        }
+            [self unsafeSendMessage:[WSMessageGetdata messageWithParameters:self.parameters inventories:inventories]];
+            if (blockHashes.count > 0) {
+                [self trackBlockRequestWithCount:blockHashes.count];
+            }
+            if (willRequestFilteredBlocks) {
+                [self unsafeSendMessage:[WSMessagePing messageWithParameters:self.parameters]];
+            }
+        }];
     }];
 }
 
@@ -501,6 +651,7 @@
     
     [self.handler submitBlock:^{
         [self unsafeSendMessage:[WSMessageGetheaders messageWithParameters:self.parameters version:WSPeerProtocol locator:locator hashStop:hashStop]];
+        [self trackHeadersRequest];
     }];
 }
 
@@ -509,7 +660,9 @@
     WSExceptionCheckIllegal(transaction);
 
     [self.handler submitBlock:^{
-        [self unsafeSendMessage:[WSMessageTx messageWithParameters:self.parameters transaction:transaction]];
+        [self unsafeSendOrDeferBlock:^{
+            [self unsafeSendMessage:[WSMessageTx messageWithParameters:self.parameters transaction:transaction]];
+        }];
     }];
 }
 
@@ -532,7 +685,13 @@
     [self.handler submitBlock:^{
         NSAssert(self->_nonce, @"Nonce not set, is handshake complete?");
 
-        [self unsafeSendMessage:[WSMessagePing messageWithParameters:self.parameters]];
+        // separator pings would measure queued blocks, track explicit pings only
+        WSMessagePing *ping = [WSMessagePing messageWithParameters:self.parameters];
+        @synchronized (self) {
+            self->_pingNonce = ping.nonce;
+            self->_pingStartTime = [NSDate timeIntervalSinceReferenceDate];
+        }
+        [self unsafeSendMessage:ping];
     }];
 }
 
@@ -552,6 +711,24 @@
     }];
 }
 
+- (void)sendGetcfheadersMessageWithStartHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash
+{
+    WSExceptionCheckIllegal(stopHash);
+
+    [self.handler submitBlock:^{
+        [self unsafeSendMessage:[WSMessageGetcfheaders messageWithParameters:self.parameters filterType:WSBIP158FilterTypeBasic startHeight:startHeight stopHash:stopHash]];
+    }];
+}
+
+- (void)sendGetcfiltersMessageWithStartHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash
+{
+    WSExceptionCheckIllegal(stopHash);
+
+    [self.handler submitBlock:^{
+        [self unsafeSendMessage:[WSMessageGetcfilters messageWithParameters:self.parameters filterType:WSBIP158FilterTypeBasic startHeight:startHeight stopHash:stopHash]];
+    }];
+}
+
 #pragma mark Protocol: receive* (connection queue)
 
 //
@@ -633,6 +810,16 @@
 - (void)receiveNotfoundMessage:(WSMessageNotfound *)message
 {
     DDLogDebug(@"%@ Got 'notfound' with %lu items", self, (unsigned long)message.inventories.count);
+
+    NSUInteger count = 0;
+    for (WSInventory *inv in message.inventories) {
+        if ([inv isBlockInventory]) {
+            ++count;
+        }
+    }
+    if (count > 0) {
+        [self trackNotfoundBlocksWithCount:count];
+    }
 }
 
 - (void)receiveTxMessage:(WSMessageTx *)message
@@ -672,12 +859,10 @@
         return;
     }
     
-    for (WSBlockHeader *header in message.headers) {
-        NSError *error;
-        if (![header verifyWithError:&error]) {
-            [self.handler disconnectWithError:error];
-            return;
-        }
+    NSError *error;
+    if (![WSBlockHeader verifyHeaders:headers error:&error]) {
+        [self.handler disconnectWithError:error];
+        return;
     }
 
     [self safelyDelegateBlock:^{
@@ -692,6 +877,8 @@
 
 - (void)receivePongMessage:(WSMessagePong *)message
 {
+    [self trackPongWithNonce:message.nonce];
+
     [self safelyDelegateBlock:^{
         [self.delegate peer:self didReceivePongMesage:message];
     }];
@@ -715,6 +902,30 @@
     }];
 }
 
+- (void)receiveCfheadersMessage:(WSMessageCfheaders *)message
+{
+    if (message.filterType != WSBIP158FilterTypeBasic) {
+        DDLogDebug(@"%@ Ignored filter headers of unknown type %u", self, message.filterType);
+        return;
+    }
+
+    [self safelyDelegateBlock:^{
+        [self.delegate peer:self didReceiveFilterHeaders:message];
+    }];
+}
+
+- (void)receiveCfilterMessage:(WSMessageCfilter *)message
+{
+    if (!message.filter) {
+        DDLogDebug(@"%@ Ignored filter of unknown type %u", self, message.filterType);
+        return;
+    }
+
+    [self safelyDelegateBlock:^{
+        [self.delegate peer:self didReceiveFilter:message];
+    }];
+}
+
 #pragma mark Complex messages
 
 - (void)beginFilteredBlock:(WSFilteredBlock *)filteredBlock
@@ -768,6 +979,163 @@
     }];
 }
 
+#pragma mark Metrics (handler queue)
+
+- (void)resetMetrics
+{
+    @synchronized (self) {
+        _pingNonce = 0;
+        _pingStartTime = 0.0;
+        _pingTime = DBL_MAX;
+        _responseTime = DBL_MAX;
+        _throughput = 0.0;
+        _throughputStartTime = 0.0;
+        _throughputLength = 0;
+        _pendingBlockRequests = [[NSMutableArray alloc] init];
+        _pendingHeadersRequests = [[NSMutableArray alloc] init];
+        _trafficStats = [[WSTrafficStats alloc] init];
+    }
+}
+
+- (void)trackHeadersRequest
+{
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    @synchronized (self) {
+
+        // headers responses come in request order, unanswered ones expire
+        while ((_pendingHeadersRequests.count > 0) && (now - [_pendingHeadersRequests[0] doubleValue] >= WSPeerRequestTimeout)) {
+            [_pendingHeadersRequests removeObjectAtIndex:0];
+        }
+        [_pendingHeadersRequests addObject:@(now)];
+    }
+}
+
+- (void)trackBlockRequestWithCount:(NSUInteger)count
+{
+    NSParameterAssert(count > 0);
+
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    WSPeerBlockRequest *request = [[WSPeerBlockRequest alloc] init];
+    request.requestTime = now;
+    request.count = count;
+
+    @synchronized (self) {
+
+        // expire requests the peer silently dropped, oldest first
+        NSUInteger expired = 0;
+        while ((expired < _pendingBlockRequests.count) &&
+               (now - [_pendingBlockRequests[expired] requestTime] >= WSPeerRequestTimeout)) {
+
+            ++expired;
+        }
+        if (expired > 0) {
+            DDLogDebug(@"%@ Expired %lu unanswered block requests", self, (unsigned long)expired);
+
+            [_pendingBlockRequests removeObjectsInRange:NSMakeRange(0, expired)];
+            if (_pendingBlockRequests.count == 0) {
+                _throughputStartTime = 0.0;
+            }
+        }
+
+        [_pendingBlockRequests addObject:request];
+    }
+}
+
+- (void)trackSentMessage:(id<WSMessage>)message length:(NSUInteger)length
+{
+    @synchronized (self) {
+        [_trafficStats trackSentMessage:message length:length];
+    }
+}
+
+- (void)trackReceivedMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime
+{
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    @synchronized (self) {
+        [_trafficStats trackReceivedMessage:message decodeTime:decodeTime];
+
+        if ((message.messageCommand == WSMessageCommandHeaders) && (_pendingHeadersRequests.count > 0)) {
+            [_trafficStats trackLatency:(now - [_pendingHeadersRequests[0] doubleValue]) forRequestType:WSMessageType_GETHEADERS];
+            [_pendingHeadersRequests removeObjectAtIndex:0];
+        }
+
+        if (_pendingBlockRequests.count == 0) {
+            return;
+        }
+
+        // throughput is only meaningful while blocks are being requested
+        if (_throughputStartTime == 0.0) {
+            _throughputStartTime = now;
+            _throughputLength = 0;
+        }
+        else {
+            _throughputLength += WSMessageHeaderLength + message.originalLength;
+        }
+
+        const WSMessageCommand command = message.messageCommand;
+        if ((command == WSMessageCommandBlock) || (command == WSMessageCommandMerkleblock)) {
+            WSPeerBlockRequest *request = _pendingBlockRequests[0];
+            if (!request.didRespond) {
+                const NSTimeInterval latency = now - request.requestTime;
+                _responseTime = ((_responseTime == DBL_MAX) ? latency : (7.0 * _responseTime + latency) / 8.0);
+                [_trafficStats trackLatency:latency forRequestType:WSMessageType_GETDATA];
+                request.didRespond = YES;
+            }
+            if (--request.count == 0) {
+                [_pendingBlockRequests removeObjectAtIndex:0];
+            }
+        }
+
+        const NSTimeInterval elapsed = now - _throughputStartTime;
+        if ((elapsed >= WSPeerThroughputSampleInterval) || ((_pendingBlockRequests.count == 0) && (elapsed > 0.0))) {
+            const double throughput = _throughputLength / elapsed;
+            _throughput = ((_throughput == 0.0) ? throughput : (7.0 * _throughput + throughput) / 8.0);
+            _throughputStartTime = ((_pendingBlockRequests.count > 0) ? now : 0.0);
+            _throughputLength = 0;
+        }
+    }
+}
+
+- (void)trackNotfoundBlocksWithCount:(NSUInteger)count
+{
+    @synchronized (self) {
+        while ((count > 0) && (_pendingBlockRequests.count > 0)) {
+            WSPeerBlockRequest *request = _pendingBlockRequests[0];
+            const NSUInteger missing = MIN(count, request.count);
+
+            request.count -= missing;
+            count -= missing;
+            if (request.count == 0) {
+                [_pendingBlockRequests removeObjectAtIndex:0];
+            }
+        }
+        if (_pendingBlockRequests.count == 0) {
+            _throughputStartTime = 0.0;
+        }
+    }
+}
+
+- (void)trackPongWithNonce:(uint64_t)nonce
+{
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+
+    @synchronized (self) {
+        if ((_pingStartTime == 0.0) || (nonce != _pingNonce)) {
+            return;
+        }
+
+        const NSTimeInterval rtt = now - _pingStartTime;
+        _pingTime = ((_pingTime == DBL_MAX) ? rtt : (7.0 * _pingTime + rtt) / 8.0);
+        [_trafficStats trackLatency:rtt forRequestType:WSMessageType_PING];
+        _pingStartTime = 0.0;
+
+        DDLogDebug(@"%@ Ping time %.3fs (smoothed: %.3fs)", self, rtt, _pingTime);
+    }
+}
+
 #pragma mark Helpers
 
 - (void)unsafeSendMessage:(id<WSMessage>)message
@@ -779,13 +1147,39 @@
 //        }
 //    }
 
-    [self.handler writeMessage:message];
+    const NSUInteger length = [self.handler writeMessage:message];
+    if (length == 0) {
+        return;
+    }
+    [self trackSentMessage:message length:length];
 
     [self safelyDelegateBlock:^{
-        [self.delegate peer:self didSendNumberOfBytes:message.length];
+        [self.delegate peer:self didSendNumberOfBytes:length];
     }];
 }
 
+// bulk requests and relays wait while the socket can't keep up, in order
+- (void)unsafeSendOrDeferBlock:(void (^)(void))block
+{
+    NSParameterAssert(block);
+
+    [self.deferredSends addObject:[block copy]];
+    [self unsafeFlushDeferredSends];
+}
+
+- (void)unsafeFlushDeferredSends
+{
+    while ((self.deferredSends.count > 0) && ([self.handler outputBacklogLength] < WSPeerOutputBacklogHighWaterMark)) {
+        void (^block)(void) = self.deferredSends[0];
+        [self.deferredSends removeObjectAtIndex:0];
+        block();
+    }
+    if (self.deferredSends.count > 0) {
+        DDLogDebug(@"%@ Output backlogged (%lu bytes), deferring %lu sends",
+                   self, (unsigned long)[self.handler outputBacklogLength], (unsigned long)self.deferredSends.count);
+    }
+}
+
 - (void)safelyDelegateBlock:(void (^)(void))block
 {
     if (!self.delegate || !self.delegateQueue) {
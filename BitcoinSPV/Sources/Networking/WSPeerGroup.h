@@ -32,6 +32,8 @@
 
 @class WSParameters;
 @class WSConnectionPool;
+@class WSConnectionReactor;
+@class WSTrafficStats;
 @protocol WSPeerGroupDownloader;
 @protocol WSPeerGroupDownloadDelegate;
 
@@ -44,6 +46,7 @@
 - (NSString *)userAgent;
 - (uint32_t)lastBlockHeight;
 - (BOOL)isDownloadPeer;
+- (WSTrafficStats *)trafficStats;
 
 @end
 
@@ -60,6 +63,7 @@
 - (NSArray *)recentBlocks;
 - (NSUInteger)sentBytes;
 - (NSUInteger)receivedBytes;
+- (WSTrafficStats *)trafficStats; // all peers since group creation
 - (NSArray *)peersInfo;
 - (WSPeerInfo *)downloadPeerInfo;
 
@@ -83,9 +87,12 @@
 @property (nonatomic, assign) NSTimeInterval reconnectionDelayOnFailure;    // 10.0
 @property (nonatomic, assign) NSTimeInterval seedTTL;                       // 600.0 (10 minutes)
 @property (nonatomic, assign) BOOL needsBloomFiltering;                     // NO
+@property (nonatomic, copy) NSString *addressesPath;                        // nil (not persistent)
+@property (nonatomic, assign) NSTimeInterval trafficLogInterval;            // 0.0 (disabled)
 
 // WARNING: queue must be of type DISPATCH_QUEUE_SERIAL
-- (instancetype)initWithParameters:(WSParameters *)parameters;
+- (instancetype)initWithParameters:(WSParameters *)parameters; // shared reactor on Linux, NSStream handlers elsewhere
+- (instancetype)initWithParameters:(WSParameters *)parameters reactor:(WSConnectionReactor *)reactor; // nil for NSStream handlers
 - (instancetype)initWithParameters:(WSParameters *)parameters pool:(WSConnectionPool *)pool queue:(dispatch_queue_t)queue;
 
 // connection
@@ -145,6 +152,10 @@
 - (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveTransaction:(WSSignedTransaction *)transaction;
 - (BOOL)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer shouldAcceptHeader:(WSBlockHeader *)header error:(NSError **)error;
 
+@optional
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveFilterHeaders:(WSMessageCfheaders *)message;
+- (void)peerGroup:(WSPeerGroup *)peerGroup peer:(WSPeer *)peer didReceiveFilter:(WSMessageCfilter *)message;
+
 @end
 
 //
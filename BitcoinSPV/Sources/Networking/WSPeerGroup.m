@@ -29,6 +29,7 @@
 #import "WSPeerGroup.h"
 #import "WSPeerGroup+Download.h"
 #import "WSConnectionPool.h"
+#import "WSConnectionReactor.h"
 #import "WSBlockChainDownloader.h"
 #import "WSHash256.h"
 #import "WSPeer.h"
@@ -43,6 +44,8 @@
 #import "WSBlockLocator.h"
 #import "WSInventory.h"
 #import "WSNetworkAddress.h"
+#import "WSAddressManager.h"
+#import "WSTrafficStats.h"
 #import "WSConfig.h"
 #import "WSLogging.h"
 #import "WSBitcoinConstants.h"
@@ -56,6 +59,7 @@
 @property (nonatomic, strong) NSString *userAgent;
 @property (nonatomic, assign) uint32_t lastBlockHeight;
 @property (nonatomic, assign) BOOL isDownloadPeer;
+@property (nonatomic, strong) WSTrafficStats *trafficStats;
 
 @end
 
@@ -76,6 +80,7 @@
 @property (nonatomic, strong) NSArray *recentBlocks;
 @property (nonatomic, assign) NSUInteger sentBytes;
 @property (nonatomic, assign) NSUInteger receivedBytes;
+@property (nonatomic, strong) WSTrafficStats *trafficStats;
 @property (nonatomic, strong) NSArray *peersInfo;
 @property (nonatomic, weak) WSPeerInfo *downloadPeerInfo;
 
@@ -98,13 +103,15 @@
 @property (nonatomic, assign) BOOL keepConnected;
 @property (nonatomic, assign) NSUInteger numberOfActiveResolutions;
 @property (nonatomic, strong) NSMutableDictionary *ttlBySeed;               // NSString -> NSDate (background DNS thread)
-@property (nonatomic, strong) NSMutableOrderedSet *inactiveAddresses;       // WSNetworkAddress
+@property (nonatomic, strong) WSAddressManager *addressManager;
 @property (nonatomic, strong) NSMutableDictionary *pendingPeers;            // NSString -> WSPeer
 @property (nonatomic, strong) NSMutableDictionary *connectedPeers;          // NSString -> WSPeer
 @property (nonatomic, strong) NSMutableSet *misbehavingHosts;               // NSString
 @property (nonatomic, assign) NSUInteger connectionFailures;
 @property (nonatomic, assign) NSUInteger sentBytes;
 @property (nonatomic, assign) NSUInteger receivedBytes;
+@property (nonatomic, strong) WSTrafficStats *disconnectedTrafficStats;
+@property (nonatomic, assign) BOOL isLoggingTraffic;
 @property (nonatomic, strong) NSMutableDictionary *pendingTransactions;     // WSHash256 -> WSSignedTransaction
 @property (nonatomic, strong) NSMutableDictionary *pendingPeerHostsByTxId;  // WSHash256 -> NSMutableSet<NSString>
 
@@ -113,11 +120,14 @@
 - (void)connect;
 - (void)disconnect;
 - (void)discoverNewHostsWithResolutionCallback:(void (^)(NSString *, NSArray *))resolutionCallback failure:(void (^)(NSError *))failure;
-- (void)triggerConnectionsFromInactive;
+- (NSUInteger)triggerConnectionsFromInactive;
 - (void)openConnectionToPeerHost:(NSString *)host;
 - (void)handleConnectionFailureFromPeer:(WSPeer *)peer error:(NSError *)error;
 - (void)reconnectAfterDelay:(NSTimeInterval)delay;
-- (void)removeInactiveHost:(NSString *)host;
+- (WSTrafficStats *)unsafeTrafficStats;
+- (void)scheduleTrafficLog;
+- (void)tryLoadAddresses;
+- (void)trySaveAddresses;
 - (BOOL)findAndRemovePublishedTransaction:(WSSignedTransaction *)transaction fromPeer:(WSPeer *)peer;
 - (BOOL)findAndRemoveRejectedTransactionWithId:(WSHash256 *)txId fromPeer:(WSPeer *)peer;
 + (BOOL)isHardNetworkError:(NSError *)error;
@@ -132,7 +142,16 @@
 
 - (instancetype)initWithParameters:(WSParameters *)parameters
 {
-    WSConnectionPool *pool = [[WSConnectionPool alloc] initWithParameters:parameters];
+#if defined(__linux__)
+    return [self initWithParameters:parameters reactor:[WSConnectionReactor sharedReactor]];
+#else
+    return [self initWithParameters:parameters reactor:nil];
+#endif
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters reactor:(WSConnectionReactor *)reactor
+{
+    WSConnectionPool *pool = [[WSConnectionPool alloc] initWithParameters:parameters reactor:reactor];
     NSString *className = [self.class description];
     dispatch_queue_t queue = dispatch_queue_create(className.UTF8String, DISPATCH_QUEUE_SERIAL);
 
@@ -162,9 +181,11 @@
         self.reconnectionDelayOnFailure = WSPeerGroupDefaultReconnectionDelay;
         self.seedTTL = 10 * WSDatesOneMinute;
         self.needsBloomFiltering = NO;
+        self.trafficLogInterval = 0.0;
         
         self.keepConnected = NO;
-        self.inactiveAddresses = [[NSMutableOrderedSet alloc] init];
+        self.disconnectedTrafficStats = [[WSTrafficStats alloc] init];
+        self.addressManager = [[WSAddressManager alloc] initWithParameters:self.parameters];
         self.pendingPeers = [[NSMutableDictionary alloc] init];
         self.connectedPeers = [[NSMutableDictionary alloc] init];
         self.misbehavingHosts = [[NSMutableSet alloc] init];
@@ -197,7 +218,9 @@
 {
     dispatch_sync(self.queue, ^{
         self.keepConnected = YES;
+        [self tryLoadAddresses];
         [self connect];
+        [self scheduleTrafficLog];
     });
     return YES;
 }
@@ -207,6 +230,7 @@
     dispatch_sync(self.queue, ^{
         self.keepConnected = NO;
         [self disconnect];
+        [self trySaveAddresses];
     });
     return YES;
 }
@@ -220,6 +244,7 @@
     dispatch_sync(self.queue, ^{
         self.keepConnected = NO;
         [self disconnect];
+        [self trySaveAddresses];
 
         if ([self unsafeIsConnected]) {
             __weak NSNotificationCenter *nc = [NSNotificationCenter defaultCenter];
@@ -423,6 +448,7 @@
         
         status.sentBytes = self.sentBytes;
         status.receivedBytes = self.receivedBytes;
+        status.trafficStats = [self unsafeTrafficStats];
 
         NSMutableArray *peersInfo = [[NSMutableArray alloc] initWithCapacity:self.connectedPeers.count];
         for (WSPeer *peer in [self.connectedPeers allValues]) {
@@ -432,6 +458,7 @@
             info.userAgent = peer.userAgent;
             info.lastBlockHeight = peer.lastBlockHeight;
             info.isDownloadPeer = [self.downloader isPeerDownloadPeer:peer];
+            info.trafficStats = peer.trafficStats;
             if (info.isDownloadPeer) {
                 status.downloadPeerInfo = info;
             }
@@ -489,6 +516,7 @@
 {
     dispatch_sync(self.queue, ^{
         [self.downloader saveState];
+        [self trySaveAddresses];
     });
 }
 
@@ -496,7 +524,7 @@
 
 - (void)peerDidConnect:(WSPeer *)peer
 {
-    [self removeInactiveHost:peer.remoteHost];
+    [self.addressManager markSuccessWithHost:peer.remoteHost];
     [self.pendingPeers removeObjectForKey:peer.remoteHost];
     self.connectedPeers[peer.remoteHost] = peer;
     
@@ -539,6 +567,8 @@
     DDLogInfo(@"Failed to connect to %@%@", peer,
               WSStringOptional(error, @" (%@)"));
 
+    [self.addressManager markFailureWithHost:peer.remoteHost];
+
     [self handleConnectionFailureFromPeer:peer error:error];
 }
 
@@ -546,6 +576,7 @@
 {
     [self.pendingPeers removeObjectForKey:peer.remoteHost];
     [self.connectedPeers removeObjectForKey:peer.remoteHost];
+    [self.disconnectedTrafficStats addStats:peer.trafficStats];
 
     DDLogInfo(@"Disconnected from %@ (active: %lu)%@", peer,
               (unsigned long)self.connectedPeers.count,
@@ -561,7 +592,7 @@
 
     if (error && (error.domain == WSErrorDomain)) {
         DDLogDebug(@"Disconnection due to known error (%@)", error);
-        [self removeInactiveHost:peer.remoteHost];
+        [self.addressManager markFailureWithHost:peer.remoteHost];
     }
 
     [self.downloader peerGroup:self peer:peer didDisconnectWithError:error];
@@ -670,6 +701,24 @@
     [self.downloader peerGroup:self peer:peer didReceiveTransaction:transaction];
 }
 
+- (void)peer:(WSPeer *)peer didReceiveFilterHeaders:(WSMessageCfheaders *)message
+{
+    DDLogVerbose(@"Received %lu filter hashes from %@", (unsigned long)message.filterHashes.count, peer);
+
+    if ([self.downloader respondsToSelector:@selector(peerGroup:peer:didReceiveFilterHeaders:)]) {
+        [self.downloader peerGroup:self peer:peer didReceiveFilterHeaders:message];
+    }
+}
+
+- (void)peer:(WSPeer *)peer didReceiveFilter:(WSMessageCfilter *)message
+{
+    DDLogVerbose(@"Received filter from %@: %@", peer, message.filter);
+
+    if ([self.downloader respondsToSelector:@selector(peerGroup:peer:didReceiveFilter:)]) {
+        [self.downloader peerGroup:self peer:peer didReceiveFilter:message];
+    }
+}
+
 - (void)peer:(WSPeer *)peer didReceiveAddresses:(NSArray *)addresses isLastRelay:(BOOL)isLastRelay
 {
     DDLogDebug(@"Received %lu addresses from %@", (unsigned long)addresses.count, peer);
@@ -678,7 +727,8 @@
         return;
     }
 
-    [self.inactiveAddresses addObjectsFromArray:addresses];
+    WSNetworkAddress *source = WSNetworkAddressMake(peer.remoteAddress, peer.remotePort, 0, 0);
+    [self.addressManager addAddresses:addresses source:source];
 
     if (![self unsafeHasReachedMaxAttempts]) {
         [self triggerConnectionsFromInactive];
@@ -687,9 +737,7 @@
 
 - (void)peer:(WSPeer *)peer didReceivePongMesage:(WSMessagePong *)pong
 {
-    DDLogDebug(@"Received 'pong' with nonce: %llu", pong.nonce);
-
-#warning TODO: track ping time
+    DDLogDebug(@"Received 'pong' from %@ with nonce: %llu (ping: %.3fs)", peer, pong.nonce, peer.pingTime);
 }
 
 - (void)peer:(WSPeer *)peer didReceiveDataRequestWithInventories:(NSArray *)inventories
@@ -782,8 +830,7 @@
         return;
     }
 
-    if (self.inactiveAddresses.count > 0) {
-        [self triggerConnectionsFromInactive];
+    if ([self triggerConnectionsFromInactive] > 0) {
         return;
     }
     if ((self.connectedPeers.count > 0) || (self.pendingPeers.count > 0)) {
@@ -799,7 +846,6 @@
         DDLogDebug(@"%@", newHosts);
         
         NSMutableArray *newAddresses = [[NSMutableArray alloc] initWithCapacity:newHosts.count];
-        const NSUInteger previousInactiveCount = self.inactiveAddresses.count;
         
         for (NSString *host in newHosts) {
             if (self.connectedPeers[host] || self.pendingPeers[host]) {
@@ -810,11 +856,10 @@
                                                              0,
                                                              WSCurrentTimestamp() - WSDatesOneWeek);
             [newAddresses addObject:address];
-            [self.inactiveAddresses addObject:address];
         }
 
-        if (self.inactiveAddresses.count == previousInactiveCount) {
-            DDLogDebug(@"All discovered peers are already connected or pending");
+        if ([self.addressManager addAddresses:newAddresses] == 0) {
+            DDLogDebug(@"All discovered peers are already known, connected or pending");
             return;
         }
         
@@ -918,70 +963,29 @@
     });
 }
 
-- (void)triggerConnectionsFromInactive
+- (NSUInteger)triggerConnectionsFromInactive
 {
-    NSMutableArray *triggered = [[NSMutableArray alloc] init];
-    
-    // recent first
-    [self.inactiveAddresses sortUsingComparator:^NSComparisonResult(WSNetworkAddress *a1, WSNetworkAddress *a2) {
-        if (a1.timestamp > a2.timestamp) {
-            return NSOrderedAscending;
-        }
-        else if (a1.timestamp < a2.timestamp) {
-            return NSOrderedDescending;
-        }
-        else {
-            return NSOrderedSame;
-        }
-    }];
+    NSUInteger triggered = 0;
     
-    // cap total
-    if (self.inactiveAddresses.count > WSPeerGroupMaxInactivePeers) {
-        [self.inactiveAddresses removeObjectsInRange:NSMakeRange(WSPeerGroupMaxInactivePeers, self.inactiveAddresses.count - WSPeerGroupMaxInactivePeers)];
-    }
-    
-    DDLogDebug(@"Sorted %lu inactive addresses", (unsigned long)self.inactiveAddresses.count);
-//    DDLogDebug(@">>> %@", self.inactiveAddresses);
-//
-//    // sequential
-//    for (WSNetworkAddress *address in self.inactiveAddresses) {
-//        if ([self isPendingHost:address.host] || [self.misbehavingHosts containsObject:address.host]) {
-//            continue;
-//        }
-//        if ([self unsafeHasReachedMaxAttempts]) {
-//            break;
-//        }
-//
-//        [self openConnectionToPeerHost:address.host];
-//        [triggered addObject:address];
-//    }
-//    [self.inactiveAddresses removeObjectsInArray:triggered];
-    
-    // randomic
-    while (self.inactiveAddresses.count > 0) {
-        
-        //
-        // taken from: https://github.com/voisine/breadwallet/blob/master/BreadWallet/BRPeerManager.m
-        //
-        // prefer recent from inactive (higher probability of retrieving lower offsets)
-        //
-        const NSUInteger inactiveOffset = (NSUInteger)(pow(lrand48() % self.inactiveAddresses.count, 2) / self.inactiveAddresses.count);
-        WSNetworkAddress *address = self.inactiveAddresses[inactiveOffset];
-        
-        if (self.pendingPeers[address.host] || [self.misbehavingHosts containsObject:address.host]) {
-            continue;
-        }
-        if ([self unsafeHasReachedMaxAttempts]) {
+    // weighted random pick, see WSAddressManager
+    while (![self unsafeHasReachedMaxAttempts]) {
+        WSNetworkAddress *address = [self.addressManager selectAddressPassingTest:^BOOL(WSNetworkAddress *address) {
+            NSString *host = address.host;
+            return (!self.connectedPeers[host] && !self.pendingPeers[host] && ![self.misbehavingHosts containsObject:host]);
+        }];
+        if (!address) {
             break;
         }
         
+        [self.addressManager markAttemptWithHost:address.host];
         [self openConnectionToPeerHost:address.host];
-        [triggered addObject:address];
-        
-        [self.inactiveAddresses removeObject:address];
+        ++triggered;
     }
     
-    DDLogDebug(@"Triggered %lu new connections from inactive", (unsigned long)triggered.count);
+    DDLogDebug(@"Triggered %lu new connections from inactive (available: %lu)",
+               (unsigned long)triggered, (unsigned long)self.addressManager.count);
+    
+    return triggered;
 }
 
 - (void)openConnectionToPeerHost:(NSString *)host
@@ -1026,7 +1030,7 @@
         
         if ([[self class] isHardNetworkError:error]) {
             DDLogDebug(@"Hard error from peer %@", peer.remoteHost);
-            [self removeInactiveHost:peer.remoteHost];
+            [self.addressManager removeHost:peer.remoteHost];
         }
         
         if (self.connectedPeers.count < self.maxConnections) {
@@ -1045,18 +1049,70 @@
     });
 }
 
-- (void)removeInactiveHost:(NSString *)host
+- (WSTrafficStats *)unsafeTrafficStats
 {
-    WSNetworkAddress *addressToRemove;
-    for (WSNetworkAddress *address in self.inactiveAddresses) {
-        if ([address.host isEqualToString:host]) {
-            addressToRemove = address;
+    WSTrafficStats *trafficStats = [self.disconnectedTrafficStats copy];
+    for (WSPeer *peer in [self.connectedPeers allValues]) {
+        [trafficStats addStats:peer.trafficStats];
+    }
+    return trafficStats;
+}
+
+- (void)scheduleTrafficLog
+{
+    if ((self.trafficLogInterval <= 0.0) || self.isLoggingTraffic) {
+        return;
+    }
+    self.isLoggingTraffic = YES;
+
+    const dispatch_time_t when = dispatch_time(DISPATCH_TIME_NOW, self.trafficLogInterval * NSEC_PER_SEC);
+    __weak WSPeerGroup *weakSelf = self;
+    dispatch_after(when, self.queue, ^{
+        WSPeerGroup *strongSelf = weakSelf;
+        if (!strongSelf) {
+            return;
         }
+        strongSelf.isLoggingTraffic = NO;
+        if (!strongSelf.keepConnected) {
+            return;
+        }
+
+        DDLogInfo(@"Traffic report (sent: %lu bytes, received: %lu bytes):\n%@",
+                  (unsigned long)strongSelf.sentBytes, (unsigned long)strongSelf.receivedBytes,
+                  [[strongSelf unsafeTrafficStats] reportDescription]);
+
+        for (WSPeer *peer in [strongSelf.connectedPeers allValues]) {
+            DDLogDebug(@"Traffic from %@: %@", peer, peer.trafficStats);
+        }
+
+        [strongSelf scheduleTrafficLog];
+    });
+}
+
+- (void)tryLoadAddresses
+{
+    if (!self.addressesPath || (self.addressManager.count > 0)) {
+        return;
     }
-    if (addressToRemove) {
-        [self.inactiveAddresses removeObject:addressToRemove];
-        
-        DDLogDebug(@"Removed host %@ from inactive (available: %lu)", host, (unsigned long)self.inactiveAddresses.count);
+    if (![[NSFileManager defaultManager] fileExistsAtPath:self.addressesPath]) {
+        return;
+    }
+    
+    NSError *error;
+    if (![self.addressManager loadFromPath:self.addressesPath error:&error]) {
+        DDLogError(@"Error loading addresses from %@: %@", self.addressesPath, error);
+    }
+}
+
+- (void)trySaveAddresses
+{
+    if (!self.addressesPath) {
+        return;
+    }
+    
+    NSError *error;
+    if (![self.addressManager saveToPath:self.addressesPath error:&error]) {
+        DDLogError(@"Error saving addresses to %@: %@", self.addressesPath, error);
     }
 }
 
@@ -37,4 +37,10 @@
 - (id<WSMessage>)parseMessageFromStream:(NSInputStream *)inputStream error:(NSError **)error;
 - (void)resetBuffers;
 
+// a single read may carry several messages, parse until nil
+- (BOOL)readFromStream:(NSInputStream *)inputStream;
+- (NSInteger)readFromSocket:(int)socket; // non-blocking recv(), 0 on EOF and -1 on error
+- (id<WSMessage>)parseMessageWithError:(NSError **)error;
+- (NSTimeInterval)lastDecodeTime; // checksum and payload decoding of last parsed message
+
 @end
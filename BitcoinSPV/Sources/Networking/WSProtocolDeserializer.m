@@ -23,25 +23,40 @@
 //  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#import <sys/socket.h>
+
 #import "WSProtocolDeserializer.h"
 #import "WSMessageFactory.h"
+#import "WSBuffer.h"
 #import "WSHash256.h"
 #import "WSPeer.h"
 #import "WSLogging.h"
 #import "WSMacrosCore.h"
 #import "WSErrors.h"
+#import "WSConfig.h"
+#import "NSData+Binary.h"
 
+//
+// received bytes are appended at writeOffset and consumed at readOffset,
+// unread bytes are only moved to the front when the tail runs out of room
+// (i.e. at most a partial message) and the buffer only grows to fit messages
+// longer than its capacity
+//
 @interface WSProtocolDeserializer ()
 
 @property (nonatomic, strong) WSParameters *parameters;
 @property (nonatomic, strong) NSString *host;
 @property (nonatomic, assign) uint16_t port;
 @property (nonatomic, strong) WSMessageFactory *factory;
-@property (nonatomic, strong) WSMutableBuffer *builtHeader;
-@property (nonatomic, strong) WSMutableBuffer *builtPayload;
+@property (nonatomic, strong) NSMutableData *buffer;
+@property (nonatomic, assign) NSUInteger readOffset;
+@property (nonatomic, assign) NSUInteger writeOffset;
+@property (nonatomic, assign) NSUInteger expectedMessageLength;
 @property (nonatomic, strong) NSString *identifier;
+@property (nonatomic, assign) NSTimeInterval lastDecodeTime;
 
-- (id<WSMessage>)parseMessageFromStream:(NSInputStream *)inputStream keepParsing:(BOOL *)keepParsing error:(NSError *__autoreleasing *)error;
+- (void)reserveLength:(NSUInteger)length;
+- (BOOL)synchronizeToMagicNumber;
 
 @end
 
@@ -64,8 +79,7 @@
         self.host = host;
         self.port = port;
         self.factory = [[WSMessageFactory alloc] initWithParameters:self.parameters];
-        self.builtHeader = [[WSMutableBuffer alloc] init];
-        self.builtPayload = [[WSMutableBuffer alloc] init];
+        self.buffer = [[NSMutableData alloc] initWithLength:WSProtocolDeserializerBufferCapacity];
         self.identifier = [NSString stringWithFormat:@"%@:%u", self.host, self.port];
     }
     return self;
@@ -75,135 +89,226 @@
 {
     WSExceptionCheckIllegal(inputStream);
     
-//    DDLogVerbose(@"Buffer length: %u", self.buffer.length);
-    
-    BOOL keepParsing = NO;
-    id<WSMessage> message = [self parseMessageFromStream:inputStream keepParsing:&keepParsing error:error];
-    if (!keepParsing) {
-        [self resetBuffers];
+    // previous read might have carried more messages
+    NSError *localError;
+    id<WSMessage> message = [self parseMessageWithError:&localError];
+    if (!message && !localError && [self readFromStream:inputStream]) {
+        message = [self parseMessageWithError:&localError];
+    }
+    if (localError && error) {
+        *error = localError;
     }
     return message;
 }
 
 - (void)resetBuffers
 {
-    self.builtHeader.length = 0;
-    self.builtPayload.length = 0;
+    self.readOffset = 0;
+    self.writeOffset = 0;
+    self.expectedMessageLength = 0;
+    
+    if (self.buffer.length > WSProtocolDeserializerBufferCapacity) {
+        self.buffer.length = WSProtocolDeserializerBufferCapacity;
+    }
+}
+
+- (BOOL)readFromStream:(NSInputStream *)inputStream
+{
+    WSExceptionCheckIllegal(inputStream);
+    
+    // enough room for the pending message, if longer than a single read
+    const NSUInteger available = self.writeOffset - self.readOffset;
+    const NSUInteger missing = ((self.expectedMessageLength > available) ? (self.expectedMessageLength - available) : 0);
+    [self reserveLength:MAX(WSProtocolDeserializerReadLength, missing)];
+    
+    uint8_t *freeBytes = (uint8_t *)self.buffer.mutableBytes + self.writeOffset;
+    const NSInteger actuallyRead = [inputStream read:freeBytes maxLength:(self.buffer.length - self.writeOffset)];
+    if (actuallyRead < 0) {
+        [self resetBuffers];
+        return NO;
+    }
+    
+//    DDLogVerbose(@"Actually read: %u", actuallyRead);
+    
+    self.writeOffset += actuallyRead;
+    return YES;
+}
+
+- (NSInteger)readFromSocket:(int)socket
+{
+    WSExceptionCheckIllegal(socket >= 0);
+    
+    const NSUInteger available = self.writeOffset - self.readOffset;
+    const NSUInteger missing = ((self.expectedMessageLength > available) ? (self.expectedMessageLength - available) : 0);
+    [self reserveLength:MAX(WSProtocolDeserializerReadLength, missing)];
+    
+    // buffers are kept on would-block, caller checks errno
+    uint8_t *freeBytes = (uint8_t *)self.buffer.mutableBytes + self.writeOffset;
+    const ssize_t actuallyRead = recv(socket, freeBytes, (self.buffer.length - self.writeOffset), 0);
+    if (actuallyRead > 0) {
+        self.writeOffset += actuallyRead;
+    }
+    return actuallyRead;
 }
 
 //
 // adapted from: https://github.com/voisine/breadwallet/blob/master/BreadWallet/BRPeer.m
 //
-// keepParsing: YES = read more bytes, NO = stop and reset buffers
+// returns nil with no error when more bytes are needed
 //
-- (id<WSMessage>)parseMessageFromStream:(NSInputStream *)inputStream keepParsing:(BOOL *)keepParsing error:(NSError *__autoreleasing *)error
+- (id<WSMessage>)parseMessageWithError:(NSError *__autoreleasing *)error
 {
-    NSParameterAssert(inputStream);
-    NSParameterAssert(keepParsing);
-
-    NSInteger currentHeaderLength = self.builtHeader.length;
-    NSInteger currentPayloadLength = self.builtPayload.length;
+    id<WSMessage> message = nil;
     
-    if (currentHeaderLength < WSMessageHeaderLength) {
-        self.builtHeader.length = WSMessageHeaderLength;
-        
-        uint8_t *freeHeader = (uint8_t *)self.builtHeader.mutableBytes + currentHeaderLength;
-        const NSUInteger toRead = self.builtHeader.length - currentHeaderLength;
-        const NSInteger actuallyRead = [inputStream read:freeHeader maxLength:toRead];
-        if (actuallyRead < 0) {
-            [self resetBuffers];
+    // skip unknown messages without leaving
+    while (!message) {
+        if (![self synchronizeToMagicNumber]) {
             return nil;
         }
-
-//        DDLogVerbose(@"Needed for header: %u", toRead);
-//        DDLogVerbose(@"Current buffer length: %u", available);
-//        DDLogVerbose(@"Actually read: %u", actuallyRead);
-
-        self.builtHeader.length = currentHeaderLength + actuallyRead;
         
-        // consume one byte at a time, up to the magic number that starts a new message header
-        const uint32_t magicNumber = [self.parameters magicNumber];
-        while ((self.builtHeader.length >= sizeof(uint32_t)) && ([self.builtHeader uint32AtOffset:0] != magicNumber)) {
-            [self.builtHeader replaceBytesInRange:NSMakeRange(0, 1) withBytes:NULL length:0];
+        const uint8_t *header = (const uint8_t *)self.buffer.bytes + self.readOffset;
+        const NSUInteger available = self.writeOffset - self.readOffset;
+        if (available < WSMessageHeaderLength) {
+            return nil;
         }
         
-        if (self.builtHeader.length < WSMessageHeaderLength) {
-            *keepParsing = YES;
+        // checkpoint: header is complete from here
+        
+        // ensure message type is null-terminated
+        if (header[15] != 0) {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Message type is not null-terminated (partial header: %@)",
+                       [NSData dataWithBytes:header length:WSMessageHeaderLength]);
+            [self resetBuffers];
             return nil;
         }
-    }
-    
-    // checkpoint: header is complete from here
-    
-    // ensure message type is null-terminated
-    if ([self.builtHeader uint8AtOffset:15] != 0) {
-        WSErrorSet(error, WSErrorCodeMalformed, @"Message type is not null-terminated (partial header: %@)", self.builtHeader);
-        *keepParsing = NO;
-        return nil;
-    }
-    
-    NSString *messageType = [NSString stringWithUTF8String:((const char *)self.builtHeader.bytes + 4)];
-    const uint32_t expectedPayloadLength = [self.builtHeader uint32AtOffset:16];
-    const uint32_t expectedChecksum = [self.builtHeader uint32AtOffset:20];
-    
-    if (expectedPayloadLength > WSMessageMaxLength) {
-        WSErrorSet(error, WSErrorCodeMalformed, @"Error deserializing '%@', message is too long (%u > %u)", messageType, expectedPayloadLength, WSMessageMaxLength);
-        *keepParsing = NO;
-        return nil;
-    }
-    
-    if (currentPayloadLength < expectedPayloadLength) {
-        self.builtPayload.length = expectedPayloadLength;
         
-        uint8_t *freePayload = (uint8_t *)self.builtPayload.mutableBytes + currentPayloadLength;
-        const NSUInteger toRead = self.builtPayload.length - currentPayloadLength;
-        const NSInteger actuallyRead = [inputStream read:freePayload maxLength:toRead];
-        if (actuallyRead < 0) {
+        const WSMessageCommand command = WSMessageCommandFromHeaderField(header + 4);
+        const uint32_t expectedPayloadLength = CFSwapInt32LittleToHost(*(const uint32_t *)(header + 16));
+        const uint32_t expectedChecksum = CFSwapInt32LittleToHost(*(const uint32_t *)(header + 20));
+        
+        if (expectedPayloadLength > WSMessageMaxLength) {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Error deserializing '%s', message is too long (%u > %u)",
+                       (const char *)header + 4, expectedPayloadLength, WSMessageMaxLength);
             [self resetBuffers];
             return nil;
         }
+        
+        const NSUInteger messageLength = WSMessageHeaderLength + expectedPayloadLength;
+        if (available < messageLength) {
+            self.expectedMessageLength = messageLength;
+            return nil;
+        }
+        
+        // checkpoint: payload is complete from here
+        
+        self.readOffset += messageLength;
+        self.expectedMessageLength = 0;
+        
+        if (command == WSMessageCommandUnknown) {
+            DDLogDebug(@"%@ Skipped unknown message '%s' (%u bytes)", self.identifier, (const char *)header + 4, expectedPayloadLength);
+        }
+        else {
+            const NSTimeInterval decodeStartTime = [NSDate timeIntervalSinceReferenceDate];
 
-//        DDLogVerbose(@"Needed for payload: %u", toRead);
-//        DDLogVerbose(@"Current buffer length: %u", available);
-//        DDLogVerbose(@"Actually read: %u", actuallyRead);
-
-        self.builtPayload.length = currentPayloadLength + actuallyRead;
-        if (self.builtPayload.length < expectedPayloadLength) {
-            *keepParsing = YES;
+            // borrowed from buffer, decoders copy what they retain
+            WSBuffer *payload = [[WSBuffer alloc] initWithBytesNoCopy:(header + WSMessageHeaderLength) length:expectedPayloadLength];
+            
+            WSHash256 *payloadHash256 = [payload computeHash256];
+            const uint32_t checksum = *(const uint32_t *)payloadHash256.bytes;
+            if (checksum != expectedChecksum) {
+                WSErrorSet(error, WSErrorCodeMalformed, @"Bad checksum deserializing '%s' (payload: %u, checksum: %x == %x, hash256: %@)",
+                           (const char *)header + 4, expectedPayloadLength, checksum, expectedChecksum, payloadHash256);
+                
+                [self resetBuffers];
+                return nil;
+            }
+            
+            if (ddLogLevel >= LOG_LEVEL_VERBOSE) {
+                DDLogVerbose(@"%@ Deserialized header: %@", self.identifier, [[NSData dataWithBytes:header length:WSMessageHeaderLength] hexString]);
+                if (payload.length <= 4096) {
+                    DDLogVerbose(@"%@ Deserialized payload: %@", self.identifier, [payload hexString]);
+                }
+                else {
+                    DDLogVerbose(@"%@ Deserialized payload: %lu bytes (too long to display)", self.identifier, (unsigned long)payload.length);
+                }
+            }
+            
+            message = [self.factory messageWithCommand:command payload:payload error:error];
+            self.lastDecodeTime = [NSDate timeIntervalSinceReferenceDate] - decodeStartTime;
+        }
+        
+        // rewind for free when all bytes were consumed
+        if (self.readOffset == self.writeOffset) {
+            self.readOffset = 0;
+            self.writeOffset = 0;
+        }
+        
+        // decoding error, let caller decide
+        if (!message && error && *error) {
             return nil;
         }
     }
+    return message;
+}
+
+#pragma mark Helpers
+
+- (void)reserveLength:(NSUInteger)length
+{
+    if (self.buffer.length - self.writeOffset >= length) {
+        return;
+    }
     
-    // checkpoint: payload is complete from here
+    // move unread bytes (at most a partial message) to the front
+    const NSUInteger available = self.writeOffset - self.readOffset;
+    if (self.readOffset > 0) {
+        uint8_t *bytes = self.buffer.mutableBytes;
+        memmove(bytes, bytes + self.readOffset, available);
+        self.readOffset = 0;
+        self.writeOffset = available;
+    }
     
-    const uint32_t payloadLength = (uint32_t)self.builtPayload.length;
-    WSHash256 *payloadHash256 = [self.builtPayload computeHash256];
-    const uint32_t checksum = *(const uint32_t *)payloadHash256.bytes;
-    if (checksum != expectedChecksum) {
-        WSErrorSet(error, WSErrorCodeMalformed, @"Bad checksum deserializing '%@' (payload: %u == %u, checksum: %x == %x, hash256: %@)",
-                   messageType, payloadLength, expectedPayloadLength, checksum, expectedChecksum, payloadHash256);
-
-        *keepParsing = NO;
-        return nil;
+    if (self.buffer.length - self.writeOffset < length) {
+        self.buffer.length = self.writeOffset + length;
     }
+}
+
+// NO if more bytes are needed to find magic number
+- (BOOL)synchronizeToMagicNumber
+{
+    const uint32_t magicNumber = [self.parameters magicNumber];
+    const uint8_t *bytes = self.buffer.bytes;
+    const uint8_t *start = bytes + self.readOffset;
+    const uint8_t *end = bytes + self.writeOffset;
     
-    NSAssert(self.builtHeader.length == WSMessageHeaderLength, @"Unexpected header length (%lu != %lu)",
-             (unsigned long)self.builtHeader.length,
-             (unsigned long)WSMessageHeaderLength);
+    if ((NSUInteger)(end - start) < sizeof(uint32_t)) {
+        return NO;
+    }
+    if (CFSwapInt32LittleToHost(*(const uint32_t *)start) == magicNumber) {
+        return YES;
+    }
     
-    DDLogVerbose(@"%@ Deserialized header: %@", self.identifier, [self.builtHeader hexString]);
-    if (ddLogLevel >= LOG_LEVEL_VERBOSE) {
-        if (self.builtPayload.length <= 4096) {
-            DDLogVerbose(@"%@ Deserialized payload: %@", self.identifier, [self.builtPayload hexString]);
+    // skip garbage up to the next candidate magic number, memchr is vectorized
+    const uint8_t magicFirstByte = (magicNumber & 0xff);
+    const uint8_t *candidate = start + 1;
+    while (candidate < end) {
+        candidate = memchr(candidate, magicFirstByte, end - candidate);
+        if (!candidate || ((NSUInteger)(end - candidate) < sizeof(uint32_t))) {
+            break;
         }
-        else {
-            DDLogVerbose(@"%@ Deserialized payload: %lu bytes (too long to display)", self.identifier, (unsigned long)self.builtPayload.length);
+        if (CFSwapInt32LittleToHost(*(const uint32_t *)candidate) == magicNumber) {
+            DDLogDebug(@"%@ Skipped %lu bytes before magic number", self.identifier, (unsigned long)(candidate - start));
+            self.readOffset = candidate - bytes;
+            return YES;
         }
+        ++candidate;
     }
-
-    *keepParsing = NO;
-
-    return [self.factory messageFromType:messageType payload:self.builtPayload error:error];
+    
+    // keep a possibly partial magic number at the end
+    const NSUInteger keptLength = (candidate ? (end - candidate) : 0);
+    DDLogDebug(@"%@ Skipped %lu bytes looking for magic number", self.identifier, (unsigned long)(end - start - keptLength));
+    self.readOffset = self.writeOffset - keptLength;
+    return NO;
 }
 
 @end
@@ -0,0 +1,88 @@
+//
+//  WSTrafficStats.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+@protocol WSMessage;
+
+#pragma mark -
+
+//
+// request->response latency samples, bucket i counts samples below
+// bucketBounds[i] and the last bucket counts the remaining ones
+//
+@interface WSLatencyHistogram : NSObject <NSCopying>
+
++ (NSArray *)bucketBounds; // NSNumber (seconds)
+
+- (NSUInteger)count;
+- (NSTimeInterval)minimum;
+- (NSTimeInterval)maximum;
+- (NSTimeInterval)average;
+- (NSArray *)bucketCounts; // NSNumber, bucketBounds.count + 1
+
+@end
+
+#pragma mark -
+
+@interface WSMessageTrafficStats : NSObject <NSCopying>
+
+- (NSUInteger)sentMessages;
+- (NSUInteger)sentBytes;
+- (NSUInteger)receivedMessages;
+- (NSUInteger)receivedBytes;
+- (NSTimeInterval)decodeTime; // total for received messages
+
+@end
+
+#pragma mark -
+
+//
+// per-command traffic counters, lengths include message header
+//
+// latencies are keyed by request command (e.g. getheaders, getdata, ping)
+//
+// thread-safe: no (owner must synchronize, copies are snapshots)
+//
+@interface WSTrafficStats : NSObject <NSCopying>
+
+- (instancetype)init;
+
+- (void)trackSentMessage:(id<WSMessage>)message length:(NSUInteger)length;
+- (void)trackReceivedMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime;
+- (void)trackLatency:(NSTimeInterval)latency forRequestType:(NSString *)requestType;
+- (void)addStats:(WSTrafficStats *)stats;
+- (void)reset;
+
+- (NSDictionary *)messageStats;         // NSString -> WSMessageTrafficStats
+- (NSDictionary *)latencyHistograms;    // NSString -> WSLatencyHistogram
+- (NSUInteger)sentBytes;
+- (NSUInteger)receivedBytes;
+- (NSTimeInterval)decodeTime;
+
+// multiline table sorted by received bytes
+- (NSString *)reportDescription;
+
+@end
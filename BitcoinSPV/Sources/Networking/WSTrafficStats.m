@@ -0,0 +1,339 @@
+//
+//  WSTrafficStats.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSTrafficStats.h"
+#import "WSMessage.h"
+#import "WSMacrosCore.h"
+
+static const NSUInteger WSLatencyHistogramNumberOfBounds = 8;
+static const NSTimeInterval WSLatencyHistogramBounds[] = { 0.01, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0 };
+
+@interface WSLatencyHistogram () {
+    NSUInteger _counts[WSLatencyHistogramNumberOfBounds + 1];
+}
+
+@property (nonatomic, assign) NSUInteger count;
+@property (nonatomic, assign) NSTimeInterval minimum;
+@property (nonatomic, assign) NSTimeInterval maximum;
+@property (nonatomic, assign) NSTimeInterval total;
+
+- (void)addSample:(NSTimeInterval)sample;
+- (void)addHistogram:(WSLatencyHistogram *)histogram;
+
+@end
+
+@implementation WSLatencyHistogram
+
++ (NSArray *)bucketBounds
+{
+    NSMutableArray *bounds = [[NSMutableArray alloc] initWithCapacity:WSLatencyHistogramNumberOfBounds];
+    for (NSUInteger i = 0; i < WSLatencyHistogramNumberOfBounds; ++i) {
+        [bounds addObject:@(WSLatencyHistogramBounds[i])];
+    }
+    return bounds;
+}
+
+- (NSTimeInterval)average
+{
+    return ((self.count > 0) ? (self.total / self.count) : 0.0);
+}
+
+- (NSArray *)bucketCounts
+{
+    NSMutableArray *counts = [[NSMutableArray alloc] initWithCapacity:(WSLatencyHistogramNumberOfBounds + 1)];
+    for (NSUInteger i = 0; i <= WSLatencyHistogramNumberOfBounds; ++i) {
+        [counts addObject:@(_counts[i])];
+    }
+    return counts;
+}
+
+- (void)addSample:(NSTimeInterval)sample
+{
+    NSUInteger i = 0;
+    while ((i < WSLatencyHistogramNumberOfBounds) && (sample >= WSLatencyHistogramBounds[i])) {
+        ++i;
+    }
+    ++_counts[i];
+
+    self.minimum = ((self.count == 0) ? sample : MIN(self.minimum, sample));
+    self.maximum = MAX(self.maximum, sample);
+    self.total += sample;
+    ++self.count;
+}
+
+- (void)addHistogram:(WSLatencyHistogram *)histogram
+{
+    if (histogram.count == 0) {
+        return;
+    }
+    for (NSUInteger i = 0; i <= WSLatencyHistogramNumberOfBounds; ++i) {
+        _counts[i] += histogram->_counts[i];
+    }
+
+    self.minimum = ((self.count == 0) ? histogram.minimum : MIN(self.minimum, histogram.minimum));
+    self.maximum = MAX(self.maximum, histogram.maximum);
+    self.total += histogram.total;
+    self.count += histogram.count;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"{count=%lu, min=%.3fs, avg=%.3fs, max=%.3fs, buckets=%@}",
+            (unsigned long)self.count, self.minimum, self.average, self.maximum,
+            [self.bucketCounts componentsJoinedByString:@"/"]];
+}
+
+#pragma mark NSCopying
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    WSLatencyHistogram *copy = [[self class] allocWithZone:zone];
+    copy = [copy init];
+    [copy addHistogram:self];
+    return copy;
+}
+
+@end
+
+#pragma mark -
+
+@interface WSMessageTrafficStats ()
+
+@property (nonatomic, assign) NSUInteger sentMessages;
+@property (nonatomic, assign) NSUInteger sentBytes;
+@property (nonatomic, assign) NSUInteger receivedMessages;
+@property (nonatomic, assign) NSUInteger receivedBytes;
+@property (nonatomic, assign) NSTimeInterval decodeTime;
+
+- (void)addStats:(WSMessageTrafficStats *)stats;
+
+@end
+
+@implementation WSMessageTrafficStats
+
+- (void)addStats:(WSMessageTrafficStats *)stats
+{
+    self.sentMessages += stats.sentMessages;
+    self.sentBytes += stats.sentBytes;
+    self.receivedMessages += stats.receivedMessages;
+    self.receivedBytes += stats.receivedBytes;
+    self.decodeTime += stats.decodeTime;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"{sent=%lu/%lu bytes, received=%lu/%lu bytes, decode=%.3fs}",
+            (unsigned long)self.sentMessages, (unsigned long)self.sentBytes,
+            (unsigned long)self.receivedMessages, (unsigned long)self.receivedBytes,
+            self.decodeTime];
+}
+
+#pragma mark NSCopying
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    WSMessageTrafficStats *copy = [[self class] allocWithZone:zone];
+    copy = [copy init];
+    [copy addStats:self];
+    return copy;
+}
+
+@end
+
+#pragma mark -
+
+@interface WSTrafficStats ()
+
+@property (nonatomic, strong) NSMutableDictionary *mutableMessageStats;         // NSString -> WSMessageTrafficStats
+@property (nonatomic, strong) NSMutableDictionary *mutableLatencyHistograms;    // NSString -> WSLatencyHistogram
+
+- (WSMessageTrafficStats *)statsForMessageType:(NSString *)messageType;
+- (WSLatencyHistogram *)histogramForRequestType:(NSString *)requestType;
+
+@end
+
+@implementation WSTrafficStats
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self.mutableMessageStats = [[NSMutableDictionary alloc] init];
+        self.mutableLatencyHistograms = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)trackSentMessage:(id<WSMessage>)message length:(NSUInteger)length
+{
+    WSExceptionCheckIllegal(message);
+
+    WSMessageTrafficStats *stats = [self statsForMessageType:message.messageType];
+    ++stats.sentMessages;
+    stats.sentBytes += length;
+}
+
+- (void)trackReceivedMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime
+{
+    WSExceptionCheckIllegal(message);
+
+    WSMessageTrafficStats *stats = [self statsForMessageType:message.messageType];
+    ++stats.receivedMessages;
+    stats.receivedBytes += message.length;
+    stats.decodeTime += decodeTime;
+}
+
+- (void)trackLatency:(NSTimeInterval)latency forRequestType:(NSString *)requestType
+{
+    WSExceptionCheckIllegal(requestType);
+
+    [[self histogramForRequestType:requestType] addSample:latency];
+}
+
+- (void)addStats:(WSTrafficStats *)stats
+{
+    WSExceptionCheckIllegal(stats);
+
+    [stats.mutableMessageStats enumerateKeysAndObjectsUsingBlock:^(NSString *messageType, WSMessageTrafficStats *messageStats, BOOL *stop) {
+        [[self statsForMessageType:messageType] addStats:messageStats];
+    }];
+    [stats.mutableLatencyHistograms enumerateKeysAndObjectsUsingBlock:^(NSString *requestType, WSLatencyHistogram *histogram, BOOL *stop) {
+        [[self histogramForRequestType:requestType] addHistogram:histogram];
+    }];
+}
+
+- (void)reset
+{
+    [self.mutableMessageStats removeAllObjects];
+    [self.mutableLatencyHistograms removeAllObjects];
+}
+
+- (NSDictionary *)messageStats
+{
+    return [[NSDictionary alloc] initWithDictionary:self.mutableMessageStats copyItems:YES];
+}
+
+- (NSDictionary *)latencyHistograms
+{
+    return [[NSDictionary alloc] initWithDictionary:self.mutableLatencyHistograms copyItems:YES];
+}
+
+- (NSUInteger)sentBytes
+{
+    NSUInteger sentBytes = 0;
+    for (WSMessageTrafficStats *stats in [self.mutableMessageStats allValues]) {
+        sentBytes += stats.sentBytes;
+    }
+    return sentBytes;
+}
+
+- (NSUInteger)receivedBytes
+{
+    NSUInteger receivedBytes = 0;
+    for (WSMessageTrafficStats *stats in [self.mutableMessageStats allValues]) {
+        receivedBytes += stats.receivedBytes;
+    }
+    return receivedBytes;
+}
+
+- (NSTimeInterval)decodeTime
+{
+    NSTimeInterval decodeTime = 0.0;
+    for (WSMessageTrafficStats *stats in [self.mutableMessageStats allValues]) {
+        decodeTime += stats.decodeTime;
+    }
+    return decodeTime;
+}
+
+- (NSString *)reportDescription
+{
+    NSArray *messageTypes = [self.mutableMessageStats keysSortedByValueUsingComparator:^NSComparisonResult(WSMessageTrafficStats *stats1, WSMessageTrafficStats *stats2) {
+        if (stats1.receivedBytes != stats2.receivedBytes) {
+            return ((stats1.receivedBytes > stats2.receivedBytes) ? NSOrderedAscending : NSOrderedDescending);
+        }
+        if (stats1.sentBytes != stats2.sentBytes) {
+            return ((stats1.sentBytes > stats2.sentBytes) ? NSOrderedAscending : NSOrderedDescending);
+        }
+        return NSOrderedSame;
+    }];
+
+    NSMutableString *report = [[NSMutableString alloc] init];
+    [report appendFormat:@"%-12s %10s %12s %10s %12s %10s\n", "command", "sent", "sent bytes", "received", "recv bytes", "decode"];
+    for (NSString *messageType in messageTypes) {
+        WSMessageTrafficStats *stats = self.mutableMessageStats[messageType];
+        [report appendFormat:@"%-12s %10lu %12lu %10lu %12lu %9.3fs\n", messageType.UTF8String,
+         (unsigned long)stats.sentMessages, (unsigned long)stats.sentBytes,
+         (unsigned long)stats.receivedMessages, (unsigned long)stats.receivedBytes,
+         stats.decodeTime];
+    }
+    for (NSString *requestType in [[self.mutableLatencyHistograms allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        [report appendFormat:@"%@ latency: %@\n", requestType, self.mutableLatencyHistograms[requestType]];
+    }
+    return report;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"{sent=%lu bytes, received=%lu bytes, decode=%.3fs, commands=%lu}",
+            (unsigned long)self.sentBytes, (unsigned long)self.receivedBytes, self.decodeTime,
+            (unsigned long)self.mutableMessageStats.count];
+}
+
+#pragma mark Helpers
+
+- (WSMessageTrafficStats *)statsForMessageType:(NSString *)messageType
+{
+    NSParameterAssert(messageType);
+
+    WSMessageTrafficStats *stats = self.mutableMessageStats[messageType];
+    if (!stats) {
+        stats = [[WSMessageTrafficStats alloc] init];
+        self.mutableMessageStats[messageType] = stats;
+    }
+    return stats;
+}
+
+- (WSLatencyHistogram *)histogramForRequestType:(NSString *)requestType
+{
+    NSParameterAssert(requestType);
+
+    WSLatencyHistogram *histogram = self.mutableLatencyHistograms[requestType];
+    if (!histogram) {
+        histogram = [[WSLatencyHistogram alloc] init];
+        self.mutableLatencyHistograms[requestType] = histogram;
+    }
+    return histogram;
+}
+
+#pragma mark NSCopying
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    WSTrafficStats *copy = [[self class] allocWithZone:zone];
+    copy = [copy init];
+    [copy addStats:self];
+    return copy;
+}
+
+@end
@@ -115,6 +115,11 @@
     return nil;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandUnknown;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return @"{}";
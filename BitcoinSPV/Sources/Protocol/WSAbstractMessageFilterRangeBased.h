@@ -0,0 +1,35 @@
+//
+//  WSAbstractMessageFilterRangeBased.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSAbstractMessage.h"
+
+@interface WSAbstractMessageFilterRangeBased : WSAbstractMessage
+
++ (instancetype)messageWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType startHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash;
+- (uint8_t)filterType;
+- (uint32_t)startHeight;
+- (WSHash256 *)stopHash;
+
+@end
@@ -0,0 +1,88 @@
+//
+//  WSAbstractMessageFilterRangeBased.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSAbstractMessageFilterRangeBased.h"
+#import "WSBitcoinConstants.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+@interface WSAbstractMessageFilterRangeBased ()
+
+@property (nonatomic, assign) uint8_t filterType;
+@property (nonatomic, assign) uint32_t startHeight;
+@property (nonatomic, strong) WSHash256 *stopHash;
+
+- (instancetype)initWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType startHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash;
+
+@end
+
+@implementation WSAbstractMessageFilterRangeBased
+
++ (instancetype)messageWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType startHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash
+{
+    return [[self alloc] initWithParameters:parameters filterType:filterType startHeight:startHeight stopHash:stopHash];
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType startHeight:(uint32_t)startHeight stopHash:(WSHash256 *)stopHash
+{
+    WSExceptionCheckIllegal(stopHash);
+    
+    if ((self = [super initWithParameters:parameters])) {
+        self.filterType = filterType;
+        self.startHeight = startHeight;
+        self.stopHash = stopHash;
+    }
+    return self;
+}
+
+#pragma mark WSMessage
+
+- (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
+{
+    NSMutableArray *tokens = [[NSMutableArray alloc] init];
+    [tokens addObject:[NSString stringWithFormat:@"filterType = %u", self.filterType]];
+    [tokens addObject:[NSString stringWithFormat:@"startHeight = %u", self.startHeight]];
+    [tokens addObject:[NSString stringWithFormat:@"stopHash = %@", self.stopHash]];
+    return [NSString stringWithFormat:@"{%@}", WSStringDescriptionFromTokens(tokens, indent)];
+}
+
+#pragma mark WSBufferEncoder
+
+- (void)appendToMutableBuffer:(WSMutableBuffer *)buffer
+{
+    [buffer appendUint8:self.filterType];
+    [buffer appendUint32:self.startHeight];
+    [buffer appendHash256:self.stopHash];
+}
+
+- (WSBuffer *)toBuffer
+{
+    // filter_type + start_height + stop_hash
+    WSMutableBuffer *buffer = [[WSMutableBuffer alloc] initWithCapacity:(1 + 4 + WSHash256Length)];
+    [self appendToMutableBuffer:buffer];
+    return buffer;
+}
+
+@end
@@ -39,6 +39,8 @@ extern const NSUInteger         WSMessageMaxInventories;
 extern const NSUInteger         WSMessageAddrMaxCount;
 extern const NSUInteger         WSMessageBlocksMaxCount;
 extern const NSUInteger         WSMessageHeadersMaxCount;
+extern const NSUInteger         WSMessageCfheadersMaxCount;
+extern const NSUInteger         WSMessageCfiltersMaxCount;
 
 extern NSString *const          WSMessageType_VERSION;
 extern NSString *const          WSMessageType_VERACK;
@@ -64,11 +66,40 @@ extern NSString *const          WSMessageType_FILTERADD;
 extern NSString *const          WSMessageType_FILTERCLEAR;
 extern NSString *const          WSMessageType_MERKLEBLOCK;
 extern NSString *const          WSMessageType_ALERT;
+extern NSString *const          WSMessageType_GETCFILTERS;      // described in BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+extern NSString *const          WSMessageType_CFILTER;
+extern NSString *const          WSMessageType_GETCFHEADERS;
+extern NSString *const          WSMessageType_CFHEADERS;
+
+// decodable messages
+typedef enum {
+    WSMessageCommandUnknown,
+    WSMessageCommandVersion,
+    WSMessageCommandVerack,
+    WSMessageCommandAddr,
+    WSMessageCommandInv,
+    WSMessageCommandGetdata,
+    WSMessageCommandNotfound,
+    WSMessageCommandTx,
+    WSMessageCommandBlock,
+    WSMessageCommandHeaders,
+    WSMessageCommandPing,
+    WSMessageCommandPong,
+    WSMessageCommandReject,
+    WSMessageCommandMerkleblock,
+    WSMessageCommandCfilter,
+    WSMessageCommandCfheaders,
+    WSMessageCommandMax
+} WSMessageCommand;
+
+// from 12-byte (null-padded) header field, no allocations
+WSMessageCommand WSMessageCommandFromHeaderField(const void *field);
 
 @protocol WSMessage <WSBufferEncoder>
 
 - (WSParameters *)parameters;
 - (NSString *)messageType;
+- (WSMessageCommand)messageCommand;
 - (NSUInteger)originalLength;
 - (WSBuffer *)toNetworkBufferWithHeaderLength:(NSUInteger *)headerLength;
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent;
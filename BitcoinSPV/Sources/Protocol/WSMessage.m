@@ -31,6 +31,8 @@ const NSUInteger        WSMessageMaxInventories                 = 50000;
 const NSUInteger        WSMessageAddrMaxCount                   = 1000;
 const NSUInteger        WSMessageBlocksMaxCount                 = 500;
 const NSUInteger        WSMessageHeadersMaxCount                = 2000;
+const NSUInteger        WSMessageCfheadersMaxCount              = 2000;
+const NSUInteger        WSMessageCfiltersMaxCount               = 1000;
 
 NSString *const         WSMessageType_VERSION                   = @"version";
 NSString *const         WSMessageType_VERACK                    = @"verack";
@@ -56,3 +58,37 @@ NSString *const         WSMessageType_FILTERADD                 = @"filteradd";
 NSString *const         WSMessageType_FILTERCLEAR               = @"filterclear";
 NSString *const         WSMessageType_MERKLEBLOCK               = @"merkleblock";
 NSString *const         WSMessageType_ALERT                     = @"alert";
+NSString *const         WSMessageType_GETCFILTERS               = @"getcfilters";
+NSString *const         WSMessageType_CFILTER                   = @"cfilter";
+NSString *const         WSMessageType_GETCFHEADERS              = @"getcfheaders";
+NSString *const         WSMessageType_CFHEADERS                 = @"cfheaders";
+
+static const char WSMessageCommandHeaderFields[WSMessageCommandMax][12] = {
+    [WSMessageCommandVersion]       = "version",
+    [WSMessageCommandVerack]        = "verack",
+    [WSMessageCommandAddr]          = "addr",
+    [WSMessageCommandInv]           = "inv",
+    [WSMessageCommandGetdata]       = "getdata",
+    [WSMessageCommandNotfound]      = "notfound",
+    [WSMessageCommandTx]            = "tx",
+    [WSMessageCommandBlock]         = "block",
+    [WSMessageCommandHeaders]       = "headers",
+    [WSMessageCommandPing]          = "ping",
+    [WSMessageCommandPong]          = "pong",
+    [WSMessageCommandReject]        = "reject",
+    [WSMessageCommandMerkleblock]   = "merkleblock",
+    [WSMessageCommandCfilter]       = "cfilter",
+    [WSMessageCommandCfheaders]     = "cfheaders"
+};
+
+WSMessageCommand WSMessageCommandFromHeaderField(const void *field)
+{
+    NSCParameterAssert(field);
+    
+    for (int command = WSMessageCommandUnknown + 1; command < WSMessageCommandMax; ++command) {
+        if (memcmp(field, WSMessageCommandHeaderFields[command], sizeof(WSMessageCommandHeaderFields[command])) == 0) {
+            return command;
+        }
+    }
+    return WSMessageCommandUnknown;
+}
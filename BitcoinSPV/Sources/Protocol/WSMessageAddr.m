@@ -61,6 +61,11 @@
     return WSMessageType_ADDR;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandAddr;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [self.addresses descriptionWithLocale:nil indent:indent];
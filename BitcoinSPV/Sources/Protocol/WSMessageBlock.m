@@ -42,6 +42,11 @@
     return WSMessageType_BLOCK;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandBlock;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [self.block descriptionWithIndent:indent];
@@ -0,0 +1,155 @@
+//
+//  WSMessageCfheaders.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSMessageCfheaders.h"
+#import "WSBitcoinConstants.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+@interface WSMessageCfheaders ()
+
+@property (nonatomic, assign) uint8_t filterType;
+@property (nonatomic, strong) WSHash256 *stopHash;
+@property (nonatomic, strong) WSHash256 *previousFilterHeader;
+@property (nonatomic, strong) NSArray *filterHashes;
+
+- (instancetype)initWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType stopHash:(WSHash256 *)stopHash previousFilterHeader:(WSHash256 *)previousFilterHeader filterHashes:(NSArray *)filterHashes;
+
+@end
+
+@implementation WSMessageCfheaders
+
++ (instancetype)messageWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType stopHash:(WSHash256 *)stopHash previousFilterHeader:(WSHash256 *)previousFilterHeader filterHashes:(NSArray *)filterHashes
+{
+    return [[self alloc] initWithParameters:parameters filterType:filterType stopHash:stopHash previousFilterHeader:previousFilterHeader filterHashes:filterHashes];
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType stopHash:(WSHash256 *)stopHash previousFilterHeader:(WSHash256 *)previousFilterHeader filterHashes:(NSArray *)filterHashes
+{
+    WSExceptionCheckIllegal(stopHash);
+    WSExceptionCheckIllegal(previousFilterHeader);
+    WSExceptionCheckIllegal(filterHashes.count <= WSMessageCfheadersMaxCount);
+    
+    if ((self = [super initWithParameters:parameters])) {
+        self.filterType = filterType;
+        self.stopHash = stopHash;
+        self.previousFilterHeader = previousFilterHeader;
+        self.filterHashes = filterHashes;
+    }
+    return self;
+}
+
+#pragma mark WSMessage
+
+- (NSString *)messageType
+{
+    return WSMessageType_CFHEADERS;
+}
+
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandCfheaders;
+}
+
+- (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
+{
+    NSMutableArray *tokens = [[NSMutableArray alloc] init];
+    [tokens addObject:[NSString stringWithFormat:@"filterType = %u", self.filterType]];
+    [tokens addObject:[NSString stringWithFormat:@"stopHash = %@", self.stopHash]];
+    [tokens addObject:[NSString stringWithFormat:@"previousFilterHeader = %@", self.previousFilterHeader]];
+    [tokens addObject:[NSString stringWithFormat:@"count = %lu", (unsigned long)self.filterHashes.count]];
+    return [NSString stringWithFormat:@"{%@}", WSStringDescriptionFromTokens(tokens, indent)];
+}
+
+#pragma mark WSBufferEncoder
+
+- (void)appendToMutableBuffer:(WSMutableBuffer *)buffer
+{
+    [buffer appendUint8:self.filterType];
+    [buffer appendHash256:self.stopHash];
+    [buffer appendHash256:self.previousFilterHeader];
+    [buffer appendVarInt:self.filterHashes.count];
+    for (WSHash256 *filterHash in self.filterHashes) {
+        [buffer appendHash256:filterHash];
+    }
+}
+
+- (WSBuffer *)toBuffer
+{
+    // filter_type + stop_hash + previous_filter_header + var_int + filter_hashes
+    const NSUInteger capacity = 1 + 2 * WSHash256Length + 8 + self.filterHashes.count * WSHash256Length;
+
+    WSMutableBuffer *buffer = [[WSMutableBuffer alloc] initWithCapacity:capacity];
+    [self appendToMutableBuffer:buffer];
+    return buffer;
+}
+
+#pragma mark WSBufferDecoder
+
+- (instancetype)initWithParameters:(WSParameters *)parameters buffer:(WSBuffer *)buffer from:(NSUInteger)from available:(NSUInteger)available error:(NSError *__autoreleasing *)error
+{
+    const NSUInteger fixedLength = 1 + 2 * WSHash256Length + 1;
+    if (available < fixedLength) {
+        WSErrorSetNotEnoughMessageBytes(error, WSMessageType_CFHEADERS, available, fixedLength);
+        return nil;
+    }
+    
+    if ((self = [super initWithParameters:parameters originalLength:buffer.length])) {
+        NSUInteger offset = from;
+        NSUInteger varIntLength;
+        
+        self.filterType = [buffer uint8AtOffset:offset];
+        offset += sizeof(uint8_t);
+        
+        self.stopHash = [buffer hash256AtOffset:offset];
+        offset += WSHash256Length;
+        
+        self.previousFilterHeader = [buffer hash256AtOffset:offset];
+        offset += WSHash256Length;
+        
+        const NSUInteger count = (NSUInteger)[buffer varIntAtOffset:offset length:&varIntLength];
+        if (count > WSMessageCfheadersMaxCount) {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Too many filter hashes (%u > %u)", count, WSMessageCfheadersMaxCount);
+            return nil;
+        }
+        offset += varIntLength;
+        
+        const NSUInteger expectedLength = (offset - from) + count * WSHash256Length;
+        if (available < expectedLength) {
+            WSErrorSetNotEnoughMessageBytes(error, WSMessageType_CFHEADERS, available, expectedLength);
+            return nil;
+        }
+        
+        NSMutableArray *filterHashes = [[NSMutableArray alloc] initWithCapacity:count];
+        for (NSUInteger i = 0; i < count; ++i) {
+            [filterHashes addObject:[buffer hash256AtOffset:offset]];
+            offset += WSHash256Length;
+        }
+        self.filterHashes = filterHashes;
+    }
+    return self;
+}
+
+@end
@@ -0,0 +1,140 @@
+//
+//  WSMessageCfilter.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "WSMessageCfilter.h"
+#import "WSBIP158.h"
+#import "WSBitcoinConstants.h"
+#import "WSMacrosCore.h"
+#import "WSErrors.h"
+
+@interface WSMessageCfilter ()
+
+@property (nonatomic, assign) uint8_t filterType;
+@property (nonatomic, strong) WSHash256 *blockId;
+@property (nonatomic, strong) NSData *filterData;
+@property (nonatomic, strong) WSBIP158Filter *filter;
+
+- (instancetype)initWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType filter:(WSBIP158Filter *)filter;
+
+@end
+
+@implementation WSMessageCfilter
+
++ (instancetype)messageWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType filter:(WSBIP158Filter *)filter
+{
+    return [[self alloc] initWithParameters:parameters filterType:filterType filter:filter];
+}
+
+- (instancetype)initWithParameters:(WSParameters *)parameters filterType:(uint8_t)filterType filter:(WSBIP158Filter *)filter
+{
+    WSExceptionCheckIllegal(filter);
+    
+    if ((self = [super initWithParameters:parameters])) {
+        self.filterType = filterType;
+        self.blockId = filter.blockId;
+        self.filterData = filter.data;
+        self.filter = filter;
+    }
+    return self;
+}
+
+#pragma mark WSMessage
+
+- (NSString *)messageType
+{
+    return WSMessageType_CFILTER;
+}
+
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandCfilter;
+}
+
+- (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
+{
+    NSMutableArray *tokens = [[NSMutableArray alloc] init];
+    [tokens addObject:[NSString stringWithFormat:@"filterType = %u", self.filterType]];
+    [tokens addObject:[NSString stringWithFormat:@"blockId = %@", self.blockId]];
+    [tokens addObject:[NSString stringWithFormat:@"length = %lu", (unsigned long)self.filterData.length]];
+    return [NSString stringWithFormat:@"{%@}", WSStringDescriptionFromTokens(tokens, indent)];
+}
+
+#pragma mark WSBufferEncoder
+
+- (void)appendToMutableBuffer:(WSMutableBuffer *)buffer
+{
+    [buffer appendUint8:self.filterType];
+    [buffer appendHash256:self.blockId];
+    [buffer appendVarData:self.filterData];
+}
+
+- (WSBuffer *)toBuffer
+{
+    // filter_type + block_hash + var_int + filter
+    const NSUInteger capacity = 1 + WSHash256Length + 8 + self.filterData.length;
+
+    WSMutableBuffer *buffer = [[WSMutableBuffer alloc] initWithCapacity:capacity];
+    [self appendToMutableBuffer:buffer];
+    return buffer;
+}
+
+#pragma mark WSBufferDecoder
+
+- (instancetype)initWithParameters:(WSParameters *)parameters buffer:(WSBuffer *)buffer from:(NSUInteger)from available:(NSUInteger)available error:(NSError *__autoreleasing *)error
+{
+    const NSUInteger fixedLength = 1 + WSHash256Length + 1;
+    if (available < fixedLength) {
+        WSErrorSetNotEnoughMessageBytes(error, WSMessageType_CFILTER, available, fixedLength);
+        return nil;
+    }
+    
+    if ((self = [super initWithParameters:parameters originalLength:buffer.length])) {
+        NSUInteger offset = from;
+        NSUInteger varDataLength;
+        
+        self.filterType = [buffer uint8AtOffset:offset];
+        offset += sizeof(uint8_t);
+        
+        self.blockId = [buffer hash256AtOffset:offset];
+        offset += WSHash256Length;
+        
+        self.filterData = [buffer varDataAtOffset:offset length:&varDataLength];
+        if (!self.filterData) {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Malformed filter data");
+            return nil;
+        }
+        
+        // other filter types are only carried through
+        if (self.filterType == WSBIP158FilterTypeBasic) {
+            self.filter = [[WSBIP158Filter alloc] initWithBlockId:self.blockId data:self.filterData error:error];
+            if (!self.filter) {
+                return nil;
+            }
+        }
+    }
+    return self;
+}
+
+@end
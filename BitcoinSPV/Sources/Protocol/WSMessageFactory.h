@@ -35,6 +35,7 @@
 - (WSParameters *)parameters;
 
 - (id<WSMessage>)messageFromType:(NSString *)type payload:(WSBuffer *)payload error:(NSError **)error;
+- (id<WSMessage>)messageWithCommand:(WSMessageCommand)command payload:(WSBuffer *)payload error:(NSError **)error;
 
 @end
 
@@ -58,4 +59,8 @@
 //#import "WSMessageFilteradd.h"
 //#import "WSMessageFilterclear.h"
 #import "WSMessageMerkleblock.h"
+#import "WSMessageGetcfilters.h"
+#import "WSMessageCfilter.h"
+#import "WSMessageGetcfheaders.h"
+#import "WSMessageCfheaders.h"
 //#import "WSMessageAlert.h"
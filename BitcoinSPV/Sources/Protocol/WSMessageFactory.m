@@ -49,23 +49,93 @@
     WSExceptionCheckIllegal(type);
     WSExceptionCheckIllegal(payload);
     
-#warning XXX: would not handle messages of type "factory" in the future (rename class?)
+    char field[12] = { 0 };
+    const WSMessageCommand command = ([type getCString:field maxLength:sizeof(field) encoding:NSASCIIStringEncoding] ?
+                                      WSMessageCommandFromHeaderField(field) :
+                                      WSMessageCommandUnknown);
     
-    NSString *className = [NSString stringWithFormat:@"WSMessage%@", [type capitalizedString]];
-    Class clazz = NSClassFromString(className);
-    if (!clazz || (clazz == [self class])) {
+    if (command == WSMessageCommandUnknown) {
         WSErrorSetUserInfo(error, WSErrorCodeUnknownMessage, @{WSErrorMessageTypeKey: type}, @"Unknown message '%@'", type);
         return nil;
     }
-    if (![clazz conformsToProtocol:@protocol(WSBufferDecoder)]) {
-        WSErrorSet(error, WSErrorCodeUndecodableMessage, @"Undecodable message '%@'", type);
-        return nil;
+    return [self messageWithCommand:command payload:payload error:error];
+}
+
+- (id<WSMessage>)messageWithCommand:(WSMessageCommand)command payload:(WSBuffer *)payload error:(NSError *__autoreleasing *)error
+{
+    WSExceptionCheckIllegal(payload);
+    
+    Class clazz = Nil;
+    switch (command) {
+        case WSMessageCommandVersion: {
+            clazz = [WSMessageVersion class];
+            break;
+        }
+        case WSMessageCommandVerack: {
+            clazz = [WSMessageVerack class];
+            break;
+        }
+        case WSMessageCommandAddr: {
+            clazz = [WSMessageAddr class];
+            break;
+        }
+        case WSMessageCommandInv: {
+            clazz = [WSMessageInv class];
+            break;
+        }
+        case WSMessageCommandGetdata: {
+            clazz = [WSMessageGetdata class];
+            break;
+        }
+        case WSMessageCommandNotfound: {
+            clazz = [WSMessageNotfound class];
+            break;
+        }
+        case WSMessageCommandTx: {
+            clazz = [WSMessageTx class];
+            break;
+        }
+        case WSMessageCommandBlock: {
+            clazz = [WSMessageBlock class];
+            break;
+        }
+        case WSMessageCommandHeaders: {
+            clazz = [WSMessageHeaders class];
+            break;
+        }
+        case WSMessageCommandPing: {
+            clazz = [WSMessagePing class];
+            break;
+        }
+        case WSMessageCommandPong: {
+            clazz = [WSMessagePong class];
+            break;
+        }
+        case WSMessageCommandReject: {
+            clazz = [WSMessageReject class];
+            break;
+        }
+        case WSMessageCommandMerkleblock: {
+            clazz = [WSMessageMerkleblock class];
+            break;
+        }
+        case WSMessageCommandCfilter: {
+            clazz = [WSMessageCfilter class];
+            break;
+        }
+        case WSMessageCommandCfheaders: {
+            clazz = [WSMessageCfheaders class];
+            break;
+        }
+        case WSMessageCommandUnknown:
+        case WSMessageCommandMax: {
+            WSErrorSet(error, WSErrorCodeUnknownMessage, @"Unknown message command (%d)", command);
+            return nil;
+        }
     }
-    id<WSMessage> message = [[clazz alloc] initWithParameters:self.parameters buffer:payload from:0 available:payload.length error:error];
-//    if (message) {
-//        NSAssert(message.originalPayload, @"Decoded messages should retain original payload");
-//    }
-    return message;
+    NSAssert([clazz conformsToProtocol:@protocol(WSBufferDecoder)], @"Undecodable message class %@", clazz);
+    
+    return [[clazz alloc] initWithParameters:self.parameters buffer:payload from:0 available:payload.length error:error];
 }
 
 @end
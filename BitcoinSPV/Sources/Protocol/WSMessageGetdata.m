@@ -34,4 +34,9 @@
     return WSMessageType_GETDATA;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandGetdata;
+}
+
 @end
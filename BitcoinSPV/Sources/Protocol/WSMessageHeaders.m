@@ -28,6 +28,7 @@
 #import "WSBitcoinConstants.h"
 #import "WSMacrosCore.h"
 #import "WSErrors.h"
+#import "WSConfig.h"
 
 @interface WSMessageHeaders ()
 
@@ -44,6 +45,11 @@
     return WSMessageType_HEADERS;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandHeaders;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     NSMutableArray *tokens = [[NSMutableArray alloc] init];
@@ -81,20 +87,43 @@
             return nil;
         }
 
+        // block ids are hashed concurrently, length was checked above
+        const size_t batches = (count + WSBlockHeaderConcurrentBatchSize - 1) / WSBlockHeaderConcurrentBatchSize;
         NSMutableArray *headers = [[NSMutableArray alloc] initWithCapacity:count];
         for (NSUInteger i = 0; i < count; ++i) {
-            WSBlockHeader *header = [[WSBlockHeader alloc] initWithParameters:parameters
-                                                                       buffer:buffer
-                                                                         from:offset
-                                                                    available:(available - offset + from)
-                                                                        error:error];
-            if (!header) {
-                return nil;
+            [headers addObject:[NSNull null]];
+        }
+
+        dispatch_apply(batches, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t batch) {
+            const NSUInteger start = batch * WSBlockHeaderConcurrentBatchSize;
+            const NSUInteger end = MIN(start + WSBlockHeaderConcurrentBatchSize, count);
+
+            // malformed headers stop the batch and leave their slots as NSNull
+            NSMutableArray *batchHeaders = [[NSMutableArray alloc] initWithCapacity:(end - start)];
+            for (NSUInteger i = start; i < end; ++i) {
+                const NSUInteger headerOffset = offset + i * WSBlockHeaderSize;
+                WSBlockHeader *header = [[WSBlockHeader alloc] initWithParameters:parameters
+                                                                           buffer:buffer
+                                                                             from:headerOffset
+                                                                        available:(available - headerOffset + from)
+                                                                            error:NULL];
+                if (!header) {
+                    break;
+                }
+                [batchHeaders addObject:header];
             }
-            [headers addObject:header];
-            offset += WSBlockHeaderSize;
+
+            @synchronized (headers) {
+                [headers replaceObjectsInRange:NSMakeRange(start, batchHeaders.count) withObjectsFromArray:batchHeaders];
+            }
+        });
+
+        const NSUInteger malformedIndex = [headers indexOfObjectIdenticalTo:[NSNull null]];
+        if (malformedIndex != NSNotFound) {
+            WSErrorSet(error, WSErrorCodeMalformed, @"Malformed header at index %lu", (unsigned long)malformedIndex);
+            return nil;
         }
-        self.headers = headers;
+        self.headers = [headers copy];
     }
     return self;
 }
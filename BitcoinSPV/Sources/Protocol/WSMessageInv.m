@@ -34,4 +34,9 @@
     return WSMessageType_INV;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandInv;
+}
+
 @end
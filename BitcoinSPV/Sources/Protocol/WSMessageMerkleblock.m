@@ -42,6 +42,11 @@
     return WSMessageType_MERKLEBLOCK;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandMerkleblock;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [self.block descriptionWithIndent:indent];
@@ -34,4 +34,9 @@
     return WSMessageType_NOTFOUND;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandNotfound;
+}
+
 @end
@@ -49,6 +49,11 @@
     return WSMessageType_PING;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandPing;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [NSString stringWithFormat:@"{nonce=%0llx}", self.nonce];
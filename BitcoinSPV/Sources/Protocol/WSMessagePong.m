@@ -56,6 +56,11 @@
     return WSMessageType_PONG;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandPong;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [NSString stringWithFormat:@"{nonce=%0llx}", self.nonce];
@@ -83,6 +83,11 @@ NSString *const WSMessageRejectMessageBlock     = @"block";
     return WSMessageType_REJECT;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandReject;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [NSString stringWithFormat:@"{message='%@', code=%x, reason='%@'}", self.message, self.code, self.reason];
@@ -60,6 +60,11 @@
     return WSMessageType_TX;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandTx;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     return [self.transaction descriptionWithIndent:indent];
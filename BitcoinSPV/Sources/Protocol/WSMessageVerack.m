@@ -34,6 +34,11 @@
     return WSMessageType_VERACK;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandVerack;
+}
+
 #pragma mark WSBufferDecoder
 
 - (instancetype)initWithParameters:(WSParameters *)parameters buffer:(WSBuffer *)buffer from:(NSUInteger)from available:(NSUInteger)available error:(NSError *__autoreleasing *)error
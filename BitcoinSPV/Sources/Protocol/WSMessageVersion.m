@@ -107,6 +107,11 @@
     return WSMessageType_VERSION;
 }
 
+- (WSMessageCommand)messageCommand
+{
+    return WSMessageCommandVersion;
+}
+
 - (NSString *)payloadDescriptionWithIndent:(NSUInteger)indent
 {
     NSMutableArray *tokens = [[NSMutableArray alloc] init];
@@ -0,0 +1,211 @@
+//
+//  WSAddressManagerTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSAddressManager.h"
+#import "WSNetworkAddress.h"
+#import "WSPeer.h"
+
+@interface WSAddressManager (Tests)
+
+- (NSMutableDictionary *)entriesByHost;
+- (NSUInteger)bucketForAddress:(WSNetworkAddress *)address sourceGroup:(NSData *)sourceGroup isTried:(BOOL)isTried;
+
+@end
+
+#pragma mark -
+
+@interface WSAddressManagerTests : XCTestCase
+
+- (WSNetworkAddress *)addressWithHost:(NSString *)host timestamp:(uint32_t)timestamp;
+- (NSUInteger)bucketOfHost:(NSString *)host inManager:(WSAddressManager *)manager;
+
+@end
+
+@implementation WSAddressManagerTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.networkType = WSNetworkTypeRegtest;
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+- (void)testNewBucketPlacement
+{
+    WSAddressManager *manager = [[WSAddressManager alloc] initWithParameters:self.networkParameters];
+    const uint32_t now = WSCurrentTimestamp();
+    WSNetworkAddress *source = [self addressWithHost:@"192.168.0.1" timestamp:now];
+
+    // same source and address group, same bucket
+    NSMutableSet *buckets = [[NSMutableSet alloc] init];
+    for (NSUInteger i = 0; i < 20; ++i) {
+        NSString *host = [NSString stringWithFormat:@"10.1.%lu.%lu", (unsigned long)i, (unsigned long)(i + 1)];
+        XCTAssertTrue([manager addAddress:[self addressWithHost:host timestamp:now] source:source]);
+        [buckets addObject:@([self bucketOfHost:host inManager:manager])];
+    }
+    XCTAssertEqual(buckets.count, 1);
+
+    // single source spans a bounded number of buckets whatever it relays
+    [buckets removeAllObjects];
+    for (NSUInteger i = 0; i < 200; ++i) {
+        NSString *host = [NSString stringWithFormat:@"%lu.%lu.0.1", (unsigned long)(20 + i / 100), (unsigned long)(i % 100)];
+        [manager addAddress:[self addressWithHost:host timestamp:now] source:source];
+        if ([manager containsHost:host]) {
+            [buckets addObject:@([self bucketOfHost:host inManager:manager])];
+        }
+    }
+    XCTAssertLessThanOrEqual(buckets.count, WSAddressManagerNewBucketsPerSourceGroup);
+
+    // same address group relayed by many sources spreads over more buckets
+    [buckets removeAllObjects];
+    for (NSUInteger i = 0; i < 200; ++i) {
+        NSString *host = [NSString stringWithFormat:@"30.1.%lu.1", (unsigned long)i];
+        NSString *sourceHost = [NSString stringWithFormat:@"%lu.%lu.0.1", (unsigned long)(40 + i / 100), (unsigned long)(i % 100)];
+        [manager addAddress:[self addressWithHost:host timestamp:now] source:[self addressWithHost:sourceHost timestamp:now]];
+        if ([manager containsHost:host]) {
+            [buckets addObject:@([self bucketOfHost:host inManager:manager])];
+        }
+    }
+    XCTAssertGreaterThan(buckets.count, WSAddressManagerNewBucketsPerSourceGroup);
+}
+
+- (void)testNewBucketEviction
+{
+    WSAddressManager *manager = [[WSAddressManager alloc] initWithParameters:self.networkParameters];
+    const uint32_t now = WSCurrentTimestamp();
+    WSNetworkAddress *source = [self addressWithHost:@"192.168.0.1" timestamp:now];
+    const NSUInteger count = WSAddressManagerBucketSize + 8;
+
+    // all land in the same bucket, fresher addresses evict the oldest
+    for (NSUInteger i = 0; i < count; ++i) {
+        NSString *host = [NSString stringWithFormat:@"10.1.0.%lu", (unsigned long)(i + 1)];
+        XCTAssertTrue([manager addAddress:[self addressWithHost:host timestamp:(uint32_t)(now - 1000 + i)] source:source]);
+    }
+    XCTAssertEqual(manager.numberOfNewAddresses, WSAddressManagerBucketSize);
+    XCTAssertFalse([manager containsHost:@"10.1.0.1"]);
+    XCTAssertFalse([manager containsHost:@"10.1.0.8"]);
+    XCTAssertTrue([manager containsHost:@"10.1.0.9"]);
+    XCTAssertTrue([manager containsHost:[NSString stringWithFormat:@"10.1.0.%lu", (unsigned long)count]]);
+
+    // older unknown address doesn't evict fresher ones
+    XCTAssertFalse([manager addAddress:[self addressWithHost:@"10.1.1.1" timestamp:(now - 2000)] source:source]);
+    XCTAssertEqual(manager.numberOfNewAddresses, WSAddressManagerBucketSize);
+}
+
+- (void)testTriedPromotion
+{
+    WSAddressManager *manager = [[WSAddressManager alloc] initWithParameters:self.networkParameters];
+    const uint32_t now = WSCurrentTimestamp();
+    WSNetworkAddress *source = [self addressWithHost:@"192.168.0.1" timestamp:now];
+
+    NSMutableSet *buckets = [[NSMutableSet alloc] init];
+    for (NSUInteger i = 0; i < 20; ++i) {
+        NSString *host = [NSString stringWithFormat:@"10.2.%lu.1", (unsigned long)i];
+        XCTAssertTrue([manager addAddress:[self addressWithHost:host timestamp:now] source:source]);
+        [manager markAttemptWithHost:host];
+        [manager markSuccessWithHost:host];
+        [buckets addObject:@([self bucketOfHost:host inManager:manager])];
+    }
+    XCTAssertEqual(manager.numberOfNewAddresses, 0);
+    XCTAssertEqual(manager.numberOfTriedAddresses, 20);
+
+    // address group spans a bounded number of tried buckets
+    XCTAssertLessThanOrEqual(buckets.count, WSAddressManagerTriedBucketsPerGroup);
+
+    // tried bucket ignores source
+    WSNetworkAddress *address = [self addressWithHost:@"10.2.0.1" timestamp:now];
+    NSData *sourceGroup1 = [NSData dataWithBytes:"\x04\x0a\x01\x00\x00" length:5];
+    NSData *sourceGroup2 = [NSData dataWithBytes:"\x04\x0a\x02\x00\x00" length:5];
+    XCTAssertEqual([manager bucketForAddress:address sourceGroup:sourceGroup1 isTried:YES],
+                   [manager bucketForAddress:address sourceGroup:sourceGroup2 isTried:YES]);
+
+    // failures don't demote
+    [manager markFailureWithHost:@"10.2.0.1"];
+    XCTAssertEqual(manager.numberOfTriedAddresses, 20);
+}
+
+- (void)testSaveLoad
+{
+    WSAddressManager *manager = [[WSAddressManager alloc] initWithParameters:self.networkParameters];
+    const uint32_t now = WSCurrentTimestamp();
+    WSNetworkAddress *source = [self addressWithHost:@"192.168.0.1" timestamp:now];
+
+    NSMutableArray *hosts = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < 50; ++i) {
+        NSString *host = [NSString stringWithFormat:@"10.%lu.0.1", (unsigned long)(i + 1)];
+        XCTAssertTrue([manager addAddress:[self addressWithHost:host timestamp:now] source:source]);
+        if (i % 5 == 0) {
+            [manager markSuccessWithHost:host];
+        }
+        [hosts addObject:host];
+    }
+    [manager markFailureWithHost:hosts[1]];
+
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"WSAddressManagerTests.addresses"];
+    NSError *error;
+    XCTAssertTrue([manager saveToPath:path error:&error], @"Error saving addresses: %@", error);
+
+    WSAddressManager *loadedManager = [[WSAddressManager alloc] initWithParameters:self.networkParameters];
+    XCTAssertTrue([loadedManager loadFromPath:path error:&error], @"Error loading addresses: %@", error);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    XCTAssertEqual(loadedManager.count, manager.count);
+    XCTAssertEqual(loadedManager.numberOfNewAddresses, manager.numberOfNewAddresses);
+    XCTAssertEqual(loadedManager.numberOfTriedAddresses, manager.numberOfTriedAddresses);
+
+    // same key and source groups, same buckets
+    for (NSString *host in hosts) {
+        XCTAssertTrue([loadedManager containsHost:host]);
+        XCTAssertEqual([self bucketOfHost:host inManager:loadedManager], [self bucketOfHost:host inManager:manager]);
+        XCTAssertEqualObjects([loadedManager.entriesByHost[host] valueForKey:@"failures"], [manager.entriesByHost[host] valueForKey:@"failures"]);
+    }
+
+    // other network is rejected
+    XCTAssertTrue([manager saveToPath:path error:&error]);
+    WSAddressManager *otherManager = [[WSAddressManager alloc] initWithParameters:WSParametersForNetworkType(WSNetworkTypeTestnet3)];
+    XCTAssertFalse([otherManager loadFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeMalformed);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+
+#pragma mark Helpers
+
+- (WSNetworkAddress *)addressWithHost:(NSString *)host timestamp:(uint32_t)timestamp
+{
+    return WSNetworkAddressMake(WSNetworkIPv4FromHost(host), [self.networkParameters peerPort], WSPeerServicesNodeNetwork, timestamp);
+}
+
+- (NSUInteger)bucketOfHost:(NSString *)host inManager:(WSAddressManager *)manager
+{
+    return [[manager.entriesByHost[host] valueForKey:@"bucket"] unsignedIntegerValue];
+}
+
+@end
@@ -0,0 +1,127 @@
+//
+//  WSBIP158Tests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSBIP158.h"
+#import "NSData+Hash.h"
+
+@interface WSBIP158Tests : XCTestCase
+
+- (NSData *)mockScriptWithIndex:(uint8_t)index;
+
+@end
+
+@implementation WSBIP158Tests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.networkType = WSNetworkTypeTestnet3;
+}
+
+- (void)tearDown
+{
+    // Put teardown code here. This method is called after the invocation of each test method in the class.
+    [super tearDown];
+}
+
+// https://github.com/bitcoin/bips/blob/master/bip-0158/testnet-19.json
+- (void)testGenesisFilter
+{
+    WSHash256 *blockId = WSHash256FromHex(@"000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943");
+    NSData *script = [@"4104678afdb0fe5548271967f1a67130b7105cd6a828e03909a67962e0ea1f61deb649f6bc3f4cef38c4f35504e51ec112de5c384df7ba0b8d578a4c702b6bf11d5fac" dataFromHex];
+
+    NSError *error;
+    WSBIP158Filter *filter = [[WSBIP158Filter alloc] initWithBlockId:blockId data:[@"019dfca8" dataFromHex] error:&error];
+    XCTAssertNotNil(filter, @"Error parsing filter: %@", error);
+    XCTAssertEqual(filter.numberOfElements, 1);
+    XCTAssertTrue([filter matchesData:script]);
+    XCTAssertFalse([filter matchesData:[self mockScriptWithIndex:0]]);
+
+    WSHash256 *header = [filter filterHeaderWithPreviousHeader:WSHash256Zero()];
+    XCTAssertEqualObjects(header, WSHash256FromHex(@"21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750"));
+
+    WSBIP158Filter *builtFilter = [WSBIP158Filter filterWithBlockId:blockId elements:@[script]];
+    XCTAssertEqualObjects(builtFilter.data, filter.data);
+}
+
+- (void)testBuildAndMatch
+{
+    WSHash256 *blockId = WSHash256FromHex(@"733e86d63c655cfd582a96c07b79dec93e3caccb7e333a509fb92afedfb94f3e");
+
+    NSMutableArray *scripts = [[NSMutableArray alloc] init];
+    for (uint8_t i = 0; i < 10; ++i) {
+        [scripts addObject:[self mockScriptWithIndex:i]];
+    }
+    WSBIP158Filter *filter = [WSBIP158Filter filterWithBlockId:blockId elements:scripts];
+    XCTAssertEqualObjects([filter.data hexString], @"0a89754b3b6ded1aa207dbcf390891858fd91b0ce5ecb81038551380");
+    XCTAssertEqualObjects(filter.filterHash, WSHash256FromHex(@"4db2edd695c43a7b6b33946905f7fa24c0ab85cde969a49beecc1c57a3a593ec"));
+
+    for (NSData *script in scripts) {
+        XCTAssertTrue([filter matchesData:script]);
+    }
+    for (uint8_t i = 10; i < 15; ++i) {
+        XCTAssertFalse([filter matchesData:[self mockScriptWithIndex:i]]);
+    }
+
+    NSArray *someScripts = @[[self mockScriptWithIndex:12], [self mockScriptWithIndex:7], [self mockScriptWithIndex:14]];
+    XCTAssertTrue([filter matchesAnyData:someScripts]);
+    NSArray *otherScripts = @[[self mockScriptWithIndex:12], [self mockScriptWithIndex:13], [self mockScriptWithIndex:14]];
+    XCTAssertFalse([filter matchesAnyData:otherScripts]);
+}
+
+- (void)testEmptyAndMalformed
+{
+    WSHash256 *blockId = WSHash256Zero();
+
+    WSBIP158Filter *emptyFilter = [WSBIP158Filter filterWithBlockId:blockId elements:@[]];
+    XCTAssertEqualObjects([emptyFilter.data hexString], @"00");
+    XCTAssertFalse([emptyFilter matchesData:[self mockScriptWithIndex:0]]);
+
+    NSError *error;
+    XCTAssertNil([[WSBIP158Filter alloc] initWithBlockId:blockId data:[@"fd01" dataFromHex] error:&error]);
+    XCTAssertNotNil(error);
+
+    // truncated set never matches
+    WSBIP158Filter *truncatedFilter = [[WSBIP158Filter alloc] initWithBlockId:blockId data:[@"0a89" dataFromHex] error:NULL];
+    XCTAssertFalse([truncatedFilter matchesData:[self mockScriptWithIndex:0]]);
+}
+
+#pragma mark Helpers
+
+// P2PKH with hash160 = SHA256(index)[0..20]
+- (NSData *)mockScriptWithIndex:(uint8_t)index
+{
+    NSData *hash = [[[NSData alloc] initWithBytes:&index length:1] SHA256];
+
+    NSMutableData *script = [[NSMutableData alloc] init];
+    [script appendData:[@"76a914" dataFromHex]];
+    [script appendData:[hash subdataWithRange:NSMakeRange(0, 20)]];
+    [script appendData:[@"88ac" dataFromHex]];
+    return script;
+}
+
+@end
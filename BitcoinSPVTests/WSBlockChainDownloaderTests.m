@@ -0,0 +1,411 @@
+//
+//  WSBlockChainDownloaderTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSBlockChainDownloader.h"
+#import "WSPeerGroup+Download.h"
+#import "WSPeer.h"
+#import "WSBlockDownloadScheduler.h"
+#import "WSConfig.h"
+#import "WSSyntheticPeer.h"
+
+@interface WSMockScoredPeer : WSPeer
+
+@property (nonatomic, assign) uint32_t mockLastBlockHeight;
+@property (nonatomic, assign) NSTimeInterval mockConnectionTime;
+@property (nonatomic, assign) NSTimeInterval mockPingTime;
+@property (nonatomic, assign) NSTimeInterval mockResponseTime;
+@property (nonatomic, assign) double mockThroughput;
+@property (nonatomic, assign) NSUInteger numberOfPings;
+@property (nonatomic, strong) NSMutableArray *requestedStopIds; // WSHash256 or NSNull
+
+@end
+
+@implementation WSMockScoredPeer
+
+- (instancetype)initWithHost:(NSString *)host parameters:(WSParameters *)parameters flags:(WSPeerFlags *)flags
+{
+    if ((self = [super initWithHost:host parameters:parameters flags:flags])) {
+        self.mockLastBlockHeight = 1000;
+        self.mockConnectionTime = DBL_MAX;
+        self.mockPingTime = DBL_MAX;
+        self.mockResponseTime = DBL_MAX;
+        self.mockThroughput = 0.0;
+        self.requestedStopIds = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (WSPeerStatus)peerStatus
+{
+    return WSPeerStatusConnected;
+}
+
+- (uint32_t)lastBlockHeight
+{
+    return self.mockLastBlockHeight;
+}
+
+- (NSTimeInterval)connectionTime
+{
+    return self.mockConnectionTime;
+}
+
+- (NSTimeInterval)pingTime
+{
+    return self.mockPingTime;
+}
+
+- (NSTimeInterval)responseTime
+{
+    return self.mockResponseTime;
+}
+
+- (double)throughput
+{
+    return self.mockThroughput;
+}
+
+- (void)sendPingMessage
+{
+    ++self.numberOfPings;
+}
+
+- (void)sendGetheadersMessageWithLocator:(WSBlockLocator *)locator hashStop:(WSHash256 *)hashStop
+{
+    [self.requestedStopIds addObject:(hashStop ? : [NSNull null])];
+}
+
+@end
+
+#pragma mark -
+
+@interface WSMockDownloadPeerGroup : WSPeerGroup
+
+@property (nonatomic, strong) NSArray *connectedPeers; // WSPeer
+@property (nonatomic, strong) NSMutableArray *disconnectedPeers; // WSPeer
+
+@end
+
+@implementation WSMockDownloadPeerGroup
+
+- (instancetype)initWithParameters:(WSParameters *)parameters pool:(WSConnectionPool *)pool queue:(dispatch_queue_t)queue
+{
+    if ((self = [super initWithParameters:parameters pool:pool queue:queue])) {
+        self.connectedPeers = @[];
+        self.disconnectedPeers = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)executeBlockInGroupQueue:(void (^)(void))block synchronously:(BOOL)synchronously
+{
+    block();
+}
+
+- (NSArray *)allConnectedPeers
+{
+    return self.connectedPeers;
+}
+
+- (void)disconnectPeer:(WSPeer *)peer error:(NSError *)error
+{
+    [self.disconnectedPeers addObject:peer];
+}
+
+@end
+
+#pragma mark -
+
+// private to WSBlockChainDownloader, instantiated by name
+@protocol WSHeadersSegmentTests <NSObject>
+
+- (instancetype)initWithStartId:(WSHash256 *)startId startHeight:(uint32_t)startHeight stopCheckpoint:(WSStorableBlock *)stopCheckpoint;
+- (WSPeer *)peer;
+- (WSHash256 *)lastId;
+- (void)setLastId:(WSHash256 *)lastId;
+- (uint32_t)lastHeight;
+- (void)setLastHeight:(uint32_t)lastHeight;
+- (BOOL)isComplete;
+- (BOOL)shouldAcceptHeader:(WSBlockHeader *)header;
+
+@end
+
+@interface WSBlockChainDownloader (Tests)
+
+- (void)setPeerGroup:(WSPeerGroup *)peerGroup;
+- (void)setDownloadPeer:(WSPeer *)downloadPeer;
+- (void)setBlockScheduler:(WSBlockDownloadScheduler *)blockScheduler;
+- (NSMutableArray *)headersSegments;
+- (void)setHeadersSegments:(NSMutableArray *)headersSegments;
+- (double)scoreOfPeer:(WSPeer *)peer;
+- (void)evaluateDownloadPeer;
+- (void)assignHeadersSegments;
+- (void)handleHeaders:(NSArray *)headers forSegmentFromPeer:(WSPeer *)peer;
+
+@end
+
+#pragma mark -
+
+@interface WSBlockChainDownloaderTests : XCTestCase
+
+- (WSMockScoredPeer *)peerWithHost:(NSString *)host;
+- (WSMockScoredPeer *)peerWithHost:(NSString *)host parameters:(WSParameters *)parameters;
+- (WSBlockChainDownloader *)downloader;
+- (id<WSHeadersSegmentTests>)segmentWithHeaders:(NSArray *)headers startHeight:(uint32_t)startHeight stopHeight:(uint32_t)stopHeight;
+- (WSMockDownloadPeerGroup *)peerGroupWithPeers:(NSArray *)peers;
+
+@end
+
+@implementation WSBlockChainDownloaderTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.networkType = WSNetworkTypeRegtest;
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+- (void)testPeerScore
+{
+    WSBlockChainDownloader *downloader = [self downloader];
+
+    // nothing measured, assume request timeout and default throughput
+    WSMockScoredPeer *peer = [self peerWithHost:@"127.0.0.1"];
+    const double defaultScore = 1.0 / (downloader.requestTimeout + WSBlockChainDownloaderPeerScoreLength / WSBlockChainDownloaderPeerDefaultThroughput);
+    XCTAssertEqualWithAccuracy([downloader scoreOfPeer:peer], defaultScore, 1e-9);
+
+    // latency falls back from response to ping to handshake time
+    peer.mockConnectionTime = 0.5;
+    XCTAssertEqualWithAccuracy([downloader scoreOfPeer:peer], 1.0 / (0.5 + WSBlockChainDownloaderPeerScoreLength / WSBlockChainDownloaderPeerDefaultThroughput), 1e-9);
+    peer.mockPingTime = 0.2;
+    XCTAssertEqualWithAccuracy([downloader scoreOfPeer:peer], 1.0 / (0.2 + WSBlockChainDownloaderPeerScoreLength / WSBlockChainDownloaderPeerDefaultThroughput), 1e-9);
+    peer.mockResponseTime = 0.1;
+    peer.mockThroughput = 1024 * 1024;
+    XCTAssertEqualWithAccuracy([downloader scoreOfPeer:peer], 1.0 / (0.1 + WSBlockChainDownloaderPeerScoreLength / (1024.0 * 1024.0)), 1e-9);
+
+    // faster and wider beats slower and narrower
+    WSMockScoredPeer *slowPeer = [self peerWithHost:@"127.0.0.2"];
+    slowPeer.mockResponseTime = 1.0;
+    slowPeer.mockThroughput = 100 * 1024;
+    XCTAssertGreaterThan([downloader scoreOfPeer:peer], [downloader scoreOfPeer:slowPeer]);
+}
+
+- (void)testEvaluateSwitchesToMuchBetterPeer
+{
+    WSBlockChainDownloader *downloader = [self downloader];
+    WSMockScoredPeer *downloadPeer = [self peerWithHost:@"127.0.0.1"];
+    downloadPeer.mockResponseTime = 2.0;
+    downloadPeer.mockThroughput = 32 * 1024;
+    WSMockScoredPeer *fastPeer = [self peerWithHost:@"127.0.0.2"];
+    fastPeer.mockResponseTime = 0.1;
+    fastPeer.mockThroughput = 1024 * 1024;
+
+    WSMockDownloadPeerGroup *peerGroup = [self peerGroupWithPeers:@[downloadPeer, fastPeer]];
+    downloader.peerGroup = peerGroup;
+    downloader.downloadPeer = downloadPeer;
+
+    [downloader evaluateDownloadPeer];
+    XCTAssertEqualObjects(peerGroup.disconnectedPeers, @[downloadPeer]);
+    XCTAssertEqual(downloadPeer.numberOfPings, 1);
+    XCTAssertEqual(fastPeer.numberOfPings, 1);
+}
+
+- (void)testEvaluateKeepsPeerWithinHysteresis
+{
+    WSBlockChainDownloader *downloader = [self downloader];
+    WSMockScoredPeer *downloadPeer = [self peerWithHost:@"127.0.0.1"];
+    downloadPeer.mockResponseTime = 0.2;
+    downloadPeer.mockThroughput = 512 * 1024;
+    WSMockScoredPeer *betterPeer = [self peerWithHost:@"127.0.0.2"];
+    betterPeer.mockResponseTime = 0.15;
+    betterPeer.mockThroughput = 768 * 1024;
+    XCTAssertGreaterThan([downloader scoreOfPeer:betterPeer], [downloader scoreOfPeer:downloadPeer]);
+    XCTAssertLessThan([downloader scoreOfPeer:betterPeer], WSBlockChainDownloaderPeerSwitchRatio * [downloader scoreOfPeer:downloadPeer]);
+
+    WSMockDownloadPeerGroup *peerGroup = [self peerGroupWithPeers:@[downloadPeer, betterPeer]];
+    downloader.peerGroup = peerGroup;
+    downloader.downloadPeer = downloadPeer;
+
+    [downloader evaluateDownloadPeer];
+    XCTAssertEqual(peerGroup.disconnectedPeers.count, 0);
+    XCTAssertEqual(betterPeer.numberOfPings, 1);
+}
+
+- (void)testEvaluateIgnoresLaggingPeer
+{
+    WSBlockChainDownloader *downloader = [self downloader];
+    WSMockScoredPeer *downloadPeer = [self peerWithHost:@"127.0.0.1"];
+    downloadPeer.mockResponseTime = 2.0;
+    downloadPeer.mockThroughput = 32 * 1024;
+    WSMockScoredPeer *laggingPeer = [self peerWithHost:@"127.0.0.2"];
+    laggingPeer.mockLastBlockHeight = downloadPeer.mockLastBlockHeight - WSBlockChainDownloaderPeerHeightTolerance - 1;
+    laggingPeer.mockResponseTime = 0.1;
+    laggingPeer.mockThroughput = 1024 * 1024;
+
+    WSMockDownloadPeerGroup *peerGroup = [self peerGroupWithPeers:@[downloadPeer, laggingPeer]];
+    downloader.peerGroup = peerGroup;
+    downloader.downloadPeer = downloadPeer;
+
+    [downloader evaluateDownloadPeer];
+    XCTAssertEqual(peerGroup.disconnectedPeers.count, 0);
+}
+
+- (void)testEvaluateSkipsWhenSynced
+{
+    WSBlockChainDownloader *downloader = [self downloader];
+    WSMockScoredPeer *downloadPeer = [self peerWithHost:@"127.0.0.1"];
+    downloadPeer.mockLastBlockHeight = 0;
+    WSMockScoredPeer *fastPeer = [self peerWithHost:@"127.0.0.2"];
+    fastPeer.mockResponseTime = 0.1;
+    fastPeer.mockThroughput = 1024 * 1024;
+
+    WSMockDownloadPeerGroup *peerGroup = [self peerGroupWithPeers:@[downloadPeer, fastPeer]];
+    downloader.peerGroup = peerGroup;
+    downloader.downloadPeer = downloadPeer;
+
+    [downloader evaluateDownloadPeer];
+    XCTAssertEqual(peerGroup.disconnectedPeers.count, 0);
+    XCTAssertEqual(fastPeer.numberOfPings, 0);
+}
+
+- (void)testHeadersSegmentRange
+{
+    WSSyntheticPeer *syntheticPeer = [[WSSyntheticPeer alloc] init];
+    [syntheticPeer generateBlocks:20 walletAddresses:nil numberOfTransactions:0];
+    NSArray *headers = [syntheticPeer allHeaders];
+    [syntheticPeer stop];
+
+    id<WSHeadersSegmentTests> segment = [self segmentWithHeaders:headers startHeight:0 stopHeight:10];
+    XCTAssertTrue([segment shouldAcceptHeader:headers[1]]);
+    XCTAssertFalse([segment shouldAcceptHeader:headers[2]]);
+    XCTAssertFalse([segment shouldAcceptHeader:headers[11]]);
+
+    // headers linked to the checkpoint belong to the next segment
+    segment.lastId = [headers[10] blockId];
+    segment.lastHeight = 10;
+    XCTAssertTrue([segment isComplete]);
+    XCTAssertFalse([segment shouldAcceptHeader:headers[11]]);
+}
+
+- (void)testHeadersSegmentsAssignmentAndStitching
+{
+    WSSyntheticPeer *syntheticPeer = [[WSSyntheticPeer alloc] init];
+    [syntheticPeer generateBlocks:30 walletAddresses:nil numberOfTransactions:0];
+    NSArray *headers = [syntheticPeer allHeaders];
+    WSParameters *parameters = syntheticPeer.parameters;
+    [syntheticPeer stop];
+
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:parameters];
+    WSBlockChainDownloader *downloader = [[WSBlockChainDownloader alloc] initWithStore:store headersOnly:YES];
+    WSMockScoredPeer *peer1 = [self peerWithHost:@"127.0.0.1" parameters:parameters];
+    WSMockScoredPeer *peer2 = [self peerWithHost:@"127.0.0.2" parameters:parameters];
+
+    WSBlockDownloadScheduler *scheduler = [[WSBlockDownloadScheduler alloc] initWithInventoryType:WSInventoryTypeFilteredBlock];
+    [scheduler addPeer:peer1];
+    [scheduler addPeer:peer2];
+    downloader.blockScheduler = scheduler;
+    downloader.downloadPeer = peer1;
+
+    NSArray *segments = @[[self segmentWithHeaders:headers startHeight:0 stopHeight:10],
+                          [self segmentWithHeaders:headers startHeight:10 stopHeight:20],
+                          [self segmentWithHeaders:headers startHeight:20 stopHeight:30]];
+    downloader.headersSegments = [segments mutableCopy];
+
+    // earliest segments first, one per peer
+    [downloader assignHeadersSegments];
+    XCTAssertEqual([segments[0] peer], peer1);
+    XCTAssertEqual([segments[1] peer], peer2);
+    XCTAssertNil([segments[2] peer]);
+    XCTAssertEqualObjects(peer1.requestedStopIds, @[[headers[10] blockId]]);
+    XCTAssertEqualObjects(peer2.requestedStopIds, @[[headers[20] blockId]]);
+
+    // later segment completes first, held until earlier ones are stitched
+    [downloader handleHeaders:[headers subarrayWithRange:NSMakeRange(11, 10)] forSegmentFromPeer:peer2];
+    XCTAssertTrue([segments[1] isComplete]);
+    XCTAssertEqual([segments[2] peer], peer2);
+    XCTAssertEqual(downloader.currentHeight, 0);
+
+    // headers outside the assigned segment are ignored
+    [downloader handleHeaders:[headers subarrayWithRange:NSMakeRange(21, 10)] forSegmentFromPeer:peer1];
+    XCTAssertEqual([segments[0] lastHeight], 0);
+
+    // partial response asks for the rest
+    [downloader handleHeaders:[headers subarrayWithRange:NSMakeRange(1, 5)] forSegmentFromPeer:peer1];
+    XCTAssertEqual([segments[0] lastHeight], 5);
+    XCTAssertEqual(peer1.requestedStopIds.count, 2);
+
+    [downloader handleHeaders:[headers subarrayWithRange:NSMakeRange(6, 5)] forSegmentFromPeer:peer1];
+    XCTAssertEqual(downloader.currentHeight, 20);
+    XCTAssertEqual(downloader.headersSegments.count, 1);
+
+    // last segment stitched, serial download resumes from download peer
+    [downloader handleHeaders:[headers subarrayWithRange:NSMakeRange(21, 10)] forSegmentFromPeer:peer2];
+    XCTAssertEqual(downloader.currentHeight, 30);
+    XCTAssertNil(downloader.headersSegments);
+    XCTAssertEqualObjects([peer1.requestedStopIds lastObject], [NSNull null]);
+}
+
+#pragma mark Helpers
+
+- (WSMockScoredPeer *)peerWithHost:(NSString *)host
+{
+    return [self peerWithHost:host parameters:self.networkParameters];
+}
+
+- (WSMockScoredPeer *)peerWithHost:(NSString *)host parameters:(WSParameters *)parameters
+{
+    WSPeerFlags *flags = [[WSPeerFlags alloc] initWithNeedsBloomFiltering:YES];
+    return [[WSMockScoredPeer alloc] initWithHost:host parameters:parameters flags:flags];
+}
+
+- (id<WSHeadersSegmentTests>)segmentWithHeaders:(NSArray *)headers startHeight:(uint32_t)startHeight stopHeight:(uint32_t)stopHeight
+{
+    WSStorableBlock *checkpoint = [[WSStorableBlock alloc] initWithHeader:headers[stopHeight] transactions:nil height:stopHeight];
+    return [[NSClassFromString(@"WSHeadersSegment") alloc] initWithStartId:[headers[startHeight] blockId] startHeight:startHeight stopCheckpoint:checkpoint];
+}
+
+- (WSBlockChainDownloader *)downloader
+{
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters];
+    return [[WSBlockChainDownloader alloc] initWithStore:store headersOnly:YES];
+}
+
+- (WSMockDownloadPeerGroup *)peerGroupWithPeers:(NSArray *)peers
+{
+    WSConnectionPool *pool = [[WSConnectionPool alloc] initWithParameters:self.networkParameters];
+    dispatch_queue_t queue = dispatch_queue_create("WSBlockChainDownloaderTests", DISPATCH_QUEUE_SERIAL);
+
+    WSMockDownloadPeerGroup *peerGroup = [[WSMockDownloadPeerGroup alloc] initWithParameters:self.networkParameters pool:pool queue:queue];
+    peerGroup.connectedPeers = peers;
+    return peerGroup;
+}
+
+@end
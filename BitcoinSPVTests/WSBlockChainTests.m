@@ -27,6 +27,12 @@
 #import "WSBlockLocator.h"
 #import "WSFilteredBlock.h"
 #import "WSBlockChain.h"
+#import "WSMappedBlockStore.h"
+#import "WSPackedBlockStore.h"
+#import "WSSQLiteBlockStore.h"
+#import "WSHeaderTable.h"
+#import "WSOrphanPool.h"
+#import "WSCoreDataManager.h"
 #import "WSStorableBlock+BlockChain.h"
 #import "WSMacrosPrivate.h"
 
@@ -35,6 +41,12 @@
 static WSBlockHeader *WSMakeDummyHeader(WSParameters *networkParameters, WSHash256 *blockId, WSHash256 *previousBlockId, NSUInteger work);
 static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WSHash256 *blockId);
 
+@interface WSLegacyBlockChainDelegate : NSObject <WSBlockChainDelegate>
+
+@property (nonatomic, strong) NSMutableArray *addedBlocks;
+
+@end
+
 @interface WSBlockChainTests : XCTestCase <WSBlockChainDelegate>
 
 @property (nonatomic, strong) WSHDWallet *wallet;
@@ -124,6 +136,56 @@ static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WS
     XCTAssertEqualObjects(previousBlock.blockId, WSHash256FromHex(@"000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943"));
 }
 
+- (void)testHeights
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    WSBlockChain *chain = [self chainWithLocalHeaders];
+    NSArray *ids = [chain allBlockIds];
+    XCTAssertEqual(ids.count, chain.currentHeight + 1);
+
+    for (uint32_t height = 0; height <= chain.currentHeight; ++height) {
+        WSStorableBlock *block = [chain blockAtHeight:height];
+        XCTAssertEqual(block.height, height);
+        XCTAssertEqualObjects(block.blockId, ids[chain.currentHeight - height]);
+    }
+    XCTAssertNil([chain blockAtHeight:(chain.currentHeight + 1)]);
+}
+
+- (void)testAncestors
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    WSBlockChain *chain = [self chainWithLocalHeaders];
+    WSStorableBlock *base = [chain blockAtHeight:5];
+    WSStorableBlock *forkHead = nil;
+
+    // long fork with less work than main chain
+    WSHash256 *previousBlockId = base.blockId;
+    for (NSUInteger i = 1; i <= 40; ++i) {
+        WSHash256 *blockId = WSHash256FromHex([NSString stringWithFormat:@"%064lx", (unsigned long)i]);
+        forkHead = [chain addBlockWithHeader:WSMakeDummyHeader(self.networkParameters, blockId, previousBlockId, 1)
+                                transactions:nil
+                                    location:NULL
+                            connectedOrphans:NULL
+                             reorganizeBlock:NULL
+                                       error:NULL];
+        XCTAssertNotNil(forkHead);
+        previousBlockId = blockId;
+    }
+    XCTAssertEqual(forkHead.height, 45);
+    XCTAssertEqual(chain.currentHeight, 20);
+    XCTAssertEqualObjects([chain findForkBaseFromHead:forkHead], base);
+
+    for (uint32_t height = 0; height <= forkHead.height; ++height) {
+        WSStorableBlock *ancestor = [forkHead ancestorAtHeight:height inChain:chain];
+        XCTAssertEqual(ancestor.height, height);
+        XCTAssertTrue([ancestor isBehindBlock:forkHead inChain:chain]);
+    }
+    XCTAssertEqualObjects([forkHead ancestorAtHeight:5 inChain:chain], base);
+    XCTAssertFalse([[chain blockAtHeight:6] isBehindBlock:forkHead inChain:chain]);
+}
+
 - (void)testEmptyLocator
 {
     self.networkType = WSNetworkTypeTestnet3;
@@ -522,6 +584,653 @@ static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WS
     DDLogInfo(@"Wallet: %@", self.wallet);
 }
 
+- (void)testMappedStore
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"MappedBlockStoreTests" extension:@"blocks"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSMappedBlockStore *store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to open store: %@", error);
+
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+    XCTAssertEqualObjects(chain.head.workString, expChain.head.workString);
+
+    [store removeTail];
+    XCTAssertEqual(store.size, 20);
+    [store synchronize];
+    store = nil;
+
+    store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+    XCTAssertEqual(store.size, 20);
+    XCTAssertEqualObjects(store.head.blockId, expChain.head.blockId);
+    XCTAssertEqual(store.head.height, 20);
+    XCTAssertNil([store blockForId:[self.networkParameters genesisBlockId]]);
+    [self assertSkipBlocksInChain:[[WSBlockChain alloc] initWithStore:store] matchChain:expChain];
+}
+
+- (void)testMappedStoreStaleIndex
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"MappedBlockStoreStaleIndexTests" extension:@"blocks"];
+    NSString *indexPath = [path stringByAppendingString:@"-index"];
+    NSString *crashedPath = [path stringByAppendingString:@"-crashed"];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *suffix in @[@"", @"-index", @"-transactions"]) {
+        [fileManager removeItemAtPath:[path stringByAppendingString:suffix] error:NULL];
+        [fileManager removeItemAtPath:[crashedPath stringByAppendingString:suffix] error:NULL];
+    }
+
+    NSError *error;
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    @autoreleasepool {
+        WSMappedBlockStore *store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+        XCTAssertNotNil(store, @"Unable to open store: %@", error);
+        [self chainWithLocalHeadersInStore:store];
+    }
+    NSData *staleIndex = [NSData dataWithContentsOfFile:indexPath];
+
+    // removals don't change record count, only the generation tells the index is stale
+    @autoreleasepool {
+        WSMappedBlockStore *store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+        XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+        for (NSUInteger i = 0; i < 3; ++i) {
+            [store removeTail];
+        }
+        [store synchronize];
+
+        // copied while open, as if crashed
+        for (NSString *suffix in @[@"", @"-index", @"-transactions"]) {
+            XCTAssertTrue([fileManager copyItemAtPath:[path stringByAppendingString:suffix] toPath:[crashedPath stringByAppendingString:suffix] error:&error]);
+        }
+    }
+    XCTAssertTrue([staleIndex writeToFile:indexPath atomically:YES]);
+
+    WSMappedBlockStore *store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+    XCTAssertEqual(store.size, 18);
+    XCTAssertNil([store blockForId:[self.networkParameters genesisBlockId]]);
+    XCTAssertNil([store blockForId:[expChain blockAtHeight:2].blockId]);
+    XCTAssertEqualObjects([store blockForId:[expChain blockAtHeight:3].blockId].blockId, [expChain blockAtHeight:3].blockId);
+    XCTAssertEqualObjects(store.head.blockId, expChain.head.blockId);
+
+    // dirty store rebuilds index on open
+    WSMappedBlockStore *crashedStore = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:crashedPath error:&error];
+    XCTAssertNotNil(crashedStore, @"Unable to open crashed store: %@", error);
+    XCTAssertEqual(crashedStore.size, 18);
+    XCTAssertNil([crashedStore blockForId:[self.networkParameters genesisBlockId]]);
+    XCTAssertEqualObjects(crashedStore.head.blockId, expChain.head.blockId);
+}
+
+- (void)testMappedStoreTransactions
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"MappedBlockStoreTransactionsTests" extension:@"blocks"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSMappedBlockStore *store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to open store: %@", error);
+    WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+
+    WSStorableBlock *block = [chain blockAtHeight:10];
+    NSOrderedSet *transactions = WSMakeDummyTransactions(self.networkParameters, block.blockId);
+    [store putBlock:[[WSStorableBlock alloc] initWithHeader:block.header transactions:transactions height:block.height work:block.workData]];
+    WSStorableBlock *emptyBlock = [chain blockAtHeight:11];
+    [store putBlock:[[WSStorableBlock alloc] initWithHeader:emptyBlock.header transactions:transactions height:emptyBlock.height work:emptyBlock.workData]];
+    [store putBlock:emptyBlock];
+    [store synchronize];
+    store = nil;
+
+    store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+    NSOrderedSet *storedTransactions = [store blockForId:block.blockId].transactions;
+    XCTAssertEqual(storedTransactions.count, transactions.count);
+    XCTAssertEqualObjects([[[storedTransactions firstObject] toBuffer] data], [[[transactions firstObject] toBuffer] data]);
+    XCTAssertEqual([store blockForId:emptyBlock.blockId].transactions.count, 0);
+
+    for (NSUInteger i = 0; i <= 10; ++i) {
+        [store removeTail];
+    }
+    XCTAssertNil([store blockForId:block.blockId]);
+    [store synchronize];
+    store = nil;
+
+    store = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+    XCTAssertEqual(store.size, 10);
+}
+
+- (void)testStoreTailOnActiveChain
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"MappedBlockStoreActiveTailTests" extension:@"blocks"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSMappedBlockStore *mappedStore = [[WSMappedBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(mappedStore, @"Unable to open store: %@", error);
+    NSArray *stores = @[[[WSPackedBlockStore alloc] initWithParameters:self.networkParameters], mappedStore];
+
+    for (id<WSBlockStore> store in stores) {
+        WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+        WSStorableBlock *sideBlock = [chain blockAtHeight:19];
+
+        // heavier fork from height #18, appended after the side branch
+        WSHash256 *previousBlockId = [chain blockAtHeight:18].blockId;
+        NSMutableArray *forkIds = [[NSMutableArray alloc] init];
+        for (NSUInteger i = 1; i <= 3; ++i) {
+            WSHash256 *blockId = WSHash256FromHex([NSString stringWithFormat:@"%064lx", (unsigned long)i]);
+            XCTAssertNotNil([chain addBlockWithHeader:WSMakeDummyHeader(self.networkParameters, blockId, previousBlockId, UINT32_MAX)
+                                         transactions:nil
+                                             location:NULL
+                                     connectedOrphans:NULL
+                                      reorganizeBlock:NULL
+                                                error:NULL]);
+            [forkIds addObject:blockId];
+            previousBlockId = blockId;
+        }
+        XCTAssertEqualObjects(chain.head.blockId, [forkIds lastObject]);
+        XCTAssertEqual(store.size, 24);
+
+        // tail follows the fork, not the first child of #18
+        for (NSUInteger i = 0; i <= 19; ++i) {
+            [store removeTail];
+        }
+        XCTAssertNil([store blockForId:[forkIds firstObject]]);
+        XCTAssertNotNil([store blockForId:sideBlock.blockId]);
+        XCTAssertEqualObjects(store.head.blockId, [forkIds lastObject]);
+        XCTAssertEqual(store.size, 4);
+    }
+}
+
+- (void)testSQLiteStore
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"SQLiteBlockStoreTests" extension:@"sqlite"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSSQLiteBlockStore *store = [[WSSQLiteBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to open store: %@", error);
+
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+    XCTAssertEqualObjects(chain.head.workString, expChain.head.workString);
+
+    [store removeTail];
+    XCTAssertEqual(store.size, 20);
+    [store synchronize];
+    store = nil;
+
+    store = [[WSSQLiteBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+    XCTAssertEqual(store.size, 20);
+    XCTAssertEqualObjects(store.head.blockId, expChain.head.blockId);
+    XCTAssertEqualObjects(store.head.workString, expChain.head.workString);
+    XCTAssertEqual(store.head.height, 20);
+    XCTAssertNil([store blockForId:[self.networkParameters genesisBlockId]]);
+    [self assertSkipBlocksInChain:[[WSBlockChain alloc] initWithStore:store] matchChain:expChain];
+
+    [store removeTail];
+    XCTAssertEqual(store.size, 19);
+    XCTAssertEqual([[store allBlocks] count], 19);
+}
+
+- (void)testSQLiteStoreTail
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"SQLiteBlockStoreTailTests" extension:@"sqlite"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSSQLiteBlockStore *store = [[WSSQLiteBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to open store: %@", error);
+    WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+
+    // short fork from height #2
+    WSHash256 *previousBlockId = [chain blockAtHeight:2].blockId;
+    for (NSUInteger i = 1; i <= 3; ++i) {
+        WSHash256 *blockId = WSHash256FromHex([NSString stringWithFormat:@"%064lx", (unsigned long)i]);
+        XCTAssertNotNil([chain addBlockWithHeader:WSMakeDummyHeader(self.networkParameters, blockId, previousBlockId, 1)
+                                     transactions:nil
+                                         location:NULL
+                                 connectedOrphans:NULL
+                                  reorganizeBlock:NULL
+                                            error:NULL]);
+        previousBlockId = blockId;
+    }
+    XCTAssertEqual(store.size, 24);
+
+    // whole fork dropped with its base
+    [store removeTail];
+    [store removeTail];
+    XCTAssertEqual(store.size, 22);
+    [store removeTail];
+    XCTAssertEqual(store.size, 18);
+    XCTAssertNil([store blockForId:previousBlockId]);
+    XCTAssertEqualObjects(store.head, chain.head);
+
+    [store synchronize];
+    store = nil;
+
+    store = [[WSSQLiteBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(store, @"Unable to reopen store: %@", error);
+    XCTAssertEqual(store.size, 18);
+    XCTAssertEqual([[store allBlocks] count], 18);
+}
+
+- (void)testMemoryStoreTail
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters];
+    WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+
+    // short fork from height #2
+    WSHash256 *previousBlockId = [chain blockAtHeight:2].blockId;
+    for (NSUInteger i = 1; i <= 3; ++i) {
+        WSHash256 *blockId = WSHash256FromHex([NSString stringWithFormat:@"%064lx", (unsigned long)i]);
+        XCTAssertNotNil([chain addBlockWithHeader:WSMakeDummyHeader(self.networkParameters, blockId, previousBlockId, 1)
+                                     transactions:nil
+                                         location:NULL
+                                 connectedOrphans:NULL
+                                  reorganizeBlock:NULL
+                                            error:NULL]);
+        previousBlockId = blockId;
+    }
+    XCTAssertEqual(store.size, 24);
+    WSHash256 *sixthBlockId = [chain blockAtHeight:6].blockId;
+
+    // whole fork dropped with its base
+    [store removeTail];
+    [store removeTail];
+    XCTAssertEqual(store.size, 22);
+    [store removeTail];
+    XCTAssertEqual(store.size, 18);
+    XCTAssertEqual([[store allBlocks] count], 18);
+    XCTAssertNil([store blockForId:previousBlockId]);
+    for (NSUInteger i = 0; i < 3; ++i) {
+        [store removeTail];
+    }
+    XCTAssertEqual(store.size, 15);
+    XCTAssertNotNil([store blockForId:sixthBlockId]);
+    XCTAssertEqualObjects(store.head, chain.head);
+
+    [store findAndRestoreTail];
+    [store removeTail];
+    XCTAssertEqual(store.size, 14);
+    XCTAssertNil([store blockForId:sixthBlockId]);
+}
+
+- (void)testPackedStore
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    WSPackedBlockStore *store = [[WSPackedBlockStore alloc] initWithParameters:self.networkParameters];
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+    XCTAssertEqualObjects(chain.head.workString, expChain.head.workString);
+    XCTAssertEqual(store.table.count, 21);
+    [self assertSkipBlocksInChain:chain matchChain:expChain];
+
+    for (uint32_t height = 0; height <= 20; ++height) {
+        WSStorableBlock *block = [chain blockAtHeight:height];
+        WSStorableBlock *expBlock = [expChain blockAtHeight:height];
+        XCTAssertEqualObjects(block.header, expBlock.header);
+        XCTAssertEqual(block.height, height);
+        XCTAssertEqualObjects(block.workString, expBlock.workString);
+    }
+
+    [store removeTail];
+    XCTAssertEqual(store.size, 20);
+    XCTAssertNil([store blockForId:[self.networkParameters genesisBlockId]]);
+    [store findAndRestoreTail];
+    [store removeTail];
+    XCTAssertEqual(store.size, 19);
+    XCTAssertEqualObjects(store.head.blockId, expChain.head.blockId);
+
+    [store truncate];
+    XCTAssertEqual(store.size, 1);
+    XCTAssertEqualObjects(store.head.blockId, [self.networkParameters genesisBlockId]);
+}
+
+- (void)testLazyTransactionsInStores
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"SQLiteBlockStoreLazyTests" extension:@"sqlite"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSSQLiteBlockStore *sqliteStore = [[WSSQLiteBlockStore alloc] initWithParameters:self.networkParameters path:path error:&error];
+    XCTAssertNotNil(sqliteStore, @"Unable to open store: %@", error);
+    NSArray *stores = @[[[WSPackedBlockStore alloc] initWithParameters:self.networkParameters], sqliteStore];
+
+    for (id<WSBlockStore> store in stores) {
+        WSBlockChain *chain = [self chainWithLocalHeadersInStore:store];
+        WSStorableBlock *head = chain.head;
+        NSOrderedSet *transactions = WSMakeDummyTransactions(self.networkParameters, head.blockId);
+
+        __block NSUInteger loads = 0;
+        WSStorableBlock *lazyBlock = [[WSStorableBlock alloc] initWithHeader:head.header transactionsLoader:^NSOrderedSet *{
+            ++loads;
+            return transactions;
+        } height:head.height work:head.workData];
+
+        [store putBlock:lazyBlock];
+        XCTAssertEqual(loads, 0);
+        XCTAssertFalse([lazyBlock hasLoadedTransactions]);
+
+        WSStorableBlock *block = [store blockForId:head.blockId];
+        XCTAssertFalse([block hasLoadedTransactions]);
+        XCTAssertEqual(loads, 0);
+        XCTAssertEqualObjects(block.transactions, transactions);
+        XCTAssertEqual(loads, 1);
+
+        // loaded now, rewriting persists the transactions
+        [store putBlock:block];
+        XCTAssertEqualObjects([store blockForId:head.blockId].transactions, transactions);
+        XCTAssertEqual(loads, 1);
+    }
+}
+
+- (void)testBatchHeaders
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    NSArray *headers = [self localHeaders];
+
+    WSBlockChain *chain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    NSError *error;
+    NSArray *addedBlocks = [chain addBlockHeaders:headers error:&error];
+    XCTAssertEqual(addedBlocks.count, headers.count, @"Unable to add headers: %@", error);
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+    XCTAssertEqualObjects(chain.head.workString, expChain.head.workString);
+    XCTAssertEqualObjects([chain blockAtHeight:10].blockId, [expChain blockAtHeight:10].blockId);
+
+    // overlapping batch stops at first duplicate
+    addedBlocks = [chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(18, 2)] error:&error];
+    XCTAssertEqual(addedBlocks.count, 0);
+    XCTAssertEqualObjects(chain.head.blockId, expChain.head.blockId);
+
+    // split batch
+    chain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    addedBlocks = [chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(0, 12)] error:&error];
+    XCTAssertEqual(addedBlocks.count, 12);
+    XCTAssertEqual(chain.currentHeight, 12);
+
+    // orphans connected once the gap is filled
+    WSBlockChainLocation location;
+    NSArray *connectedOrphans;
+    addedBlocks = [chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(15, 5)] location:&location connectedOrphans:NULL reorganizeBlock:NULL error:&error];
+    XCTAssertEqual(addedBlocks.count, 5);
+    XCTAssertEqual(location, WSBlockChainLocationOrphan);
+    XCTAssertEqual(chain.currentHeight, 12);
+    addedBlocks = [chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(12, 3)] location:&location connectedOrphans:&connectedOrphans reorganizeBlock:NULL error:&error];
+    XCTAssertEqual(addedBlocks.count, 3);
+    XCTAssertEqual(location, WSBlockChainLocationMain);
+    XCTAssertEqual(connectedOrphans.count, 5);
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+}
+
+- (void)testBatchHeadersLegacyDelegate
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSArray *headers = [self localHeaders];
+    WSLegacyBlockChainDelegate *delegate = [[WSLegacyBlockChainDelegate alloc] init];
+
+    WSBlockChain *chain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    chain.delegate = delegate;
+
+    // delegates without batch callback are notified once per block, in order
+    NSError *error;
+    NSArray *addedBlocks = [chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(0, 12)] error:&error];
+    XCTAssertEqual(addedBlocks.count, 12, @"Unable to add headers: %@", error);
+    XCTAssertEqualObjects(delegate.addedBlocks, addedBlocks);
+}
+
+- (void)testOrphanPool
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    WSOrphanPool *pool = [[WSOrphanPool alloc] initWithMaxSize:3 maxAge:60.0];
+    WSHash256 *parentId = WSHash256FromHex(@"1111111111111111111111111111111111111111111111111111111111111111");
+    NSMutableArray *orphans = [[NSMutableArray alloc] init];
+    for (NSUInteger i = 0; i < 4; ++i) {
+        WSHash256 *blockId = WSHash256FromHex([NSString stringWithFormat:@"%064lx", (unsigned long)(i + 1)]);
+        WSHash256 *previousBlockId = ((i < 2) ? parentId : [orphans[i - 1] blockId]);
+        [orphans addObject:[[WSStorableBlock alloc] initWithHeader:WSMakeDummyHeader(self.networkParameters, blockId, previousBlockId, 1) transactions:nil]];
+    }
+
+    [pool addOrphan:orphans[0]];
+    [pool addOrphan:orphans[1]];
+    [pool addOrphan:orphans[2]];
+    XCTAssertEqual(pool.count, 3);
+
+    // membership checks must not affect eviction order
+    XCTAssertTrue([pool containsOrphanWithId:[orphans[1] blockId]]);
+
+    // touch first orphan, second is now least recently used
+    XCTAssertNotNil([pool orphanForId:[orphans[0] blockId]]);
+    [pool addOrphan:orphans[3]];
+    XCTAssertEqual(pool.count, 3);
+    XCTAssertEqual(pool.numberOfEvictedOrphans, 1);
+    XCTAssertFalse([pool containsOrphanWithId:[orphans[1] blockId]]);
+
+    NSArray *children = [pool removeOrphansWithParentId:parentId];
+    XCTAssertEqualObjects(children, @[orphans[0]]);
+    XCTAssertEqualObjects([pool removeOrphansWithParentId:[orphans[2] blockId]], @[orphans[3]]);
+    XCTAssertEqual(pool.count, 1);
+    XCTAssertEqual(pool.numberOfAddedOrphans, 4);
+    XCTAssertEqual(pool.numberOfConnectedOrphans, 2);
+}
+
+- (void)testSnapshot
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"HeadersSnapshotTests" extension:@"headers"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    XCTAssertTrue([expChain exportHeadersToPath:path error:&error], @"Unable to export headers: %@", error);
+
+    WSBlockChain *chain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    XCTAssertTrue([chain importHeadersFromPath:path error:&error], @"Unable to import headers: %@", error);
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+    XCTAssertEqualObjects(chain.head.blockId, expChain.head.blockId);
+    XCTAssertEqualObjects(chain.head.workString, expChain.head.workString);
+    [self assertSkipBlocksInChain:chain matchChain:expChain];
+
+    // flip a byte, checksum must fail
+    NSMutableData *data = [[NSData dataWithContentsOfFile:path] mutableCopy];
+    const NSUInteger nonceOffset = 16 + 5 * 80 + 76;
+    ((uint8_t *)data.mutableBytes)[nonceOffset] ^= 0xff;
+    [data writeToFile:path atomically:YES];
+
+    chain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    XCTAssertFalse([chain importHeadersFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeMalformed);
+
+    // fix checksum, proof-of-work must fail
+    const NSUInteger checksumOffset = data.length - WSHash256Length;
+    NSData *checksum = [[data subdataWithRange:NSMakeRange(0, checksumOffset)] hash256];
+    [data replaceBytesInRange:NSMakeRange(checksumOffset, WSHash256Length) withBytes:checksum.bytes];
+    [data writeToFile:path atomically:YES];
+
+    XCTAssertFalse([chain importHeadersFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeInvalidBlock);
+    XCTAssertEqual(chain.currentHeight, 0);
+}
+
+- (void)testSnapshotWork
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"HeadersSnapshotWorkTests" extension:@"headers"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSBlockChain *shortChain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    XCTAssertEqual([shortChain addBlockHeaders:[[self localHeaders] subarrayWithRange:NSMakeRange(0, 12)] error:&error].count, 12);
+    XCTAssertTrue([shortChain exportHeadersToPath:path error:&error], @"Unable to export headers: %@", error);
+
+    // shorter snapshot doesn't replace a better chain
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    WSBlockChain *chain = [self chainWithLocalHeaders];
+    XCTAssertFalse([chain importHeadersFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeInvalidBlock);
+    XCTAssertEqualObjects([chain allBlockIds], [expChain allBlockIds]);
+
+    // same work is rejected too
+    XCTAssertTrue([expChain exportHeadersToPath:path error:&error], @"Unable to export headers: %@", error);
+    XCTAssertFalse([chain importHeadersFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeInvalidBlock);
+    XCTAssertEqualObjects(chain.head.blockId, expChain.head.blockId);
+
+    // longer snapshot replaces a shorter chain
+    XCTAssertTrue([shortChain importHeadersFromPath:path error:&error], @"Unable to import headers: %@", error);
+    XCTAssertEqualObjects([shortChain allBlockIds], [expChain allBlockIds]);
+}
+
+- (void)testSnapshotAnchor
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockNetworkPathForFilename:@"HeadersSnapshotAnchorTests" extension:@"headers"];
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+
+    NSError *error;
+    WSBlockChain *expChain = [self chainWithLocalHeaders];
+    XCTAssertTrue([expChain exportHeadersToPath:path error:&error], @"Unable to export headers: %@", error);
+    NSData *exported = [NSData dataWithContentsOfFile:path];
+
+    // trailer: base height, head height, base work, head work, checksum
+    const NSUInteger trailerOffset = exported.length - 104;
+
+    // shift heights, base is no longer genesis nor a checkpoint
+    NSMutableData *data = [exported mutableCopy];
+    uint32_t heights[2] = {CFSwapInt32HostToLittle(1), CFSwapInt32HostToLittle(21)};
+    [data replaceBytesInRange:NSMakeRange(trailerOffset, sizeof(heights)) withBytes:heights];
+    [self fixSnapshotChecksumInData:data];
+    [data writeToFile:path atomically:YES];
+
+    // failed imports leave current chain untouched
+    WSBlockChain *chain = [self chainWithLocalHeaders];
+    XCTAssertFalse([chain importHeadersFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeInvalidBlock);
+    XCTAssertEqual(chain.currentHeight, 20);
+    XCTAssertEqualObjects(chain.head.blockId, expChain.head.blockId);
+
+    // base work isn't trusted, inflating both works is rejected
+    data = [exported mutableCopy];
+    ((uint8_t *)data.mutableBytes)[trailerOffset + 8] ^= 0x01;
+    ((uint8_t *)data.mutableBytes)[trailerOffset + 40] ^= 0x01;
+    [self fixSnapshotChecksumInData:data];
+    [data writeToFile:path atomically:YES];
+
+    XCTAssertFalse([chain importHeadersFromPath:path error:&error]);
+    XCTAssertEqual(error.code, WSErrorCodeInvalidBlock);
+    XCTAssertEqual(chain.currentHeight, 20);
+}
+
+- (void)testIncrementalCoreDataSave
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    NSString *path = [self mockPathForFile:@"BlockChainTests-Incremental.sqlite"];
+    WSCoreDataManager *manager = [[WSCoreDataManager alloc] initWithPath:path error:NULL];
+    XCTAssertNotNil(manager);
+    [manager truncate];
+
+    NSArray *headers = [self localHeaders];
+    WSBlockChain *chain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    NSError *error;
+    XCTAssertEqual([[chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(0, 10)] error:&error] count], 10);
+
+    // first save is full, following saves only write new blocks
+    [chain saveToCoreDataManager:manager];
+    XCTAssertEqual([[chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(10, 5)] error:&error] count], 5);
+    [chain saveToCoreDataManager:manager];
+    XCTAssertEqual([[chain addBlockHeaders:[headers subarrayWithRange:NSMakeRange(15, 5)] error:&error] count], 5);
+    [chain saveToCoreDataManager:manager];
+
+    // wait for background writer
+    [manager.context performBlockAndWait:^{
+        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"WSStorableBlockEntity"];
+        XCTAssertEqual([manager.context countForFetchRequest:request error:NULL], headers.count + 1);
+    }];
+
+    WSBlockChain *loadedChain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    [loadedChain loadFromCoreDataManager:manager];
+    XCTAssertEqualObjects([loadedChain allBlockIds], [chain allBlockIds]);
+    XCTAssertEqualObjects(loadedChain.head.workString, chain.head.workString);
+    [self assertSkipBlocksInChain:loadedChain matchChain:chain];
+}
+
+- (void)testFullCoreDataSaveInPlace
+{
+    self.networkType = WSNetworkTypeTestnet3;
+
+    WSCoreDataManager *manager = [[WSCoreDataManager alloc] initWithPath:[self mockPathForFile:@"BlockChainTests-InPlace.sqlite"] error:NULL];
+    WSCoreDataManager *otherManager = [[WSCoreDataManager alloc] initWithPath:[self mockPathForFile:@"BlockChainTests-InPlaceOther.sqlite"] error:NULL];
+    XCTAssertNotNil(manager);
+    XCTAssertNotNil(otherManager);
+    [manager truncate];
+    [otherManager truncate];
+
+    WSBlockChain *chain = [self chainWithLocalHeaders];
+    WSHash256 *blockId = WSHash256FromHex(@"0000000000000000000000000000000000000000000000000000000000000001");
+    XCTAssertNotNil([chain addBlockWithHeader:WSMakeDummyHeader(self.networkParameters, blockId, chain.head.blockId, 1)
+                                 transactions:WSMakeDummyTransactions(self.networkParameters, blockId)
+                                     location:NULL
+                             connectedOrphans:NULL
+                              reorganizeBlock:NULL
+                                        error:NULL]);
+
+    __block BOOL didSave = NO;
+    [chain saveToCoreDataManager:manager completionBlock:^(BOOL success) {
+        didSave = success;
+    }];
+    [chain waitForPendingSavesToCoreDataManager:manager];
+    XCTAssertTrue(didSave);
+    NSSet *objectIDs = [self blockObjectIDsInManager:manager];
+    XCTAssertEqual(objectIDs.count, 22);
+
+    // switching manager back and forth makes both saves full
+    WSBlockChain *loadedChain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    [loadedChain loadFromCoreDataManager:manager];
+    [loadedChain saveToCoreDataManager:otherManager];
+    [loadedChain saveToCoreDataManager:manager];
+    [loadedChain waitForPendingSavesToCoreDataManager:otherManager];
+    [loadedChain waitForPendingSavesToCoreDataManager:manager];
+
+    // lazy blocks still point to live entities
+    XCTAssertEqualObjects([self blockObjectIDsInManager:manager], objectIDs);
+    XCTAssertEqual(loadedChain.head.transactions.count, 1);
+
+    WSBlockChain *reloadedChain = [[WSBlockChain alloc] initWithStore:[[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters]];
+    [reloadedChain loadFromCoreDataManager:manager];
+    XCTAssertEqualObjects([reloadedChain allBlockIds], [chain allBlockIds]);
+    XCTAssertEqual(reloadedChain.head.transactions.count, 1);
+}
+
 #pragma mark WSBlockChainDelegate
 
 - (void)blockChain:(WSBlockChain *)blockChain didAddNewBlock:(WSStorableBlock *)block location:(WSBlockChainLocation)location
@@ -536,6 +1245,15 @@ static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WS
     DDLogInfo(@"Wallet transactions (%lu): %@", (unsigned long)self.wallet.allTransactions.count, self.wallet.allTransactions);
 }
 
+- (void)blockChain:(WSBlockChain *)blockChain didExtendHeadWithBlocks:(NSArray *)blocks
+{
+    DDLogInfo(@"Extended head with %lu blocks: %@", (unsigned long)blocks.count, blockChain.head);
+
+    for (WSStorableBlock *block in blocks) {
+        [self.wallet registerBlock:block matchingFilteredBlock:nil];
+    }
+}
+
 - (void)blockChain:(WSBlockChain *)blockChain didReplaceHead:(WSStorableBlock *)head
 {
     DDLogInfo(@"Replaced head: %@", head);
@@ -565,13 +1283,59 @@ static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WS
 
 #pragma mark Helpers
 
+- (NSSet *)blockObjectIDsInManager:(WSCoreDataManager *)manager
+{
+    __block NSSet *objectIDs = nil;
+    [manager.context performBlockAndWait:^{
+        NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"WSStorableBlockEntity"];
+        request.resultType = NSManagedObjectIDResultType;
+        objectIDs = [NSSet setWithArray:[manager.context executeFetchRequest:request error:NULL]];
+    }];
+    return objectIDs;
+}
+
+- (void)fixSnapshotChecksumInData:(NSMutableData *)data
+{
+    const NSUInteger checksumOffset = data.length - WSHash256Length;
+    NSData *checksum = [[data subdataWithRange:NSMakeRange(0, checksumOffset)] hash256];
+    [data replaceBytesInRange:NSMakeRange(checksumOffset, WSHash256Length) withBytes:checksum.bytes];
+}
+
+// blockForId: reads back from store, so skip pointers must have been restored
+- (void)assertSkipBlocksInChain:(WSBlockChain *)chain matchChain:(WSBlockChain *)expChain
+{
+    for (uint32_t height = 2; height <= expChain.currentHeight; ++height) {
+        WSStorableBlock *expBlock = [expChain blockAtHeight:height];
+        WSStorableBlock *block = [chain blockForId:expBlock.blockId];
+        XCTAssertNotNil(expBlock.skipBlockId);
+        XCTAssertEqualObjects(block.skipBlockId, expBlock.skipBlockId, @"Skip mismatch at height %u", height);
+    }
+}
+
 - (WSBlockChain *)chainWithLocalHeaders
 {
     id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.networkParameters];
+    
+    return [self chainWithLocalHeadersInStore:store];
+}
+
+- (WSBlockChain *)chainWithLocalHeadersInStore:(id<WSBlockStore>)store
+{
     WSBlockChain *chain = [[WSBlockChain alloc] initWithStore:store];
 
+    NSError *error;
+    for (WSBlockHeader *header in [self localHeaders]) {
+//        DDLogInfo(@"Header: %@", header);
+        XCTAssertTrue([chain addBlockWithHeader:header transactions:nil location:NULL connectedOrphans:NULL reorganizeBlock:NULL error:&error], @"Unable to add block %@: %@", header.blockId, error);
+    }
+
+    return chain;
+}
+
+- (NSArray *)localHeaders
+{
     // from height #1
-    NSArray *headers = @[@"0100000043497fd7f826957108f4a30fd9cec3aeba79972084e90ead01ea330900000000bac8b0fa927c0ac8234287e33c5f74d38d354820e24756ad709d7038fc5f31f020e7494dffff001d03e4b67200",
+    NSArray *hexes = @[@"0100000043497fd7f826957108f4a30fd9cec3aeba79972084e90ead01ea330900000000bac8b0fa927c0ac8234287e33c5f74d38d354820e24756ad709d7038fc5f31f020e7494dffff001d03e4b67200",
                          @"0100000006128e87be8b1b4dea47a7247d5528d2702c96826c7a648497e773b800000000e241352e3bec0a95a6217e10c3abb54adfa05abb12c126695595580fb92e222032e7494dffff001d00d2353400",
                          @"0100000020782a005255b657696ea057d5b98f34defcf75196f64f6eeac8026c0000000041ba5afc532aae03151b8aa87b65e1594f97504a768e010c98c0add79216247186e7494dffff001d058dc2b600",
                          @"0100000010befdc16d281e40ecec65b7c9976ddc8fd9bc9752da5827276e898b000000004c976d5776dda2da30d96ee810cd97d23ba852414990d64c4c720f977e651f2daae7494dffff001d02a9764000",
@@ -591,15 +1355,12 @@ static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WS
                          @"0100000043a78ddf30a2d28a42cc66f90d13cb8211ee0fca9dbf8a4cce8c19fe000000004edbd2b89cb6d6fd69b575a62bd4e3103b1e0ce19e31bccf9a093ad8ccd753cf7deb494dffff001d0591a0b300",
                          @"01000000489ac81592595a4004e14331cb096ffef12b1daf709f6378e9c3558d00000000c757bebd6f2c2c071a3cf739a4cf98b27441809790a5cf40652b46df8a98a473b0eb494dffff001d011aedb600",
                          @"01000000a9c570a45d959023551f9a694ace9c12206174f21383f30949ca3b9b00000000eaf93dbbfb3551a1ff8b6bd5ba4cea7508e790c23cd07b9d9e791936a79d5fd4b3eb494dffff001d0385a7dd00"];
-    
-    NSError *error;
-    for (NSString *hex in headers) {
-        WSBlockHeader *header = WSBlockHeaderFromHex(self.networkParameters, hex);
-//        DDLogInfo(@"Header: %@", header);
-        XCTAssertTrue([chain addBlockWithHeader:header transactions:nil location:NULL connectedOrphans:NULL reorganizeBlock:NULL error:&error], @"Unable to add block %@: %@", header.blockId, error);
-    }
 
-    return chain;
+    NSMutableArray *headers = [[NSMutableArray alloc] initWithCapacity:hexes.count];
+    for (NSString *hex in hexes) {
+        [headers addObject:WSBlockHeaderFromHex(self.networkParameters, hex)];
+    }
+    return headers;
 }
 
 @end
@@ -665,3 +1426,30 @@ static NSOrderedSet *WSMakeDummyTransactions(WSParameters *networkParameters, WS
     
     return txs;
 }
+
+@implementation WSLegacyBlockChainDelegate
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self.addedBlocks = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)blockChain:(WSBlockChain *)blockChain didAddNewBlock:(WSStorableBlock *)block location:(WSBlockChainLocation)location
+{
+    if (location == WSBlockChainLocationMain) {
+        [self.addedBlocks addObject:block];
+    }
+}
+
+- (void)blockChain:(WSBlockChain *)blockChain didReplaceHead:(WSStorableBlock *)head
+{
+}
+
+- (void)blockChain:(WSBlockChain *)blockChain didReorganizeAtBase:(WSStorableBlock *)base oldBlocks:(NSArray *)oldBlocks newBlocks:(NSArray *)newBlocks
+{
+}
+
+@end
@@ -0,0 +1,312 @@
+//
+//  WSBlockDownloadSchedulerTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSBlockDownloadScheduler.h"
+#import "WSPeer.h"
+
+static NSArray *WSMakeBlockIds(NSUInteger count);
+
+@interface WSMockDownloadPeer : WSPeer
+
+@property (nonatomic, strong) NSMutableArray *requestedIds; // WSHash256
+
+@end
+
+@implementation WSMockDownloadPeer
+
+- (instancetype)initWithHost:(NSString *)host parameters:(WSParameters *)parameters flags:(WSPeerFlags *)flags
+{
+    if ((self = [super initWithHost:host parameters:parameters flags:flags])) {
+        self.requestedIds = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)sendGetdataMessageWithHashes:(NSArray *)hashes forInventoryType:(WSInventoryType)inventoryType
+{
+    [self.requestedIds addObjectsFromArray:hashes];
+}
+
+@end
+
+#pragma mark -
+
+@interface WSBlockDownloadScheduler (Tests)
+
+- (void)updateWindowForPeer:(WSPeer *)peer withLatency:(NSTimeInterval)latency;
+
+@end
+
+#pragma mark -
+
+@interface WSBlockDownloadSchedulerTests : XCTestCase
+
+- (WSMockDownloadPeer *)peerWithHost:(NSString *)host;
+- (WSBlockDownloadScheduler *)schedulerWithWindowSize:(NSUInteger)windowSize;
+
+@end
+
+@implementation WSBlockDownloadSchedulerTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.networkType = WSNetworkTypeRegtest;
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+- (void)testAssignment
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:20];
+    WSMockDownloadPeer *peer1 = [self peerWithHost:@"127.0.0.1"];
+    WSMockDownloadPeer *peer2 = [self peerWithHost:@"127.0.0.2"];
+    [scheduler addPeer:peer1];
+    [scheduler addPeer:peer2];
+
+    NSArray *blockIds = WSMakeBlockIds(50);
+    [scheduler scheduleBlockIds:blockIds];
+
+    // both windows full, remainder waits for room
+    XCTAssertEqual([scheduler numberOfPendingRequestsForPeer:peer1], 20);
+    XCTAssertEqual([scheduler numberOfPendingRequestsForPeer:peer2], 20);
+    XCTAssertEqual(peer1.requestedIds.count, 20);
+    XCTAssertEqual(peer2.requestedIds.count, 20);
+    XCTAssertEqual(scheduler.numberOfScheduledBlocks, 50);
+
+    NSMutableSet *requestedIds = [[NSMutableSet alloc] initWithArray:peer1.requestedIds];
+    [requestedIds addObjectsFromArray:peer2.requestedIds];
+    XCTAssertEqual(requestedIds.count, 40, @"Same block requested twice");
+    XCTAssertEqualObjects(requestedIds, [NSSet setWithArray:[blockIds subarrayWithRange:NSMakeRange(0, 40)]]);
+
+    // received chunk frees room for the unassigned tail
+    for (WSHash256 *blockId in [peer1.requestedIds subarrayWithRange:NSMakeRange(0, 10)]) {
+        XCTAssertTrue([scheduler receiveBlockWithId:blockId entity:blockId transactions:nil fromPeer:peer1]);
+    }
+    XCTAssertEqual(peer1.requestedIds.count, 30);
+    XCTAssertEqualObjects([peer1.requestedIds subarrayWithRange:NSMakeRange(20, 10)], [blockIds subarrayWithRange:NSMakeRange(40, 10)]);
+
+    // unscheduled blocks are not consumed
+    XCTAssertFalse([scheduler receiveBlockWithId:WSHash256Zero() entity:blockIds[0] transactions:nil fromPeer:peer1]);
+}
+
+- (void)testReassignmentOnPeerLoss
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:30];
+    WSMockDownloadPeer *peer1 = [self peerWithHost:@"127.0.0.1"];
+    WSMockDownloadPeer *peer2 = [self peerWithHost:@"127.0.0.2"];
+    [scheduler addPeer:peer1];
+    [scheduler addPeer:peer2];
+
+    NSArray *blockIds = WSMakeBlockIds(30);
+    [scheduler scheduleBlockIds:blockIds];
+    XCTAssertEqual([scheduler numberOfPendingRequestsForPeer:peer1] + [scheduler numberOfPendingRequestsForPeer:peer2], 30);
+
+    NSArray *lostIds = [peer1.requestedIds copy];
+    XCTAssertGreaterThan(lostIds.count, 0);
+
+    [scheduler removePeer:peer1];
+    XCTAssertFalse([scheduler containsPeer:peer1]);
+    XCTAssertEqual([scheduler numberOfPendingRequestsForPeer:peer2], 30);
+    XCTAssertEqualObjects([NSSet setWithArray:peer2.requestedIds], [NSSet setWithArray:blockIds]);
+
+    // late response from lost peer still counts
+    [scheduler receiveBlockWithId:lostIds[0] entity:lostIds[0] transactions:nil fromPeer:peer1];
+    XCTAssertEqual([scheduler numberOfPendingRequestsForPeer:peer2], 29);
+}
+
+- (void)testStalledReassignment
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:30];
+    scheduler.requestTimeout = 0.0;
+    WSMockDownloadPeer *peer1 = [self peerWithHost:@"127.0.0.1"];
+    [scheduler addPeer:peer1];
+    [scheduler scheduleBlockIds:WSMakeBlockIds(10)];
+
+    WSMockDownloadPeer *peer2 = [self peerWithHost:@"127.0.0.2"];
+    [scheduler addPeer:peer2];
+    XCTAssertEqual(peer2.requestedIds.count, 0);
+
+    [scheduler rescheduleStalledRequests];
+    XCTAssertEqual(peer2.requestedIds.count, 10);
+}
+
+- (void)testInOrderDelivery
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:20];
+    WSMockDownloadPeer *peer1 = [self peerWithHost:@"127.0.0.1"];
+    WSMockDownloadPeer *peer2 = [self peerWithHost:@"127.0.0.2"];
+    [scheduler addPeer:peer1];
+    [scheduler addPeer:peer2];
+
+    NSArray *blockIds = WSMakeBlockIds(20);
+    [scheduler scheduleBlockIds:blockIds];
+
+    NSMutableArray *dequeuedIds = [[NSMutableArray alloc] init];
+    void (^dequeueBlock)(id, NSOrderedSet *, WSPeer *) = ^(id entity, NSOrderedSet *transactions, WSPeer *peer) {
+        [dequeuedIds addObject:entity];
+    };
+
+    // second half first, nothing is ready
+    for (NSUInteger i = 10; i < 20; ++i) {
+        [scheduler receiveBlockWithId:blockIds[i] entity:blockIds[i] transactions:nil fromPeer:peer2];
+    }
+    [scheduler dequeueReadyBlocksWithBlock:dequeueBlock];
+    XCTAssertEqual(dequeuedIds.count, 0);
+
+    // gap at head holds back the rest
+    for (NSUInteger i = 1; i < 10; ++i) {
+        [scheduler receiveBlockWithId:blockIds[i] entity:blockIds[i] transactions:nil fromPeer:peer1];
+    }
+    [scheduler dequeueReadyBlocksWithBlock:dequeueBlock];
+    XCTAssertEqual(dequeuedIds.count, 0);
+
+    [scheduler receiveBlockWithId:blockIds[0] entity:blockIds[0] transactions:nil fromPeer:peer1];
+    [scheduler dequeueReadyBlocksWithBlock:dequeueBlock];
+    XCTAssertEqualObjects(dequeuedIds, blockIds);
+    XCTAssertEqual(scheduler.numberOfScheduledBlocks, 0);
+}
+
+- (void)testWindowClamps
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:20];
+    scheduler.initialRequestsPerPeer = 100;
+    WSMockDownloadPeer *peer1 = [self peerWithHost:@"127.0.0.1"];
+    [scheduler addPeer:peer1];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer1], 20);
+
+    scheduler.initialRequestsPerPeer = 1;
+    WSMockDownloadPeer *peer2 = [self peerWithHost:@"127.0.0.2"];
+    [scheduler addPeer:peer2];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer2], 10);
+
+    // unknown peer is ignored
+    WSMockDownloadPeer *peer3 = [self peerWithHost:@"127.0.0.3"];
+    [scheduler updateWindowForPeer:peer3 withLatency:0.1];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer3], 0);
+}
+
+- (void)testWindowGrowth
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:20];
+    scheduler.maxRequestsPerPeer = 50;
+    scheduler.latencyTolerance = 2.0;
+    WSMockDownloadPeer *peer = [self peerWithHost:@"127.0.0.1"];
+    [scheduler addPeer:peer];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 20);
+
+    // about one chunk per window of fast responses
+    for (NSUInteger i = 0; i < 20; ++i) {
+        [scheduler updateWindowForPeer:peer withLatency:0.1];
+    }
+    const NSUInteger grownSize = [scheduler windowSizeForPeer:peer];
+    XCTAssertGreaterThanOrEqual(grownSize, 28);
+    XCTAssertLessThanOrEqual(grownSize, 30);
+
+    // never above max
+    for (NSUInteger i = 0; i < 1000; ++i) {
+        [scheduler updateWindowForPeer:peer withLatency:0.1];
+    }
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 50);
+}
+
+- (void)testWindowHalvingOnSlowResponse
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:40];
+    scheduler.latencyTolerance = 2.0;
+    WSMockDownloadPeer *peer = [self peerWithHost:@"127.0.0.1"];
+    [scheduler addPeer:peer];
+
+    [scheduler updateWindowForPeer:peer withLatency:0.1];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 40);
+
+    // latency builds up, halve
+    [scheduler updateWindowForPeer:peer withLatency:10.0];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 20);
+
+    // at most once per round trip
+    [scheduler updateWindowForPeer:peer withLatency:10.0];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 20);
+
+    // never below min
+    WSMockDownloadPeer *smallPeer = [self peerWithHost:@"127.0.0.2"];
+    scheduler.initialRequestsPerPeer = 12;
+    [scheduler addPeer:smallPeer];
+    [scheduler updateWindowForPeer:smallPeer withLatency:0.1];
+    [scheduler updateWindowForPeer:smallPeer withLatency:10.0];
+    XCTAssertEqual([scheduler windowSizeForPeer:smallPeer], 10);
+}
+
+- (void)testWindowResetOnTimeout
+{
+    WSBlockDownloadScheduler *scheduler = [self schedulerWithWindowSize:40];
+    WSMockDownloadPeer *peer = [self peerWithHost:@"127.0.0.1"];
+    [scheduler addPeer:peer];
+    [scheduler scheduleBlockIds:WSMakeBlockIds(20)];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 40);
+
+    // not timed out yet
+    [scheduler rescheduleStalledRequests];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 40);
+
+    scheduler.requestTimeout = 0.0;
+    [scheduler rescheduleStalledRequests];
+    XCTAssertEqual([scheduler windowSizeForPeer:peer], 10);
+}
+
+#pragma mark Helpers
+
+- (WSMockDownloadPeer *)peerWithHost:(NSString *)host
+{
+    WSPeerFlags *flags = [[WSPeerFlags alloc] initWithNeedsBloomFiltering:YES];
+    return [[WSMockDownloadPeer alloc] initWithHost:host parameters:self.networkParameters flags:flags];
+}
+
+- (WSBlockDownloadScheduler *)schedulerWithWindowSize:(NSUInteger)windowSize
+{
+    WSBlockDownloadScheduler *scheduler = [[WSBlockDownloadScheduler alloc] initWithInventoryType:WSInventoryTypeFilteredBlock];
+    scheduler.chunkSize = 10;
+    scheduler.minRequestsPerPeer = 10;
+    scheduler.initialRequestsPerPeer = windowSize;
+    scheduler.maxRequestsPerPeer = windowSize;
+    scheduler.latencyTolerance = HUGE_VAL; // never shrink window
+    return scheduler;
+}
+
+@end
+
+static NSArray *WSMakeBlockIds(NSUInteger count)
+{
+    NSMutableArray *blockIds = [[NSMutableArray alloc] initWithCapacity:count];
+    for (uint32_t i = 0; i < count; ++i) {
+        [blockIds addObject:WSHash256Compute([NSData dataWithBytes:&i length:sizeof(i)])];
+    }
+    return blockIds;
+}
@@ -29,6 +29,7 @@
 #import "WSPartialMerkleTree.h"
 #import "WSMessageHeaders.h"
 #import "WSMacrosPrivate.h"
+#import "WSUInt256.h"
 
 #import <openssl/bn.h>
 
@@ -100,6 +101,24 @@
     XCTAssertEqual([block estimatedSize], 215);
 }
 
+- (void)testLazyTransactions
+{
+    WSBlock *fullBlock = WSBlockFromHex(self.networkParameters, @"01000000c300ab8b147c7792994375e70c33168391cfd78db6a627926d0fb5a900000000da3f1c08e2d6ffe82fb99ffab4fc969ad014e7dabbd37cccc697cb573b39b939c9f2a749ffff001d0893788f0101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704ffff001d0176ffffffff0100f2052a01000000434104c8808d044bc43f17bc8b1a0c332b082029d6e059d12f30b91df9dc844fc6651ad1527e0551b7fceaac302714e63de5677d7427344b958885373a0d82899054c5ac00000000");
+
+    __block NSUInteger loads = 0;
+    WSStorableBlock *block = [[WSStorableBlock alloc] initWithHeader:fullBlock.header transactionsLoader:^NSOrderedSet *{
+        ++loads;
+        return fullBlock.transactions;
+    } height:1 work:[fullBlock.header workData]];
+
+    XCTAssertEqualObjects(block.blockId, fullBlock.header.blockId);
+    XCTAssertEqual(block.height, 1);
+    XCTAssertEqual(loads, 0);
+    XCTAssertEqualObjects(block.transactions, fullBlock.transactions);
+    XCTAssertEqual(block.transactions.count, 1);
+    XCTAssertEqual(loads, 1);
+}
+
 - (void)testParseFilteredBlock
 {
     WSFilteredBlock *block = WSFilteredBlockFromHex(self.networkParameters, @"020000005bd7027635cbcca125a156377643b86f6dd2b820a0741d39b4a7000000000000fca15af0cbaae20e8cd6d8c613ca058b291f793da7925db7e30b71db349479353f9cb5536431011b8818102d12000000120763f91fe0bb2d89c0284588556f466123a1fb76cf591d7aa196115a1ed0cafa1fe750aeb68a59570d7be7f0b8f62698d6242b84db50bf6e314d10ca624789dd9a628ae55f7b1f7c652b99259503705b106c7cbe300e0a77054be720caec243668ff80caa26851ea1170462bf96e91e0bbe23da9949e1b0520e20983aca3406167febc07e28ca2163b9243f6878c53ceeeb71d18528f40bbc19c03dfd194e77f523e3d286d0856d951992ca24970abc98cd0b5a61bffe472583ecc60f06c3c033034b6b8b9d215df13bd46fcd8f26a3a12300a8f0213676ecd27ec8a51ecb18eeca10647a8a0c5466f5ac0d65623b7783eb83095379a15d99c7a86867fb951c098f8fbef7589f8bb9b09f290547af41eabb511037023359e8877a37574034c11b3f0acc28f3b97ecd78f3d9d3e96919a90d3067018fe981c10a0bb0148ddef696d74fa51489b4b1a3e03c0a888a71171b8c4936169ece50c71e7444281b305a92a2011c92a479b505340e1cdc48a0854536db8f2937a55a7cf07d2f59f26f6d3ed175b94b22798a73b723109901a30a94ad261c63a928acb8ca17a8019992515c074d1dfa3bd43935a1274b00c4d12fd87ee2ff0608d58d581e4e729af530b021808b863656bf47ece10a6c4f6a5a4173737a5cd113580d2f7e13bcd14201bea62b08a42110fb85b4e0e7116179b482a706edd4a8e975fe9b6df39931cc55ae6221d7cfc745b8d4234279fc7f3dc057f03b0ef29f942e929b9f52f28267f77fd98713c3f05a0de8922d1392ce26f60239865a38a8c94e5e4e7eb90a51245dc7a05ffffffff3f");
@@ -183,6 +202,7 @@
                          @"01000000489ac81592595a4004e14331cb096ffef12b1daf709f6378e9c3558d00000000c757bebd6f2c2c071a3cf739a4cf98b27441809790a5cf40652b46df8a98a473b0eb494dffff001d011aedb600",
                          @"01000000a9c570a45d959023551f9a694ace9c12206174f21383f30949ca3b9b00000000eaf93dbbfb3551a1ff8b6bd5ba4cea7508e790c23cd07b9d9e791936a79d5fd4b3eb494dffff001d0385a7dd00"];
 
+    NSMutableArray *parsedHeaders = [[NSMutableArray alloc] initWithCapacity:headers.count];
     for (NSString *hex in headers) {
         NSError *error;
         WSBuffer *buffer = WSBufferFromHex(hex);
@@ -192,7 +212,15 @@
 
         [header verifyWithError:&error];
         XCTAssertNil(error, @"Error validating header: %@", error);
+
+        [parsedHeaders addObject:header];
     }
+
+    NSError *error;
+    XCTAssertTrue([WSBlockHeader verifyHeaders:parsedHeaders error:&error], @"Error validating headers: %@", error);
+
+    [parsedHeaders exchangeObjectAtIndex:5 withObjectAtIndex:6];
+    XCTAssertFalse([WSBlockHeader verifyHeaders:parsedHeaders error:&error], @"Verified non-contiguous headers");
 }
 
 - (void)testVerifyFilteredBlocks
@@ -246,6 +274,32 @@
     BN_clear_free(target);
 }
 
+- (void)testCompactUInt256
+{
+    NSString *expHex = @"00000000ffff0000000000000000000000000000000000000000000000000000";
+    const uint32_t expBits = 0x1d00ffff;
+    WSUInt256 target;
+    WSUInt256 work;
+    BOOL negative;
+    BOOL overflow;
+
+    WSUInt256SetData(&target, [expHex dataFromHex]);
+    XCTAssertEqual(WSUInt256GetCompact(&target), expBits);
+
+    WSUInt256SetCompact(&target, expBits, &negative, &overflow);
+    XCTAssertFalse(negative);
+    XCTAssertFalse(overflow);
+    XCTAssertEqualObjects([WSUInt256Data(&target) hexString], [expHex substringFromIndex:8]);
+
+    WSUInt256SetWorkFromCompact(&work, expBits);
+    XCTAssertEqualObjects(WSUInt256DecimalString(&work), @"4295032833");
+
+    // halve target (double difficulty)
+    WSUInt256MultiplyUInt64(&target, &target, 302400);
+    WSUInt256DivideUInt64(&target, &target, 604800);
+    XCTAssertEqual(WSUInt256GetCompact(&target), 0x1c7fff80);
+}
+
 - (void)testDifficulty
 {
     // block #310261
@@ -0,0 +1,228 @@
+//
+//  WSConnectionPoolTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSConnection.h"
+#import "WSPeer.h"
+#import "WSMessageGetdata.h"
+#import "WSConfig.h"
+
+// private to WSConnectionPool, instantiated by name
+@protocol WSStreamConnectionHandlerTests <NSObject>
+
+- (instancetype)initWithParameters:(WSParameters *)parameters host:(NSString *)host port:(uint16_t)port processor:(id<WSConnectionProcessor>)processor;
+- (NSMutableArray *)outputChunks;
+- (void)setOutputChunks:(NSMutableArray *)outputChunks;
+- (NSUInteger)outputChunkOffset;
+- (NSUInteger)outputBacklogLength;
+- (void)unsafeEnqueueData:(NSData *)data;
+- (void)unsafeDrainLength:(NSUInteger)length;
+
+@end
+
+@interface WSMockConnectionHandler : NSObject <WSConnectionHandler>
+
+@property (nonatomic, assign) NSUInteger outputBacklogLength;
+@property (nonatomic, strong) NSMutableArray *writtenMessages; // id<WSMessage>
+
+@end
+
+@implementation WSMockConnectionHandler
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self.writtenMessages = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (NSString *)host
+{
+    return @"127.0.0.1";
+}
+
+- (uint16_t)port
+{
+    return 0;
+}
+
+- (NSString *)identifier
+{
+    return @"(mock)";
+}
+
+- (id<WSConnectionProcessor>)processor
+{
+    return nil;
+}
+
+- (BOOL)isConnected
+{
+    return YES;
+}
+
+- (void)submitBlock:(void (^)(void))block
+{
+    block();
+}
+
+- (NSUInteger)writeMessage:(id<WSMessage>)message
+{
+    [self.writtenMessages addObject:message];
+    return 1;
+}
+
+- (void)disconnectWithError:(NSError *)error
+{
+}
+
+@end
+
+#pragma mark -
+
+@interface WSConnectionPoolTests : XCTestCase
+
+- (NSData *)remainingDataOfHandler:(id<WSStreamConnectionHandlerTests>)handler;
+
+@end
+
+@implementation WSConnectionPoolTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.networkType = WSNetworkTypeRegtest;
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+- (void)testOutputChunks
+{
+    id<WSStreamConnectionHandlerTests> handler = [[NSClassFromString(@"WSStreamConnectionHandler") alloc] initWithParameters:self.networkParameters
+                                                                                                                         host:@"127.0.0.1"
+                                                                                                                         port:[self.networkParameters peerPort]
+                                                                                                                    processor:nil];
+    handler.outputChunks = [[NSMutableArray alloc] init];
+
+    // chunks are snapshots, empty data is skipped
+    NSMutableData *data = [[NSMutableData alloc] initWithBytes:"abc" length:3];
+    [handler unsafeEnqueueData:data];
+    [data setLength:0];
+    [handler unsafeEnqueueData:data];
+    [handler unsafeEnqueueData:[NSData dataWithBytes:"defgh" length:5]];
+    [handler unsafeEnqueueData:[NSData dataWithBytes:"ij" length:2]];
+    XCTAssertEqual(handler.outputChunks.count, 3);
+    XCTAssertEqual(handler.outputBacklogLength, 10);
+    XCTAssertEqualObjects([self remainingDataOfHandler:handler], [NSData dataWithBytes:"abcdefghij" length:10]);
+
+    // partial write advances into the head chunk
+    [handler unsafeDrainLength:2];
+    XCTAssertEqual(handler.outputChunks.count, 3);
+    XCTAssertEqual(handler.outputChunkOffset, 2);
+    XCTAssertEqualObjects([self remainingDataOfHandler:handler], [NSData dataWithBytes:"cdefghij" length:8]);
+
+    // write across chunk boundary releases written chunks
+    [handler unsafeDrainLength:4];
+    XCTAssertEqual(handler.outputChunks.count, 2);
+    XCTAssertEqual(handler.outputChunkOffset, 3);
+    XCTAssertEqual(handler.outputBacklogLength, 4);
+    XCTAssertEqualObjects([self remainingDataOfHandler:handler], [NSData dataWithBytes:"ghij" length:4]);
+
+    // appended after a partial write, order preserved
+    [handler unsafeEnqueueData:[NSData dataWithBytes:"k" length:1]];
+    XCTAssertEqualObjects([self remainingDataOfHandler:handler], [NSData dataWithBytes:"ghijk" length:5]);
+
+    [handler unsafeDrainLength:2];
+    XCTAssertEqual(handler.outputChunks.count, 2);
+    XCTAssertEqual(handler.outputChunkOffset, 0);
+
+    [handler unsafeDrainLength:3];
+    XCTAssertEqual(handler.outputChunks.count, 0);
+    XCTAssertEqual(handler.outputChunkOffset, 0);
+    XCTAssertEqual(handler.outputBacklogLength, 0);
+}
+
+- (void)testPeerOutputBacklog
+{
+    WSPeerFlags *flags = [[WSPeerFlags alloc] initWithNeedsBloomFiltering:YES];
+    WSPeer *peer = [[WSPeer alloc] initWithHost:@"127.0.0.1" parameters:self.networkParameters flags:flags];
+    WSMockConnectionHandler *handler = [[WSMockConnectionHandler alloc] init];
+    [peer openedConnectionToHost:@"127.0.0.1" port:[self.networkParameters peerPort] handler:handler];
+    [handler.writtenMessages removeAllObjects];
+
+    NSArray *blockIds = @[WSHash256Compute([@"1" dataUsingEncoding:NSUTF8StringEncoding]),
+                          WSHash256Compute([@"2" dataUsingEncoding:NSUTF8StringEncoding]),
+                          WSHash256Compute([@"3" dataUsingEncoding:NSUTF8StringEncoding])];
+
+    // getdata waits above high-water mark, control messages don't
+    handler.outputBacklogLength = WSPeerOutputBacklogHighWaterMark;
+    [peer sendGetdataMessageWithHashes:@[blockIds[0]] forInventoryType:WSInventoryTypeBlock];
+    [peer sendGetdataMessageWithHashes:@[blockIds[1]] forInventoryType:WSInventoryTypeBlock];
+    XCTAssertEqual(handler.writtenMessages.count, 0);
+    [peer sendGetaddr];
+    XCTAssertEqual(handler.writtenMessages.count, 1);
+    [handler.writtenMessages removeAllObjects];
+
+    // drain notification resumes deferred requests without inbound traffic
+    handler.outputBacklogLength = WSPeerOutputBacklogHighWaterMark - 1;
+    [peer drainedOutputWithBacklogLength:handler.outputBacklogLength];
+    XCTAssertEqual(handler.writtenMessages.count, 2);
+
+    // deferred requests go first once drained
+    handler.outputBacklogLength = WSPeerOutputBacklogHighWaterMark;
+    [peer sendGetdataMessageWithHashes:@[blockIds[2]] forInventoryType:WSInventoryTypeBlock];
+    XCTAssertEqual(handler.writtenMessages.count, 2);
+    handler.outputBacklogLength = 0;
+    [peer drainedOutputWithBacklogLength:handler.outputBacklogLength];
+    XCTAssertEqual(handler.writtenMessages.count, 3);
+
+    NSMutableArray *requestedIds = [[NSMutableArray alloc] init];
+    for (id<WSMessage> message in handler.writtenMessages) {
+        XCTAssertEqual(message.messageCommand, WSMessageCommandGetdata);
+        WSInventory *inventory = [[(WSMessageGetdata *)message inventories] firstObject];
+        [requestedIds addObject:inventory.inventoryHash];
+    }
+    XCTAssertEqualObjects(requestedIds, blockIds);
+}
+
+#pragma mark Helpers
+
+- (NSData *)remainingDataOfHandler:(id<WSStreamConnectionHandlerTests>)handler
+{
+    NSMutableData *remaining = [[NSMutableData alloc] init];
+    NSUInteger offset = handler.outputChunkOffset;
+    for (NSData *chunk in handler.outputChunks) {
+        [remaining appendData:[chunk subdataWithRange:NSMakeRange(offset, chunk.length - offset)]];
+        offset = 0;
+    }
+    return remaining;
+}
+
+@end
@@ -0,0 +1,186 @@
+//
+//  WSConnectionReactorTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSConnectionReactor.h"
+#import "WSConnectionPool.h"
+#import "WSSyntheticPeer.h"
+
+@interface WSMockConnectionProcessor : NSObject <WSConnectionProcessor>
+
+@property (nonatomic, copy) void (^completionBlock)(void);
+@property (atomic, assign) BOOL didOpen;
+@property (atomic, assign) BOOL wasConnected;
+@property (atomic, strong) NSError *closeError;
+
+@end
+
+@implementation WSMockConnectionProcessor
+
+- (void)openedConnectionToHost:(NSString *)host port:(uint16_t)port handler:(id<WSConnectionHandler>)handler
+{
+    self.didOpen = YES;
+    self.wasConnected = [handler isConnected];
+    self.completionBlock();
+}
+
+- (void)processMessage:(id<WSMessage>)message decodeTime:(NSTimeInterval)decodeTime
+{
+}
+
+- (void)drainedOutputWithBacklogLength:(NSUInteger)backlogLength
+{
+}
+
+- (void)closedConnectionWithError:(NSError *)error
+{
+    self.closeError = error;
+    self.completionBlock();
+}
+
+@end
+
+#pragma mark -
+
+@interface WSConnectionReactorTests : XCTestCase
+
+@property (nonatomic, strong) WSConnectionReactor *reactor;
+@property (nonatomic, strong) WSSyntheticPeer *peer;
+
+- (WSMockConnectionProcessor *)processor;
+- (uint16_t)unusedPort;
+
+@end
+
+@implementation WSConnectionReactorTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.reactor = [[WSConnectionReactor alloc] initWithName:@"WSConnectionReactorTests"];
+    self.peer = [[WSSyntheticPeer alloc] init];
+}
+
+- (void)tearDown
+{
+    [self.peer stop];
+    [self.reactor stop];
+
+    [super tearDown];
+}
+
+- (void)testConnect
+{
+    WSConnectionPool *pool = [[WSConnectionPool alloc] initWithParameters:self.peer.parameters reactor:self.reactor];
+    WSMockConnectionProcessor *processor = [self processor];
+
+    // localhost may resolve to ::1 first, synthetic peer only listens on 127.0.0.1
+    XCTAssertTrue([pool openConnectionToHost:@"localhost" port:(uint16_t)self.peer.parameters.peerPort processor:processor]);
+    XCTAssertTrue([self runUntilStoppedWithTimeout:5.0], @"Connection timed out");
+
+    XCTAssertTrue(processor.didOpen, @"Connection failed: %@", processor.closeError);
+    XCTAssertTrue(processor.wasConnected);
+    XCTAssertEqual(pool.numberOfConnections, 1);
+
+    [pool closeConnectionForProcessor:processor];
+    XCTAssertTrue([self runUntilStoppedWithTimeout:5.0]);
+    XCTAssertEqual(pool.numberOfConnections, 0);
+}
+
+- (void)testConnectionRefused
+{
+    const uint16_t port = [self unusedPort];
+
+    WSConnectionPool *pool = [[WSConnectionPool alloc] initWithParameters:self.peer.parameters reactor:self.reactor];
+    WSMockConnectionProcessor *processor = [self processor];
+
+    XCTAssertTrue([pool openConnectionToHost:self.peer.host port:port processor:processor]);
+    XCTAssertTrue([self runUntilStoppedWithTimeout:5.0], @"Connection neither failed nor timed out");
+
+    XCTAssertFalse(processor.didOpen);
+    XCTAssertEqualObjects(processor.closeError.domain, NSPOSIXErrorDomain);
+    XCTAssertEqual(processor.closeError.code, ECONNREFUSED);
+    XCTAssertEqual(pool.numberOfConnections, 0);
+}
+
+- (void)testPeerGroupSync
+{
+    [self.peer generateBlocks:500 walletAddresses:nil numberOfTransactions:0];
+
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.peer.parameters];
+    WSBlockChainDownloader *downloader = [[WSBlockChainDownloader alloc] initWithStore:store headersOnly:YES];
+    WSPeerGroup *peerGroup = [[WSPeerGroup alloc] initWithParameters:self.peer.parameters reactor:self.reactor];
+    peerGroup.peerHosts = @[self.peer.host];
+    peerGroup.maxConnections = 1;
+
+    id observer = [[NSNotificationCenter defaultCenter] addObserverForName:WSPeerGroupDidFinishDownloadNotification object:peerGroup queue:nil usingBlock:^(NSNotification *note) {
+        [self stopRunning];
+    }];
+
+    [peerGroup startConnections];
+    [peerGroup startDownloadWithDownloader:downloader];
+    XCTAssertTrue([self runUntilStoppedWithTimeout:30.0], @"Sync timed out");
+    [[NSNotificationCenter defaultCenter] removeObserver:observer];
+
+    XCTAssertEqual(peerGroup.currentHeight, self.peer.currentHeight);
+
+    [peerGroup stopConnections];
+}
+
+#pragma mark Helpers
+
+- (WSMockConnectionProcessor *)processor
+{
+    WSMockConnectionProcessor *processor = [[WSMockConnectionProcessor alloc] init];
+    processor.completionBlock = ^{
+        [self stopRunning];
+    };
+    return processor;
+}
+
+- (uint16_t)unusedPort
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    bind(fd, (struct sockaddr *)&address, sizeof(address));
+    getsockname(fd, (struct sockaddr *)&address, &addressLength);
+    close(fd);
+
+    // released ephemeral port, nobody listening
+    return ntohs(address.sin_port);
+}
+
+@end
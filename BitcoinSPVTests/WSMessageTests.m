@@ -107,6 +107,52 @@
 //    XCTAssertEqualObjects([messageFull toBuffer], [messagePartial toBuffer]);
 }
 
+- (void)testDeserializerMultipleMessages
+{
+    NSError *error;
+    WSProtocolDeserializer *deserializer = [[WSProtocolDeserializer alloc] initWithParameters:self.networkParameters host:@"0.0.0.0" port:10000];
+    NSString *verackHex = @"0b11090776657261636b000000000000000000005df6e0e2";
+
+    // garbage (with partial magic), two messages and a partial one in a single read
+    NSMutableString *hex = [[NSMutableString alloc] initWithString:@"aabb0b1109"];
+    [hex appendString:verackHex];
+    [hex appendString:verackHex];
+    [hex appendString:[verackHex substringToIndex:20]];
+
+    NSInputStream *stream = [[NSInputStream alloc] initWithData:[hex dataFromHex]];
+    [stream open];
+    XCTAssertTrue([deserializer readFromStream:stream]);
+
+    for (int i = 0; i < 2; ++i) {
+        id<WSMessage> message = [deserializer parseMessageWithError:&error];
+        XCTAssertNil(error, @"Error: %@", error);
+        XCTAssertEqualObjects(message.messageType, WSMessageType_VERACK);
+    }
+    XCTAssertNil([deserializer parseMessageWithError:&error]);
+    XCTAssertNil(error, @"Error: %@", error);
+}
+
+- (void)testCommands
+{
+    const char verack[12] = "verack";
+    const char merkleblock[12] = "merkleblock";
+    const char sendheaders[12] = "sendheaders";
+    XCTAssertEqual(WSMessageCommandFromHeaderField(verack), WSMessageCommandVerack);
+    XCTAssertEqual(WSMessageCommandFromHeaderField(merkleblock), WSMessageCommandMerkleblock);
+    XCTAssertEqual(WSMessageCommandFromHeaderField(sendheaders), WSMessageCommandUnknown);
+
+    // unknown message is skipped, not reported
+    NSError *error;
+    WSProtocolDeserializer *deserializer = [[WSProtocolDeserializer alloc] initWithParameters:self.networkParameters host:@"0.0.0.0" port:10000];
+    NSString *hex = @"0b11090773656e646865616465727300000000005df6e0e20b11090776657261636b000000000000000000005df6e0e2";
+    NSInputStream *stream = [[NSInputStream alloc] initWithData:[hex dataFromHex]];
+    [stream open];
+
+    id<WSMessage> message = [deserializer parseMessageFromStream:stream error:&error];
+    XCTAssertNil(error, @"Error: %@", error);
+    XCTAssertEqual(message.messageCommand, WSMessageCommandVerack);
+}
+
 - (void)testVarInt
 {
     WSBuffer *buffer = WSBufferFromHex(@"fd22040200000041886e01c7d01099b89e280c46cf134fad34d77ab55f61dd223829b600000000");
@@ -0,0 +1,148 @@
+//
+//  WSSyncBenchmarkTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSSyntheticPeer.h"
+
+static const NSTimeInterval WSSyncBenchmarkTestsTimeout = 300.0;
+
+@interface WSSyncBenchmarkTests : XCTestCase
+
+@property (nonatomic, strong) WSSyntheticPeer *peer;
+
+- (WSPeerGroup *)peerGroup;
+- (NSTimeInterval)runSyncWithPeerGroup:(WSPeerGroup *)peerGroup downloader:(id<WSPeerGroupDownloader>)downloader;
+
+@end
+
+@implementation WSSyncBenchmarkTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.peer = [[WSSyntheticPeer alloc] init];
+}
+
+- (void)tearDown
+{
+    [self.peer stop];
+
+    [super tearDown];
+}
+
+- (void)testHeadersSync
+{
+    const NSUInteger numberOfBlocks = 2016;
+    [self.peer generateBlocks:numberOfBlocks walletAddresses:nil numberOfTransactions:0];
+
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.peer.parameters];
+    WSBlockChainDownloader *downloader = [[WSBlockChainDownloader alloc] initWithStore:store headersOnly:YES];
+    WSPeerGroup *peerGroup = [self peerGroup];
+
+    const NSTimeInterval elapsed = [self runSyncWithPeerGroup:peerGroup downloader:downloader];
+    DDLogInfo(@"Synced %lu headers in %.3fs (%.0f headers/s)", (unsigned long)numberOfBlocks, elapsed, numberOfBlocks / elapsed);
+
+    XCTAssertEqual(peerGroup.currentHeight, self.peer.currentHeight);
+}
+
+- (void)testWalletSync
+{
+    const NSUInteger numberOfBlocks = 500;
+    const NSUInteger numberOfTransactions = 50;
+
+    WSHDWallet *wallet = [[WSHDWallet alloc] initWithParameters:self.peer.parameters seed:WSSeedMakeUnknown([self mockWalletMnemonic])];
+    [self.peer generateBlocks:numberOfBlocks walletAddresses:[wallet.allReceiveAddresses array] numberOfTransactions:numberOfTransactions];
+
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.peer.parameters];
+    WSBlockChainDownloader *downloader = [[WSBlockChainDownloader alloc] initWithStore:store wallet:wallet];
+    WSPeerGroup *peerGroup = [self peerGroup];
+
+    const NSTimeInterval elapsed = [self runSyncWithPeerGroup:peerGroup downloader:downloader];
+    DDLogInfo(@"Synced %lu blocks (%lu wallet transactions) in %.3fs (%.0f blocks/s)",
+              (unsigned long)numberOfBlocks, (unsigned long)numberOfTransactions, elapsed, numberOfBlocks / elapsed);
+
+    XCTAssertEqual(peerGroup.currentHeight, self.peer.currentHeight);
+    XCTAssertEqual(wallet.allTransactions.count, self.peer.walletTransactions.count);
+}
+
+- (void)testCompactFilterSync
+{
+    const NSUInteger numberOfBlocks = 500;
+    const NSUInteger numberOfTransactions = 50;
+
+    WSHDWallet *wallet = [[WSHDWallet alloc] initWithParameters:self.peer.parameters seed:WSSeedMakeUnknown([self mockWalletMnemonic])];
+    [self.peer generateBlocks:numberOfBlocks walletAddresses:[wallet.allReceiveAddresses array] numberOfTransactions:numberOfTransactions];
+
+    id<WSBlockStore> store = [[WSMemoryBlockStore alloc] initWithParameters:self.peer.parameters];
+    WSCompactFilterDownloader *downloader = [[WSCompactFilterDownloader alloc] initWithStore:store wallet:wallet];
+    WSPeerGroup *peerGroup = [self peerGroup];
+
+    const NSTimeInterval elapsed = [self runSyncWithPeerGroup:peerGroup downloader:downloader];
+    DDLogInfo(@"Synced %lu blocks with compact filters (%lu wallet transactions) in %.3fs (%.0f blocks/s)",
+              (unsigned long)numberOfBlocks, (unsigned long)numberOfTransactions, elapsed, numberOfBlocks / elapsed);
+
+    // only blocks matching wallet scripts are downloaded in full
+    XCTAssertEqual(peerGroup.currentHeight, self.peer.currentHeight);
+    XCTAssertEqual(wallet.allTransactions.count, self.peer.walletTransactions.count);
+}
+
+#pragma mark Helpers
+
+- (WSPeerGroup *)peerGroup
+{
+    WSConnectionPool *pool = [[WSConnectionPool alloc] initWithParameters:self.peer.parameters];
+    dispatch_queue_t queue = dispatch_queue_create("WSSyncBenchmarkTests", DISPATCH_QUEUE_SERIAL);
+
+    WSPeerGroup *peerGroup = [[WSPeerGroup alloc] initWithParameters:self.peer.parameters pool:pool queue:queue];
+    peerGroup.peerHosts = @[self.peer.host];
+    peerGroup.maxConnections = 1;
+    return peerGroup;
+}
+
+- (NSTimeInterval)runSyncWithPeerGroup:(WSPeerGroup *)peerGroup downloader:(id<WSPeerGroupDownloader>)downloader
+{
+    id finishObserver = [[NSNotificationCenter defaultCenter] addObserverForName:WSPeerGroupDidFinishDownloadNotification object:peerGroup queue:nil usingBlock:^(NSNotification *note) {
+        [self stopRunning];
+    }];
+
+    const NSTimeInterval startTime = [NSDate timeIntervalSinceReferenceDate];
+    [peerGroup startConnections];
+    [peerGroup startDownloadWithDownloader:downloader];
+    if (![self runUntilStoppedWithTimeout:WSSyncBenchmarkTestsTimeout]) {
+        XCTFail(@"Sync didn't finish within %.0f seconds", WSSyncBenchmarkTestsTimeout);
+    }
+    const NSTimeInterval elapsed = [NSDate timeIntervalSinceReferenceDate] - startTime;
+    [[NSNotificationCenter defaultCenter] removeObserver:finishObserver];
+
+    WSPeerGroupStatus *status = [peerGroup statusWithNumberOfRecentBlocks:0];
+    DDLogInfo(@"Synthetic peer sent %lu bytes", (unsigned long)self.peer.sentBytes);
+    DDLogInfo(@"Traffic:\n%@", [status.trafficStats reportDescription]);
+
+    [peerGroup stopConnections];
+    return elapsed;
+}
+
+@end
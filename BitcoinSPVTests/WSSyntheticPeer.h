@@ -0,0 +1,63 @@
+//
+//  WSSyntheticPeer.h
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <Foundation/Foundation.h>
+
+@class WSParameters;
+
+#pragma mark -
+
+//
+// in-process peer listening on loopback, serves a synthetic regtest chain
+// for deterministic sync tests without network access
+//
+// every generated block has a coinbase, numberOfTransactions blocks (evenly
+// spaced) also carry a transaction paying walletAddresses round-robin
+//
+// answers version/verack, ping, getheaders, getblocks and getdata for
+// blocks, filtered blocks (merkleblock + tx) and transactions, plus
+// getcfheaders/getcfilters for BIP158 basic filters over output scripts,
+// anything else is ignored, e.g. Bloom filters are not applied and
+// merkleblocks always match the wallet transactions
+//
+// parameters are regtest's except for peerPort (bound on init) and the
+// proof-of-work limit, which matches the regtest genesis target
+//
+@interface WSSyntheticPeer : NSObject
+
+- (instancetype)init;
+- (WSParameters *)parameters;
+- (NSString *)host;
+
+// WARNING: generate before any client connects
+- (void)generateBlocks:(NSUInteger)numberOfBlocks walletAddresses:(NSArray *)walletAddresses numberOfTransactions:(NSUInteger)numberOfTransactions; // WSAddress
+- (uint32_t)currentHeight;
+- (NSArray *)allHeaders; // WSBlockHeader, by height
+- (NSArray *)walletTransactions; // WSSignedTransaction
+
+- (NSUInteger)sentBytes;
+- (void)stop;
+
+@end
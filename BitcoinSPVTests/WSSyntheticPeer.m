@@ -0,0 +1,892 @@
+//
+//  WSSyntheticPeer.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+#import "WSSyntheticPeer.h"
+#import "WSParameters.h"
+#import "WSBlockHeader.h"
+#import "WSFilteredBlock.h"
+#import "WSPartialMerkleTree.h"
+#import "WSTransaction.h"
+#import "WSTransactionInput.h"
+#import "WSTransactionOutput.h"
+#import "WSTransactionOutPoint.h"
+#import "WSScript.h"
+#import "WSAddress.h"
+#import "WSInventory.h"
+#import "WSHash256.h"
+#import "WSBuffer.h"
+#import "WSMessage.h"
+#import "WSMessageCfheaders.h"
+#import "WSMessageCfilter.h"
+#import "WSBIP158.h"
+#import "WSPeer.h"
+#import "WSBitcoinConstants.h"
+#import "WSConfig.h"
+#import "WSLogging.h"
+#import "WSMacrosCore.h"
+
+// SO_NOSIGPIPE is BSD-only, elsewhere suppress SIGPIPE per send
+#ifdef MSG_NOSIGNAL
+static const int            WSSyntheticPeerSendFlags        = MSG_NOSIGNAL;
+#else
+static const int            WSSyntheticPeerSendFlags        = 0;
+#endif
+
+static const uint32_t       WSSyntheticPeerBits             = 0x207fffff;
+static const uint32_t       WSSyntheticPeerBlockSpacing     = 600;
+static const uint64_t       WSSyntheticPeerCoinbaseValue    = 50 * 100000000ULL;
+static const uint64_t       WSSyntheticPeerPaymentValue     = 100000000ULL;
+static const NSUInteger     WSSyntheticPeerReadLength       = 64 * 1024;
+
+static void WSSyntheticPeerAppendHeader(WSMutableBuffer *buffer, WSBlockHeader *header);
+static WSHash256 *WSSyntheticPeerMerkleRoot(NSArray *txIds, NSUInteger height, NSUInteger position);
+static void WSSyntheticPeerBuildPartialTree(NSArray *txIds, NSIndexSet *matches, NSUInteger height, NSUInteger position, NSMutableArray *hashes, NSMutableArray *bits);
+
+@class WSSyntheticPeerConnection;
+
+@interface WSSyntheticPeer ()
+
+@property (nonatomic, strong) WSParameters *parameters;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t acceptSource;
+@property (nonatomic, strong) NSMutableArray *connections;                  // WSSyntheticPeerConnection
+@property (nonatomic, assign) NSUInteger sentBytes;
+
+// chain
+@property (nonatomic, strong) NSMutableArray *headers;                      // WSBlockHeader, by height
+@property (nonatomic, strong) NSMutableArray *transactions;                 // NSArray<WSSignedTransaction>, by height
+@property (nonatomic, strong) NSMutableDictionary *heightsById;             // WSHash256 -> NSNumber
+@property (nonatomic, strong) NSMutableDictionary *walletTransactionsById;  // WSHash256 -> WSSignedTransaction
+@property (nonatomic, strong) NSMutableArray *walletTransactionsArray;      // WSSignedTransaction
+@property (nonatomic, strong) NSMutableArray *filters;                      // WSBIP158Filter, by height
+@property (nonatomic, strong) NSMutableArray *filterHeaders;                // WSHash256, by height
+
+- (WSSignedTransaction *)coinbaseAtHeight:(uint32_t)height;
+- (WSSignedTransaction *)paymentToAddress:(WSAddress *)address spendingTransaction:(WSSignedTransaction *)transaction;
+- (WSBlockHeader *)mineHeaderWithPreviousHeader:(WSBlockHeader *)previousHeader transactions:(NSArray *)transactions;
+- (void)appendFilterAtHeight:(uint32_t)height;
+- (uint32_t)forkHeightFromLocatorInPayload:(WSBuffer *)payload hashStop:(WSHash256 **)hashStop;
+- (BOOL)filterRangeFromPayload:(WSBuffer *)payload startHeight:(uint32_t *)startHeight stopHeight:(uint32_t *)stopHeight;
+
+// handlers (queue)
+- (void)acceptConnections;
+- (void)connection:(WSSyntheticPeerConnection *)connection didReceiveCommand:(NSString *)command payload:(WSBuffer *)payload;
+- (void)connection:(WSSyntheticPeerConnection *)connection didCloseWithError:(int)error;
+- (void)sendVersionToConnection:(WSSyntheticPeerConnection *)connection;
+- (void)sendHeadersToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload;
+- (void)sendBlockInventoriesToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload;
+- (void)sendDataToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload;
+- (void)sendMerkleblockAtHeight:(uint32_t)height toConnection:(WSSyntheticPeerConnection *)connection;
+- (void)sendFilterHeadersToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload;
+- (void)sendFiltersToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload;
+- (void)sendCommand:(NSString *)command payload:(WSBuffer *)payload toConnection:(WSSyntheticPeerConnection *)connection;
+
+@end
+
+#pragma mark -
+
+@interface WSSyntheticPeerConnection : NSObject
+
+@property (nonatomic, weak) WSSyntheticPeer *peer;
+@property (nonatomic, assign) int socket;
+@property (nonatomic, strong) dispatch_source_t readSource;
+@property (nonatomic, strong) NSMutableData *inputBuffer;
+
+- (instancetype)initWithPeer:(WSSyntheticPeer *)peer socket:(int)socket queue:(dispatch_queue_t)queue;
+- (void)readAvailableBytes:(NSUInteger)available;
+- (void)parseMessages;
+- (BOOL)writeData:(NSData *)data;
+- (void)close;
+
+@end
+
+@implementation WSSyntheticPeerConnection
+
+- (instancetype)initWithPeer:(WSSyntheticPeer *)peer socket:(int)socket queue:(dispatch_queue_t)queue
+{
+    if ((self = [super init])) {
+        self.peer = peer;
+        self.socket = socket;
+        self.inputBuffer = [[NSMutableData alloc] init];
+
+#ifdef SO_NOSIGPIPE
+        const int one = 1;
+        setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+        // socket stays blocking, reads never exceed available bytes
+        self.readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, socket, 0, queue);
+        __weak WSSyntheticPeerConnection *weakSelf = self;
+        dispatch_source_set_event_handler(self.readSource, ^{
+            WSSyntheticPeerConnection *connection = weakSelf;
+            if (!connection) {
+                return;
+            }
+            [connection readAvailableBytes:dispatch_source_get_data(connection.readSource)];
+        });
+        dispatch_source_set_cancel_handler(self.readSource, ^{
+            close(socket);
+        });
+        dispatch_resume(self.readSource);
+    }
+    return self;
+}
+
+- (void)readAvailableBytes:(NSUInteger)available
+{
+    if (available == 0) {
+        [self.peer connection:self didCloseWithError:0];
+        return;
+    }
+
+    uint8_t bytes[WSSyntheticPeerReadLength];
+    const ssize_t actuallyRead = recv(self.socket, bytes, MIN(available, sizeof(bytes)), 0);
+    if (actuallyRead <= 0) {
+        [self.peer connection:self didCloseWithError:((actuallyRead < 0) ? errno : 0)];
+        return;
+    }
+    [self.inputBuffer appendBytes:bytes length:actuallyRead];
+
+    [self parseMessages];
+}
+
+- (void)parseMessages
+{
+    const uint32_t magicNumber = [self.peer.parameters magicNumber];
+    NSUInteger offset = 0;
+
+    while (self.inputBuffer.length - offset >= WSMessageHeaderLength) {
+        const uint8_t *header = (const uint8_t *)self.inputBuffer.bytes + offset;
+        if (CFSwapInt32LittleToHost(*(const uint32_t *)header) != magicNumber) {
+            DDLogError(@"Synthetic peer received bad magic number, closing connection");
+            [self.peer connection:self didCloseWithError:EPROTO];
+            return;
+        }
+
+        const uint32_t payloadLength = CFSwapInt32LittleToHost(*(const uint32_t *)(header + 16));
+        if (self.inputBuffer.length - offset < WSMessageHeaderLength + payloadLength) {
+            break;
+        }
+
+        NSString *command = [[NSString alloc] initWithBytes:(header + 4) length:strnlen((const char *)header + 4, 12) encoding:NSASCIIStringEncoding];
+        NSData *payloadData = [NSData dataWithBytes:(header + WSMessageHeaderLength) length:payloadLength];
+        offset += WSMessageHeaderLength + payloadLength;
+
+        [self.peer connection:self didReceiveCommand:command payload:[[WSBuffer alloc] initWithData:payloadData]];
+        if (self.socket < 0) {
+            return;
+        }
+    }
+
+    [self.inputBuffer replaceBytesInRange:NSMakeRange(0, offset) withBytes:NULL length:0];
+}
+
+- (BOOL)writeData:(NSData *)data
+{
+    const uint8_t *bytes = data.bytes;
+    NSUInteger written = 0;
+    while (written < data.length) {
+        const ssize_t sent = send(self.socket, bytes + written, data.length - written, WSSyntheticPeerSendFlags);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return NO;
+        }
+        written += sent;
+    }
+    return YES;
+}
+
+- (void)close
+{
+    if (self.socket < 0) {
+        return;
+    }
+    dispatch_source_cancel(self.readSource);
+    self.socket = -1;
+}
+
+@end
+
+#pragma mark -
+
+@implementation WSSyntheticPeer
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self.queue = dispatch_queue_create("WSSyntheticPeer", DISPATCH_QUEUE_SERIAL);
+        self.connections = [[NSMutableArray alloc] init];
+
+        const int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        NSAssert(listenSocket >= 0, @"Unable to create listening socket (%d)", errno);
+
+        const int one = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+
+        socklen_t addressLength = sizeof(address);
+        if ((bind(listenSocket, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+            (listen(listenSocket, SOMAXCONN) < 0) ||
+            (getsockname(listenSocket, (struct sockaddr *)&address, &addressLength) < 0)) {
+
+            NSAssert(NO, @"Unable to listen on loopback (%d)", errno);
+        }
+
+        // regtest with ephemeral port and matching proof-of-work limit
+        WSParameters *regtest = WSParametersForNetworkType(WSNetworkTypeRegtest);
+        WSBlockHeader *genesisHeader = regtest.genesisBlock.header;
+
+        WSParametersBuilder *builder = [[WSParametersBuilder alloc] initWithNetworkType:WSNetworkTypeRegtest];
+        builder.magicNumber = regtest.magicNumber;
+        builder.publicKeyAddressVersion = regtest.publicKeyAddressVersion;
+        builder.scriptAddressVersion = regtest.scriptAddressVersion;
+        builder.privateKeyVersion = regtest.privateKeyVersion;
+        builder.peerPort = ntohs(address.sin_port);
+        builder.bip32PublicKeyVersion = regtest.bip32PublicKeyVersion;
+        builder.bip32PrivateKeyVersion = regtest.bip32PrivateKeyVersion;
+        builder.maxProofOfWork = WSSyntheticPeerBits;
+        builder.retargetTimespan = regtest.retargetTimespan;
+        builder.retargetSpacing = regtest.retargetSpacing;
+        builder.minRetargetTimespan = regtest.minRetargetTimespan;
+        builder.maxRetargetTimespan = regtest.maxRetargetTimespan;
+        builder.retargetInterval = UINT32_MAX;
+        builder.genesisVersion = genesisHeader.version;
+        builder.genesisMerkleRoot = genesisHeader.merkleRoot;
+        builder.genesisTimestamp = genesisHeader.timestamp;
+        builder.genesisBits = genesisHeader.bits;
+        builder.genesisNonce = genesisHeader.nonce;
+        self.parameters = [builder build];
+
+        self.headers = [[NSMutableArray alloc] initWithObjects:self.parameters.genesisBlock.header, nil];
+        self.transactions = [[NSMutableArray alloc] initWithObjects:@[], nil];
+        self.heightsById = [[NSMutableDictionary alloc] initWithObjectsAndKeys:@0, self.parameters.genesisBlockId, nil];
+        self.walletTransactionsById = [[NSMutableDictionary alloc] init];
+        self.walletTransactionsArray = [[NSMutableArray alloc] init];
+        self.filters = [[NSMutableArray alloc] init];
+        self.filterHeaders = [[NSMutableArray alloc] init];
+        [self appendFilterAtHeight:0];
+
+        self.acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, listenSocket, 0, self.queue);
+        __weak WSSyntheticPeer *weakSelf = self;
+        dispatch_source_set_event_handler(self.acceptSource, ^{
+            [weakSelf acceptConnections];
+        });
+        dispatch_source_set_cancel_handler(self.acceptSource, ^{
+            close(listenSocket);
+        });
+        dispatch_resume(self.acceptSource);
+
+        DDLogInfo(@"Synthetic peer listening on %@:%lu", self.host, (unsigned long)self.parameters.peerPort);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self stop];
+}
+
+- (NSString *)host
+{
+    return @"127.0.0.1";
+}
+
+- (void)generateBlocks:(NSUInteger)numberOfBlocks walletAddresses:(NSArray *)walletAddresses numberOfTransactions:(NSUInteger)numberOfTransactions
+{
+    WSExceptionCheckIllegal(numberOfBlocks > 0);
+    WSExceptionCheckIllegal((numberOfTransactions == 0) || (walletAddresses.count > 0));
+    WSExceptionCheckIllegal(numberOfTransactions < numberOfBlocks);
+
+    dispatch_sync(self.queue, ^{
+        const uint32_t startHeight = (uint32_t)self.headers.count;
+        const NSUInteger spacing = (numberOfTransactions > 0) ? (numberOfBlocks / numberOfTransactions) : 0;
+        NSUInteger numberOfPayments = 0;
+
+        for (NSUInteger i = 0; i < numberOfBlocks; ++i) {
+            const uint32_t height = startHeight + (uint32_t)i;
+            NSMutableArray *transactions = [[NSMutableArray alloc] initWithObjects:[self coinbaseAtHeight:height], nil];
+
+            // pay wallet spending previous coinbase (i.e. skip first block)
+            if ((numberOfPayments < numberOfTransactions) && (i > 0) && (i % spacing == 0)) {
+                WSAddress *address = walletAddresses[numberOfPayments % walletAddresses.count];
+                WSSignedTransaction *previousCoinbase = [self.transactions[height - 1] firstObject];
+                WSSignedTransaction *payment = [self paymentToAddress:address spendingTransaction:previousCoinbase];
+
+                [transactions addObject:payment];
+                self.walletTransactionsById[payment.txId] = payment;
+                [self.walletTransactionsArray addObject:payment];
+                ++numberOfPayments;
+            }
+
+            WSBlockHeader *header = [self mineHeaderWithPreviousHeader:[self.headers lastObject] transactions:transactions];
+            [self.headers addObject:header];
+            [self.transactions addObject:transactions];
+            self.heightsById[header.blockId] = @(height);
+            [self appendFilterAtHeight:height];
+        }
+
+        DDLogInfo(@"Synthetic chain generated up to height %u (%lu wallet transactions)",
+                  (uint32_t)(self.headers.count - 1), (unsigned long)numberOfPayments);
+    });
+}
+
+- (uint32_t)currentHeight
+{
+    __block uint32_t currentHeight;
+    dispatch_sync(self.queue, ^{
+        currentHeight = (uint32_t)(self.headers.count - 1);
+    });
+    return currentHeight;
+}
+
+- (NSArray *)allHeaders
+{
+    __block NSArray *allHeaders;
+    dispatch_sync(self.queue, ^{
+        allHeaders = [self.headers copy];
+    });
+    return allHeaders;
+}
+
+- (NSArray *)walletTransactions
+{
+    __block NSArray *walletTransactions;
+    dispatch_sync(self.queue, ^{
+        walletTransactions = [self.walletTransactionsArray copy];
+    });
+    return walletTransactions;
+}
+
+- (NSUInteger)sentBytes
+{
+    __block NSUInteger sentBytes;
+    dispatch_sync(self.queue, ^{
+        sentBytes = _sentBytes;
+    });
+    return sentBytes;
+}
+
+- (void)stop
+{
+    dispatch_source_t acceptSource = self.acceptSource;
+    NSArray *connections = self.connections;
+
+    dispatch_sync(self.queue, ^{
+        if (acceptSource) {
+            dispatch_source_cancel(acceptSource);
+        }
+        for (WSSyntheticPeerConnection *connection in connections) {
+            [connection close];
+        }
+    });
+    self.acceptSource = nil;
+    [self.connections removeAllObjects];
+}
+
+#pragma mark Chain
+
+- (WSSignedTransaction *)coinbaseAtHeight:(uint32_t)height
+{
+    // BIP34-like height push makes coinbase ids unique
+    WSMutableBuffer *coinbaseData = [[WSMutableBuffer alloc] init];
+    [coinbaseData appendUint8:sizeof(uint32_t)];
+    [coinbaseData appendUint32:height];
+
+    WSTransactionOutPoint *outpoint = [WSTransactionOutPoint outpointWithParameters:self.parameters txId:WSHash256Zero() index:UINT32_MAX];
+    WSScript *script = [WSCoinbaseScript scriptWithCoinbaseData:coinbaseData.data];
+    WSSignedTransactionInput *input = [[WSSignedTransactionInput alloc] initWithOutpoint:outpoint script:script];
+
+    WSScript *outputScript = [WSScript scriptWithAddress:[[WSAddress alloc] initWithParameters:self.parameters
+                                                                                        version:self.parameters.publicKeyAddressVersion
+                                                                                        hash160:WSHash160Compute(coinbaseData.data)]];
+    WSTransactionOutput *output = [[WSTransactionOutput alloc] initWithParameters:self.parameters script:outputScript value:WSSyntheticPeerCoinbaseValue];
+
+    return [[WSSignedTransaction alloc] initWithSignedInputs:[NSOrderedSet orderedSetWithObject:input]
+                                                     outputs:[NSOrderedSet orderedSetWithObject:output]
+                                                       error:NULL];
+}
+
+- (WSSignedTransaction *)paymentToAddress:(WSAddress *)address spendingTransaction:(WSSignedTransaction *)transaction
+{
+    // signature is never verified by SPV clients
+    NSMutableData *fakeSignature = [[NSMutableData alloc] initWithLength:72];
+    WSScript *script = [[WSScript alloc] initWithChunks:@[[WSScriptChunk chunkWithPushData:fakeSignature]]];
+
+    WSTransactionOutPoint *outpoint = [WSTransactionOutPoint outpointWithParameters:self.parameters txId:transaction.txId index:0];
+    WSSignedTransactionInput *input = [[WSSignedTransactionInput alloc] initWithOutpoint:outpoint script:script];
+    WSTransactionOutput *output = [[WSTransactionOutput alloc] initWithAddress:address value:WSSyntheticPeerPaymentValue];
+
+    return [[WSSignedTransaction alloc] initWithSignedInputs:[NSOrderedSet orderedSetWithObject:input]
+                                                     outputs:[NSOrderedSet orderedSetWithObject:output]
+                                                       error:NULL];
+}
+
+- (WSBlockHeader *)mineHeaderWithPreviousHeader:(WSBlockHeader *)previousHeader transactions:(NSArray *)transactions
+{
+    NSMutableArray *txIds = [[NSMutableArray alloc] initWithCapacity:transactions.count];
+    for (WSSignedTransaction *transaction in transactions) {
+        [txIds addObject:transaction.txId];
+    }
+    NSUInteger merkleHeight = 0;
+    while ((1 << merkleHeight) < txIds.count) {
+        ++merkleHeight;
+    }
+    WSHash256 *merkleRoot = WSSyntheticPeerMerkleRoot(txIds, merkleHeight, 0);
+
+    // about 2 attempts on average at regtest target
+    for (uint32_t nonce = 0; nonce < UINT32_MAX; ++nonce) {
+        WSBlockHeader *header = [[WSBlockHeader alloc] initWithParameters:self.parameters
+                                                                  version:previousHeader.version
+                                                          previousBlockId:previousHeader.blockId
+                                                               merkleRoot:merkleRoot
+                                                                timestamp:(previousHeader.timestamp + WSSyntheticPeerBlockSpacing)
+                                                                     bits:WSSyntheticPeerBits
+                                                                    nonce:nonce];
+        if ([header verifyWithError:NULL]) {
+            return header;
+        }
+    }
+    NSAssert(NO, @"Nonce space exhausted");
+    return nil;
+}
+
+- (void)appendFilterAtHeight:(uint32_t)height
+{
+    NSAssert(height == self.filters.count, @"Filters must be appended in height order");
+
+    // payments only spend coinbases, spent scripts would never match the wallet
+    NSMutableArray *scripts = [[NSMutableArray alloc] init];
+    for (WSSignedTransaction *transaction in self.transactions[height]) {
+        for (WSTransactionOutput *output in transaction.outputs) {
+            [scripts addObject:[output.script toBuffer].data];
+        }
+    }
+    WSBIP158Filter *filter = [WSBIP158Filter filterWithBlockId:[self.headers[height] blockId] elements:scripts];
+    WSHash256 *previousFilterHeader = ((height > 0) ? self.filterHeaders[height - 1] : WSHash256Zero());
+
+    [self.filters addObject:filter];
+    [self.filterHeaders addObject:[filter filterHeaderWithPreviousHeader:previousFilterHeader]];
+}
+
+- (uint32_t)forkHeightFromLocatorInPayload:(WSBuffer *)payload hashStop:(WSHash256 *__autoreleasing *)hashStop
+{
+    NSUInteger offset = sizeof(uint32_t);
+    NSUInteger varIntLength;
+    const NSUInteger count = (NSUInteger)[payload varIntAtOffset:offset length:&varIntLength];
+    offset += varIntLength;
+
+    uint32_t forkHeight = 0;
+    for (NSUInteger i = 0; i < count; ++i) {
+        NSNumber *height = self.heightsById[[payload hash256AtOffset:offset]];
+        offset += WSHash256Length;
+
+        if (height) {
+            forkHeight = [height unsignedIntValue];
+            break;
+        }
+    }
+    offset = sizeof(uint32_t) + varIntLength + count * WSHash256Length;
+    *hashStop = [payload hash256AtOffset:offset];
+
+    return forkHeight;
+}
+
+- (BOOL)filterRangeFromPayload:(WSBuffer *)payload startHeight:(uint32_t *)startHeight stopHeight:(uint32_t *)stopHeight
+{
+    if (payload.length < sizeof(uint8_t) + sizeof(uint32_t) + WSHash256Length) {
+        return NO;
+    }
+    if ([payload uint8AtOffset:0] != WSBIP158FilterTypeBasic) {
+        return NO;
+    }
+    *startHeight = [payload uint32AtOffset:sizeof(uint8_t)];
+
+    NSNumber *height = self.heightsById[[payload hash256AtOffset:(sizeof(uint8_t) + sizeof(uint32_t))]];
+    if (!height || (height.unsignedIntValue < *startHeight)) {
+        return NO;
+    }
+    *stopHeight = height.unsignedIntValue;
+    return YES;
+}
+
+#pragma mark Handlers (queue)
+
+- (void)acceptConnections
+{
+    const int listenSocket = (int)dispatch_source_get_handle(self.acceptSource);
+    const int socket = accept(listenSocket, NULL, NULL);
+    if (socket < 0) {
+        return;
+    }
+
+    WSSyntheticPeerConnection *connection = [[WSSyntheticPeerConnection alloc] initWithPeer:self socket:socket queue:self.queue];
+    [self.connections addObject:connection];
+
+    DDLogDebug(@"Synthetic peer accepted connection (active: %lu)", (unsigned long)self.connections.count);
+}
+
+- (void)connection:(WSSyntheticPeerConnection *)connection didReceiveCommand:(NSString *)command payload:(WSBuffer *)payload
+{
+    DDLogVerbose(@"Synthetic peer received '%@' (%lu bytes)", command, (unsigned long)payload.length);
+
+    if ([command isEqualToString:WSMessageType_VERSION]) {
+        [self sendVersionToConnection:connection];
+        [self sendCommand:WSMessageType_VERACK payload:nil toConnection:connection];
+    }
+    else if ([command isEqualToString:WSMessageType_PING]) {
+        WSMutableBuffer *pong = [[WSMutableBuffer alloc] init];
+        [pong appendUint64:[payload uint64AtOffset:0]];
+        [self sendCommand:WSMessageType_PONG payload:pong toConnection:connection];
+    }
+    else if ([command isEqualToString:WSMessageType_GETHEADERS]) {
+        [self sendHeadersToConnection:connection forPayload:payload];
+    }
+    else if ([command isEqualToString:WSMessageType_GETBLOCKS]) {
+        [self sendBlockInventoriesToConnection:connection forPayload:payload];
+    }
+    else if ([command isEqualToString:WSMessageType_GETDATA]) {
+        [self sendDataToConnection:connection forPayload:payload];
+    }
+    else if ([command isEqualToString:WSMessageType_GETCFHEADERS]) {
+        [self sendFilterHeadersToConnection:connection forPayload:payload];
+    }
+    else if ([command isEqualToString:WSMessageType_GETCFILTERS]) {
+        [self sendFiltersToConnection:connection forPayload:payload];
+    }
+}
+
+- (void)connection:(WSSyntheticPeerConnection *)connection didCloseWithError:(int)error
+{
+    DDLogDebug(@"Synthetic peer closed connection%@", (error ? [NSString stringWithFormat:@" (%s)", strerror(error)] : @""));
+
+    [connection close];
+    [self.connections removeObject:connection];
+}
+
+- (void)sendVersionToConnection:(WSSyntheticPeerConnection *)connection
+{
+    WSMutableBuffer *payload = [[WSMutableBuffer alloc] init];
+    [payload appendUint32:WSPeerProtocol];
+    [payload appendUint64:(WSPeerServicesNodeNetwork | WSPeerServicesNodeCompactFilters)];
+    [payload appendUint64:WSCurrentTimestamp()];
+    for (NSUInteger i = 0; i < 2; ++i) {
+        [payload appendUint64:WSPeerServicesNodeNetwork];
+        [payload appendData:[NSMutableData dataWithLength:16]];
+        [payload appendUint16:0];
+    }
+    [payload appendUint64:arc4random()];
+    [payload appendString:@"/BitcoinSPV:synthetic/"];
+    [payload appendUint32:(uint32_t)(self.headers.count - 1)];
+    [payload appendUint8:1];
+
+    [self sendCommand:WSMessageType_VERSION payload:payload toConnection:connection];
+}
+
+- (void)sendHeadersToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload
+{
+    WSHash256 *hashStop;
+    const uint32_t forkHeight = [self forkHeightFromLocatorInPayload:payload hashStop:&hashStop];
+
+    NSMutableArray *headers = [[NSMutableArray alloc] init];
+    for (NSUInteger height = forkHeight + 1; (height < self.headers.count) && (headers.count < WSMessageHeadersMaxCount); ++height) {
+        WSBlockHeader *header = self.headers[height];
+        [headers addObject:header];
+        if ([header.blockId isEqual:hashStop]) {
+            break;
+        }
+    }
+
+    WSMutableBuffer *response = [[WSMutableBuffer alloc] initWithCapacity:(9 + headers.count * WSBlockHeaderSize)];
+    [response appendVarInt:headers.count];
+    for (WSBlockHeader *header in headers) {
+        WSSyntheticPeerAppendHeader(response, header);
+        [response appendVarInt:0];
+    }
+    [self sendCommand:WSMessageType_HEADERS payload:response toConnection:connection];
+}
+
+- (void)sendBlockInventoriesToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload
+{
+    WSHash256 *hashStop;
+    const uint32_t forkHeight = [self forkHeightFromLocatorInPayload:payload hashStop:&hashStop];
+
+    NSMutableArray *inventories = [[NSMutableArray alloc] init];
+    for (NSUInteger height = forkHeight + 1; (height < self.headers.count) && (inventories.count < WSMessageBlocksMaxCount); ++height) {
+        WSHash256 *blockId = [self.headers[height] blockId];
+        [inventories addObject:[[WSInventory alloc] initWithType:WSInventoryTypeBlock hash:blockId]];
+        if ([blockId isEqual:hashStop]) {
+            break;
+        }
+    }
+
+    // empty inv is not allowed
+    if (inventories.count == 0) {
+        return;
+    }
+
+    WSMutableBuffer *response = [[WSMutableBuffer alloc] init];
+    [response appendVarInt:inventories.count];
+    for (WSInventory *inventory in inventories) {
+        [response appendInventory:inventory];
+    }
+    [self sendCommand:WSMessageType_INV payload:response toConnection:connection];
+}
+
+- (void)sendDataToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload
+{
+    NSUInteger varIntLength;
+    const NSUInteger count = (NSUInteger)[payload varIntAtOffset:0 length:&varIntLength];
+
+    NSMutableArray *notfound = [[NSMutableArray alloc] init];
+    NSUInteger offset = varIntLength;
+    for (NSUInteger i = 0; i < count; ++i) {
+        WSInventory *inventory = [payload inventoryAtOffset:offset];
+        offset += sizeof(uint32_t) + WSHash256Length;
+
+        switch (inventory.inventoryType) {
+            case WSInventoryTypeBlock: {
+                NSNumber *height = self.heightsById[inventory.inventoryHash];
+                if (!height) {
+                    [notfound addObject:inventory];
+                    break;
+                }
+                NSArray *transactions = self.transactions[height.unsignedIntValue];
+
+                WSMutableBuffer *response = [[WSMutableBuffer alloc] init];
+                WSSyntheticPeerAppendHeader(response, self.headers[height.unsignedIntValue]);
+                [response appendVarInt:transactions.count];
+                for (WSSignedTransaction *transaction in transactions) {
+                    [transaction appendToMutableBuffer:response];
+                }
+                [self sendCommand:WSMessageType_BLOCK payload:response toConnection:connection];
+                break;
+            }
+            case WSInventoryTypeFilteredBlock: {
+                NSNumber *height = self.heightsById[inventory.inventoryHash];
+                if (!height) {
+                    [notfound addObject:inventory];
+                    break;
+                }
+                [self sendMerkleblockAtHeight:height.unsignedIntValue toConnection:connection];
+                break;
+            }
+            case WSInventoryTypeTx: {
+                WSSignedTransaction *transaction = self.walletTransactionsById[inventory.inventoryHash];
+                if (!transaction) {
+                    [notfound addObject:inventory];
+                    break;
+                }
+                [self sendCommand:WSMessageType_TX payload:[transaction toBuffer] toConnection:connection];
+                break;
+            }
+            default: {
+                [notfound addObject:inventory];
+                break;
+            }
+        }
+    }
+
+    if (notfound.count > 0) {
+        WSMutableBuffer *response = [[WSMutableBuffer alloc] init];
+        [response appendVarInt:notfound.count];
+        for (WSInventory *inventory in notfound) {
+            [response appendInventory:inventory];
+        }
+        [self sendCommand:WSMessageType_NOTFOUND payload:response toConnection:connection];
+    }
+}
+
+- (void)sendMerkleblockAtHeight:(uint32_t)height toConnection:(WSSyntheticPeerConnection *)connection
+{
+    NSArray *transactions = self.transactions[height];
+    NSMutableArray *txIds = [[NSMutableArray alloc] initWithCapacity:transactions.count];
+    NSMutableIndexSet *matches = [[NSMutableIndexSet alloc] init];
+    for (NSUInteger i = 0; i < transactions.count; ++i) {
+        WSSignedTransaction *transaction = transactions[i];
+        [txIds addObject:transaction.txId];
+        if (self.walletTransactionsById[transaction.txId]) {
+            [matches addIndex:i];
+        }
+    }
+
+    NSUInteger merkleHeight = 0;
+    while ((1 << merkleHeight) < txIds.count) {
+        ++merkleHeight;
+    }
+    NSMutableArray *hashes = [[NSMutableArray alloc] init];
+    NSMutableArray *bits = [[NSMutableArray alloc] init];
+    WSSyntheticPeerBuildPartialTree(txIds, matches, merkleHeight, 0, hashes, bits);
+
+    NSMutableData *flags = [[NSMutableData alloc] initWithLength:((bits.count + 7) / 8)];
+    uint8_t *flagsBytes = flags.mutableBytes;
+    for (NSUInteger i = 0; i < bits.count; ++i) {
+        if ([bits[i] boolValue]) {
+            flagsBytes[i / 8] |= (1 << (i % 8));
+        }
+    }
+
+    NSError *error;
+    WSPartialMerkleTree *tree = [[WSPartialMerkleTree alloc] initWithTxCount:(uint32_t)txIds.count hashes:hashes flags:flags error:&error];
+    NSAssert(tree, @"Invalid synthetic partial merkle tree: %@", error);
+
+    WSMutableBuffer *response = [[WSMutableBuffer alloc] init];
+    WSSyntheticPeerAppendHeader(response, self.headers[height]);
+    [tree appendToMutableBuffer:response];
+    [self sendCommand:WSMessageType_MERKLEBLOCK payload:response toConnection:connection];
+
+    [matches enumerateIndexesUsingBlock:^(NSUInteger i, BOOL *stop) {
+        [self sendCommand:WSMessageType_TX payload:[transactions[i] toBuffer] toConnection:connection];
+    }];
+}
+
+- (void)sendFilterHeadersToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload
+{
+    uint32_t startHeight;
+    uint32_t stopHeight;
+    if (![self filterRangeFromPayload:payload startHeight:&startHeight stopHeight:&stopHeight] ||
+        (stopHeight - startHeight + 1 > WSMessageCfheadersMaxCount)) {
+
+        return;
+    }
+
+    NSMutableArray *filterHashes = [[NSMutableArray alloc] initWithCapacity:(stopHeight - startHeight + 1)];
+    for (uint32_t height = startHeight; height <= stopHeight; ++height) {
+        [filterHashes addObject:[self.filters[height] filterHash]];
+    }
+    WSHash256 *previousFilterHeader = ((startHeight > 0) ? self.filterHeaders[startHeight - 1] : WSHash256Zero());
+
+    WSMessageCfheaders *message = [WSMessageCfheaders messageWithParameters:self.parameters
+                                                                 filterType:WSBIP158FilterTypeBasic
+                                                                   stopHash:[self.headers[stopHeight] blockId]
+                                                       previousFilterHeader:previousFilterHeader
+                                                               filterHashes:filterHashes];
+
+    [self sendCommand:WSMessageType_CFHEADERS payload:[message toBuffer] toConnection:connection];
+}
+
+- (void)sendFiltersToConnection:(WSSyntheticPeerConnection *)connection forPayload:(WSBuffer *)payload
+{
+    uint32_t startHeight;
+    uint32_t stopHeight;
+    if (![self filterRangeFromPayload:payload startHeight:&startHeight stopHeight:&stopHeight] ||
+        (stopHeight - startHeight + 1 > WSMessageCfiltersMaxCount)) {
+
+        return;
+    }
+
+    for (uint32_t height = startHeight; height <= stopHeight; ++height) {
+        WSMessageCfilter *message = [WSMessageCfilter messageWithParameters:self.parameters
+                                                                 filterType:WSBIP158FilterTypeBasic
+                                                                     filter:self.filters[height]];
+
+        [self sendCommand:WSMessageType_CFILTER payload:[message toBuffer] toConnection:connection];
+    }
+}
+
+- (void)sendCommand:(NSString *)command payload:(WSBuffer *)payload toConnection:(WSSyntheticPeerConnection *)connection
+{
+    if (!payload) {
+        payload = [[WSBuffer alloc] init];
+    }
+    WSHash256 *payloadHash256 = [payload computeHash256];
+
+    WSMutableBuffer *message = [[WSMutableBuffer alloc] initWithCapacity:(WSMessageHeaderLength + payload.length)];
+    [message appendUint32:[self.parameters magicNumber]];
+    [message appendNullPaddedString:command length:12];
+    [message appendUint32:(uint32_t)payload.length];
+    [message appendBytes:payloadHash256.bytes length:sizeof(uint32_t)];
+    [message appendBuffer:payload];
+
+    if (![connection writeData:message.data]) {
+        [self connection:connection didCloseWithError:errno];
+        return;
+    }
+    _sentBytes += message.length;
+}
+
+@end
+
+#pragma mark -
+
+static void WSSyntheticPeerAppendHeader(WSMutableBuffer *buffer, WSBlockHeader *header)
+{
+    // header without trailing tx count
+    WSBuffer *headerBuffer = [header toBuffer];
+    [buffer appendBytes:headerBuffer.bytes length:(WSBlockHeaderSize - 1)];
+}
+
+static NSUInteger WSSyntheticPeerTreeWidth(NSUInteger count, NSUInteger height)
+{
+    return (count + (1 << height) - 1) >> height;
+}
+
+static WSHash256 *WSSyntheticPeerMerkleRoot(NSArray *txIds, NSUInteger height, NSUInteger position)
+{
+    if (height == 0) {
+        return txIds[position];
+    }
+
+    WSHash256 *left = WSSyntheticPeerMerkleRoot(txIds, height - 1, position * 2);
+    WSHash256 *right = left;
+    if (position * 2 + 1 < WSSyntheticPeerTreeWidth(txIds.count, height - 1)) {
+        right = WSSyntheticPeerMerkleRoot(txIds, height - 1, position * 2 + 1);
+    }
+
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:(2 * WSHash256Length)];
+    [data appendData:left.data];
+    [data appendData:right.data];
+    return WSHash256Compute(data);
+}
+
+// BIP37 depth-first traversal
+static void WSSyntheticPeerBuildPartialTree(NSArray *txIds, NSIndexSet *matches, NSUInteger height, NSUInteger position, NSMutableArray *hashes, NSMutableArray *bits)
+{
+    const NSUInteger first = position << height;
+    const NSUInteger last = MIN((position + 1) << height, txIds.count);
+    const BOOL isParentOfMatch = [matches intersectsIndexesInRange:NSMakeRange(first, last - first)];
+
+    [bits addObject:@(isParentOfMatch)];
+    if ((height == 0) || !isParentOfMatch) {
+        [hashes addObject:WSSyntheticPeerMerkleRoot(txIds, height, position)];
+        return;
+    }
+
+    WSSyntheticPeerBuildPartialTree(txIds, matches, height - 1, position * 2, hashes, bits);
+    if (position * 2 + 1 < WSSyntheticPeerTreeWidth(txIds.count, height - 1)) {
+        WSSyntheticPeerBuildPartialTree(txIds, matches, height - 1, position * 2 + 1, hashes, bits);
+    }
+}
@@ -0,0 +1,252 @@
+//
+//  WSTrafficStatsTests.m
+//  BitcoinSPV
+//
+//  Created by Davide De Rosa on 17/10/15.
+//  Copyright (c) 2015 Davide De Rosa. All rights reserved.
+//
+//  https://github.com/keeshux
+//
+//  This file is part of BitcoinSPV.
+//
+//  BitcoinSPV is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  BitcoinSPV is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with BitcoinSPV.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#import "XCTestCase+BitcoinSPV.h"
+#import "WSTrafficStats.h"
+#import "WSConnection.h"
+#import "WSPeer.h"
+#import "WSMessage.h"
+#import "WSMessagePing.h"
+#import "WSMessageGetaddr.h"
+#import "WSMessageHeaders.h"
+
+@interface WSMockSerializingHandler : NSObject <WSConnectionHandler>
+
+@property (nonatomic, strong) NSMutableDictionary *writtenLengths; // NSString -> NSNumber
+
+@end
+
+@implementation WSMockSerializingHandler
+
+- (instancetype)init
+{
+    if ((self = [super init])) {
+        self.writtenLengths = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (NSString *)host
+{
+    return @"127.0.0.1";
+}
+
+- (uint16_t)port
+{
+    return 0;
+}
+
+- (NSString *)identifier
+{
+    return @"(mock)";
+}
+
+- (id<WSConnectionProcessor>)processor
+{
+    return nil;
+}
+
+- (BOOL)isConnected
+{
+    return YES;
+}
+
+- (void)submitBlock:(void (^)(void))block
+{
+    block();
+}
+
+- (NSUInteger)writeMessage:(id<WSMessage>)message
+{
+    NSUInteger headerLength;
+    WSBuffer *buffer = [message toNetworkBufferWithHeaderLength:&headerLength];
+    self.writtenLengths[message.messageType] = @([self.writtenLengths[message.messageType] unsignedIntegerValue] + buffer.length);
+    return buffer.length;
+}
+
+- (NSUInteger)outputBacklogLength
+{
+    return 0;
+}
+
+- (void)disconnectWithError:(NSError *)error
+{
+}
+
+@end
+
+#pragma mark -
+
+@interface WSTrafficStatsTests : XCTestCase
+
+- (WSPeer *)connectedPeerWithHandler:(id<WSConnectionHandler>)handler;
+
+@end
+
+@implementation WSTrafficStatsTests
+
+- (void)setUp
+{
+    [super setUp];
+
+    self.networkType = WSNetworkTypeRegtest;
+}
+
+- (void)tearDown
+{
+    [super tearDown];
+}
+
+- (void)testHistogramBuckets
+{
+    NSArray *bounds = [WSLatencyHistogram bucketBounds];
+    XCTAssertEqual(bounds.count, 8);
+
+    // bucket i counts samples below bounds[i], bounds belong to the upper bucket
+    WSTrafficStats *stats = [[WSTrafficStats alloc] init];
+    for (NSNumber *sample in @[@0.0, @0.009, @0.01, @0.05, @0.099, @5.0, @100.0]) {
+        [stats trackLatency:sample.doubleValue forRequestType:WSMessageType_PING];
+    }
+
+    WSLatencyHistogram *histogram = stats.latencyHistograms[WSMessageType_PING];
+    const NSUInteger expectedCounts[] = { 2, 1, 2, 0, 0, 0, 0, 0, 2 };
+    XCTAssertEqual(histogram.bucketCounts.count, bounds.count + 1);
+    for (NSUInteger i = 0; i < histogram.bucketCounts.count; ++i) {
+        XCTAssertEqual([histogram.bucketCounts[i] unsignedIntegerValue], expectedCounts[i], @"Bucket %lu", (unsigned long)i);
+    }
+    XCTAssertEqual(histogram.count, 7);
+    XCTAssertEqualWithAccuracy(histogram.minimum, 0.0, 1e-9);
+    XCTAssertEqualWithAccuracy(histogram.maximum, 100.0, 1e-9);
+    XCTAssertEqualWithAccuracy(histogram.average, (0.009 + 0.01 + 0.05 + 0.099 + 5.0 + 100.0) / 7, 1e-9);
+
+    XCTAssertNil(stats.latencyHistograms[WSMessageType_GETDATA]);
+}
+
+- (void)testAggregation
+{
+    WSMessagePing *ping = [WSMessagePing messageWithParameters:self.networkParameters];
+    WSMessageGetaddr *getaddr = [WSMessageGetaddr messageWithParameters:self.networkParameters];
+
+    WSTrafficStats *stats1 = [[WSTrafficStats alloc] init];
+    [stats1 trackSentMessage:ping length:32];
+    [stats1 trackSentMessage:ping length:32];
+    [stats1 trackLatency:0.02 forRequestType:WSMessageType_PING];
+
+    WSTrafficStats *stats2 = [[WSTrafficStats alloc] init];
+    [stats2 trackSentMessage:ping length:32];
+    [stats2 trackSentMessage:getaddr length:24];
+    [stats2 trackReceivedMessage:ping decodeTime:0.5];
+    [stats2 trackLatency:3.0 forRequestType:WSMessageType_PING];
+
+    WSTrafficStats *total = [stats1 copy];
+    [total addStats:stats2];
+
+    WSMessageTrafficStats *pingStats = total.messageStats[WSMessageType_PING];
+    XCTAssertEqual(pingStats.sentMessages, 3);
+    XCTAssertEqual(pingStats.sentBytes, 96);
+    XCTAssertEqual(pingStats.receivedMessages, 1);
+    XCTAssertEqual(pingStats.receivedBytes, ping.length);
+    XCTAssertEqual([total.messageStats[WSMessageType_GETADDR] sentMessages], 1);
+    XCTAssertEqual(total.sentBytes, 120);
+    XCTAssertEqual(total.receivedBytes, ping.length);
+    XCTAssertEqualWithAccuracy(total.decodeTime, 0.5, 1e-9);
+
+    WSLatencyHistogram *histogram = total.latencyHistograms[WSMessageType_PING];
+    XCTAssertEqual(histogram.count, 2);
+    XCTAssertEqualWithAccuracy(histogram.minimum, 0.02, 1e-9);
+    XCTAssertEqualWithAccuracy(histogram.maximum, 3.0, 1e-9);
+
+    // copies are snapshots
+    XCTAssertEqual(stats1.sentBytes, 64);
+    [stats1 trackSentMessage:ping length:32];
+    [stats1 trackLatency:0.01 forRequestType:WSMessageType_PING];
+    XCTAssertEqual(total.sentBytes, 120);
+    XCTAssertEqual([total.latencyHistograms[WSMessageType_PING] count], 2);
+
+    WSMessageTrafficStats *snapshot = stats1.messageStats[WSMessageType_PING];
+    [stats1 trackSentMessage:ping length:32];
+    XCTAssertEqual(snapshot.sentBytes, 96);
+
+    [total reset];
+    XCTAssertEqual(total.sentBytes, 0);
+    XCTAssertEqual(total.latencyHistograms.count, 0);
+}
+
+- (void)testSentBytesIncludeHeader
+{
+    WSMockSerializingHandler *handler = [[WSMockSerializingHandler alloc] init];
+    WSPeer *peer = [self connectedPeerWithHandler:handler];
+    [peer sendGetaddr];
+    [peer sendGetdataMessageWithHashes:@[WSHash256Zero()] forInventoryType:WSInventoryTypeBlock];
+
+    WSTrafficStats *stats = peer.trafficStats;
+    NSUInteger writtenBytes = 0;
+    for (NSString *messageType in handler.writtenLengths) {
+        const NSUInteger length = [handler.writtenLengths[messageType] unsignedIntegerValue];
+        XCTAssertEqual([stats.messageStats[messageType] sentBytes], length, @"Message '%@'", messageType);
+        writtenBytes += length;
+    }
+    XCTAssertEqual(stats.sentBytes, writtenBytes);
+
+    // empty payload still costs a header, getdata carries one inventory
+    XCTAssertEqual([stats.messageStats[WSMessageType_GETADDR] sentBytes], (NSUInteger)WSMessageHeaderLength);
+    XCTAssertEqual([stats.messageStats[WSMessageType_GETDATA] sentBytes], (NSUInteger)WSMessageHeaderLength + 1 + 36);
+}
+
+- (void)testHeadersLatencyQueue
+{
+    WSMockSerializingHandler *handler = [[WSMockSerializingHandler alloc] init];
+    WSPeer *peer = [self connectedPeerWithHandler:handler];
+    WSBlockLocator *locator = [[WSBlockLocator alloc] initWithHashes:@[WSHash256Zero()]];
+
+    NSString *hex = @"010200000023dd3ee8947c37cc3c5ca446bb3ccfc3d9e2af04482d366b6db97537000000006092a5f1e1628c1da9b17a720fb5366271fced2686ee45bde664cc325f7f76d8886cda50f0ff0f1cf4cd2abd00";
+    WSBuffer *buffer = WSBufferFromHex(hex);
+    WSMessageHeaders *message = [[WSMessageHeaders alloc] initWithParameters:self.networkParameters buffer:buffer from:0 available:buffer.length error:NULL];
+    XCTAssertNotNil(message);
+
+    // pipelined requests, one sample per response
+    [peer sendGetheadersMessageWithLocator:locator hashStop:nil];
+    [peer sendGetheadersMessageWithLocator:locator hashStop:nil];
+    [peer processMessage:message decodeTime:0.0];
+    [peer processMessage:message decodeTime:0.0];
+    XCTAssertEqual([peer.trafficStats.latencyHistograms[WSMessageType_GETHEADERS] count], 2);
+
+    // unsolicited headers (e.g. announcements) are not sampled
+    [peer processMessage:message decodeTime:0.0];
+    XCTAssertEqual([peer.trafficStats.latencyHistograms[WSMessageType_GETHEADERS] count], 2);
+    XCTAssertEqual([peer.trafficStats.messageStats[WSMessageType_HEADERS] receivedMessages], 3);
+}
+
+#pragma mark Helpers
+
+- (WSPeer *)connectedPeerWithHandler:(id<WSConnectionHandler>)handler
+{
+    WSPeerFlags *flags = [[WSPeerFlags alloc] initWithNeedsBloomFiltering:YES];
+    WSPeer *peer = [[WSPeer alloc] initWithHost:@"127.0.0.1" parameters:self.networkParameters flags:flags];
+    [peer openedConnectionToHost:@"127.0.0.1" port:[self.networkParameters peerPort] handler:handler];
+    return peer;
+}
+
+@end
@@ -43,6 +43,7 @@
 - (NSString *)mockNetworkPathForFilename:(NSString *)filename extension:(NSString *)extension;
 
 - (void)runForever;
+- (BOOL)runUntilStoppedWithTimeout:(NSTimeInterval)timeout; // NO on timeout
 - (void)runForSeconds:(NSTimeInterval)seconds;
 - (void)stopRunning;
 
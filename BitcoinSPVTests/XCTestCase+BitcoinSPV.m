@@ -87,6 +87,21 @@ static WSParameters *networkParameters;
     }
 }
 
+- (BOOL)runUntilStoppedWithTimeout:(NSTimeInterval)timeout
+{
+    const NSTimeInterval deadline = [NSDate timeIntervalSinceReferenceDate] + timeout;
+
+    running = YES;
+    while (running) {
+        if ([NSDate timeIntervalSinceReferenceDate] >= deadline) {
+            running = NO;
+            return NO;
+        }
+        [self runForSeconds:0.1];
+    }
+    return YES;
+}
+
 - (void)runForSeconds:(NSTimeInterval)seconds
 {
     [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:seconds]];